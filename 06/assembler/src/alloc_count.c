@@ -0,0 +1,49 @@
+/*
+ * Allocation counting for the assembler's --profile flag.
+ *
+ * This replaces malloc(), calloc(), realloc() and free() with versions that hand straight on to
+ * glibc's allocator, counting each allocation in profile while a run is being profiled. Since the
+ * replacements are in the executable, they also catch the allocations made inside libc, like
+ * strdup()'s, and inside the hash table library. Only the assembler binary links this file; the
+ * tests and libhackasm.a use the plain allocator.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stddef.h>
+
+#include "profile.h"
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+extern void __libc_free(void*);
+
+// Counts an allocation of @size bytes, if the run is being profiled
+static inline void count_alloc(size_t size) {
+    prof_stats *stats = profile;
+    if (stats != NULL) {
+        __atomic_fetch_add(&stats->allocs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->alloc_bytes, (long)size, __ATOMIC_RELAXED);
+    }
+}
+
+void *malloc(size_t size) {
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    count_alloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
@@ -0,0 +1,54 @@
+/*
+ * Reference model of the Hack CPU for the nand2tetris assembler.
+ *
+ * This computes what a C_COMMAND does straight from its bits, the same way the ALU chip does, rather
+ * than from the mnemonics in COMPUTATIONS. Tools that have to know exactly what an instruction does,
+ * like the superoptimizer, use it as their oracle.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdint.h>
+
+#include "alu.h"
+#include "encoder.h"
+
+// The six control bits of the ALU, as they appear in a computation code
+#define ALU_ZX 0x20  // Zero the x input
+#define ALU_NX 0x10  // Negate the x input
+#define ALU_ZY 0x08  // Zero the y input
+#define ALU_NY 0x04  // Negate the y input
+#define ALU_F  0x02  // Compute x + y if set, or x & y if not
+#define ALU_NO 0x01  // Negate the output
+
+#define A_BIT 0x40  // The bit of the computation that selects M rather than A as the y input
+
+/**
+ * Computes what the ALU outputs for some control bits and inputs.
+ * @param  control  The six ALU control bits, e.g. 0x2A (101010) for 0.
+ * @param  x        The x input, which is always D.
+ * @param  y        The y input, which is A or M.
+ * @return          The ALU's output.
+ */
+uint16_t hack_alu(int control, uint16_t x, uint16_t y) {
+    if (control & ALU_ZX) x = 0;
+    if (control & ALU_NX) x = ~x;
+    if (control & ALU_ZY) y = 0;
+    if (control & ALU_NY) y = ~y;
+    uint16_t out = control & ALU_F ? x + y : x & y;
+    return control & ALU_NO ? ~out : out;
+}
+
+/**
+ * Computes the value a C_COMMAND computes, before it's stored anywhere.
+ * @param  word  The C_COMMAND.
+ * @param  a     The A register.
+ * @param  d     The D register.
+ * @param  m     The word in RAM at A.
+ * @return       The value of the computation.
+ */
+uint16_t c_command_result(uint16_t word, uint16_t a, uint16_t d, uint16_t m) {
+    int comp = (word >> COMP_SHIFT) & (A_BIT | 0x3F);
+    return hack_alu(comp & ~A_BIT, d, comp & A_BIT ? m : a);
+}
@@ -0,0 +1,18 @@
+/*
+ * Header file for the reference model of the Hack CPU for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _ALU_H
+#define _ALU_H
+
+#include <stdint.h>
+
+#define ADDRESS_MASK 0x7FFF  // The bits of A that address RAM
+#define IO_BASE 0x4000       // The address of SCREEN, where memory-mapped I/O starts
+
+uint16_t hack_alu(int, uint16_t, uint16_t);
+uint16_t c_command_result(uint16_t, uint16_t, uint16_t, uint16_t);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ * Batch driver for the nand2tetris assembler.
+ *
+ * Assembling thousands of small programs one process at a time spends most of its time starting
+ * processes and rebuilding the predefined symbols. This assembles any number of files in one process
+ * instead, handing them out to a pool of worker threads. The predefined symbols are built once and
+ * shared read-only by every worker; each file gets its own small table for its labels and variables,
+ * which is searched before the predefined one, so labels still shadow predefined symbols exactly as
+ * they do with first_pass().
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "batch.h"
+#include "encoder.h"
+#include "lexer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "program.h"
+#include "symboltable.h"
+#include "../../../lib/hash_table.h"
+
+static const char *ASM_EXT = ".asm";
+
+typedef struct worker_pool {
+    const file_list *files;
+    ht_hash_table *predefined;  // Shared by every worker, and never modified while they run
+    atomic_int next_file;       // The index of the next file that hasn't been handed out yet
+    atomic_int num_failed;
+    atomic_long num_instrs;
+} worker_pool;
+
+
+/**
+ * Initializes an empty file list.
+ * @param list  The list to initialize.
+ */
+void file_list_init(file_list *list) {
+    list->paths = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/**
+ * Frees every path in a file list, and the list's storage.
+ * @param list  The list to free.
+ */
+void file_list_free(file_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    file_list_init(list);
+}
+
+static void file_list_push(file_list *list, char *path) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->paths = realloc(list->paths, list->capacity * sizeof(char*));
+    }
+    list->paths[list->count++] = path;
+}
+
+static int has_asm_ext(const char *name) {
+    size_t len = strlen(name);
+    size_t ext_len = strlen(ASM_EXT);
+    return len > ext_len && !strcmp(name + len - ext_len, ASM_EXT);
+}
+
+/**
+ * Adds a file to a list, or if @path is a directory, every .asm file anywhere underneath it.
+ * @param  path  The file or directory to add.
+ * @param  list  The list to add to.
+ * @return       0 on success, or -1 if @path (or a directory under it) couldn't be read.
+ */
+int collect_asm_files(const char *path, file_list *list) {
+    // Anything that isn't a directory is added as-is, so if it can't be read, assemble_file() will
+    // count it as a failure
+    struct stat st;
+    if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+        file_list_push(list, strdup(path));
+        return 0;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+
+        char *child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+        sprintf(child, "%s/%s", path, entry->d_name);
+        if (!stat(child, &st) && S_ISDIR(st.st_mode)) {
+            if (collect_asm_files(child, list)) ret = -1;
+        } else if (has_asm_ext(entry->d_name)) {
+            file_list_push(list, child);
+            continue;
+        }
+        free(child);
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+/**
+ * Looks a symbol up in a file's own symbol table, and then in the predefined symbols.
+ * @return  The symbol's binary address, which the caller must free, or NULL if it isn't defined.
+ */
+static char *lookup_symbol(ht_hash_table *local, ht_hash_table *predefined, const char *symbol) {
+    char *binary_addr = ht_search(local, symbol);
+    return binary_addr != NULL ? binary_addr : ht_search(predefined, symbol);
+}
+
+/**
+ * Assembles a single .asm file into a .hack file next to it, without modifying @predefined. The
+ * output is the same as first_pass() followed by second_pass().
+ *
+ * @param  path        the .asm file to assemble
+ * @param  predefined  the predefined symbols, as built by constructor()
+ * @return             the number of ROM instructions written, or -1 if the file couldn't be
+ *                     assembled
+ */
+long assemble_file(const char *path, ht_hash_table *predefined) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t len = 0;
+    char *src = read_all(in, &len);
+    fclose(in);
+
+    // Lex every line, reporting an invalid one without stopping the rest of the batch
+    instr_list instrs;
+    instr_list_init(&instrs);
+    hackasm_diag diag;
+    int lexed = lex_program_diag(src, len, &instrs, &diag);
+    free(src);
+    if (lexed) {
+        fprintf(stderr, "%s:%d: %s\n", path, diag.line, diag.message);
+        instr_list_free(&instrs);
+        return -1;
+    }
+
+    // Give each label the ROM address of the instruction after it
+    long addr_ROM = 0;
+    for (int i = 0; i < instrs.count; i++) {
+        if (instrs.items[i].type == L_COMMAND) {
+            instrs.items[i].word = addr_ROM;
+        } else {
+            addr_ROM++;
+        }
+    }
+
+    if (addr_ROM > UINT16_MAX) {
+        fprintf(stderr, "%s: %ld instructions do not fit in the %d-bit address space\n", path,
+            addr_ROM, WORD);
+        instr_list_free(&instrs);
+        return -1;
+    }
+
+    // Every label and variable takes at least one instruction
+    ht_hash_table *local = ht_new(instrs.count + 1);
+    for (int i = 0; i < instrs.count; i++) {
+        if (instrs.items[i].type == L_COMMAND) {
+            char *binary_addr = parse_to_binary(instrs.items[i].word);
+            ht_insert(local, instrs.items[i].symbol, binary_addr);
+            free(binary_addr);
+        }
+    }
+
+    size_t text_len = (size_t)addr_ROM * (WORD + 1);
+    char *text = malloc(text_len + 1);
+    char *out_text = text;
+    int addr_RAM = 16;
+    for (int i = 0; i < instrs.count; i++) {
+        instruction *instr = &instrs.items[i];
+        if (instr->type == L_COMMAND) {
+            continue;
+        }
+
+        if (instr->symbol != NULL) {
+            char *binary_addr = lookup_symbol(local, predefined, instr->symbol);
+            if (binary_addr == NULL) {
+                binary_addr = parse_to_binary(addr_RAM);
+                ht_insert(local, instr->symbol, binary_addr);
+                addr_RAM++;
+            }
+            instr->word = binary_to_word(binary_addr);
+            free(binary_addr);
+        }
+
+        word_to_binary(instr->word, out_text);
+        out_text[WORD] = '\n';
+        out_text += WORD + 1;
+    }
+    ht_delete(local);
+    instr_list_free(&instrs);
+
+    char *out_path = hack_path(path);
+    FILE *out = fopen(out_path, "w");
+    long ret = addr_ROM;
+    if (!out || fwrite(text, sizeof(char), text_len, out) != text_len) {
+        fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+        ret = -1;
+    }
+    if (out && fclose(out) && ret >= 0) {
+        fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+        ret = -1;
+    }
+
+    free(out_path);
+    free(text);
+    return ret;
+}
+
+/**
+ * Assembles files from the pool until there are none left.
+ * @param arg  The worker_pool to take files from.
+ */
+static void *batch_worker(void *arg) {
+    worker_pool *pool = arg;
+    int i;
+    while ((i = atomic_fetch_add(&pool->next_file, 1)) < pool->files->count) {
+        long num_instrs = assemble_file(pool->files->paths[i], pool->predefined);
+        if (num_instrs < 0) {
+            atomic_fetch_add(&pool->num_failed, 1);
+        } else {
+            atomic_fetch_add(&pool->num_instrs, num_instrs);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Assembles every file in a list, on a pool of @num_threads worker threads. Each file is written to
+ * a .hack file next to it. A file that can't be assembled is counted as a failure, and doesn't stop
+ * the rest of the batch.
+ *
+ * @param files        the .asm files to assemble
+ * @param num_threads  the number of worker threads to use
+ * @param stats        filled in with how many files were assembled, and how quickly
+ */
+void assemble_batch(const file_list *files, int num_threads, batch_stats *stats) {
+    if (num_threads > files->count) {
+        num_threads = files->count;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    } else if (num_threads > MAX_THREADS) {
+        num_threads = MAX_THREADS;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The encoder's lookup tables have to exist before more than one thread can encode
+    encoder_init();
+
+    worker_pool pool = {.files = files, .predefined = constructor(64)};
+    atomic_init(&pool.next_file, 0);
+    atomic_init(&pool.num_failed, 0);
+    atomic_init(&pool.num_instrs, 0);
+
+    pthread_t threads[MAX_THREADS];
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, batch_worker, &pool)) {
+            perror("Failed to start assembler worker thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    ht_delete(pool.predefined);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats->num_files = files->count;
+    stats->num_failed = atomic_load(&pool.num_failed);
+    stats->num_instrs = atomic_load(&pool.num_instrs);
+    stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * Prints a summary of a batch.
+ * @param out    The file to print to.
+ * @param stats  The batch_stats filled in by assemble_batch().
+ */
+void print_batch_stats(FILE *out, const batch_stats *stats) {
+    double seconds = stats->seconds > 0 ? stats->seconds : 1e-9;
+    fprintf(out, "Assembled %d of %d files (%d failed) in %.3f s\n",
+        stats->num_files - stats->num_failed, stats->num_files, stats->num_failed, stats->seconds);
+    fprintf(out, "%.1f files/s, %.0f instructions/s\n", stats->num_files / seconds,
+        stats->num_instrs / seconds);
+}
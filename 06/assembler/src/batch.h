@@ -0,0 +1,36 @@
+/*
+ * Header file for the batch driver for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stdio.h>
+
+#include "../../../lib/hash_table.h"
+
+// A growable list of .asm files to assemble
+typedef struct file_list {
+    char **paths;
+    int count;
+    int capacity;
+} file_list;
+
+// What happened over the course of a batch
+typedef struct batch_stats {
+    int num_files;      // The number of files that were attempted
+    int num_failed;     // The number of files that couldn't be assembled
+    long num_instrs;    // The number of ROM instructions written, across every file
+    double seconds;     // The wall-clock time the whole batch took
+} batch_stats;
+
+void file_list_init(file_list*);
+void file_list_free(file_list*);
+int collect_asm_files(const char*, file_list*);
+long assemble_file(const char*, ht_hash_table*);
+void assemble_batch(const file_list*, int, batch_stats*);
+void print_batch_stats(FILE*, const batch_stats*);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Throughput benchmark for the nand2tetris assembler.
+ *
+ * This times two things. The first is a whole run, which assembles the program exactly the way
+ * `./assembler prog.asm` does. The second runs the same program through the in-memory passes one at
+ * a time, so that each stage can be timed on its own. Both write prog.hack.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "program.h"
+#include "symboltable.h"
+#include "../../../lib/hash_table.h"
+
+#define NUM_BENCH_STAGES 5
+// lex_program() encodes each C_COMMAND as it lexes it, so encoding only has a stage of its own for
+// the A_COMMANDs that load symbols
+static const char *BENCH_STAGE_NAMES[] = {"read", "lex+encode C", "resolve labels", "resolve symbols",
+    "write"};
+static const double MB = 1024.0 * 1024.0;
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The most memory the process has used so far, in MB
+static double peak_rss_mb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Counts the lines in a file, the way main() does to size the symbol table
+static int count_lines(FILE *in) {
+    int line_count = 0;
+    for (int c = getc(in); c != EOF; c = getc(in)) {
+        if (c == '\n') line_count++;
+    }
+    fseek(in, 0, SEEK_SET);
+    return line_count;
+}
+
+/**
+ * Assembles a program the same way the assembler does without any options.
+ * @param  path  The .asm file to assemble.
+ * @return       How long it took, in seconds.
+ */
+static double time_whole_run(const char *path) {
+    double start = now();
+    io files = init(path);
+    ht_hash_table *ht = constructor(2 * (count_lines(files.in) / 3));
+    first_pass(files.in, ht);
+    fseek(files.in, 0, SEEK_SET);
+    second_pass(files.in, files.out, ht);
+    fclose(files.in);
+    fclose(files.out);
+    ht_delete(ht);
+    return now() - start;
+}
+
+/**
+ * Assembles a program one in-memory stage at a time, and times each stage.
+ * @param  path     The .asm file to assemble.
+ * @param  seconds  Set to how long each stage took.
+ * @param  bytes    Set to the size of the program.
+ * @return          The number of ROM instructions in the program.
+ */
+static long time_stages(const char *path, double *seconds, size_t *bytes) {
+    double start = now();
+    io files = init(path);
+    char *src = read_all(files.in, bytes);
+    fclose(files.in);
+    seconds[0] = now() - start;
+
+    start = now();
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, *bytes, &instrs);
+    seconds[1] = now() - start;
+
+    start = now();
+    ht_hash_table *ht = constructor(2 * (instrs.count / 3) + 1);
+    resolve_labels(&instrs, ht, NULL);
+    seconds[2] = now() - start;
+
+    start = now();
+    resolve_symbols(&instrs, ht, NULL);
+    seconds[3] = now() - start;
+
+    start = now();
+    write_program(&instrs, files.out);
+    fclose(files.out);
+    seconds[4] = now() - start;
+
+    long num_instrs = count_rom(&instrs);
+    ht_delete(ht);
+    instr_list_free(&instrs);
+    free(src);
+    return num_instrs;
+}
+
+int main(int argc, char *argv[]) {
+    const char *usage =
+        "Usage: ./benchmark [-s seed] [-o corpus.asm] size\n"
+        "       ./benchmark path/to/prog.asm\n\n"
+        "  size           generate a program this big, like 1M, 64M or 1G, and benchmark it\n"
+        "  -s seed        the seed for the generated program (default 1)\n"
+        "  -o corpus.asm  where to write the generated program (default bench.asm)\n";
+    unsigned int seed = 1;
+    const char *path = "bench.asm";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:o:")) != -1) {
+        if (opt == 's') {
+            seed = strtoul(optarg, NULL, 10);
+        } else if (opt == 'o') {
+            path = optarg;
+        } else {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        printf("%s", usage);
+        return EXIT_FAILURE;
+    }
+
+    long size = parse_size(argv[optind]);
+    if (size >= 0) {
+        FILE *out = fopen(path, "w");
+        if (!out) {
+            perror("Failed to open corpus file");
+            return EXIT_FAILURE;
+        }
+        corpus_stats corpus;
+        double start = now();
+        generate_corpus(out, size, seed, &corpus);
+        fclose(out);
+        printf("Generated %s in %.3f s: %.1f MB, %ld lines, %ld instructions, %ld labels\n", path,
+            now() - start, corpus.bytes / MB, corpus.lines, corpus.num_instrs, corpus.num_labels);
+    } else {
+        path = argv[optind];
+    }
+
+    double whole = time_whole_run(path);
+    double whole_rss = peak_rss_mb();
+
+    double seconds[NUM_BENCH_STAGES];
+    size_t bytes = 0;
+    long num_instrs = time_stages(path, seconds, &bytes);
+    double mb = bytes / MB;
+
+    printf("\nWhole run: %.3f s, %.1f MB/s, %.0f instructions/s, peak RSS %.1f MB\n\n", whole,
+        mb / whole, num_instrs / whole, whole_rss);
+
+    double total = 0;
+    for (int i = 0; i < NUM_BENCH_STAGES; i++) {
+        total += seconds[i];
+    }
+    printf("%-15s %12s %8s %10s %16s\n", "stage", "time (ms)", "share", "MB/s", "instructions/s");
+    for (int i = 0; i < NUM_BENCH_STAGES; i++) {
+        double s = seconds[i] > 0 ? seconds[i] : 1e-9;
+        printf("%-15s %12.3f %7.1f%% %10.1f %16.0f\n", BENCH_STAGE_NAMES[i], seconds[i] * 1e3,
+            total > 0 ? 100.0 * seconds[i] / total : 0.0, mb / s, num_instrs / s);
+    }
+    printf("%-15s %12.3f %7.1f%% %10.1f %16.0f\n", "total", total * 1e3, 100.0, mb / total,
+        num_instrs / total);
+    printf("\nPeak RSS with the whole program in memory: %.1f MB\n", peak_rss_mb());
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Constant loads for the nand2tetris assembler. See constant.h for the syntax and the expansions.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constant.h"
+#include "encoder.h"
+#include "hackasm.h"
+#include "lexer.h"
+#include "parser.h"
+
+const char CONST_BEGIN = '#';
+
+static const int DEST_M = 1;  // The destination bit for M
+static const int DEST_A = 4;  // The destination bit for A
+
+// Encodes the C_COMMAND dest=comp
+static uint16_t c_word(const char *comp, int dest_bits) {
+    return C_CMD_PREFIX | lookup_comp(pack_mnemonic(comp)) << COMP_SHIFT | dest_bits << DEST_SHIFT;
+}
+
+/**
+ * Determines whether a command is a constant load, like `D=#-1`.
+ * @param  command  The command, with its whitespace and comments stripped.
+ * @return          1 if @command is a constant load, or 0 if it's any other kind of command.
+ */
+int is_constant_load(const char *command) {
+    return command[0] != A_CMD_BEGIN && command[0] != L_CMD_BEGIN
+        && strchr(command, CONST_BEGIN) != NULL;
+}
+
+/**
+ * Builds the shortest sequence of instructions that puts a value into some registers, following the
+ * rules in constant.h.
+ *
+ * @param  value      The value to load.
+ * @param  dest_bits  The destination bits of the registers to load it into.
+ * @param  words      Filled in with the instructions. Must have room for MAX_CONST_WORDS.
+ * @return            The number of instructions, or -1 if the value can only be loaded by changing
+ *                    A and @dest_bits includes M.
+ */
+int materialize_constant(uint16_t value, int dest_bits, uint16_t *words) {
+    if (value == 0 || value == 1 || value == UINT16_MAX) {
+        words[0] = c_word(value == 0 ? "0" : value == 1 ? "1" : "-1", dest_bits);
+        return 1;
+    }
+    if (dest_bits & DEST_M) {
+        return -1;
+    }
+
+    // A_COMMANDs only hold 15 bits, so values with the top bit set are built from their negation,
+    // or from their complement for the one value whose negation is itself
+    const uint16_t top_bit = 1 << (WORD - 1);
+    const char *comp = "A";
+    if (value == top_bit) {
+        words[0] = top_bit - 1;
+        comp = "!A";
+    } else if (value & top_bit) {
+        words[0] = (uint16_t)-value;
+        comp = "-A";
+    } else {
+        words[0] = value;
+        if (dest_bits == DEST_A) {
+            return 1;
+        }
+    }
+    words[1] = c_word(comp, dest_bits);
+    return 2;
+}
+
+/**
+ * Expands a constant load into the instructions that build its value.
+ * @param  command  The constant load, with its whitespace and comments stripped.
+ * @param  words    Filled in with the instructions. Must have room for MAX_CONST_WORDS.
+ * @param  diag     The diagnostic to fill in if the command is invalid, or NULL to print the error
+ *                  and exit.
+ * @return          The number of instructions, or -1 if the command is invalid. The diagnostic's
+ *                  line is left at 0, since only the caller knows it.
+ */
+int expand_constant_load(const char *command, uint16_t *words, hackasm_diag *diag) {
+    const char *assign = strchr(command, ASSIGN);
+    if (assign == NULL || assign[1] != CONST_BEGIN || assign == command) {
+        return report_error(diag, 0, "Constant load `%s` is not of the form dest=%cvalue", command,
+            CONST_BEGIN);
+    }
+
+    char *dest = strndup(command, assign - command);
+    int dest_bits = lookup_dest(pack_mnemonic(dest));
+    free(dest);
+    if (dest_bits < 0) {
+        return report_error(diag, 0, "Invalid destination in constant load `%s`", command);
+    }
+
+    const char *digits = assign + 2;
+    char *end = NULL;
+    errno = 0;
+    long value = strtol(digits, &end, 10);
+    if (end == digits || *end != '\0' || errno) {
+        return report_error(diag, 0, "Invalid constant `%s`", digits);
+    }
+    if (value < INT16_MIN || value > UINT16_MAX) {
+        return report_error(diag, 0, "Constant `%s` does not fit in %d bits", digits, WORD);
+    }
+
+    int n = materialize_constant((uint16_t)value, dest_bits, words);
+    if (n < 0) {
+        return report_error(diag, 0, "Constant load `%s` can't write to M, since it changes A",
+            command);
+    }
+    return n;
+}
@@ -0,0 +1,38 @@
+/*
+ * Header file for constant loads for the nand2tetris assembler.
+ *
+ * A constant load, like `D=#-1` or `AM=#0`, puts any 16-bit value into one or more registers. The
+ * value can be anything from -32768 to 65535; negative values are stored in two's complement. Each
+ * constant load expands to the shortest sequence of real instructions that builds its value, and
+ * code generators can rely on exactly these expansions:
+ *
+ *   0, 1 and -1          dest=0, dest=1 or dest=-1         1 instruction, A is left alone
+ *   0 to 32767, into A   @value                            1 instruction
+ *   0 to 32767           @value, dest=A                    2 instructions
+ *   -32767 to -2         @-value, dest=-A                  2 instructions
+ *   -32768 (or 32768)    @32767, dest=!A                   2 instructions
+ *
+ * Values between 32768 and 65535 are the same as value - 65536. Every expansion but the first
+ * leaves A holding something else, so those can't write to M: `M=#5` is an error, but `M=#-1`
+ * isn't. A constant load can't jump.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _CONSTANT_H
+#define _CONSTANT_H
+
+#include <stdint.h>
+
+#include "hackasm.h"
+
+#define MAX_CONST_WORDS 2  // The most instructions a constant load expands to
+
+extern const char CONST_BEGIN;  // The char that begins the value in a constant load
+
+int is_constant_load(const char*);
+int materialize_constant(uint16_t, int, uint16_t*);
+int expand_constant_load(const char*, uint16_t*, hackasm_diag*);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * Benchmark corpus generator for the nand2tetris assembler.
+ *
+ * The corpus reads like the output of the VM translator, with some hand-written code mixed in: stack
+ * pushes and pops, arithmetic, branches to labels both behind and ahead, a few hundred variables and
+ * statics, predefined symbols, and comments and blank lines. The same size and seed always produce
+ * the same corpus, so runs can be compared with each other.
+ *
+ * Label addresses have to fit in an A_COMMAND, so labels are only defined in the first
+ * MAX_CORPUS_LABEL instructions. A reference to the next label is only written while there's room
+ * left to define it, and the label is defined before running out of room. Past that, the code only
+ * jumps back to labels that already exist.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "corpus.h"
+
+const int MAX_CORPUS_LABEL = 1 << 15;
+
+static const int NUM_VARIABLES = 256;
+static const int NUM_STATICS = 64;
+static const int MAX_SNIPPET_INSTRS = 8;  // More than any one snippet writes
+static const char *BINARY_OPS[] = {"M=D+M", "M=M-D", "M=D&M", "M=D|M"};
+static const char *UNARY_OPS[] = {"M=-M", "M=!M", "M=M+1", "M=M-1"};
+static const char *POINTERS[] = {"LCL", "ARG", "THIS", "THAT"};
+static const char *CONDITIONS[] = {"D;JNE", "D;JEQ", "D;JGT", "D;JLT", "D;JGE", "D;JLE"};
+static const char *COMMENTS[] = {"push constant", "pop local", "push argument", "add", "sub", "if-goto",
+    "label", "function call", "return"};
+
+#define NUM_OF(array) (sizeof(array) / sizeof(array[0]))
+
+// The state of a corpus that's being generated
+typedef struct generator {
+    FILE *out;
+    unsigned int rng;      // The state of the xorshift random number generator
+    int label_ahead;       // Set if the next label has been referenced but not defined yet
+    corpus_stats *stats;
+} generator;
+
+
+static unsigned int pick(generator *g, unsigned int n) {
+    g->rng ^= g->rng << 13;
+    g->rng ^= g->rng >> 17;
+    g->rng ^= g->rng << 5;
+    return g->rng % n;
+}
+
+// Writes a single line, and counts it as a ROM instruction if @is_instr is set
+static void emit(generator *g, int is_instr, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vfprintf(g->out, fmt, args);
+    va_end(args);
+
+    fputc('\n', g->out);
+    g->stats->bytes += n + 1;
+    g->stats->lines++;
+    g->stats->num_instrs += is_instr;
+}
+
+// Writes an A_COMMAND that loads a variable or a static
+static void emit_variable(generator *g) {
+    if (pick(g, 4)) {
+        emit(g, 1, "    @var%u", pick(g, NUM_VARIABLES));
+    } else {
+        emit(g, 1, "    @Main.%u", pick(g, NUM_STATICS));
+    }
+}
+
+// Whether the next label can still be defined, with room for the snippet that references it
+static int room_ahead(const generator *g) {
+    return g->stats->num_instrs < MAX_CORPUS_LABEL - MAX_SNIPPET_INSTRS;
+}
+
+// Whether there's a label that emit_label_ref() can reference
+static int has_label(const generator *g) {
+    return room_ahead(g) || g->stats->num_labels > 0;
+}
+
+static void define_label(generator *g) {
+    emit(g, 0, "(LOOP_%ld)", g->stats->num_labels++);
+    g->label_ahead = 0;
+}
+
+/**
+ * Writes an A_COMMAND that loads a label, either one that's already been defined or, while there's
+ * room to define it, the next one. Only call this if has_label().
+ */
+static void emit_label_ref(generator *g) {
+    long defined = g->stats->num_labels;
+    int ahead = room_ahead(g) && (defined == 0 || pick(g, 3) == 0);
+    long label = ahead ? defined : (long)pick(g, defined);
+    g->label_ahead |= ahead;
+    emit(g, 1, "    @LOOP_%ld", label);
+}
+
+static void emit_screen_addr(generator *g) {
+    emit(g, 1, "    @SCREEN");
+    emit(g, 1, "    D=A");
+    emit(g, 1, "    @R13");
+    emit(g, 1, "    M=D");
+}
+
+static void emit_push(generator *g) {
+    emit(g, 1, "    @SP");
+    emit(g, 1, "    A=M");
+    emit(g, 1, "    M=D");
+    emit(g, 1, "    @SP");
+    emit(g, 1, "    M=M+1");
+}
+
+// Writes one randomly chosen snippet of code
+static void emit_snippet(generator *g) {
+    // A label that's been referenced has to be defined while its address still fits
+    if (g->label_ahead && !room_ahead(g)) {
+        define_label(g);
+    }
+
+    switch (pick(g, 16)) {
+    case 0:
+        emit(g, 0, "// %s %u", COMMENTS[pick(g, NUM_OF(COMMENTS))], pick(g, 32));
+        break;
+    case 1:
+        emit(g, 0, "");
+        break;
+    case 2:
+    case 3:
+        emit(g, 1, "    @%u", pick(g, 1 << 15));
+        emit(g, 1, "    D=A");
+        emit_push(g);
+        break;
+    case 4:
+    case 5:
+        emit_variable(g);
+        emit(g, 1, "    D=M");
+        emit_push(g);
+        break;
+    case 6:
+    case 7:
+        emit(g, 1, "    @SP");
+        emit(g, 1, "    AM=M-1");
+        emit(g, 1, "    D=M");
+        emit_variable(g);
+        emit(g, 1, "    M=D  // pop");
+        break;
+    case 8:
+    case 9:
+        emit(g, 1, "    @SP");
+        emit(g, 1, "    AM=M-1");
+        emit(g, 1, "    D=M");
+        emit(g, 1, "    A=A-1");
+        emit(g, 1, "    %s", BINARY_OPS[pick(g, NUM_OF(BINARY_OPS))]);
+        break;
+    case 10:
+        emit(g, 1, "    @SP");
+        emit(g, 1, "    A=M-1");
+        emit(g, 1, "    %s", UNARY_OPS[pick(g, NUM_OF(UNARY_OPS))]);
+        break;
+    case 11:
+        emit(g, 1, "    @%s", POINTERS[pick(g, NUM_OF(POINTERS))]);
+        emit(g, 1, "    D=M");
+        emit(g, 1, "    @%u", pick(g, 8));
+        emit(g, 1, "    A=D+A");
+        emit(g, 1, "    D=M");
+        break;
+    case 12:
+    case 13:
+        if (!has_label(g)) {
+            emit_screen_addr(g);
+            break;
+        }
+        emit(g, 1, "    @SP");
+        emit(g, 1, "    AM=M-1");
+        emit(g, 1, "    D=M");
+        emit_label_ref(g);
+        emit(g, 1, "    %s", CONDITIONS[pick(g, NUM_OF(CONDITIONS))]);
+        break;
+    case 14:
+        if (room_ahead(g)) {
+            define_label(g);
+        }
+        break;
+    default:
+        if (pick(g, 2) && has_label(g)) {
+            emit_label_ref(g);
+            emit(g, 1, "    0;JMP");
+        } else {
+            emit_screen_addr(g);
+        }
+        break;
+    }
+}
+
+/**
+ * Parses a size like "512", "64K", "16M" or "1G".
+ * @param  str  The size to parse. The suffixes are powers of 1024, and can be either case.
+ * @return      The size in bytes, or -1 if @str isn't a size.
+ */
+long parse_size(const char *str) {
+    char *end;
+    long size = strtol(str, &end, 10);
+    if (end == str || size < 0) {
+        return -1;
+    }
+
+    int shift = 0;
+    switch (toupper(*end)) {
+    case 'G': shift += 10;  // fall through
+    case 'M': shift += 10;  // fall through
+    case 'K': shift += 10; end++; break;
+    case '\0': break;
+    default: return -1;
+    }
+    return *end == '\0' ? size << shift : -1;
+}
+
+/**
+ * Writes a synthetic .asm program of at least @size bytes. It stops at the end of the snippet that
+ * takes it past @size, so it's at most a few hundred bytes over.
+ *
+ * @param out    the file to write the program to
+ * @param size   how many bytes to write
+ * @param seed   the seed for the random number generator; a given seed always gives the same program
+ * @param stats  filled in with what went into the program
+ */
+void generate_corpus(FILE *out, long size, unsigned int seed, corpus_stats *stats) {
+    stats->bytes = 0;
+    stats->lines = 0;
+    stats->num_instrs = 0;
+    stats->num_labels = 0;
+
+    generator g = {out, seed ? seed : 1, 0, stats};
+    emit(&g, 0, "// Synthetic benchmark program, seed %u", seed);
+    while (stats->bytes < size) {
+        emit_snippet(&g);
+    }
+    if (g.label_ahead) {
+        define_label(&g);
+    }
+}
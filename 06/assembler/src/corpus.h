@@ -0,0 +1,25 @@
+/*
+ * Header file for the benchmark corpus generator for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _CORPUS_H
+#define _CORPUS_H
+
+#include <stdio.h>
+
+// What went into a generated corpus
+typedef struct corpus_stats {
+    long bytes;         // The size of the corpus
+    long lines;         // The number of lines, including comments and blank lines
+    long num_instrs;    // The number of ROM instructions
+    long num_labels;    // The number of labels defined
+} corpus_stats;
+
+extern const int MAX_CORPUS_LABEL;  // Labels are only defined while the ROM address is below this
+
+long parse_size(const char*);
+void generate_corpus(FILE*, long, unsigned int, corpus_stats*);
+
+#endif
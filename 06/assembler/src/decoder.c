@@ -0,0 +1,360 @@
+/*
+ * Instruction decoder for the nand2tetris disassembler.
+ *
+ * There are only 65,536 possible words, so rather than picking each word apart as it's read, every
+ * word is decoded once up front into a table, using the same mnemonic tables the encoder uses.
+ * Disassembling a word is then a single table lookup. Where there's more than one way to write a
+ * mnemonic (e.g. "MD" and "DM"), the first one listed in encoder.c is used, so the output reassembles
+ * to exactly the same words.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "decoder.h"
+#include "encoder.h"
+#include "parser.h"
+
+const char *SYM_ROM = "ROM";
+const char *SYM_RAM = "RAM";
+const char *SYM_SRC = "SRC";
+const char SYM_MAGIC[8] = {'H', 'A', 'C', 'K', 'S', 'Y', 'M', 1};
+
+static const uint16_t A_CMD_MAX = 0x7FFF;  // The largest word that's an A_COMMAND
+static const uint16_t C_CMD_MASK = 0xE000;
+#define COMP_MASK 0x7F  // The a-bit and the computation bits, once shifted down
+#define FIELD_MASK 0x7  // The destination or jump bits, once shifted down
+
+static char decode_table[NUM_WORDS][DECODED_LEN];
+static int table_built = 0;
+
+
+/**
+ * Decodes every possible word into decode_table. Words that aren't valid instructions, i.e. whose
+ * top three bits aren't all set or whose computation isn't one the assembler knows, decode to "".
+ */
+void decoder_init(void) {
+    if (table_built) {
+        return;
+    }
+
+    const char *comps[COMP_MASK + 1] = {NULL};
+    for (unsigned int i = 0; i < sizeof(COMPUTATION_LENGTHS) / sizeof(int); i++) {
+        int bits = code_to_bits(COMPUTATION_CODES[i]);
+        for (int j = COMPUTATION_LENGTHS[i] - 1; j >= 0; j--) {
+            const char *comp = COMPUTATIONS[i][j];
+            int a_bit = strchr(comp, MEM) != NULL ? 1 << COMP_CODE_LEN : 0;
+            comps[a_bit | bits] = comp;
+        }
+    }
+
+    const char *dests[FIELD_MASK + 1] = {NULL};
+    for (unsigned int i = 0; i < sizeof(DESTINATION_LENGTHS) / sizeof(int); i++) {
+        dests[code_to_bits(DESTINATION_CODES[i])] = DESTINATIONS[i][0];
+    }
+
+    // The jump codes are the same as the destination codes
+    const char *jumps[FIELD_MASK + 1] = {NULL};
+    for (int i = 0; i < NUM_JUMP_TYPES; i++) {
+        jumps[code_to_bits(DESTINATION_CODES[i])] = JUMPS[i];
+    }
+
+    for (int word = 0; word < NUM_WORDS; word++) {
+        char *text = decode_table[word];
+        if (word <= A_CMD_MAX) {
+            snprintf(text, DECODED_LEN, "%c%d", A_CMD_BEGIN, word);
+            continue;
+        }
+
+        const char *comp = comps[(word >> COMP_SHIFT) & COMP_MASK];
+        if ((word & C_CMD_MASK) != C_CMD_PREFIX || comp == NULL) {
+            text[0] = '\0';
+            continue;
+        }
+
+        const char *dest = dests[(word >> DEST_SHIFT) & FIELD_MASK];
+        const char *jump = jumps[word & FIELD_MASK];
+        // advance() skips lines that are a single character long, so a lone computation like "D"
+        // gets a trailing ';' (with no jump after it) to keep it from being dropped
+        int needs_sep = jump != NULL || (dest == NULL && strlen(comp) == 1);
+        snprintf(text, DECODED_LEN, "%s%s%s%s%s", dest ? dest : "", dest ? "=" : "", comp,
+            needs_sep ? ";" : "", jump ? jump : "");
+    }
+
+    table_built = 1;
+}
+
+/**
+ * Decodes a single word. decoder_init() must have been called first.
+ * @param  word  The word to decode.
+ * @return       The instruction as .asm text, or NULL if @word isn't a valid instruction.
+ */
+const char *decode_word(uint16_t word) {
+    return decode_table[word][0] != '\0' ? decode_table[word] : NULL;
+}
+
+
+/**
+ * Initializes an empty symbol table.
+ * @param syms  The table to initialize.
+ */
+void sym_table_init(sym_table *syms) {
+    syms->labels = NULL;
+    syms->num_labels = 0;
+    syms->capacity = 0;
+    syms->rom = calloc(NUM_WORDS, sizeof(char*));
+    syms->ram = calloc(NUM_WORDS, sizeof(char*));
+    syms->lines = calloc(NUM_WORDS, sizeof(int));
+}
+
+/**
+ * Frees a symbol table.
+ * @param syms  The table to free.
+ */
+void sym_table_free(sym_table *syms) {
+    for (int i = 0; i < syms->num_labels; i++) {
+        free(syms->labels[i].name);
+    }
+    for (int i = 0; i < NUM_WORDS; i++) {
+        free(syms->ram[i]);
+    }
+    free(syms->labels);
+    free(syms->rom);
+    free(syms->ram);
+    free(syms->lines);
+}
+
+static int compare_labels(const void *a, const void *b) {
+    const rom_label *la = a;
+    const rom_label *lb = b;
+    return la->addr != lb->addr ? la->addr - lb->addr : strcmp(la->name, lb->name);
+}
+
+// Adds a label or a variable to a symbol table
+static void add_symbol(sym_table *syms, int is_rom, int addr, const char *name) {
+    if (!is_rom) {
+        if (syms->ram[addr] == NULL) {
+            syms->ram[addr] = strdup(name);
+        }
+        return;
+    }
+
+    if (syms->num_labels == syms->capacity) {
+        syms->capacity = syms->capacity ? 2 * syms->capacity : 64;
+        syms->labels = realloc(syms->labels, syms->capacity * sizeof(rom_label));
+    }
+    syms->labels[syms->num_labels].addr = addr;
+    syms->labels[syms->num_labels].name = strdup(name);
+    syms->num_labels++;
+}
+
+// Marks the start of a run of source lines at a ROM address, until fill_src_runs() fills it in
+static void add_src_run(sym_table *syms, int addr, int line) {
+    syms->lines[addr] = -line;
+}
+
+// Fills in the source line of every ROM address after the start of a run, up to the next run
+static void fill_src_runs(sym_table *syms) {
+    int line = 0;
+    for (int addr = 0; addr < NUM_WORDS; addr++) {
+        if (syms->lines[addr] < 0) {
+            line = -syms->lines[addr];
+        } else if (line > 0) {
+            line++;
+        }
+        syms->lines[addr] = line;
+    }
+}
+
+/**
+ * Reads the records of a binary .sym file, after its magic number.
+ * @return  0 on success, or -1 if the file is cut short or has an address that's out of range.
+ */
+static int read_sym_binary(FILE *f, sym_table *syms) {
+    int32_t counts[3];
+    if (fread(counts, sizeof(int32_t), 3, f) != 3) {
+        return -1;
+    }
+
+    char name[UINT16_MAX + 1];
+    for (int i = 0; i < counts[0] + counts[1]; i++) {
+        uint16_t addr, len;
+        if (fread(&addr, sizeof(addr), 1, f) != 1 || fread(&len, sizeof(len), 1, f) != 1
+                || fread(name, sizeof(char), len, f) != len) {
+            return -1;
+        }
+        name[len] = '\0';
+        add_symbol(syms, i < counts[0], addr, name);
+    }
+
+    for (int i = 0; i < counts[2]; i++) {
+        uint16_t addr;
+        int32_t line;
+        if (fread(&addr, sizeof(addr), 1, f) != 1 || fread(&line, sizeof(line), 1, f) != 1) {
+            return -1;
+        }
+        add_src_run(syms, addr, line);
+    }
+    return 0;
+}
+
+/**
+ * Reads the lines of a text .sym file.
+ * @return  0 on success, or -1 if a line is malformed.
+ */
+static int read_sym_text(FILE *f, const char *path, sym_table *syms) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    int line_num = 0;
+    int ret = 0;
+    while (getline(&line, &line_cap, f) > 0) {
+        line_num++;
+        char space[4];
+        char name[256];
+        long addr;
+        if (line[strspn(line, " \t\r\n")] == '\0' || !strncmp(line, "//", 2)) {
+            continue;
+        }
+        if (sscanf(line, "%3s %ld %255s", space, &addr, name) != 3 || addr < 0 || addr >= NUM_WORDS
+                || (strcmp(space, SYM_ROM) && strcmp(space, SYM_RAM) && strcmp(space, SYM_SRC))) {
+            fprintf(stderr, "%s:%d: expected `%s <address> <name>`, `%s <address> <name>` or "
+                "`%s <address> <line>`\n", path, line_num, SYM_ROM, SYM_RAM, SYM_SRC);
+            ret = -1;
+            break;
+        }
+
+        if (!strcmp(space, SYM_SRC)) {
+            add_src_run(syms, addr, atoi(name));
+        } else {
+            add_symbol(syms, !strcmp(space, SYM_ROM), addr, name);
+        }
+    }
+    free(line);
+    return ret;
+}
+
+/**
+ * Loads the symbols from a .sym file, in either the text or the binary form the assembler writes. In
+ * the text form, each line of the file is "ROM <address> <label>", "RAM <address> <variable>", or
+ * "SRC <address> <line>"; blank lines and lines starting with "//" are ignored.
+ * @param  path  The .sym file to load.
+ * @param  syms  The table to add the symbols to.
+ * @return       0 on success, or -1 if the file couldn't be read or is malformed.
+ */
+int load_sym_file(const char *path, sym_table *syms) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("Failed to open symbol file");
+        return -1;
+    }
+
+    char magic[sizeof(SYM_MAGIC)];
+    int ret;
+    if (fread(magic, sizeof(char), sizeof(magic), f) == sizeof(magic)
+            && !memcmp(magic, SYM_MAGIC, sizeof(magic))) {
+        ret = read_sym_binary(f, syms);
+        if (ret) {
+            fprintf(stderr, "%s: the binary symbol file is malformed\n", path);
+        }
+    } else {
+        rewind(f);
+        ret = read_sym_text(f, path, syms);
+    }
+    fclose(f);
+
+    fill_src_runs(syms);
+    if (syms->num_labels > 0) {
+        qsort(syms->labels, syms->num_labels, sizeof(rom_label), compare_labels);
+    }
+    for (int i = syms->num_labels - 1; i >= 0; i--) {
+        syms->rom[syms->labels[i].addr] = syms->labels[i].name;
+    }
+    return ret;
+}
+
+/**
+ * Picks a name for the address in an A_COMMAND. An address that's about to be jumped to is a label;
+ * otherwise a variable at that address is preferred over a label.
+ * @return  The name to use, or NULL if there's no symbol for @addr.
+ */
+static const char *name_addr(const sym_table *syms, uint16_t addr, int jumps) {
+    if (jumps && syms->rom[addr] != NULL) {
+        return syms->rom[addr];
+    }
+    return syms->ram[addr] != NULL ? syms->ram[addr] : syms->rom[addr];
+}
+
+/**
+ * Disassembles a .hack file. Words that aren't valid instructions are written out as comments.
+ * @param  in    the .hack file to disassemble
+ * @param  out   the file to write the assembly program to
+ * @param  syms  the symbols to restore, or NULL to leave every address numeric
+ * @return       0 on success, or -1 if @in isn't a valid .hack file
+ */
+int disassemble(FILE *in, FILE *out, const sym_table *syms) {
+    decoder_init();
+
+    // Read every word first, so that each A_COMMAND can see whether the instruction after it jumps
+    uint16_t *words = malloc(NUM_WORDS * sizeof(uint16_t));
+    int num_words = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+    int ret = 0;
+    while ((n = getline(&line, &line_cap, in)) > 0) {
+        while (n > 0 && (line[n - 1] == EOL || line[n - 1] == '\r')) {
+            line[--n] = '\0';
+        }
+        if (n != WORD || strspn(line, "01") != (size_t)WORD || num_words == NUM_WORDS) {
+            fprintf(stderr, "Line %d is not a %d-bit binary word: `%s`\n", num_words + 1, WORD, line);
+            ret = -1;
+            break;
+        }
+        words[num_words++] = binary_to_word(line);
+    }
+    free(line);
+
+    const char *indent = syms != NULL && syms->num_labels > 0 ? "    " : "";
+    int next_label = 0;
+    for (int pc = 0; pc <= num_words && ret == 0; pc++) {
+        // Labels past the end of the program all go at the end
+        while (syms != NULL && next_label < syms->num_labels
+                && (syms->labels[next_label].addr <= pc || pc == num_words)) {
+            fprintf(out, "%c%s)\n", L_CMD_BEGIN, syms->labels[next_label].name);
+            next_label++;
+        }
+        if (pc == num_words) {
+            break;
+        }
+
+        uint16_t word = words[pc];
+        const char *text = decode_word(word);
+        if (text == NULL) {
+            char binary[WORD + 1];
+            word_to_binary(word, binary);
+            binary[WORD] = '\0';
+            fprintf(out, "%s// Not a valid instruction: %s\n", indent, binary);
+            continue;
+        }
+
+        const char *name = NULL;
+        if (syms != NULL && text[0] == A_CMD_BEGIN) {
+            int jumps = pc + 1 < num_words && decode_word(words[pc + 1]) != NULL
+                && words[pc + 1] > A_CMD_MAX && (words[pc + 1] & FIELD_MASK);
+            name = name_addr(syms, word, jumps);
+        }
+        if (name != NULL) {
+            fprintf(out, "%s%c%s\n", indent, A_CMD_BEGIN, name);
+        } else {
+            fprintf(out, "%s%s\n", indent, text);
+        }
+    }
+
+    free(words);
+    return ret;
+}
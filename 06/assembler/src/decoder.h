@@ -0,0 +1,45 @@
+/*
+ * Header file for the instruction decoder for the nand2tetris disassembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _DECODER_H
+#define _DECODER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define NUM_WORDS (1 << 16)  // The number of distinct 16-bit words
+#define DECODED_LEN 16       // Enough room for the longest decoded instruction, e.g. "AMD=D|M;JMP"
+
+// A label at a ROM address
+typedef struct rom_label {
+    int addr;
+    char *name;
+} rom_label;
+
+// The symbols from a .sym file
+typedef struct sym_table {
+    rom_label *labels;  // Every label, sorted by address
+    int num_labels;
+    int capacity;
+    char **rom;         // The first label at each ROM address, or NULL
+    char **ram;         // The variable at each RAM address, or NULL
+    int *lines;         // The source line each ROM address came from, or 0 if it isn't known
+} sym_table;
+
+extern const char *SYM_ROM;       // The first field of a .sym line that defines a label
+extern const char *SYM_RAM;       // The first field of a .sym line that defines a variable
+extern const char *SYM_SRC;       // The first field of a .sym line that gives an instruction's source line
+extern const char SYM_MAGIC[8];   // The first bytes of a binary .sym file
+
+
+void decoder_init(void);
+const char *decode_word(uint16_t);
+void sym_table_init(sym_table*);
+void sym_table_free(sym_table*);
+int load_sym_file(const char*, sym_table*);
+int disassemble(FILE*, FILE*, const sym_table*);
+
+#endif
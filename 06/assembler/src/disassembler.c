@@ -0,0 +1,53 @@
+/*
+ * Main controller for the nand2tetris disassembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "decoder.h"
+
+int main(int argc, char *argv[]) {
+    const char *usage =
+        "Usage: ./disassembler [-s prog.sym] path/to/prog.hack > prog.asm\n\n"
+        "  -s prog.sym  restore the label and variable names in this symbol file\n";
+    const char *sym_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            sym_path = optarg;
+        } else {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        printf("%s", usage);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[optind], "r");
+    if (!in) {
+        perror("Failed to open input file");
+        return EXIT_FAILURE;
+    }
+
+    sym_table syms;
+    sym_table_init(&syms);
+    if (sym_path != NULL && load_sym_file(sym_path, &syms)) {
+        sym_table_free(&syms);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    int ret = disassemble(in, stdout, sym_path != NULL ? &syms : NULL);
+
+    sym_table_free(&syms);
+    fclose(in);
+    return ret ? EXIT_FAILURE : 0;
+}
@@ -98,90 +98,256 @@ const char *JUMPS[] = {
 // The jump codes are the same as the destination codes
 const char **jump_codes = DESTINATION_CODES;
 
+const uint16_t C_CMD_PREFIX = 0xE000;  // 111 followed by 13 zeroes
+const int COMP_SHIFT = 6;
+const int DEST_SHIFT = 3;
+const int MAX_MNEMONIC_LEN = 3;  // AMD, D+M, JGT, etc
+
 #endif
 
 
+/*
+ * Every dest, comp and jump mnemonic is at most MAX_MNEMONIC_LEN characters long, so each one packs
+ * losslessly into a uint32_t (see pack_mnemonic()). The packed keys are resolved through a perfect
+ * hash table per field: the slot for a key is (key * mult) >> (32 - MNEMONIC_TABLE_BITS), where mult
+ * is chosen when the tables are built so that no two valid mnemonics share a slot. Looking up a
+ * mnemonic is then a multiply, a shift, one load and one compare.
+ */
+#define MNEMONIC_TABLE_BITS 8
+#define MNEMONIC_TABLE_SIZE (1 << MNEMONIC_TABLE_BITS)
+
+// A single slot in a mnemonic lookup table
+typedef struct mnemonic_slot {
+    uint32_t key;  // The packed mnemonic stored in this slot, or 0 if the slot is empty
+    int32_t bits;  // The encoded bitfield for the mnemonic, or -1 if the slot is empty
+} mnemonic_slot;
+
+// A perfect hash table from packed mnemonics to their encoded bitfields
+typedef struct mnemonic_table {
+    uint32_t mult;
+    mnemonic_slot slots[MNEMONIC_TABLE_SIZE];
+} mnemonic_table;
+
+static mnemonic_table dest_table;
+static mnemonic_table comp_table;
+static mnemonic_table jump_table;
+static int tables_built = 0;
+
+
 /**
- * Converts a destination command string from the parser, into the machine code for that
- * destination command.
- * @param  comp_str The destination command to convert.
- * @return          The machine code for the given destination command.
+ * Converts a string of '0's and '1's, like those in COMPUTATION_CODES, into an integer.
+ * @param  code  The binary string to convert.
+ * @return       The integer value of @code.
  */
-const char *encode_dest(char *dest_str) {
-    if (!dest_str) {
-        return "000\0";
+int32_t code_to_bits(const char *code) {
+    int32_t bits = 0;
+    for (int i = 0; code[i] != '\0'; i++) {
+        bits = (bits << 1) | (code[i] == '1');
     }
+    return bits;
+}
 
-    for (unsigned int i = 0; i < sizeof(DESTINATION_LENGTHS) / sizeof(int); i++) {
-        const char **dests_to_match = DESTINATIONS[i];
-        int len = DESTINATION_LENGTHS[i];
-        for (int j = 0; j < len; j++) {
-            if (!strcmp(dest_str, dests_to_match[j])) {
-                return DESTINATION_CODES[i];
+static inline uint32_t mnemonic_slot_idx(uint32_t key, uint32_t mult) {
+    return (key * mult) >> (32 - MNEMONIC_TABLE_BITS);
+}
+
+/**
+ * Fills in a mnemonic_table with the given keys, searching for a multiplier that places every key in
+ * its own slot.
+ * @param table  The table to fill in.
+ * @param keys   The packed mnemonics to store in the table.
+ * @param bits   The encoded bitfield for each of @keys.
+ * @param n      The number of keys.
+ */
+static void build_table(mnemonic_table *table, const uint32_t *keys, const int32_t *bits, int n) {
+    // Start at the golden ratio multiplier from Knuth's multiplicative hashing, and walk odd
+    // multipliers until one is collision-free. There are only a few dozen keys per table, so this
+    // takes a handful of tries.
+    for (uint32_t mult = 0x9E3779B1u; ; mult += 2) {
+        int collision = 0;
+        for (int i = 0; i < MNEMONIC_TABLE_SIZE; i++) {
+            table->slots[i].key = 0;
+            table->slots[i].bits = -1;
+        }
+
+        for (int i = 0; i < n && !collision; i++) {
+            mnemonic_slot *slot = &table->slots[mnemonic_slot_idx(keys[i], mult)];
+            if (slot->bits != -1 && slot->key != keys[i]) {
+                collision = 1;
             }
+            slot->key = keys[i];
+            slot->bits = bits[i];
+        }
+
+        if (!collision) {
+            table->mult = mult;
+            return;
         }
     }
+}
 
-    printf("Invalid destination `%s`\n", dest_str);
-    exit(EXIT_FAILURE);
+static inline int table_lookup(const mnemonic_table *table, uint32_t key) {
+    const mnemonic_slot *slot = &table->slots[mnemonic_slot_idx(key, table->mult)];
+    return slot->key == key ? slot->bits : -1;
 }
 
+
 /**
- * Converts a computation command string from the parser, into the machine code for that
- * computation command.
- * @param  comp_str The computation command to convert.
- * @return          The machine code for the given computation command.
+ * Builds the dest, comp and jump lookup tables from DESTINATIONS, COMPUTATIONS and JUMPS. This is
+ * done automatically the first time anything is encoded, but must be called explicitly before
+ * encoding from more than one thread.
  */
-char *encode_comp(char *comp_str) {
-    char *comp = calloc(COMP_CODE_LEN + 2, sizeof(char));
-	// Start computation command with bit indicating command type (0 means A, 1 means M)
-	char comp_type = '0';
-	if (strchr(comp_str, MEM) != NULL) {
-		comp_type = '1';
-	}
-	comp[0] = comp_type;
-
-	// Iterate over list of all possible computations
+void encoder_init(void) {
+    if (tables_built) {
+        return;
+    }
+
+    uint32_t keys[MNEMONIC_TABLE_SIZE];
+    int32_t bits[MNEMONIC_TABLE_SIZE];
+    int n = 0;
+
+    for (unsigned int i = 0; i < sizeof(DESTINATION_LENGTHS) / sizeof(int); i++) {
+        for (int j = 0; j < DESTINATION_LENGTHS[i]; j++) {
+            keys[n] = pack_mnemonic(DESTINATIONS[i][j]);
+            bits[n++] = code_to_bits(DESTINATION_CODES[i]);
+        }
+    }
+    build_table(&dest_table, keys, bits, n);
+
+    n = 0;
     for (unsigned int i = 0; i < sizeof(COMPUTATION_LENGTHS) / sizeof(int); i++) {
-        const char **comps_to_match = COMPUTATIONS[i];
-        int len = COMPUTATION_LENGTHS[i];
-		// Iterate over meanings of this command (a command can have two different meanings
-		// depending on the value of comp_type)
-        for (int j = 0; j < len; j++) {
-            if (!strcmp(comp_str, comps_to_match[j])) {
-				// Copy starting one character into the string to account for comp_type
-                strcpy(comp + 1, COMPUTATION_CODES[i]);
-                comp[strlen(comp)] = '\0';
-                break;
-            }
+        for (int j = 0; j < COMPUTATION_LENGTHS[i]; j++) {
+            const char *comp = COMPUTATIONS[i][j];
+            // The a-bit, which selects M instead of A, sits just above the computation bits
+            int32_t a_bit = strchr(comp, MEM) != NULL ? 1 << COMP_CODE_LEN : 0;
+            keys[n] = pack_mnemonic(comp);
+            bits[n++] = a_bit | code_to_bits(COMPUTATION_CODES[i]);
+        }
+    }
+    build_table(&comp_table, keys, bits, n);
+
+    n = 0;
+    for (int i = 0; i < NUM_JUMP_TYPES; i++) {
+        keys[n] = pack_mnemonic(JUMPS[i]);
+        bits[n++] = code_to_bits(jump_codes[i]);
+    }
+    build_table(&jump_table, keys, bits, n);
+
+    tables_built = 1;
+}
+
+/**
+ * Packs a dest, comp or jump mnemonic into a single integer key, one character per byte.
+ * @param  mnemonic  The mnemonic to pack.
+ * @return           The packed key, or 0 if @mnemonic is empty or too long to be valid.
+ */
+uint32_t pack_mnemonic(const char *mnemonic) {
+    uint32_t key = 0;
+    for (int i = 0; mnemonic[i] != '\0'; i++) {
+        if (i == MAX_MNEMONIC_LEN) {
+            return 0;
         }
+        key |= (uint32_t)(unsigned char)mnemonic[i] << (8 * i);
     }
+    return key;
+}
 
-    if (sizeof(comp) <= 1) {
-		free(comp);
-        printf("Invalid computation `%s`\n", comp_str);
+/**
+ * Looks up the 3 destination bits for a packed destination mnemonic.
+ * @param  key  The packed destination mnemonic.
+ * @return      The destination bits, or -1 if @key isn't a valid destination.
+ */
+int lookup_dest(uint32_t key) {
+    if (!tables_built) encoder_init();
+    return table_lookup(&dest_table, key);
+}
+
+/**
+ * Looks up the a-bit and 6 computation bits for a packed computation mnemonic.
+ * @param  key  The packed computation mnemonic.
+ * @return      The a-bit followed by the computation bits, or -1 if @key isn't a valid computation.
+ */
+int lookup_comp(uint32_t key) {
+    if (!tables_built) encoder_init();
+    return table_lookup(&comp_table, key);
+}
+
+/**
+ * Looks up the 3 jump bits for a packed jump mnemonic.
+ * @param  key  The packed jump mnemonic.
+ * @return      The jump bits, or -1 if @key isn't a valid jump.
+ */
+int lookup_jump(uint32_t key) {
+    if (!tables_built) encoder_init();
+    return table_lookup(&jump_table, key);
+}
+
+
+/**
+ * Converts a destination command string from the parser, into the machine code for that
+ * destination command.
+ * @param  dest_str The destination command to convert.
+ * @return          The 3 destination bits for the given destination command.
+ */
+int encode_dest(const char *dest_str) {
+    if (!dest_str) {
+        return 0;
+    }
+
+    int bits = lookup_dest(pack_mnemonic(dest_str));
+    if (bits < 0) {
+        fprintf(stderr, "Invalid destination `%s`\n", dest_str);
+        exit(EXIT_FAILURE);
+    }
+
+    return bits;
+}
+
+/**
+ * Converts a computation command string from the parser, into the machine code for that
+ * computation command.
+ * @param  comp_str The computation command to convert.
+ * @return          The a-bit (0 means A, 1 means M) followed by the 6 computation bits.
+ */
+int encode_comp(const char *comp_str) {
+    int bits = lookup_comp(pack_mnemonic(comp_str));
+    if (bits < 0) {
+        fprintf(stderr, "Invalid computation `%s`\n", comp_str);
         exit(EXIT_FAILURE);
     }
 
-    return comp;
+    return bits;
 }
 
 /**
  * Converts a jump command string from the parser, into the machine code for that jump command.
  * @param  jump_str The jump command to convert.
- * @return          The machine code for the given jump command.
+ * @return          The 3 jump bits for the given jump command.
  */
-const char *encode_jump(char *jump_str) {
+int encode_jump(const char *jump_str) {
     if (!jump_str) {
-        return "000\0";
+        return 0;
     }
 
-    for (int i = 0; i < NUM_JUMP_TYPES; i++) {
-        if (!strcmp(jump_str, JUMPS[i])) {
-            return jump_codes[i];
-        }
+    int bits = lookup_jump(pack_mnemonic(jump_str));
+    if (bits < 0) {
+        fprintf(stderr, "Invalid jump command `%s`\n", jump_str);
+        exit(EXIT_FAILURE);
     }
 
-    printf("Invalid jump command `%s`\n", jump_str);
-    exit(EXIT_FAILURE);
+    return bits;
+}
+
+/**
+ * Encodes a full C_COMMAND from its parsed parts.
+ * @param  dest_str  The destination command, or NULL if there is none.
+ * @param  comp_str  The computation command.
+ * @param  jump_str  The jump command, or NULL if there is none.
+ * @return           The 16-bit machine instruction.
+ */
+uint16_t encode_c_command(const char *dest_str, const char *comp_str, const char *jump_str) {
+    return C_CMD_PREFIX
+        | encode_comp(comp_str) << COMP_SHIFT
+        | encode_dest(dest_str) << DEST_SHIFT
+        | encode_jump(jump_str);
 }
@@ -7,6 +7,8 @@
 #ifndef _ENCODER_H
 #define _ENCODER_H
 
+#include <stdint.h>
+
 extern const char MEM;  // Character used to reference a memory address in .asm files
 extern const int COMP_CODE_LEN;  // The max length of a binary computation command (in a .hack file)
 
@@ -19,9 +21,21 @@ extern const char *COMPUTATION_CODES[];  // The binary equivalents for each comp
 extern int NUM_JUMP_TYPES;               // The number of possible .asm-style jump commands
 extern const char *JUMPS[];              // A list of all the .asm-style jump commands
 
+extern const uint16_t C_CMD_PREFIX;  // The three bits that begin every encoded C_COMMAND
+extern const int COMP_SHIFT;         // The position of the a-bit + computation bits in a C_COMMAND
+extern const int DEST_SHIFT;         // The position of the destination bits in a C_COMMAND
+extern const int MAX_MNEMONIC_LEN;   // The most characters a single dest, comp or jump mnemonic can have
+
 
-const char *encode_dest(char*);
-char *encode_comp(char*);
-const char *encode_jump(char*);
+int32_t code_to_bits(const char*);
+void encoder_init(void);
+uint32_t pack_mnemonic(const char*);
+int lookup_dest(uint32_t);
+int lookup_comp(uint32_t);
+int lookup_jump(uint32_t);
+int encode_dest(const char*);
+int encode_comp(const char*);
+int encode_jump(const char*);
+uint16_t encode_c_command(const char*, const char*, const char*);
 
 #endif
@@ -0,0 +1,65 @@
+/*
+ * libhackasm: the nand2tetris assembler as a library.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "encoder.h"
+#include "hackasm.h"
+#include "lexer.h"
+#include "program.h"
+#include "symboltable.h"
+#include "../../../lib/hash_table.h"
+
+/**
+ * Assembles a program that's in memory. Nothing is printed and nothing is read from or written to
+ * disk, and the process never exits, whatever's wrong with the program.
+ *
+ * @param  src    the .asm program to assemble
+ * @param  len    the length of @src
+ * @param  words  set to a malloc'd array of the program's machine code, or NULL on an error. The
+ *                caller must free it.
+ * @param  n      set to the number of words in @words
+ * @param  diag   filled in with the first error in the program, if there is one. May be NULL.
+ * @return        0 on success, or -1 if the program couldn't be assembled
+ */
+int hackasm_assemble(const char *src, size_t len, uint16_t **words, size_t *n, hackasm_diag *diag) {
+    hackasm_diag scratch_diag;
+    if (diag == NULL) {
+        diag = &scratch_diag;
+    }
+    diag->line = 0;
+    diag->message[0] = '\0';
+    *words = NULL;
+    *n = 0;
+
+    // Build the encoder's tables up front, since they're built lazily and without any locking
+    encoder_init();
+
+    instr_list instrs;
+    instr_list_init(&instrs);
+    ht_hash_table *ht = NULL;
+    int ret = lex_program_diag(src, len, &instrs, diag);
+    if (ret == 0) {
+        ht = constructor(2 * (instrs.count / 3) + 1);
+        ret = resolve_program_diag(&instrs, ht, diag);
+    }
+
+    if (ret == 0) {
+        *words = malloc((instrs.count + 1) * sizeof(uint16_t));
+        for (int i = 0; i < instrs.count; i++) {
+            if (instrs.items[i].type != L_COMMAND) {
+                (*words)[(*n)++] = instrs.items[i].word;
+            }
+        }
+    }
+
+    if (ht != NULL) {
+        ht_delete(ht);
+    }
+    instr_list_free(&instrs);
+    return ret;
+}
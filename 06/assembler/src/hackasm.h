@@ -0,0 +1,32 @@
+/*
+ * libhackasm: the nand2tetris assembler as a library.
+ *
+ * This assembles a program that's already in memory into an array of machine words, without touching
+ * the filesystem. Instead of printing an error and exiting, like the command-line assembler does, it
+ * returns the first error it finds as a diagnostic, so it's safe to call from a long-running process.
+ * The output is exactly what `./assembler prog.asm` writes to prog.hack.
+ *
+ * Link with libhackasm.a, libhashtable and libm. The library is built with the same flags as the
+ * assembler, so programs that link it need -fsanitize=undefined too.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _HACKASM_H
+#define _HACKASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HACKASM_MESSAGE_LEN 256
+
+// What went wrong, when a program couldn't be assembled
+typedef struct hackasm_diag {
+    int line;                           // The source line the error is on, or 0 if it's not on one
+    char message[HACKASM_MESSAGE_LEN];  // A description of the error
+} hackasm_diag;
+
+int hackasm_assemble(const char*, size_t, uint16_t**, size_t*, hackasm_diag*);
+
+#endif
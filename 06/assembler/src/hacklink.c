@@ -0,0 +1,65 @@
+/*
+ * Main controller for the nand2tetris linker.
+ *
+ * This combines object files written by `./assembler -c` into a single .hack file. The objects are
+ * laid out in ROM in the order they're given, so the first one should hold the program's entry point.
+ * Labels are shared between all the objects, so each one may only be defined in one of them.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "object.h"
+#include "program.h"
+#include "symboltable.h"
+#include "../../../lib/hash_table.h"
+
+int main(int argc, char *argv[]) {
+    const char *usage =
+        "Usage: ./hacklink -o prog.hack main.hobj [lib.hobj ...]\n\n"
+        "  -o prog.hack  the file to write the linked program to\n";
+    const char *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        if (opt == 'o') {
+            out_path = optarg;
+        } else {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (out_path == NULL || optind == argc) {
+        printf("%s", usage);
+        return EXIT_FAILURE;
+    }
+
+    instr_list instrs;
+    instr_list_init(&instrs);
+    if (read_objects(&argv[optind], argc - optind, &instrs)) {
+        instr_list_free(&instrs);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        perror("Failed to open output file");
+        instr_list_free(&instrs);
+        return EXIT_FAILURE;
+    }
+
+    ht_hash_table *ht = constructor(2 * (instrs.count / 3) + 1);
+    resolve_program(&instrs, ht);
+    write_program(&instrs, out);
+
+    fclose(out);
+    ht_delete(ht);
+    instr_list_free(&instrs);
+    return 0;
+}
@@ -0,0 +1,520 @@
+/*
+ * Incremental mode for the nand2tetris assembler.
+ *
+ * The program is split into blocks, each of which starts at a label (or after MAX_BLOCK_LINES lines
+ * without one), so editing one function only changes the blocks that function is made of. Every
+ * block is hashed, and a sidecar cache next to the .hack file keeps, for each block of the last run,
+ * its hash, its resolved machine code, the labels it defines, and the symbols it references along
+ * with the addresses they resolved to.
+ *
+ * On the next run, only blocks whose hash isn't in the cache are lexed and encoded. Cached blocks
+ * still contribute their labels and symbol references, which is enough to rebuild the symbol table
+ * and allocate variables in the same order second_pass() would. A cached block's machine code is
+ * then output as-is, unless one of the symbols it references now resolves somewhere else, in which
+ * case just the references to that symbol are patched.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "incremental.h"
+#include "lexer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "../../../lib/hash_table.h"
+
+const char *CACHE_EXT = ".cache";
+
+static const char CACHE_MAGIC[8] = {'H', 'A', 'C', 'K', 'I', 'N', 'C', 1};
+static const int MAX_BLOCK_LINES = 256;
+
+// A position in a cache file that's being read
+typedef struct cursor {
+    const char *pos;
+    const char *end;
+    int ok;  // Cleared as soon as a read runs past the end of the file
+} cursor;
+
+
+/**
+ * Hashes a block's source text with 64-bit FNV-1a.
+ * @param  src  The block's source text.
+ * @param  len  The length of @src.
+ * @return      The hash.
+ */
+uint64_t hash_block(const char *src, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)src[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void free_block(block *b) {
+    for (int i = 0; i < b->num_labels; i++) {
+        free(b->labels[i].name);
+    }
+    for (int i = 0; i < b->num_syms; i++) {
+        free(b->syms[i]);
+    }
+    free(b->words);
+    free(b->labels);
+    free(b->syms);
+    free(b->sym_addrs);
+    free(b->refs);
+    memset(b, 0, sizeof(block));
+}
+
+static void copy_block(block *dst, const block *src) {
+    *dst = *src;
+    dst->words = malloc((src->rom_count + 1) * sizeof(uint16_t));
+    dst->labels = malloc((src->num_labels + 1) * sizeof(block_ref));
+    dst->syms = malloc((src->num_syms + 1) * sizeof(char*));
+    dst->sym_addrs = malloc((src->num_syms + 1) * sizeof(uint16_t));
+    dst->refs = malloc((src->num_refs + 1) * sizeof(block_ref));
+
+    memcpy(dst->words, src->words, src->rom_count * sizeof(uint16_t));
+    memcpy(dst->labels, src->labels, src->num_labels * sizeof(block_ref));
+    memcpy(dst->sym_addrs, src->sym_addrs, src->num_syms * sizeof(uint16_t));
+    memcpy(dst->refs, src->refs, src->num_refs * sizeof(block_ref));
+    for (int i = 0; i < src->num_labels; i++) {
+        dst->labels[i].name = strdup(src->labels[i].name);
+    }
+    for (int i = 0; i < src->num_syms; i++) {
+        dst->syms[i] = strdup(src->syms[i]);
+    }
+}
+
+/**
+ * Lexes and encodes every line of a block. Symbolic A_COMMANDs are left as 0 in the block's words,
+ * to be filled in once the symbol table has been built.
+ * @param b    The block to lex. Its len must already be set.
+ * @param src  The block's source text.
+ */
+static void lex_block(block *b, const char *src) {
+    instr_list instrs;
+    instr_list_init(&instrs);
+    size_t scratch_len = 128;
+    char *scratch = malloc(scratch_len);
+
+    const char *line = src;
+    const char *src_end = src + b->len;
+    while (line < src_end) {
+        const char *eol = memchr(line, EOL, src_end - line);
+        size_t len = eol - line;
+        if (len + 1 > scratch_len) {
+            scratch_len = 2 * (len + 1);
+            scratch = realloc(scratch, scratch_len);
+        }
+
+        b->num_lines++;
+        instruction lexed[MAX_LINE_INSTRS];
+        int n = lex_line(line, len, scratch, lexed);
+        for (int i = 0; i < n; i++) {
+            *instr_list_push(&instrs) = lexed[i];
+        }
+        line = eol + 1;
+    }
+    free(scratch);
+
+    b->words = malloc((instrs.count + 1) * sizeof(uint16_t));
+    b->labels = malloc((instrs.count + 1) * sizeof(block_ref));
+    b->syms = malloc((instrs.count + 1) * sizeof(char*));
+    b->sym_addrs = calloc(instrs.count + 1, sizeof(uint16_t));
+    b->refs = malloc((instrs.count + 1) * sizeof(block_ref));
+
+    // Maps each symbol to its index in b->syms
+    ht_hash_table *sym_ids = ht_new(instrs.count + 1);
+    for (int i = 0; i < instrs.count; i++) {
+        instruction *instr = &instrs.items[i];
+        if (instr->type == L_COMMAND) {
+            b->labels[b->num_labels].offset = b->rom_count;
+            b->labels[b->num_labels].sym = -1;
+            b->labels[b->num_labels].name = instr->symbol;
+            b->num_labels++;
+            instr->symbol = NULL;
+            continue;
+        }
+
+        if (instr->symbol != NULL) {
+            int sym;
+            char *id_str = ht_search(sym_ids, instr->symbol);
+            if (id_str != NULL) {
+                sym = atoi(id_str);
+                free(id_str);
+            } else {
+                char id_buf[16];
+                sym = b->num_syms++;
+                snprintf(id_buf, sizeof(id_buf), "%d", sym);
+                ht_insert(sym_ids, instr->symbol, id_buf);
+                b->syms[sym] = strdup(instr->symbol);
+            }
+            b->refs[b->num_refs].offset = b->rom_count;
+            b->refs[b->num_refs].sym = sym;
+            b->refs[b->num_refs].name = NULL;
+            b->num_refs++;
+        }
+        b->words[b->rom_count++] = instr->word;
+    }
+
+    ht_delete(sym_ids);
+    instr_list_free(&instrs);
+}
+
+
+// Reads @n bytes from a cache file into @dst, or clears c->ok if there aren't enough left
+static void take(cursor *c, void *dst, size_t n) {
+    if (!c->ok || (size_t)(c->end - c->pos) < n) {
+        c->ok = 0;
+        memset(dst, 0, n);
+        return;
+    }
+    memcpy(dst, c->pos, n);
+    c->pos += n;
+}
+
+static char *take_string(cursor *c) {
+    uint16_t len;
+    take(c, &len, sizeof(len));
+    char *str = calloc(len + 1, sizeof(char));
+    take(c, str, len);
+    return str;
+}
+
+// Reads a count from a cache file, and checks that it's at least plausible
+static int take_count(cursor *c) {
+    int32_t n;
+    take(c, &n, sizeof(n));
+    if (n < 0 || n > c->end - c->pos) {
+        c->ok = 0;
+        return 0;
+    }
+    return n;
+}
+
+static void put_string(FILE *f, const char *str) {
+    uint16_t len = strlen(str);
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(str, sizeof(char), len, f);
+}
+
+/**
+ * Reads the blocks saved by the last run.
+ * @param  path        The path to the cache file.
+ * @param  num_blocks  Set to the number of blocks read.
+ * @return             The cached blocks, or NULL if there's no usable cache.
+ */
+static block *read_cache(const char *path, int *num_blocks) {
+    *num_blocks = 0;
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    size_t len = 0;
+    char *data = read_all(f, &len);
+    fclose(f);
+
+    cursor c = {data, data + len, 1};
+    char magic[sizeof(CACHE_MAGIC)];
+    take(&c, magic, sizeof(magic));
+    if (!c.ok || memcmp(magic, CACHE_MAGIC, sizeof(magic))) {
+        free(data);
+        return NULL;
+    }
+
+    int n = take_count(&c);
+    block *blocks = calloc(n + 1, sizeof(block));
+    int i;
+    for (i = 0; i < n && c.ok; i++) {
+        block *b = &blocks[i];
+        uint64_t len64;
+        take(&c, &b->hash, sizeof(b->hash));
+        take(&c, &len64, sizeof(len64));
+        b->len = len64;
+        b->num_lines = take_count(&c);
+        b->rom_count = take_count(&c);
+        int num_labels = take_count(&c);
+        int num_syms = take_count(&c);
+        int num_refs = take_count(&c);
+
+        b->words = malloc((b->rom_count + 1) * sizeof(uint16_t));
+        b->labels = calloc(num_labels + 1, sizeof(block_ref));
+        b->syms = calloc(num_syms + 1, sizeof(char*));
+        b->sym_addrs = malloc((num_syms + 1) * sizeof(uint16_t));
+        b->refs = malloc((num_refs + 1) * sizeof(block_ref));
+
+        take(&c, b->words, b->rom_count * sizeof(uint16_t));
+        for (; b->num_labels < num_labels; b->num_labels++) {
+            int32_t offset;
+            take(&c, &offset, sizeof(offset));
+            b->labels[b->num_labels].offset = offset;
+            b->labels[b->num_labels].sym = -1;
+            b->labels[b->num_labels].name = take_string(&c);
+        }
+        for (; b->num_syms < num_syms; b->num_syms++) {
+            b->syms[b->num_syms] = take_string(&c);
+            take(&c, &b->sym_addrs[b->num_syms], sizeof(uint16_t));
+        }
+        for (; b->num_refs < num_refs; b->num_refs++) {
+            int32_t ref[2];
+            take(&c, ref, sizeof(ref));
+            if (ref[0] < 0 || ref[0] >= b->rom_count || ref[1] < 0 || ref[1] >= num_syms) {
+                c.ok = 0;
+            }
+            b->refs[b->num_refs].offset = ref[0];
+            b->refs[b->num_refs].sym = ref[1];
+            b->refs[b->num_refs].name = NULL;
+        }
+    }
+    free(data);
+
+    // A cache that's been cut short or corrupted is no better than no cache at all
+    if (!c.ok) {
+        for (int j = 0; j < i; j++) {
+            free_block(&blocks[j]);
+        }
+        free(blocks);
+        return NULL;
+    }
+
+    *num_blocks = n;
+    return blocks;
+}
+
+/**
+ * Saves the blocks of this run for the next one. The cache is written to a temporary file and then
+ * renamed over the old one, so an interrupted run can't leave a half-written cache behind.
+ */
+static void write_cache(const char *path, const block *blocks, int num_blocks) {
+    char *tmp_path = malloc(strlen(path) + strlen(".tmp") + 1);
+    sprintf(tmp_path, "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to write cache %s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return;
+    }
+
+    int32_t n = num_blocks;
+    fwrite(CACHE_MAGIC, sizeof(char), sizeof(CACHE_MAGIC), f);
+    fwrite(&n, sizeof(n), 1, f);
+    for (int i = 0; i < num_blocks; i++) {
+        const block *b = &blocks[i];
+        uint64_t len64 = b->len;
+        int32_t counts[] = {b->num_lines, b->rom_count, b->num_labels, b->num_syms, b->num_refs};
+        fwrite(&b->hash, sizeof(b->hash), 1, f);
+        fwrite(&len64, sizeof(len64), 1, f);
+        fwrite(counts, sizeof(int32_t), 5, f);
+        fwrite(b->words, sizeof(uint16_t), b->rom_count, f);
+        for (int j = 0; j < b->num_labels; j++) {
+            int32_t offset = b->labels[j].offset;
+            fwrite(&offset, sizeof(offset), 1, f);
+            put_string(f, b->labels[j].name);
+        }
+        for (int j = 0; j < b->num_syms; j++) {
+            put_string(f, b->syms[j]);
+            fwrite(&b->sym_addrs[j], sizeof(uint16_t), 1, f);
+        }
+        for (int j = 0; j < b->num_refs; j++) {
+            int32_t ref[] = {b->refs[j].offset, b->refs[j].sym};
+            fwrite(ref, sizeof(int32_t), 2, f);
+        }
+    }
+
+    if (fclose(f) || rename(tmp_path, path)) {
+        fprintf(stderr, "Failed to write cache %s: %s\n", path, strerror(errno));
+        remove(tmp_path);
+    }
+    free(tmp_path);
+}
+
+
+// Checks whether a line (not including its newline) defines a label
+static int is_label_line(const char *line, const char *eol) {
+    while (line < eol && (*line == ' ' || *line == '\t')) {
+        line++;
+    }
+    return line < eol && *line == L_CMD_BEGIN;
+}
+
+/**
+ * Assembles a program that's already in memory, reusing as much as possible of the last run's work
+ * from the cache at @cache_path, and then updates the cache. This produces exactly the same output
+ * as first_pass() followed by second_pass().
+ *
+ * @param src         the .asm program to assemble
+ * @param len         the length of @src
+ * @param out         the file to write the assembled binary to
+ * @param ht          the symbol table, which should contain only the predefined symbols
+ * @param cache_path  the cache file to read from and write to
+ * @param stats       filled in with how many blocks were reused
+ */
+void assemble_incremental(const char *src, size_t len, FILE *out, ht_hash_table *ht,
+                          const char *cache_path, incr_stats *stats) {
+    memset(stats, 0, sizeof(incr_stats));
+
+    int num_cached = 0;
+    block *cached = read_cache(cache_path, &num_cached);
+
+    // Maps the hash and length of each cached block to its index in cached
+    ht_hash_table *cached_ids = ht_new(2 * num_cached + 1);
+    for (int i = 0; i < num_cached; i++) {
+        char key[48], id_buf[16];
+        snprintf(key, sizeof(key), "%016llx:%zu", (unsigned long long)cached[i].hash, cached[i].len);
+        snprintf(id_buf, sizeof(id_buf), "%d", i);
+        ht_insert(cached_ids, key, id_buf);
+    }
+
+    // Split the input into blocks, and take each one from the cache if it's there
+    int num_blocks = 0;
+    int blocks_cap = 64;
+    block *blocks = malloc(blocks_cap * sizeof(block));
+    char *fresh = malloc(blocks_cap);  // Set for blocks that were just lexed
+
+    const char *src_end = src + len;
+    const char *block_start = src;
+    int block_lines = 0;
+    const char *line = src;
+    while (line <= src_end) {
+        const char *eol = line < src_end ? memchr(line, EOL, src_end - line) : NULL;
+        int boundary = eol == NULL  // Like advance(), ignore a final line with no newline
+            || (block_lines > 0 && (block_lines == MAX_BLOCK_LINES || is_label_line(line, eol)));
+
+        if (boundary && line > block_start) {
+            if (num_blocks == blocks_cap) {
+                blocks_cap *= 2;
+                blocks = realloc(blocks, blocks_cap * sizeof(block));
+                fresh = realloc(fresh, blocks_cap);
+            }
+
+            block *b = &blocks[num_blocks];
+            memset(b, 0, sizeof(block));
+            b->len = line - block_start;
+            b->hash = hash_block(block_start, b->len);
+
+            char key[48];
+            snprintf(key, sizeof(key), "%016llx:%zu", (unsigned long long)b->hash, b->len);
+            char *id_str = ht_search(cached_ids, key);
+            if (id_str != NULL) {
+                copy_block(b, &cached[atoi(id_str)]);
+                free(id_str);
+                fresh[num_blocks] = 0;
+            } else {
+                lex_block(b, block_start);
+                fresh[num_blocks] = 1;
+                stats->relexed++;
+            }
+
+            num_blocks++;
+            block_start = line;
+            block_lines = 0;
+        }
+
+        if (eol == NULL) {
+            break;
+        }
+        block_lines++;
+        line = eol + 1;
+    }
+
+    for (int i = 0; i < num_cached; i++) {
+        free_block(&cached[i]);
+    }
+    free(cached);
+    ht_delete(cached_ids);
+
+    // Insert every label into the symbol table, in source order
+    long addr_ROM = 0;
+    for (int i = 0; i < num_blocks; i++) {
+        for (int j = 0; j < blocks[i].num_labels; j++) {
+            long addr = addr_ROM + blocks[i].labels[j].offset;
+            if (addr > UINT16_MAX) {
+                fprintf(stderr, "Label `%s` is past the end of the %d-bit address space\n",
+                    blocks[i].labels[j].name, WORD);
+                exit(EXIT_FAILURE);
+            }
+            char *binary_addr = parse_to_binary(addr);
+            ht_insert(ht, blocks[i].labels[j].name, binary_addr);
+            free(binary_addr);
+        }
+        addr_ROM += blocks[i].rom_count;
+    }
+
+    // Resolve every symbol each block references, allocating variables in order of first reference,
+    // and patch the references to any symbol that doesn't resolve where it did last time
+    int addr_RAM = 16;
+    for (int i = 0; i < num_blocks; i++) {
+        block *b = &blocks[i];
+        char *moved = calloc(b->num_syms + 1, sizeof(char));
+        int any_moved = fresh[i];
+
+        for (int j = 0; j < b->num_syms; j++) {
+            char *binary_addr = ht_search(ht, b->syms[j]);
+            if (binary_addr == NULL) {
+                binary_addr = parse_to_binary(addr_RAM);
+                ht_insert(ht, b->syms[j], binary_addr);
+                addr_RAM++;
+            }
+            uint16_t addr = binary_to_word(binary_addr);
+            free(binary_addr);
+
+            if (fresh[i] || addr != b->sym_addrs[j]) {
+                moved[j] = 1;
+                any_moved = 1;
+                b->sym_addrs[j] = addr;
+            }
+        }
+
+        if (any_moved) {
+            for (int j = 0; j < b->num_refs; j++) {
+                if (moved[b->refs[j].sym]) {
+                    b->words[b->refs[j].offset] = b->sym_addrs[b->refs[j].sym];
+                }
+            }
+            if (!fresh[i]) {
+                stats->reresolved++;
+            }
+        } else {
+            stats->reused++;
+        }
+        free(moved);
+    }
+
+    // Write out every block's machine code
+    for (int i = 0; i < num_blocks; i++) {
+        size_t text_len = (size_t)blocks[i].rom_count * (WORD + 1);
+        char *text = malloc(text_len + 1);
+        for (int j = 0; j < blocks[i].rom_count; j++) {
+            word_to_binary(blocks[i].words[j], text + j * (WORD + 1));
+            text[j * (WORD + 1) + WORD] = '\n';
+        }
+        fwrite(text, sizeof(char), text_len, out);
+        free(text);
+    }
+
+    write_cache(cache_path, blocks, num_blocks);
+
+    stats->num_blocks = num_blocks;
+    for (int i = 0; i < num_blocks; i++) {
+        free_block(&blocks[i]);
+    }
+    free(blocks);
+    free(fresh);
+}
+
+/**
+ * Prints how much of an incremental run was reused from the cache.
+ * @param out    The file to print to.
+ * @param stats  The incr_stats filled in by assemble_incremental().
+ */
+void print_incr_stats(FILE *out, const incr_stats *stats) {
+    fprintf(out, "%d blocks: %d reused, %d re-resolved, %d re-lexed\n", stats->num_blocks,
+        stats->reused, stats->reresolved, stats->relexed);
+}
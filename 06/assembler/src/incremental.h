@@ -0,0 +1,53 @@
+/*
+ * Header file for the incremental mode of the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _INCREMENTAL_H
+#define _INCREMENTAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../../../lib/hash_table.h"
+
+// A symbol in a block, and where in the block it's used or defined
+typedef struct block_ref {
+    int offset;  // The block-relative ROM address of the reference or label
+    int sym;     // For references, the index of the symbol in the block's syms. Unused for labels.
+    char *name;  // For labels, the label's name. NULL for references.
+} block_ref;
+
+// A run of whole lines from the input, and everything needed to output it without lexing it again
+typedef struct block {
+    uint64_t hash;        // The FNV-1a hash of the block's source text
+    size_t len;           // The length of the block's source text
+    int num_lines;
+    int rom_count;        // The number of instructions in the block that take up ROM
+    uint16_t *words;      // The block's machine code, with every symbol resolved
+    block_ref *labels;    // Every label the block defines
+    int num_labels;
+    char **syms;          // Every symbol the block references, in the order they're first referenced
+    uint16_t *sym_addrs;  // The address each of syms resolved to when words was last resolved
+    int num_syms;
+    block_ref *refs;      // Every symbolic A_COMMAND in the block
+    int num_refs;
+} block;
+
+// What an incremental run was able to reuse
+typedef struct incr_stats {
+    int num_blocks;    // The number of blocks in the program
+    int relexed;       // Blocks that weren't in the cache, and had to be lexed and encoded
+    int reused;        // Blocks whose cached machine code was output as-is
+    int reresolved;    // Cached blocks that referenced a symbol that moved, and had to be patched
+} incr_stats;
+
+extern const char *CACHE_EXT;  // The extension appended to the .hack file's name to name its cache
+
+uint64_t hash_block(const char*, size_t);
+void assemble_incremental(const char*, size_t, FILE*, ht_hash_table*, const char*, incr_stats*);
+void print_incr_stats(FILE*, const incr_stats*);
+
+#endif
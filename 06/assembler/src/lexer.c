@@ -0,0 +1,240 @@
+/*
+ * In-memory lexer for the nand2tetris assembler. Where advance() and the parse_* functions work on
+ * one malloc'd line at a time from a FILE, this lexes lines that are already in memory straight
+ * into instruction structs, which lets many lines be lexed independently of each other.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constant.h"
+#include "encoder.h"
+#include "hackasm.h"
+#include "lexer.h"
+#include "parser.h"
+
+/**
+ * Strips whitespace and comments out of a line, the same way advance() does.
+ * @param  line     The line to strip, not including its trailing newline.
+ * @param  len      The length of @line.
+ * @param  scratch  A buffer of at least @len + 1 chars to write the stripped line into.
+ * @return          The length of the stripped line, or 0 if the line should be skipped.
+ */
+static size_t strip_line(const char *line, size_t len, char *scratch) {
+    size_t size = 0;
+    int precomment = 0;
+    int skip = 0;
+    int inline_comment = 0;
+
+    for (size_t i = 0; i < len && !inline_comment; i++) {
+        char c = line[i];
+        if (c == BEGIN_COMMENT) {
+            if (precomment) {
+                if (size > 1) {
+                    inline_comment = 1;
+                } else {
+                    skip = 1;
+                }
+            } else {
+                precomment = 1;
+            }
+        } else if (c == ' ' || c == '\t') {
+            continue;
+        }
+        scratch[size++] = c;
+    }
+
+    // Drop the '//' that began an inline comment
+    if (inline_comment) {
+        size -= 2;
+    }
+
+    if (skip || size <= 1) {
+        return 0;
+    }
+
+    scratch[size] = '\0';
+    return size;
+}
+
+/**
+ * Reports an error. Callers that can recover pass a diagnostic to fill in; the command-line tools pass
+ * NULL, and the error is printed and the process exits, the way it always has.
+ *
+ * @param  diag  the diagnostic to fill in, or NULL to print the error and exit
+ * @param  line  the source line the error is on, or 0 if it's not known
+ * @param  fmt   a printf-style description of the error, without a trailing newline
+ * @return       -1, so that callers can `return report_error(...)`
+ */
+int report_error(hackasm_diag *diag, int line, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (diag == NULL) {
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+        fputc('\n', stderr);
+        exit(EXIT_FAILURE);
+    }
+    diag->line = line;
+    vsnprintf(diag->message, sizeof(diag->message), fmt, args);
+    va_end(args);
+    return -1;
+}
+
+/**
+ * Lexes a single line of a .asm program. C_COMMANDs and numeric A_COMMANDs are fully encoded;
+ * symbolic A_COMMANDs and L_COMMANDs have their symbol copied into @out, to be resolved later. A
+ * constant load, like `D=#-1`, is expanded into the instructions that build its value.
+ *
+ * @param  line     The line to lex, not including its trailing newline.
+ * @param  len      The length of @line.
+ * @param  scratch  A buffer of at least @len + 1 chars that the lexer can use as working space.
+ * @param  out      The instructions to fill in. Must have room for MAX_LINE_INSTRS.
+ * @return          The number of instructions on the line, which is 0 if it was blank or a comment.
+ */
+int lex_line(const char *line, size_t len, char *scratch, instruction *out) {
+    return lex_line_diag(line, len, scratch, out, NULL);
+}
+
+/**
+ * Lexes a single line of a .asm program, like lex_line(), but reports errors through @diag.
+ * @param  diag  The diagnostic to fill in if the line is invalid, or NULL to print the error and exit.
+ * @return       The number of instructions on the line, or -1 if it's invalid. The diagnostic's
+ *               line is left at 0, since only the caller knows it.
+ */
+int lex_line_diag(const char *line, size_t len, char *scratch, instruction *out, hackasm_diag *diag) {
+    size_t size = strip_line(line, len, scratch);
+    if (!size) {
+        return 0;
+    }
+
+    if (is_constant_load(scratch)) {
+        uint16_t words[MAX_CONST_WORDS];
+        int n = expand_constant_load(scratch, words, diag);
+        for (int i = 0; i < n; i++) {
+            out[i].type = (words[i] & C_CMD_PREFIX) == C_CMD_PREFIX ? C_COMMAND : A_COMMAND;
+            out[i].word = words[i];
+            out[i].symbol = NULL;
+        }
+        return n;
+    }
+
+    out->type = command_type(scratch);
+    out->word = 0;
+    out->symbol = NULL;
+
+    if (out->type == L_COMMAND) {
+        out->symbol = strndup(scratch + 1, size - 2);
+    } else if (out->type == A_COMMAND) {
+        if (scratch[1] >= '0' && scratch[1] <= '9') {
+            long value = strtol(scratch + 1, NULL, 10);
+            if (value > UINT16_MAX) {
+                return report_error(diag, 0, "A_COMMAND constant `%s` does not fit in %d bits",
+                    scratch + 1, WORD);
+            }
+            out->word = value;
+        } else {
+            out->symbol = strdup(scratch + 1);
+        }
+    } else {
+        // Mirror parse_dest(), parse_comp() and parse_jump(): the destination is everything before
+        // an '=' in the first MAX_DEST_LEN + 1 chars, the computation runs from the last '=' to the
+        // last ';', and the jump is the JMP_LEN chars after the first ';'.
+        char *dest = NULL;
+        char *jump = NULL;
+        size_t comp_start = 0;
+        size_t comp_end = size;
+        size_t first_sep = size;
+
+        for (size_t i = 0; i < size; i++) {
+            if (scratch[i] == ASSIGN) {
+                comp_start = i + 1;
+            } else if (scratch[i] == SEP) {
+                comp_end = i;
+                if (first_sep == size) first_sep = i;
+            }
+        }
+
+        for (size_t i = 0; i < size && i < (size_t)MAX_DEST_LEN + 1; i++) {
+            if (scratch[i] == ASSIGN) {
+                dest = scratch;
+                scratch[i] = '\0';
+                break;
+            } else if (scratch[i] == SEP) {
+                break;
+            }
+        }
+
+        if (first_sep + 1 < size) {
+            jump = scratch + first_sep + 1;
+            if (first_sep + 1 + JMP_LEN < size) {
+                jump[JMP_LEN] = '\0';
+            }
+        }
+
+        if (comp_end < comp_start) {
+            return report_error(diag, 0, "Invalid computation in `%s`", scratch);
+        }
+        scratch[comp_end] = '\0';
+        const char *comp = scratch + comp_start;
+
+        // The same checks as encode_c_command(), which exits on an invalid mnemonic
+        int comp_bits = lookup_comp(pack_mnemonic(comp));
+        if (comp_bits < 0) {
+            return report_error(diag, 0, "Invalid computation `%s`", comp);
+        }
+        int dest_bits = dest != NULL ? lookup_dest(pack_mnemonic(dest)) : 0;
+        if (dest_bits < 0) {
+            return report_error(diag, 0, "Invalid destination `%s`", dest);
+        }
+        int jump_bits = jump != NULL ? lookup_jump(pack_mnemonic(jump)) : 0;
+        if (jump_bits < 0) {
+            return report_error(diag, 0, "Invalid jump command `%s`", jump);
+        }
+        out->word = C_CMD_PREFIX | comp_bits << COMP_SHIFT | dest_bits << DEST_SHIFT | jump_bits;
+    }
+
+    return 1;
+}
+
+/**
+ * Initializes an empty instruction list.
+ * @param list  The list to initialize.
+ */
+void instr_list_init(instr_list *list) {
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/**
+ * Appends a new, zeroed instruction to the end of a list, growing the list if needed.
+ * @param  list  The list to append to.
+ * @return       A pointer to the new instruction.
+ */
+instruction *instr_list_push(instr_list *list) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->items = realloc(list->items, list->capacity * sizeof(instruction));
+    }
+
+    instruction *instr = &list->items[list->count++];
+    memset(instr, 0, sizeof(instruction));
+    return instr;
+}
+
+/**
+ * Frees every instruction in a list, and the list's storage.
+ * @param list  The list to free.
+ */
+void instr_list_free(instr_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i].symbol);
+    }
+    free(list->items);
+    instr_list_init(list);
+}
@@ -0,0 +1,42 @@
+/*
+ * Header file for the in-memory lexer for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _LEXER_H
+#define _LEXER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constant.h"
+#include "hackasm.h"
+#include "parser.h"
+
+#define MAX_LINE_INSTRS MAX_CONST_WORDS  // The most instructions a single line can lex to
+
+// A single lexed .asm instruction
+typedef struct instruction {
+    command_t type;  // One of A_COMMAND, C_COMMAND, or L_COMMAND
+    uint16_t word;   // The machine code for the instruction, once it's known
+    char *symbol;    // The symbol in an A_COMMAND or L_COMMAND, or NULL for C_COMMANDs and numeric A_COMMANDs
+    int line;        // The line of the source file the instruction came from
+} instruction;
+
+// A growable list of instructions
+typedef struct instr_list {
+    instruction *items;
+    int count;
+    int capacity;
+} instr_list;
+
+
+int report_error(hackasm_diag*, int, const char*, ...);
+int lex_line(const char*, size_t, char*, instruction*);
+int lex_line_diag(const char*, size_t, char*, instruction*, hackasm_diag*);
+void instr_list_init(instr_list*);
+instruction *instr_list_push(instr_list*);
+void instr_list_free(instr_list*);
+
+#endif
@@ -4,20 +4,171 @@
  * @email jesse27999@gmail.com
  */
 
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "batch.h"
+#include "incremental.h"
+#include "object.h"
+#include "optimizer.h"
+#include "parallel.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "program.h"
+#include "rom.h"
+#include "stream.h"
 #include "symboltable.h"
+#include "symfile.h"
 #include "../../../lib/hash_table.h"
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: ./assembler path/to/prog.asm");
+    const char *usage =
+        "Usage: ./assembler [-j threads | -p | -i | --profile | [-O] [-r] [-s | -S]] prog.asm\n"
+        "       ./assembler [-j threads] path/to/prog.asm|dir ...\n"
+        "       ./assembler -c path/to/prog.asm\n"
+        "       ./assembler - < prog.asm > prog.hack\n\n"
+        "  -j threads  split the program into chunks and assemble them on this many threads, or\n"
+        "              with several files or a directory, assemble that many files at once\n"
+        "  -p          read, encode and write on separate pipelined threads, and print how busy\n"
+        "              each one was\n"
+        "  -O          remove redundant and unreachable instructions, and print how many each rule\n"
+        "              removed\n"
+        "  -s          also write the symbol map, i.e. every label and variable's address and\n"
+        "              every instruction's source line, to prog.sym\n"
+        "  -S          write the symbol map to prog.sym in binary rather than as text\n"
+        "  -r          also write a ROM image, prog.rom, that can be mapped straight into memory.\n"
+        "              With -s or -S, the symbol map is included in it too\n"
+        "  -c          write a relocatable object, prog.hobj, to be linked with hacklink, instead of\n"
+        "              prog.hack\n"
+        "  -i          reuse the unchanged parts of the last run, which are cached in prog.hack.cache\n"
+        "  --profile   print how long each pass took, what kinds of lines and instructions were\n"
+        "              read, how the symbol table was used, how much was allocated and peak RSS\n"
+        "  -           read the program from stdin and write the binary to stdout in a single pass\n";
+    int num_threads = 1;
+    int threads_given = 0;
+    int pipelined = 0;
+    int incremental = 0;
+    int optimize = 0;
+    int sym_form = 0;  // 0 for no symbol map, or 's' or 'S'
+    int object = 0;
+    int rom = 0;
+    int profiled = 0;
+
+    const struct option long_opts[] = {
+        {"profile", no_argument, &profiled, 1},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:piOsScr", long_opts, NULL)) != -1) {
+        if (opt == 0) {
+            continue;  // A long option that just sets a flag
+        } else if (opt == 'p') {
+            pipelined = 1;
+        } else if (opt == 'i') {
+            incremental = 1;
+        } else if (opt == 'O') {
+            optimize = 1;
+        } else if (opt == 'c') {
+            object = 1;
+        } else if (opt == 'r') {
+            rom = 1;
+        } else if (opt == 's' || opt == 'S') {
+            sym_form = opt;
+        } else if (opt == 'j') {
+            num_threads = atoi(optarg);
+            threads_given = 1;
+            if (num_threads < 1 || num_threads > MAX_THREADS) {
+                printf("The number of threads must be between 1 and %d\n", MAX_THREADS);
+                return EXIT_FAILURE;
+            }
+        } else {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct stat st;
+    int batch = argc - optind > 1 || (optind == argc - 1 && !stat(argv[optind], &st) && S_ISDIR(st.st_mode));
+    if (batch) {
+        if (pipelined || incremental || optimize || sym_form || object || rom || profiled) {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+        if (!threads_given) {
+            long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            num_threads = num_cpus < 1 ? 1 : num_cpus > MAX_THREADS ? MAX_THREADS : num_cpus;
+        }
+
+        file_list files;
+        file_list_init(&files);
+        int missing = 0;
+        for (int i = optind; i < argc; i++) {
+            if (collect_asm_files(argv[i], &files)) missing++;
+        }
+
+        batch_stats stats;
+        assemble_batch(&files, num_threads, &stats);
+        print_batch_stats(stdout, &stats);
+        file_list_free(&files);
+        return missing || stats.num_failed ? EXIT_FAILURE : 0;
+    }
+
+    int in_memory = optimize || sym_form || rom;
+    int num_modes = pipelined + incremental + in_memory + profiled + (num_threads > 1);
+    if (optind != argc - 1 || num_modes > 1) {
+        printf("%s", usage);
         return EXIT_FAILURE;
     }
 
-    io files = init(argv[1]);
+    if (object) {
+        if (pipelined || incremental || in_memory || profiled || num_threads > 1
+                || !strcmp(argv[optind], STREAM_PATH)) {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+        FILE *in = fopen(argv[optind], "r");
+        if (!in) {
+            perror("Failed to open input file");
+            return EXIT_FAILURE;
+        }
+        char *obj_path = replace_ext(argv[optind], OBJ_EXT);
+        FILE *out = fopen(obj_path, "wb");
+        free(obj_path);
+        if (!out) {
+            perror("Failed to open output file");
+            return EXIT_FAILURE;
+        }
+
+        size_t len = 0;
+        char *src = read_all(in, &len);
+        instr_list instrs;
+        instr_list_init(&instrs);
+        lex_program(src, len, &instrs);
+        write_object(&instrs, out);
+        instr_list_free(&instrs);
+        free(src);
+        fclose(in);
+        fclose(out);
+        return 0;
+    }
+
+    if (!strcmp(argv[optind], STREAM_PATH)) {
+        if (pipelined || incremental || in_memory || profiled || num_threads > 1) {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+        ht_hash_table *ht = constructor(4096);
+        assemble_stream(stdin, stdout, ht);
+        ht_delete(ht);
+        return 0;
+    }
+
+    io files = init(argv[optind]);
     FILE *in = files.in;
     FILE *out = files.out;
 
@@ -32,9 +183,94 @@ int main(int argc, char *argv[]) {
     // given the assembly syntax we're using
     ht_hash_table *ht = constructor(2 * (line_count / 3));
 
-    first_pass(in, ht);
-    fseek(in, 0, SEEK_SET);
-    second_pass(in, out, ht);
+    if (pipelined) {
+        stage_stats stats[NUM_STAGES];
+        first_pass(in, ht);
+        fseek(in, 0, SEEK_SET);
+        second_pass_pipelined(in, out, ht, stats);
+        print_stage_stats(stderr, stats);
+    } else if (in_memory) {
+        size_t len = 0;
+        char *src = read_all(in, &len);
+        instr_list instrs;
+        instr_list_init(&instrs);
+        lex_program(src, len, &instrs);
+        opt_stats stats;
+        if (optimize) {
+            optimize_program(&instrs, &stats);
+        }
+        resolve_program(&instrs, ht);
+        write_program(&instrs, out);
+        if (sym_form) {
+            char *sym_path = replace_ext(argv[optind], SYM_EXT);
+            FILE *sym_out = fopen(sym_path, "wb");
+            if (!sym_out) {
+                perror("Failed to open symbol file");
+                exit(EXIT_FAILURE);
+            }
+            write_sym_file(&instrs, sym_out, sym_form == 'S');
+            fclose(sym_out);
+            free(sym_path);
+        }
+        if (rom) {
+            char *rom_path = replace_ext(argv[optind], ROM_EXT);
+            FILE *rom_out = fopen(rom_path, "wb");
+            if (!rom_out) {
+                perror("Failed to open ROM image");
+                exit(EXIT_FAILURE);
+            }
+            write_rom(&instrs, rom_out, sym_form != 0);
+            fclose(rom_out);
+            free(rom_path);
+        }
+        if (optimize) {
+            print_opt_stats(stderr, &stats);
+        }
+        instr_list_free(&instrs);
+        free(src);
+    } else if (incremental) {
+        size_t len = 0;
+        char *src = read_all(in, &len);
+        char *file_out = hack_path(argv[optind]);
+        char *cache_path = malloc(strlen(file_out) + strlen(CACHE_EXT) + 1);
+        sprintf(cache_path, "%s%s", file_out, CACHE_EXT);
+        incr_stats stats;
+        assemble_incremental(src, len, out, ht, cache_path, &stats);
+        print_incr_stats(stderr, &stats);
+        free(cache_path);
+        free(file_out);
+        free(src);
+    } else if (num_threads > 1) {
+        size_t len = 0;
+        char *src = read_all(in, &len);
+        assemble_parallel(src, len, out, ht, num_threads);
+        free(src);
+    } else if (profiled) {
+        prof_stats stats;
+        profile_begin(&stats);
+        first_pass(in, ht);
+        profile_mark(PHASE_FIRST_PASS);
+        fseek(in, 0, SEEK_SET);
+
+        // second_pass() writes as it encodes, so it writes to memory here, and copying that to the
+        // output file is timed as a phase of its own
+        char *encoded = NULL;
+        size_t encoded_len = 0;
+        FILE *encoded_out = open_memstream(&encoded, &encoded_len);
+        second_pass(in, encoded_out, ht);
+        fclose(encoded_out);
+        profile_mark(PHASE_SECOND_PASS);
+        fwrite(encoded, sizeof(char), encoded_len, out);
+        fflush(out);
+        profile_mark(PHASE_OUTPUT);
+        free(encoded);
+        profile_end();
+        print_profile(stderr, &stats);
+    } else {
+        first_pass(in, ht);
+        fseek(in, 0, SEEK_SET);
+        second_pass(in, out, ht);
+    }
 
     fclose(in);
     fclose(out);
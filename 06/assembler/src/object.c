@@ -0,0 +1,226 @@
+/*
+ * Relocatable object format for the nand2tetris assembler and linker.
+ *
+ * An object file is one assembled piece of a program that hasn't been given its final addresses yet.
+ * It holds the machine code for every instruction, with a 0 in place of every `@symbol`, along with
+ * each label it defines and a relocation for each `@symbol` it uses. Labels are given as offsets from
+ * the start of the object, and are visible to every other object, so no two objects linked together
+ * may define the same label; relocations are resolved by name at link time, to a label in any object,
+ * a predefined symbol, or else a new variable.
+ *
+ * The linker turns the objects back into a single instruction list and resolves it just like a whole
+ * program, so linking objects in order gives exactly the same .hack file as assembling their sources
+ * concatenated in that order.
+ *
+ * The file is OBJ_MAGIC, then the int32 number of words, labels and relocations, then the words as
+ * uint16s, then each label and each relocation as an int32 offset followed by a uint16 length and the
+ * name. Labels and relocations are in offset order. Numbers are in the machine's byte order.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "lexer.h"
+#include "object.h"
+#include "parser.h"
+#include "../../../lib/hash_table.h"
+
+const char *OBJ_EXT = ".hobj";
+const char OBJ_MAGIC[8] = {'H', 'A', 'C', 'K', 'O', 'B', 'J', 1};
+
+static const uint16_t C_CMD_BIT = 0x8000;  // Set in every C_COMMAND, and in no A_COMMAND
+
+// A label or relocation in an object file
+typedef struct obj_symbol {
+    int32_t offset;
+    char *name;
+} obj_symbol;
+
+
+static void put_symbol(FILE *f, int32_t offset, const char *name) {
+    uint16_t len = strlen(name);
+    fwrite(&offset, sizeof(offset), 1, f);
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(name, sizeof(char), len, f);
+}
+
+/**
+ * Writes a lexed program out as an object file.
+ * @param instrs  the program, before its symbols have been resolved
+ * @param out     the file to write the object to
+ */
+void write_object(const instr_list *instrs, FILE *out) {
+    int32_t counts[3] = {0, 0, 0};
+    for (int i = 0; i < instrs->count; i++) {
+        const instruction *instr = &instrs->items[i];
+        counts[0] += instr->type != L_COMMAND;
+        counts[1] += instr->type == L_COMMAND;
+        counts[2] += instr->type == A_COMMAND && instr->symbol != NULL;
+    }
+    fwrite(OBJ_MAGIC, sizeof(char), sizeof(OBJ_MAGIC), out);
+    fwrite(counts, sizeof(int32_t), 3, out);
+
+    for (int i = 0; i < instrs->count; i++) {
+        const instruction *instr = &instrs->items[i];
+        if (instr->type != L_COMMAND) {
+            uint16_t word = instr->symbol != NULL ? 0 : instr->word;
+            fwrite(&word, sizeof(word), 1, out);
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        int32_t offset = 0;
+        for (int i = 0; i < instrs->count; i++) {
+            const instruction *instr = &instrs->items[i];
+            if (instr->type == L_COMMAND) {
+                if (pass == 0) put_symbol(out, offset, instr->symbol);
+                continue;
+            }
+            if (pass == 1 && instr->symbol != NULL) {
+                put_symbol(out, offset, instr->symbol);
+            }
+            offset++;
+        }
+    }
+}
+
+// Reads @n labels or relocations, and checks that they're in order and within the object
+static obj_symbol *read_symbols(FILE *f, int n, int num_words, int *ok) {
+    obj_symbol *syms = calloc(n + 1, sizeof(obj_symbol));
+    for (int i = 0; i < n && *ok; i++) {
+        uint16_t len;
+        if (fread(&syms[i].offset, sizeof(int32_t), 1, f) != 1 || fread(&len, sizeof(len), 1, f) != 1
+                || syms[i].offset < (i > 0 ? syms[i - 1].offset : 0) || syms[i].offset > num_words) {
+            *ok = 0;
+            break;
+        }
+        syms[i].name = malloc(len + 1);
+        *ok = fread(syms[i].name, sizeof(char), len, f) == len;
+        syms[i].name[len] = '\0';
+    }
+    return syms;
+}
+
+static void free_symbols(obj_symbol *syms, int n) {
+    for (int i = 0; i < n; i++) {
+        free(syms[i].name);
+    }
+    free(syms);
+}
+
+/**
+ * Reads an object file, and appends its instructions to a program. Labels become L_COMMANDs again,
+ * and relocations become symbolic A_COMMANDs, so the program can be resolved like any other.
+ *
+ * @param  path    the object file to read
+ * @param  instrs  the program to append the object's instructions to
+ * @return         0 on success, or -1 if the file couldn't be read or isn't a valid object file
+ */
+int read_object(const char *path, instr_list *instrs) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("Failed to open object file");
+        return -1;
+    }
+
+    char magic[sizeof(OBJ_MAGIC)];
+    int32_t counts[3];
+    int ok = fread(magic, sizeof(char), sizeof(magic), f) == sizeof(magic)
+        && !memcmp(magic, OBJ_MAGIC, sizeof(magic)) && fread(counts, sizeof(int32_t), 3, f) == 3
+        && counts[0] >= 0 && counts[1] >= 0 && counts[2] >= 0;
+
+    // Every word, label and relocation takes up some of the file, so a corrupt count can't be
+    // bigger than the file could hold, and is caught before anything is allocated for it
+    struct stat st;
+    if (ok) {
+        long long min_size = sizeof(OBJ_MAGIC) + 3 * sizeof(int32_t)
+            + (long long)counts[0] * sizeof(uint16_t)
+            + ((long long)counts[1] + counts[2]) * (sizeof(int32_t) + sizeof(uint16_t));
+        ok = !fstat(fileno(f), &st) && min_size <= (long long)st.st_size;
+    }
+    int num_words = ok ? counts[0] : 0;
+    int num_labels = ok ? counts[1] : 0;
+    int num_relocs = ok ? counts[2] : 0;
+
+    uint16_t *words = malloc((num_words + 1) * sizeof(uint16_t));
+    ok = ok && fread(words, sizeof(uint16_t), num_words, f) == (size_t)num_words;
+    obj_symbol *labels = read_symbols(f, num_labels, num_words, &ok);
+    obj_symbol *relocs = read_symbols(f, num_relocs, num_words - 1, &ok);
+    fclose(f);
+
+    int l = 0;
+    int r = 0;
+    for (int i = 0; ok && i <= num_words; i++) {
+        for (; l < num_labels && labels[l].offset == i; l++) {
+            instruction *instr = instr_list_push(instrs);
+            *instr = (instruction){L_COMMAND, 0, labels[l].name, 0};
+            labels[l].name = NULL;
+        }
+        if (i == num_words) {
+            break;
+        }
+
+        instruction *instr = instr_list_push(instrs);
+        if (r < num_relocs && relocs[r].offset == i) {
+            *instr = (instruction){A_COMMAND, 0, relocs[r].name, 0};
+            relocs[r++].name = NULL;
+        } else {
+            *instr = (instruction){words[i] & C_CMD_BIT ? C_COMMAND : A_COMMAND, words[i], NULL, 0};
+        }
+    }
+
+    // Two relocations for the same word would leave the second one unused
+    ok = ok && l == num_labels && r == num_relocs;
+    if (!ok) {
+        fprintf(stderr, "%s is not a valid object file\n", path);
+    }
+
+    free_symbols(labels, num_labels);
+    free_symbols(relocs, num_relocs);
+    free(words);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Reads every object file being linked, in order, and appends their instructions to a program.
+ * Labels are global, so a label defined more than once would silently take the address of its last
+ * definition; that's reported as an error instead.
+ *
+ * @param  paths   the object files to read
+ * @param  n       the number of object files
+ * @param  instrs  the program to append the objects' instructions to
+ * @return         0 on success, or -1 if an object couldn't be read or two of them define a label
+ */
+int read_objects(char **paths, int n, instr_list *instrs) {
+    ht_hash_table *defined = ht_new(64);
+    int ok = 1;
+    for (int i = 0; i < n && ok; i++) {
+        int start = instrs->count;
+        ok = !read_object(paths[i], instrs);
+        for (int j = start; ok && j < instrs->count; j++) {
+            const instruction *instr = &instrs->items[j];
+            if (instr->type != L_COMMAND) {
+                continue;
+            }
+            char *prev = ht_search(defined, instr->symbol);
+            if (prev != NULL) {
+                fprintf(stderr, "Label `%s` is defined in both %s and %s\n", instr->symbol,
+                    paths[atoi(prev)], paths[i]);
+                ok = 0;
+            } else {
+                char id_buf[16];
+                snprintf(id_buf, sizeof(id_buf), "%d", i);
+                ht_insert(defined, instr->symbol, id_buf);
+            }
+            free(prev);
+        }
+    }
+    ht_delete(defined);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,21 @@
+/*
+ * Header file for the relocatable object format for the nand2tetris assembler and linker.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _OBJECT_H
+#define _OBJECT_H
+
+#include <stdio.h>
+
+#include "lexer.h"
+
+extern const char *OBJ_EXT;        // The file extension to use for object files
+extern const char OBJ_MAGIC[8];    // The first bytes of an object file
+
+void write_object(const instr_list*, FILE*);
+int read_object(const char*, instr_list*);
+int read_objects(char**, int, instr_list*);
+
+#endif
@@ -0,0 +1,1094 @@
+/*
+ * Optimizer for the nand2tetris assembler.
+ *
+ * The optimizer runs over the lexed instruction list, after C_COMMANDs have been encoded but before any
+ * symbols have been resolved, so removing instructions just moves the labels after them. Each rule
+ * looks at a short window of instructions, and a label always ends the window for rules that
+ * depend on what the registers held beforehand, since code can be jumped to from anywhere. The
+ * rules are applied over and over until none of them can remove anything else.
+ *
+ * Value tracking is the exception to that: it follows what A and D hold along every path through
+ * the program, so it only forgets what it knows at a label that paths disagree on.
+ *
+ * Separately, a control-flow pass walks the program from its first instruction, and removes
+ * everything no path reaches, such as runtime helpers and library functions that are never called.
+ *
+ * Every rule but one only removes instructions. The exception applies the rewrites the
+ * superoptimizer found (see superopt.c), each of which replaces a short window of instructions with
+ * a shorter one that leaves A, D and RAM exactly the same.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alu.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "rewrite.h"
+#include "../../../lib/hash_table.h"
+
+const char *OPT_RULE_NAMES[] = {
+    "redundant A reload",
+    "dead A load",
+    "cancelling update",
+    "duplicate assignment",
+    "no-op computation",
+    "jump to next instruction",
+    "unreachable code",
+    "block layout",
+    "superoptimizer rewrite",
+    "known register value"
+};
+
+// The destination bits, which double as the registers a computation reads
+#define REG_M 1
+#define REG_D 2
+#define REG_A 4
+#define FIELD_MASK 0x7
+#define COMP_MASK 0x7F
+
+// The jump bits, which together make up every jump condition
+#define JUMP_GT 1
+#define JUMP_EQ 2
+#define JUMP_LT 4
+
+// The passes run_passes() can run
+#define PASS_PEEPHOLE 1
+#define PASS_UNREACHABLE 2
+#define PASS_LAYOUT 4
+
+#define NUM_CONSTANTS 3
+static const char *CONSTANTS[] = {"0", "1", "-1"};
+static const int CONSTANT_VALUES[] = {0, 1, -1};
+
+static int comp_reads[COMP_MASK + 1];  // The registers each computation reads
+static uint16_t increments[3];         // X=X+1 for X in M, D and A
+static uint16_t decrements[3];         // X=X-1 for X in M, D and A
+static int constants[NUM_CONSTANTS];   // The computation bits of each of CONSTANTS
+static int tables_built = 0;
+
+// The shapes of computation that value tracking can follow when an input isn't a constant
+typedef enum comp_form {
+    FORM_OTHER,  // Anything else, like !D or D&M, which is only known when its inputs are constants
+    FORM_COPY,   // X
+    FORM_STEP,   // X+1 or X-1
+    FORM_ADD,    // X+Y
+    FORM_SUB     // X-Y
+} comp_form;
+
+// The shape of each computation, and its operands as registers
+static struct {
+    comp_form form;
+    int x;
+    int y;
+    int step;
+} comp_forms[COMP_MASK + 1];
+
+// The superoptimizer's rewrites, best first, as text and then parsed
+static const char *REWRITE_TEXT[][2] = {
+#define REWRITE(target, replacement) {target, replacement},
+#include "rewrites.def"
+#undef REWRITE
+};
+#define NUM_REWRITES (int)(sizeof(REWRITE_TEXT) / sizeof(REWRITE_TEXT[0]))
+static rewrite_rule rewrites[NUM_REWRITES];
+
+
+static inline int dest_of(uint16_t word) {
+    return (word >> DEST_SHIFT) & FIELD_MASK;
+}
+
+static inline int jump_of(uint16_t word) {
+    return word & FIELD_MASK;
+}
+
+static inline int reads_of(uint16_t word) {
+    return comp_reads[(word >> COMP_SHIFT) & COMP_MASK];
+}
+
+// The register a char of a computation names, or 0 if it's not a register
+static inline int register_of(char c) {
+    return c == 'M' ? REG_M : c == 'D' ? REG_D : c == 'A' ? REG_A : 0;
+}
+
+static void build_tables(void) {
+    if (tables_built) {
+        return;
+    }
+
+    decoder_init();
+    for (int comp = 0; comp <= COMP_MASK; comp++) {
+        const char *text = decode_word(C_CMD_PREFIX | comp << COMP_SHIFT);
+        for (int i = 0; text != NULL && text[i] != '\0'; i++) {
+            comp_reads[comp] |= text[i] == 'M' ? REG_M : text[i] == 'D' ? REG_D : text[i] == 'A' ? REG_A : 0;
+        }
+
+        // Computations without a destination decode with a trailing ';'
+        size_t len = text != NULL ? strcspn(text, ";") : 0;
+        int x = len > 0 ? comp_reads[comp] & register_of(text[0]) : 0;
+        int y = len == 3 ? comp_reads[comp] & register_of(text[2]) : 0;
+        comp_forms[comp].x = x;
+        comp_forms[comp].y = y;
+        if (len == 1 && x) {
+            comp_forms[comp].form = FORM_COPY;
+        } else if (len == 3 && x && text[2] == '1' && (text[1] == '+' || text[1] == '-')) {
+            comp_forms[comp].form = FORM_STEP;
+            comp_forms[comp].step = text[1] == '+' ? 1 : -1;
+        } else if (len == 3 && x && y && text[1] == '+') {
+            comp_forms[comp].form = FORM_ADD;
+        } else if (len == 3 && x && y && text[1] == '-') {
+            comp_forms[comp].form = FORM_SUB;
+        }
+    }
+
+    const char *regs[] = {"M", "D", "A"};
+    const char *incs[] = {"M+1", "D+1", "A+1"};
+    const char *decs[] = {"M-1", "D-1", "A-1"};
+    for (int i = 0; i < 3; i++) {
+        increments[i] = encode_c_command(regs[i], incs[i], NULL);
+        decrements[i] = encode_c_command(regs[i], decs[i], NULL);
+    }
+    for (int i = 0; i < NUM_CONSTANTS; i++) {
+        constants[i] = (encode_c_command(NULL, CONSTANTS[i], NULL) >> COMP_SHIFT) & COMP_MASK;
+    }
+    for (int i = 0; i < NUM_REWRITES; i++) {
+        rewrites[i].target_len = parse_window(REWRITE_TEXT[i][0], rewrites[i].target);
+        rewrites[i].replacement_len = parse_window(REWRITE_TEXT[i][1], rewrites[i].replacement);
+        if (rewrites[i].target_len < 0 || rewrites[i].replacement_len < 0) {
+            fprintf(stderr, "Invalid rewrite `%s` -> `%s`\n", REWRITE_TEXT[i][0], REWRITE_TEXT[i][1]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    tables_built = 1;
+}
+
+/**
+ * Counts the instructions in a program that take up ROM, i.e. everything but labels.
+ * @param  instrs  The program.
+ * @return         The number of ROM instructions.
+ */
+int count_rom(const instr_list *instrs) {
+    int n = 0;
+    for (int i = 0; i < instrs->count; i++) {
+        n += instrs->items[i].type != L_COMMAND;
+    }
+    return n;
+}
+
+// Checks whether two A_COMMANDs load the same value
+static int same_load(const instruction *a, const instruction *b) {
+    if (a->symbol != NULL || b->symbol != NULL) {
+        return a->symbol != NULL && b->symbol != NULL && !strcmp(a->symbol, b->symbol);
+    }
+    return a->word == b->word;
+}
+
+// Marks instruction @i to be removed, and charges it to @rule
+static void drop(char *dead, int i, opt_stats *stats, opt_rule rule) {
+    dead[i] = 1;
+    stats->removed[rule]++;
+}
+
+/**
+ * Removes A_COMMANDs that load A with the value it already holds. That's either a plain `@X` while
+ * A still holds X, or an `@X` followed by an A-only computation like `A=M-1` that's already been
+ * done, as long as nothing has written to memory since.
+ */
+static void rule_a_reload(instr_list *instrs, char *dead, opt_stats *stats) {
+    enum { UNKNOWN, LOADED, DERIVED } state = UNKNOWN;
+    const instruction *load = NULL;  // The A_COMMAND A was last loaded by
+    uint16_t derive = 0;             // The computation A was derived from @load with, if DERIVED
+
+    for (int i = 0; i < instrs->count; i++) {
+        instruction *instr = &instrs->items[i];
+        if (instr->type == L_COMMAND) {
+            state = UNKNOWN;
+        } else if (instr->type == A_COMMAND) {
+            int j = i + 1;
+            if (state == LOADED && same_load(instr, load)) {
+                drop(dead, i, stats, RULE_A_RELOAD);
+            } else if (state == DERIVED && same_load(instr, load) && j < instrs->count
+                    && instrs->items[j].type == C_COMMAND && instrs->items[j].word == derive) {
+                drop(dead, i, stats, RULE_A_RELOAD);
+                drop(dead, j, stats, RULE_A_RELOAD);
+                i = j;
+            } else {
+                state = LOADED;
+                load = instr;
+            }
+        } else {
+            int dest = dest_of(instr->word);
+            if (state == LOADED && dest == REG_A && !jump_of(instr->word)
+                    && !(reads_of(instr->word) & REG_D)) {
+                state = DERIVED;
+                derive = instr->word;
+            } else if ((dest & REG_A) || (state == DERIVED && (dest & REG_M))) {
+                state = UNKNOWN;
+            }
+        }
+    }
+}
+
+/**
+ * Removes A_COMMANDs whose value is overwritten by another A_COMMAND before anything uses it. Labels
+ * in between don't matter, since the second load happens no matter how it's reached.
+ */
+static void rule_dead_a_load(instr_list *instrs, char *dead, opt_stats *stats) {
+    for (int i = 0; i < instrs->count; i++) {
+        if (instrs->items[i].type != A_COMMAND) {
+            continue;
+        }
+        int j = i + 1;
+        while (j < instrs->count && instrs->items[j].type == L_COMMAND) {
+            j++;
+        }
+        if (j < instrs->count && instrs->items[j].type == A_COMMAND) {
+            drop(dead, i, stats, RULE_DEAD_A_LOAD);
+        }
+    }
+}
+
+/**
+ * Removes pairs like `M=M+1` followed by `M=M-1`, which leave everything as it was.
+ */
+static void rule_cancelling(instr_list *instrs, char *dead, opt_stats *stats) {
+    for (int i = 0; i + 1 < instrs->count; i++) {
+        const instruction *a = &instrs->items[i];
+        const instruction *b = &instrs->items[i + 1];
+        if (a->type != C_COMMAND || b->type != C_COMMAND) {
+            continue;
+        }
+        for (int r = 0; r < 3; r++) {
+            if ((a->word == increments[r] && b->word == decrements[r])
+                    || (a->word == decrements[r] && b->word == increments[r])) {
+                drop(dead, i, stats, RULE_CANCELLING);
+                drop(dead, i + 1, stats, RULE_CANCELLING);
+                i++;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Removes the second of two identical assignments in a row, when the first couldn't have changed
+ * anything the second reads. An assignment to A that also reads or writes M is never a duplicate,
+ * since the first one changes which address M is.
+ */
+static void rule_duplicate(instr_list *instrs, char *dead, opt_stats *stats) {
+    for (int i = 0; i + 1 < instrs->count; i++) {
+        const instruction *a = &instrs->items[i];
+        const instruction *b = &instrs->items[i + 1];
+        if (a->type != C_COMMAND || b->type != C_COMMAND || a->word != b->word || jump_of(a->word)) {
+            continue;
+        }
+
+        int dest = dest_of(a->word);
+        int reads = reads_of(a->word);
+        if (dest & reads) {
+            continue;
+        }
+        if ((dest & REG_A) && ((dest & REG_M) || (reads & REG_M))) {
+            continue;
+        }
+        drop(dead, i + 1, stats, RULE_DUPLICATE);
+    }
+}
+
+/**
+ * Removes computations that are neither stored anywhere nor jumped on.
+ */
+static void rule_noop(instr_list *instrs, char *dead, opt_stats *stats) {
+    for (int i = 0; i < instrs->count; i++) {
+        const instruction *instr = &instrs->items[i];
+        if (instr->type == C_COMMAND && !dest_of(instr->word) && !jump_of(instr->word)) {
+            drop(dead, i, stats, RULE_NOOP);
+        }
+    }
+}
+
+/**
+ * Removes `@L` followed by a jump that doesn't store anything, when (L) is the very next
+ * instruction. The `@L` itself is only removed if the code after (L) loads A before using it, since
+ * otherwise that code could depend on A holding L. What's removed is charged to @rule.
+ */
+static void remove_jumps_next(instr_list *instrs, char *dead, opt_stats *stats, opt_rule rule) {
+    for (int i = 0; i + 2 < instrs->count; i++) {
+        const instruction *load = &instrs->items[i];
+        const instruction *jump = &instrs->items[i + 1];
+        if (load->type != A_COMMAND || load->symbol == NULL || jump->type != C_COMMAND
+                || !jump_of(jump->word) || dest_of(jump->word)) {
+            continue;
+        }
+
+        int target = 0;
+        int j = i + 2;
+        for (; j < instrs->count && instrs->items[j].type == L_COMMAND; j++) {
+            target |= !strcmp(instrs->items[j].symbol, load->symbol);
+        }
+        if (!target) {
+            continue;
+        }
+
+        drop(dead, i + 1, stats, rule);
+        if (j < instrs->count && instrs->items[j].type == A_COMMAND) {
+            drop(dead, i, stats, rule);
+        }
+        i++;
+    }
+}
+
+static void rule_jump_next(instr_list *instrs, char *dead, opt_stats *stats) {
+    remove_jumps_next(instrs, dead, stats, RULE_JUMP_NEXT);
+}
+
+// Checks whether a program jumps to a hard-coded ROM address, which removing instructions would break
+static int jumps_to_numeric(const instr_list *instrs) {
+    for (int i = 1; i < instrs->count; i++) {
+        const instruction *prev = &instrs->items[i - 1];
+        const instruction *instr = &instrs->items[i];
+        if (instr->type == C_COMMAND && jump_of(instr->word) && prev->type == A_COMMAND
+                && prev->symbol == NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Applies the superoptimizer's rewrites. Where a window of instructions matches a rewrite's target,
+ * its first instructions become the replacement, and the rest are removed. A window never spans a
+ * label or a jump, and the rewrites don't depend on what the registers held beforehand.
+ */
+static void rule_superopt(instr_list *instrs, char *dead, opt_stats *stats) {
+    const instruction *window[MAX_REWRITE_LEN];
+    const instruction *slots[MAX_REWRITE_SLOTS];
+    uint16_t tokens[MAX_REWRITE_LEN];
+    instruction replacement[MAX_REWRITE_LEN];
+
+    for (int i = 0; i < instrs->count; i++) {
+        int n = 0;
+        while (n < MAX_REWRITE_LEN && i + n < instrs->count) {
+            window[n] = &instrs->items[i + n];
+            n++;
+        }
+        n = window_tokens(window, n, tokens, slots);
+
+        const rewrite_rule *rule = NULL;
+        for (int r = 0; r < NUM_REWRITES && rule == NULL; r++) {
+            if (rewrites[r].target_len <= n
+                    && !memcmp(rewrites[r].target, tokens, rewrites[r].target_len * sizeof(uint16_t))) {
+                rule = &rewrites[r];
+            }
+        }
+        if (rule == NULL) {
+            continue;
+        }
+
+        // Build the replacement before overwriting anything, since the slots point into the window
+        for (int k = 0; k < rule->replacement_len; k++) {
+            uint16_t token = rule->replacement[k];
+            if (token < MAX_REWRITE_SLOTS) {
+                replacement[k] = *slots[token];
+                if (replacement[k].symbol != NULL) {
+                    replacement[k].symbol = strdup(replacement[k].symbol);
+                }
+            } else {
+                replacement[k].type = C_COMMAND;
+                replacement[k].word = token;
+                replacement[k].symbol = NULL;
+            }
+            replacement[k].line = instrs->items[i + k].line;
+        }
+        for (int k = 0; k < rule->target_len; k++) {
+            if (k < rule->replacement_len) {
+                free(instrs->items[i + k].symbol);
+                instrs->items[i + k] = replacement[k];
+            } else {
+                drop(dead, i + k, stats, RULE_SUPEROPT);
+            }
+        }
+        i += rule->target_len - 1;
+    }
+}
+
+// Drops every instruction marked dead, and reports whether there were any
+static int compact(instr_list *instrs, char *dead) {
+    int n = 0;
+    for (int i = 0; i < instrs->count; i++) {
+        if (dead[i]) {
+            free(instrs->items[i].symbol);
+        } else {
+            instrs->items[n++] = instrs->items[i];
+        }
+    }
+
+    int changed = n != instrs->count;
+    memset(dead, 0, instrs->count);
+    instrs->count = n;
+    return changed;
+}
+
+/**
+ * Checks whether a jump is always taken, or never taken. Only a jump on a constant can be either.
+ * @return  1 if the jump is always taken, -1 if it's never taken, or 0 if it depends on the data.
+ */
+static int jump_certainty(uint16_t word) {
+    int jump = jump_of(word);
+    if (jump == FIELD_MASK) {
+        return 1;
+    }
+
+    for (int i = 0; i < NUM_CONSTANTS; i++) {
+        if (((word >> COMP_SHIFT) & COMP_MASK) == constants[i]) {
+            int value = CONSTANT_VALUES[i];
+            int taken = ((jump & JUMP_LT) && value < 0) || ((jump & JUMP_EQ) && value == 0)
+                || ((jump & JUMP_GT) && value > 0);
+            return taken ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+// Checks whether an instruction is a jump that's always taken, so nothing falls through past it
+static int always_jumps(const instruction *instr) {
+    return instr->type == C_COMMAND && jump_of(instr->word) && jump_certainty(instr->word) > 0;
+}
+
+/**
+ * Marks every instruction that's reachable from the start of the program. A jump whose target was
+ * loaded right before it goes to that label; any other jump, like the `A=M` / `0;JMP` that returns
+ * from a function, is treated as able to reach every label whose address is loaded by reachable code
+ * for any reason other than jumping to it.
+ *
+ * @param instrs     the program
+ * @param reachable  set to 1 for every reachable instruction
+ */
+static void mark_reachable(const instr_list *instrs, char *reachable) {
+    // Maps each label to the index of its L_COMMAND
+    ht_hash_table *labels = ht_new(instrs->count + 1);
+    for (int i = 0; i < instrs->count; i++) {
+        if (instrs->items[i].type == L_COMMAND) {
+            char id_buf[16];
+            snprintf(id_buf, sizeof(id_buf), "%d", i);
+            ht_insert(labels, instrs->items[i].symbol, id_buf);
+        }
+    }
+
+    // Each label whose address is loaded as data goes into taken once, and is pushed once the first
+    // indirect jump is reached
+    int *stack = malloc((2 * instrs->count + 1) * sizeof(int));
+    int num_stack = 0;
+    int *taken = malloc((instrs->count + 1) * sizeof(int));
+    int num_taken = 0;
+    char *pushed = calloc(instrs->count + 1, sizeof(char));
+    int indirect = 0;  // Set once a reachable jump has an unknown target
+
+    stack[num_stack++] = 0;
+    while (num_stack > 0) {
+        for (int i = stack[--num_stack]; i < instrs->count && !reachable[i]; i++) {
+            reachable[i] = 1;
+            const instruction *instr = &instrs->items[i];
+
+            if (instr->type == A_COMMAND && instr->symbol != NULL) {
+                int jumps_next = i + 1 < instrs->count && instrs->items[i + 1].type == C_COMMAND
+                    && jump_of(instrs->items[i + 1].word);
+                char *id_str = ht_search(labels, instr->symbol);
+                if (id_str != NULL && !jumps_next) {
+                    int label = atoi(id_str);
+                    if (!pushed[label]) {
+                        pushed[label] = 1;
+                        taken[num_taken++] = label;
+                        if (indirect) stack[num_stack++] = label;
+                    }
+                }
+                free(id_str);
+            } else if (instr->type == C_COMMAND && jump_of(instr->word)) {
+                int certainty = jump_certainty(instr->word);
+                const instruction *prev = i > 0 ? &instrs->items[i - 1] : NULL;
+                char *id_str = NULL;
+                if (prev != NULL && prev->type == A_COMMAND && prev->symbol != NULL) {
+                    id_str = ht_search(labels, prev->symbol);
+                }
+
+                if (certainty < 0) {
+                    // Never taken, so this is just a computation
+                } else if (id_str != NULL) {
+                    stack[num_stack++] = atoi(id_str);
+                } else if (!indirect) {
+                    indirect = 1;
+                    for (int j = 0; j < num_taken; j++) {
+                        stack[num_stack++] = taken[j];
+                    }
+                }
+                free(id_str);
+
+                if (certainty > 0) {
+                    break;
+                }
+            }
+        }
+    }
+
+    free(pushed);
+    free(taken);
+    free(stack);
+    ht_delete(labels);
+}
+
+// Removes every instruction no path reaches, and reports whether there were any. Labels are kept.
+static int run_unreachable(instr_list *instrs, char *dead, opt_stats *stats) {
+    char *reachable = calloc(instrs->count + 1, sizeof(char));
+    mark_reachable(instrs, reachable);
+    for (int i = 0; i < instrs->count; i++) {
+        if (!reachable[i] && instrs->items[i].type != L_COMMAND) {
+            drop(dead, i, stats, RULE_UNREACHABLE);
+        }
+    }
+    free(reachable);
+    return compact(instrs, dead);
+}
+
+// What value tracking knows about the value in a register
+typedef enum value_kind {
+    VALUE_UNKNOWN,
+    VALUE_ADDRESS,   // @symbol + offset, or just offset if there's no symbol
+    VALUE_CONTENTS   // The RAM word at @symbol + base, plus offset
+} value_kind;
+
+typedef struct known_value {
+    value_kind kind;
+    const char *symbol;  // The symbol the value is based on, or NULL for a plain number
+    uint16_t base;       // For VALUE_CONTENTS, the offset from @symbol of the RAM word
+    uint16_t offset;     // What's added to the address, or to the RAM word's contents
+} known_value;
+
+// What value tracking knows about A and D at some point in the program
+typedef struct reg_state {
+    int reached;  // Whether any path has reached this point yet
+    known_value a;
+    known_value d;
+} reg_state;
+
+static const known_value UNKNOWN_VALUE = {VALUE_UNKNOWN, NULL, 0, 0};
+
+static int same_symbol(const char *a, const char *b) {
+    return a == b || (a != NULL && b != NULL && !strcmp(a, b));
+}
+
+static int same_value(const known_value *a, const known_value *b) {
+    return a->kind != VALUE_UNKNOWN && a->kind == b->kind && same_symbol(a->symbol, b->symbol)
+        && a->offset == b->offset && (a->kind != VALUE_CONTENTS || a->base == b->base);
+}
+
+static inline int is_constant(const known_value *v) {
+    return v->kind == VALUE_ADDRESS && v->symbol == NULL;
+}
+
+// Checks whether two addresses are the same RAM word, given that they share a symbol
+static inline int same_word(uint16_t a, uint16_t b) {
+    return !((a - b) & ADDRESS_MASK);
+}
+
+// The value an A_COMMAND loads
+static known_value load_value(const instruction *instr) {
+    known_value v = {VALUE_ADDRESS, instr->symbol, 0, instr->symbol == NULL ? instr->word : 0};
+    return v;
+}
+
+// Adds a constant to a value, if that's something value tracking can follow
+static known_value add_offset(known_value v, uint16_t offset) {
+    v.offset += offset;
+    return v;
+}
+
+/**
+ * Works out what a computation produces from what's known about its inputs. It's only known if its
+ * inputs are all constants, or if it adds a constant to one known value.
+ */
+static known_value eval_known(uint16_t word, const reg_state *s, const known_value *m) {
+    int comp = (word >> COMP_SHIFT) & COMP_MASK;
+    int reads = comp_reads[comp];
+    const known_value *regs[REG_A + 1] = {NULL};
+    regs[REG_A] = &s->a;
+    regs[REG_D] = &s->d;
+    regs[REG_M] = m;
+
+    int all_constant = 1;
+    for (int r = REG_M; r <= REG_A; r <<= 1) {
+        if ((reads & r) && !is_constant(regs[r])) all_constant = 0;
+    }
+    if (all_constant) {
+        uint16_t value = c_command_result(word, s->a.offset, s->d.offset, m->offset);
+        known_value v = {VALUE_ADDRESS, NULL, 0, value};
+        return v;
+    }
+
+    const known_value *x = comp_forms[comp].x ? regs[comp_forms[comp].x] : NULL;
+    const known_value *y = comp_forms[comp].y ? regs[comp_forms[comp].y] : NULL;
+    switch (comp_forms[comp].form) {
+        case FORM_COPY:
+            return *x;
+        case FORM_STEP:
+            return x->kind != VALUE_UNKNOWN ? add_offset(*x, comp_forms[comp].step) : UNKNOWN_VALUE;
+        case FORM_ADD:
+            if (is_constant(y) && x->kind != VALUE_UNKNOWN) return add_offset(*x, y->offset);
+            if (is_constant(x) && y->kind != VALUE_UNKNOWN) return add_offset(*y, x->offset);
+            return UNKNOWN_VALUE;
+        case FORM_SUB:
+            if (is_constant(y) && x->kind != VALUE_UNKNOWN) return add_offset(*x, -y->offset);
+            return UNKNOWN_VALUE;
+        default:
+            return UNKNOWN_VALUE;
+    }
+}
+
+/**
+ * Updates a value after a store to RAM. Values read from the word that was written follow it if the
+ * store added a constant to it, like `M=M+1`; values read from a word that might be the same one are
+ * forgotten.
+ *
+ * @param v       the value to update
+ * @param addr    where the store went
+ * @param stored  the value that was stored, in terms of RAM before the store
+ */
+static void after_store(known_value *v, const known_value *addr, const known_value *stored) {
+    if (v->kind != VALUE_CONTENTS) {
+        return;
+    }
+    if (addr->kind != VALUE_ADDRESS || !same_symbol(addr->symbol, v->symbol)) {
+        *v = UNKNOWN_VALUE;
+    } else if (same_word(addr->offset, v->base)) {
+        if (stored->kind == VALUE_CONTENTS && same_symbol(stored->symbol, v->symbol)
+                && stored->base == v->base) {
+            v->offset -= stored->offset;
+        } else {
+            *v = UNKNOWN_VALUE;
+        }
+    }
+}
+
+/**
+ * Checks whether an address might be memory-mapped I/O rather than RAM. The keyboard word changes
+ * without the program writing to it, so nothing read from it, or from anything at or past SCREEN,
+ * can be treated as known.
+ */
+static int io_address(const known_value *addr) {
+    if (addr->symbol != NULL) {
+        return !strcmp(addr->symbol, "SCREEN") || !strcmp(addr->symbol, "KBD");
+    }
+    return (addr->offset & ADDRESS_MASK) >= IO_BASE;
+}
+
+// Runs one instruction over what's known about A and D
+static void step_known(reg_state *s, const instruction *instr) {
+    if (instr->type == A_COMMAND) {
+        s->a = load_value(instr);
+        return;
+    }
+
+    known_value m = UNKNOWN_VALUE;
+    if (s->a.kind == VALUE_ADDRESS && !io_address(&s->a)) {
+        m.kind = VALUE_CONTENTS;
+        m.symbol = s->a.symbol;
+        m.base = s->a.offset;
+    }
+    known_value result = eval_known(instr->word, s, &m);
+
+    int dest = dest_of(instr->word);
+    if (dest & REG_M) {
+        known_value addr = s->a;
+        known_value stored = result;
+        after_store(&s->a, &addr, &stored);
+        after_store(&s->d, &addr, &stored);
+        after_store(&result, &addr, &stored);
+    }
+    if (dest & REG_D) s->d = result;
+    if (dest & REG_A) s->a = result;
+}
+
+// Merges what's known along another path into a label's state, and reports whether it changed
+static int meet_state(reg_state *into, const reg_state *from) {
+    if (!from->reached) {
+        return 0;
+    }
+    if (!into->reached) {
+        *into = *from;
+        return 1;
+    }
+    int changed = 0;
+    if (into->a.kind != VALUE_UNKNOWN && !same_value(&into->a, &from->a)) {
+        into->a = UNKNOWN_VALUE;
+        changed = 1;
+    }
+    if (into->d.kind != VALUE_UNKNOWN && !same_value(&into->d, &from->d)) {
+        into->d = UNKNOWN_VALUE;
+        changed = 1;
+    }
+    return changed;
+}
+
+/**
+ * Walks the program once, tracking what A and D hold. A label's state is what's known on every path
+ * into it: falling through, and every jump whose target is known to be that label. A label whose
+ * address is loaded for any reason other than jumping straight to it could be reached from anywhere,
+ * so nothing is known there.
+ *
+ * @param  at_label  the state at each label, merged with what this walk finds
+ * @param  escaped   set for each label whose address is loaded as data
+ * @param  labels    maps each label to the index of its L_COMMAND
+ * @param  dead      if not NULL, loads of values already held are marked dead and charged to stats
+ * @return           whether any label's state changed
+ */
+static int walk_known(instr_list *instrs, reg_state *at_label, const char *escaped,
+        ht_hash_table *labels, char *dead, opt_stats *stats) {
+    reg_state s = {1, UNKNOWN_VALUE, UNKNOWN_VALUE};
+    int changed = 0;
+    for (int i = 0; i < instrs->count; i++) {
+        instruction *instr = &instrs->items[i];
+        if (instr->type == L_COMMAND) {
+            if (escaped[i]) {
+                s.reached = 1;
+                s.a = s.d = UNKNOWN_VALUE;
+            } else {
+                meet_state(&at_label[i], &s);
+                s = at_label[i];
+            }
+            continue;
+        }
+        if (!s.reached) {
+            // Code no path falls into or jumps to
+            s.reached = 1;
+            s.a = s.d = UNKNOWN_VALUE;
+        }
+
+        if (dead != NULL && instr->type == A_COMMAND) {
+            known_value v = load_value(instr);
+            const instruction *next = i + 1 < instrs->count ? &instrs->items[i + 1] : NULL;
+            if (same_value(&v, &s.a)) {
+                drop(dead, i, stats, RULE_KNOWN_VALUE);
+                continue;
+            }
+            // An `@X` and an A-only computation that leave A as it was, like `@SP` / `A=M-1`
+            if (next != NULL && next->type == C_COMMAND && dest_of(next->word) == REG_A
+                    && !jump_of(next->word)) {
+                reg_state t = s;
+                step_known(&t, instr);
+                step_known(&t, next);
+                if (same_value(&t.a, &s.a)) {
+                    drop(dead, i, stats, RULE_KNOWN_VALUE);
+                    drop(dead, i + 1, stats, RULE_KNOWN_VALUE);
+                    i++;
+                    continue;
+                }
+            }
+        } else if (dead != NULL && !jump_of(instr->word)
+                && (dest_of(instr->word) == REG_A || dest_of(instr->word) == REG_D)) {
+            reg_state t = s;
+            step_known(&t, instr);
+            if (same_value(&t.a, &s.a) && same_value(&t.d, &s.d)) {
+                drop(dead, i, stats, RULE_KNOWN_VALUE);
+                continue;
+            }
+        }
+
+        known_value target = s.a;
+        step_known(&s, instr);
+        if (instr->type != C_COMMAND || !jump_of(instr->word) || jump_certainty(instr->word) < 0) {
+            continue;
+        }
+
+        // The jump goes wherever A pointed before the instruction ran
+        if (target.kind == VALUE_ADDRESS && target.symbol != NULL && target.offset == 0) {
+            char *id_str = ht_search(labels, target.symbol);
+            if (id_str != NULL) {
+                changed |= meet_state(&at_label[atoi(id_str)], &s);
+            }
+            free(id_str);
+        }
+        if (jump_certainty(instr->word) > 0) {
+            s.reached = 0;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Removes loads of values a register is already known to hold, by tracking what A and D hold across
+ * the whole program. A value is a number, the address of a symbol plus a constant, or the word in
+ * RAM at such an address plus a constant, which stays known until something might write to that
+ * word. Unlike rule_a_reload, this follows jumps to labels, so it can see through a label that's only
+ * ever reached from places that agree on what the registers hold.
+ */
+static void rule_known_value(instr_list *instrs, char *dead, opt_stats *stats) {
+    ht_hash_table *labels = ht_new(instrs->count + 1);
+    for (int i = 0; i < instrs->count; i++) {
+        if (instrs->items[i].type == L_COMMAND) {
+            char id_buf[16];
+            snprintf(id_buf, sizeof(id_buf), "%d", i);
+            ht_insert(labels, instrs->items[i].symbol, id_buf);
+        }
+    }
+
+    // The same test mark_reachable() uses for whether a label's address is loaded as data
+    char *escaped = calloc(instrs->count + 1, sizeof(char));
+    for (int i = 0; i < instrs->count; i++) {
+        const instruction *instr = &instrs->items[i];
+        int jumps_next = i + 1 < instrs->count && instrs->items[i + 1].type == C_COMMAND
+            && jump_of(instrs->items[i + 1].word);
+        if (instr->type == A_COMMAND && instr->symbol != NULL && !jumps_next) {
+            char *id_str = ht_search(labels, instr->symbol);
+            if (id_str != NULL) {
+                escaped[atoi(id_str)] = 1;
+            }
+            free(id_str);
+        }
+    }
+
+    // Walk until every label's state has settled, and only then remove anything
+    reg_state *at_label = calloc(instrs->count + 1, sizeof(reg_state));
+    while (walk_known(instrs, at_label, escaped, labels, NULL, stats)) {
+    }
+    walk_known(instrs, at_label, escaped, labels, dead, stats);
+
+    free(at_label);
+    free(escaped);
+    ht_delete(labels);
+}
+
+/**
+ * Orders a program's chains of basic blocks so that as many unconditional jumps as possible go to
+ * the very next instruction. A chain is a run of instructions that can only be left by an
+ * unconditional jump at its end, so it has to stay in one piece: everything inside it falls through
+ * to what comes next.
+ *
+ * Starting from the chain holding the entry point, which stays first, each chain is followed by the
+ * chain its closing `@L` / `0;JMP` jumps to, if that chain starts with (L) and hasn't been placed yet.
+ * Otherwise the next chain in the original order comes next. A final chain that runs off the end of
+ * the program instead of jumping stays last. Labels move along with their code, and are only given
+ * addresses afterwards, so the targets of computed jumps still resolve.
+ *
+ * @param  instrs  the program to reorder
+ * @return         whether the order changed
+ */
+static int order_chains(instr_list *instrs) {
+    int n = instrs->count;
+    int *starts = malloc((n + 2) * sizeof(int));  // Where each chain starts, then n
+    int num_chains = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || always_jumps(&instrs->items[i - 1])) {
+            starts[num_chains++] = i;
+        }
+    }
+    starts[num_chains] = n;
+
+    // Map each label at the start of a chain to its chain
+    ht_hash_table *heads = ht_new(n + 1);
+    for (int c = 0; c < num_chains; c++) {
+        for (int i = starts[c]; i < starts[c + 1] && instrs->items[i].type == L_COMMAND; i++) {
+            char id_buf[16];
+            snprintf(id_buf, sizeof(id_buf), "%d", c);
+            ht_insert(heads, instrs->items[i].symbol, id_buf);
+        }
+    }
+
+    // The chain each chain jumps straight to at its end, or -1
+    int *next = malloc((num_chains + 1) * sizeof(int));
+    for (int c = 0; c < num_chains; c++) {
+        next[c] = -1;
+        int last = starts[c + 1] - 1;
+        const instruction *load = last > starts[c] ? &instrs->items[last - 1] : NULL;
+        if (load != NULL && load->type == A_COMMAND && load->symbol != NULL
+                && instrs->items[last].type == C_COMMAND && jump_of(instrs->items[last].word)) {
+            char *id_str = ht_search(heads, load->symbol);
+            if (id_str != NULL) {
+                next[c] = atoi(id_str);
+            }
+            free(id_str);
+        }
+    }
+    ht_delete(heads);
+
+    int pinned = always_jumps(&instrs->items[n - 1]) ? -1 : num_chains - 1;
+    char *placed = calloc(num_chains + 1, sizeof(char));
+    int *order = malloc((num_chains + 1) * sizeof(int));
+    int num_placed = 0;
+    int first_unplaced = 1;
+    int cur = 0;
+    while (cur >= 0) {
+        placed[cur] = 1;
+        order[num_placed++] = cur;
+
+        int following = next[cur];
+        if (following <= 0 || placed[following] || following == pinned) {
+            while (first_unplaced < num_chains && (placed[first_unplaced] || first_unplaced == pinned)) {
+                first_unplaced++;
+            }
+            following = first_unplaced < num_chains ? first_unplaced : -1;
+        }
+        cur = following;
+    }
+    if (pinned > 0) {
+        order[num_placed++] = pinned;
+    }
+
+    int changed = 0;
+    for (int c = 0; c < num_chains; c++) {
+        changed |= order[c] != c;
+    }
+    if (changed) {
+        instruction *items = malloc((n + 1) * sizeof(instruction));
+        int k = 0;
+        for (int c = 0; c < num_chains; c++) {
+            for (int i = starts[order[c]]; i < starts[order[c] + 1]; i++) {
+                items[k++] = instrs->items[i];
+            }
+        }
+        memcpy(instrs->items, items, n * sizeof(instruction));
+        free(items);
+    }
+
+    free(order);
+    free(placed);
+    free(next);
+    free(starts);
+    return changed;
+}
+
+// Reorders the program's blocks, and removes the jumps that now go to the next instruction
+static int run_layout(instr_list *instrs, char *dead, opt_stats *stats) {
+    if (instrs->count == 0 || !order_chains(instrs)) {
+        return 0;
+    }
+    remove_jumps_next(instrs, dead, stats, RULE_BLOCK_LAYOUT);
+    return compact(instrs, dead);
+}
+
+// Counts the instructions in a program that can jump
+static int count_jumps(const instr_list *instrs) {
+    int n = 0;
+    for (int i = 0; i < instrs->count; i++) {
+        n += instrs->items[i].type == C_COMMAND && jump_of(instrs->items[i].word);
+    }
+    return n;
+}
+
+// Runs every peephole rule once, and reports whether any of them removed anything
+static int run_peephole(instr_list *instrs, char *dead, opt_stats *stats) {
+    void (*rules[])(instr_list*, char*, opt_stats*) = {
+        rule_a_reload, rule_dead_a_load, rule_cancelling, rule_duplicate, rule_noop, rule_jump_next,
+        rule_known_value, rule_superopt
+    };
+
+    int changed = 0;
+    for (unsigned int r = 0; r < sizeof(rules) / sizeof(rules[0]); r++) {
+        rules[r](instrs, dead, stats);
+        changed |= compact(instrs, dead);
+    }
+    return changed;
+}
+
+/**
+ * Runs some combination of the peephole rules, unreachable-code elimination and block layout over a
+ * program, until none of them can remove anything else. Programs that jump to hard-coded ROM
+ * addresses are left alone.
+ *
+ * @param passes  some combination of PASS_PEEPHOLE, PASS_UNREACHABLE and PASS_LAYOUT
+ */
+static void run_passes(instr_list *instrs, opt_stats *stats, int passes) {
+    memset(stats, 0, sizeof(opt_stats));
+    stats->before = count_rom(instrs);
+    stats->after = stats->before;
+    stats->jumps_before = count_jumps(instrs);
+    stats->jumps_after = stats->jumps_before;
+    if (jumps_to_numeric(instrs)) {
+        stats->skipped = 1;
+        return;
+    }
+
+    build_tables();
+    char *dead = calloc(instrs->count + 1, sizeof(char));
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        if (passes & PASS_UNREACHABLE) changed |= run_unreachable(instrs, dead, stats);
+        if (passes & PASS_PEEPHOLE) changed |= run_peephole(instrs, dead, stats);
+        // Lay the blocks out once everything else is done, so there's as little left to move around
+        if (!changed && (passes & PASS_LAYOUT)) changed |= run_layout(instrs, dead, stats);
+    }
+    free(dead);
+
+    stats->after = count_rom(instrs);
+    stats->jumps_after = count_jumps(instrs);
+}
+
+/**
+ * Runs the peephole rules over a program, until none of them can remove anything else. Programs that
+ * jump to hard-coded ROM addresses are left alone.
+ *
+ * @param instrs  the program to optimize, before its symbols have been resolved
+ * @param stats   filled in with how many instructions each rule removed
+ */
+void peephole(instr_list *instrs, opt_stats *stats) {
+    run_passes(instrs, stats, PASS_PEEPHOLE);
+}
+
+/**
+ * Removes every instruction that can't be reached from the start of the program. Labels are kept,
+ * so that any address loaded as data still resolves. Programs that jump to hard-coded ROM addresses
+ * are left alone.
+ *
+ * @param instrs  the program to optimize, before its symbols have been resolved
+ * @param stats   filled in with how many instructions were removed
+ */
+void eliminate_unreachable(instr_list *instrs, opt_stats *stats) {
+    run_passes(instrs, stats, PASS_UNREACHABLE);
+}
+
+/**
+ * Reorders a program's basic blocks so that as many unconditional jumps as possible can be removed,
+ * and removes them. Programs that jump to hard-coded ROM addresses are left alone.
+ *
+ * @param instrs  the program to optimize, before its symbols have been resolved
+ * @param stats   filled in with how many instructions were removed
+ */
+void layout_blocks(instr_list *instrs, opt_stats *stats) {
+    run_passes(instrs, stats, PASS_LAYOUT);
+}
+
+/**
+ * Runs every optimization over a program, until none of them can remove anything else.
+ *
+ * @param instrs  the program to optimize, before its symbols have been resolved
+ * @param stats   filled in with how many instructions each rule removed
+ */
+void optimize_program(instr_list *instrs, opt_stats *stats) {
+    run_passes(instrs, stats, PASS_PEEPHOLE | PASS_UNREACHABLE | PASS_LAYOUT);
+}
+
+/**
+ * Prints how many instructions each optimization rule removed.
+ * @param out    The file to print to.
+ * @param stats  The opt_stats filled in by optimize_program().
+ */
+void print_opt_stats(FILE *out, const opt_stats *stats) {
+    if (stats->skipped) {
+        fprintf(out, "Not optimizing, since the program jumps to hard-coded ROM addresses\n");
+        return;
+    }
+
+    fprintf(out, "%-26s %8s\n", "rule", "removed");
+    for (int i = 0; i < NUM_OPT_RULES; i++) {
+        fprintf(out, "%-26s %8d\n", OPT_RULE_NAMES[i], stats->removed[i]);
+    }
+    fprintf(out, "%d -> %d instructions (%.1f%% smaller)\n", stats->before, stats->after,
+        stats->before > 0 ? 100.0 * (stats->before - stats->after) / stats->before : 0.0);
+    fprintf(out, "%d -> %d jumps\n", stats->jumps_before, stats->jumps_after);
+}
@@ -0,0 +1,48 @@
+/*
+ * Header file for the peephole optimizer for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _OPTIMIZER_H
+#define _OPTIMIZER_H
+
+#include <stdio.h>
+
+#include "lexer.h"
+
+// The rewrites the optimizer knows about
+typedef enum opt_rule {
+    RULE_A_RELOAD = 0,      // Loading A with the value it already holds
+    RULE_DEAD_A_LOAD = 1,   // Loading A, and then loading it again before using it
+    RULE_CANCELLING = 2,    // Incrementing a register and then decrementing it, or vice versa
+    RULE_DUPLICATE = 3,     // Repeating an assignment whose inputs haven't changed
+    RULE_NOOP = 4,          // A computation that's neither stored nor jumped on
+    RULE_JUMP_NEXT = 5,     // Jumping to the very next instruction
+    RULE_UNREACHABLE = 6,   // Code that no path from the start of the program reaches
+    RULE_BLOCK_LAYOUT = 7,  // Jumps that reordering the program's blocks turned into fall-through
+    RULE_SUPEROPT = 8,      // A sequence the superoptimizer found a shorter equivalent for
+    RULE_KNOWN_VALUE = 9,   // Loading a register with a value dataflow shows it already holds
+    NUM_OPT_RULES = 10
+} opt_rule;
+
+// How many instructions each rule removed
+typedef struct opt_stats {
+    int before;                         // The number of ROM instructions before optimizing
+    int after;                          // The number of ROM instructions after optimizing
+    int removed[NUM_OPT_RULES];         // The number of instructions each rule removed
+    int jumps_before;                   // The number of jump instructions before optimizing
+    int jumps_after;                    // The number of jump instructions after optimizing
+    int skipped;                        // Set if the program couldn't safely be optimized
+} opt_stats;
+
+extern const char *OPT_RULE_NAMES[];
+
+int count_rom(const instr_list*);
+void peephole(instr_list*, opt_stats*);
+void eliminate_unreachable(instr_list*, opt_stats*);
+void layout_blocks(instr_list*, opt_stats*);
+void optimize_program(instr_list*, opt_stats*);
+void print_opt_stats(FILE*, const opt_stats*);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * Multithreaded driver for the nand2tetris assembler.
+ *
+ * The input is split into chunks of whole lines, and each chunk is lexed and encoded on its own
+ * thread. Every chunk reports how many ROM instructions it holds, so a prefix sum over the chunks
+ * gives each chunk's base ROM address, and with it the global address of every label. Symbols are
+ * then resolved against the labels in parallel, and whatever is left over is a variable, which is
+ * allocated in source order on a single thread. That keeps the output byte-identical to
+ * first_pass() + second_pass().
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encoder.h"
+#include "lexer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "../../../lib/hash_table.h"
+
+const int MAX_THREADS = 64;
+
+
+/**
+ * Lexes and encodes every line in a chunk. Labels get their chunk-relative ROM address as their
+ * word, and every instruction gets its chunk-relative line number.
+ * @param arg  The chunk to lex.
+ */
+static void *lex_chunk(void *arg) {
+    chunk *c = arg;
+    size_t scratch_len = 128;
+    char *scratch = malloc(scratch_len);
+
+    const char *line = c->start;
+    while (line < c->end) {
+        const char *eol = memchr(line, EOL, c->end - line);
+        if (eol == NULL) {
+            break;  // Like advance(), ignore a final line with no newline
+        }
+
+        size_t len = eol - line;
+        if (len + 1 > scratch_len) {
+            scratch_len = 2 * (len + 1);
+            scratch = realloc(scratch, scratch_len);
+        }
+
+        c->num_lines++;
+        instruction lexed[MAX_LINE_INSTRS];
+        int n = lex_line(line, len, scratch, lexed);
+        for (int i = 0; i < n; i++) {
+            instruction *instr = &lexed[i];
+            instr->line = c->num_lines;
+            if (instr->type == L_COMMAND) {
+                if (c->rom_count > UINT16_MAX) {
+                    fprintf(stderr, "Label `%s` is past the end of the %d-bit address space\n",
+                        instr->symbol, WORD);
+                    exit(EXIT_FAILURE);
+                }
+                instr->word = c->rom_count;
+            } else {
+                c->rom_count++;
+            }
+            *instr_list_push(&c->instrs) = *instr;
+        }
+        line = eol + 1;
+    }
+
+    free(scratch);
+    return NULL;
+}
+
+/**
+ * Resolves every symbolic A_COMMAND in a chunk whose symbol is already in the symbol table. The
+ * symbol table must not be modified while this runs. Unresolved symbols are left in place.
+ * @param arg  The chunk to resolve.
+ */
+static void *resolve_chunk(void *arg) {
+    chunk *c = arg;
+    for (int i = 0; i < c->instrs.count; i++) {
+        instruction *instr = &c->instrs.items[i];
+        instr->line += c->first_line - 1;
+        if (instr->type == A_COMMAND && instr->symbol != NULL) {
+            char *binary_addr = ht_search(c->ht, instr->symbol);
+            if (binary_addr != NULL) {
+                instr->word = binary_to_word(binary_addr);
+                free(binary_addr);
+                free(instr->symbol);
+                instr->symbol = NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Writes the .hack text for every ROM instruction in a chunk into the chunk's text buffer.
+ * @param arg  The chunk to format.
+ */
+static void *format_chunk(void *arg) {
+    chunk *c = arg;
+    c->text_len = (size_t)c->rom_count * (WORD + 1);
+    c->text = malloc(c->text_len + 1);
+
+    char *out = c->text;
+    for (int i = 0; i < c->instrs.count; i++) {
+        if (c->instrs.items[i].type != L_COMMAND) {
+            word_to_binary(c->instrs.items[i].word, out);
+            out[WORD] = '\n';
+            out += WORD + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Runs @fn on every chunk, each on its own thread, and waits for them all to finish.
+ */
+static void run_on_chunks(chunk *chunks, int num_chunks, void *(*fn)(void*)) {
+    pthread_t *threads = calloc(num_chunks, sizeof(pthread_t));
+    for (int i = 0; i < num_chunks; i++) {
+        if (pthread_create(&threads[i], NULL, fn, &chunks[i])) {
+            perror("Failed to start assembler thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < num_chunks; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+
+/**
+ * Reads the rest of a file into memory.
+ * @param  in   The file to read.
+ * @param  len  Set to the number of bytes read.
+ * @return      A buffer holding the file's contents. The caller must free it.
+ */
+char *read_all(FILE *in, size_t *len) {
+    size_t capacity = 1 << 16;
+    char *buf = malloc(capacity);
+    *len = 0;
+
+    size_t n;
+    while ((n = fread(buf + *len, 1, capacity - *len, in)) > 0) {
+        *len += n;
+        if (*len == capacity) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+        }
+    }
+
+    if (ferror(in)) {
+        perror("Error reading .asm file");
+        free(buf);
+        exit(EXIT_FAILURE);
+    }
+
+    return buf;
+}
+
+/**
+ * Assembles a whole program that's already in memory, using up to @num_threads threads, and writes
+ * the result to @out. This produces exactly the same output as first_pass() followed by
+ * second_pass().
+ *
+ * @param src          the .asm program to assemble
+ * @param len          the length of @src
+ * @param out          the file to write the assembled binary to
+ * @param ht           the symbol table, which should contain only the predefined symbols
+ * @param num_threads  the number of chunks to split the program into
+ */
+void assemble_parallel(const char *src, size_t len, FILE *out, ht_hash_table *ht, int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    } else if (num_threads > MAX_THREADS) {
+        num_threads = MAX_THREADS;
+    }
+
+    // The encoder's lookup tables have to exist before more than one thread can encode
+    encoder_init();
+
+    // Split the input at the first newline after each evenly-spaced offset
+    chunk *chunks = calloc(num_threads, sizeof(chunk));
+    const char *src_end = src + len;
+    const char *start = src;
+    for (int i = 0; i < num_threads; i++) {
+        const char *end = src_end;
+        if (i < num_threads - 1) {
+            const char *target = src + len * (i + 1) / num_threads;
+            if (target < start) {
+                target = start;
+            }
+            const char *eol = memchr(target, EOL, src_end - target);
+            end = eol != NULL ? eol + 1 : src_end;
+        }
+
+        chunks[i].start = start;
+        chunks[i].end = end;
+        chunks[i].ht = ht;
+        instr_list_init(&chunks[i].instrs);
+        start = end;
+    }
+
+    run_on_chunks(chunks, num_threads, lex_chunk);
+
+    // Prefix sum over the chunks to find where each one starts, and insert every label into the
+    // symbol table in source order
+    int addr_ROM = 0;
+    int line = 1;
+    for (int i = 0; i < num_threads; i++) {
+        chunks[i].base_addr = addr_ROM;
+        chunks[i].first_line = line;
+        addr_ROM += chunks[i].rom_count;
+        line += chunks[i].num_lines;
+
+        for (int j = 0; j < chunks[i].instrs.count; j++) {
+            instruction *instr = &chunks[i].instrs.items[j];
+            if (instr->type == L_COMMAND) {
+                char *binary_addr = parse_to_binary(chunks[i].base_addr + instr->word);
+                instr->word = binary_to_word(binary_addr);
+                ht_insert(ht, instr->symbol, binary_addr);
+                free(binary_addr);
+            }
+        }
+    }
+
+    run_on_chunks(chunks, num_threads, resolve_chunk);
+
+    // Anything still unresolved is a variable. These have to be allocated in source order.
+    int addr_RAM = 16;
+    for (int i = 0; i < num_threads; i++) {
+        for (int j = 0; j < chunks[i].instrs.count; j++) {
+            instruction *instr = &chunks[i].instrs.items[j];
+            if (instr->type == A_COMMAND && instr->symbol != NULL) {
+                char *binary_addr = ht_search(ht, instr->symbol);
+                if (binary_addr == NULL) {
+                    binary_addr = parse_to_binary(addr_RAM);
+                    ht_insert(ht, instr->symbol, binary_addr);
+                    addr_RAM++;
+                }
+                instr->word = binary_to_word(binary_addr);
+                free(binary_addr);
+            }
+        }
+    }
+
+    run_on_chunks(chunks, num_threads, format_chunk);
+
+    for (int i = 0; i < num_threads; i++) {
+        fwrite(chunks[i].text, sizeof(char), chunks[i].text_len, out);
+        free(chunks[i].text);
+        instr_list_free(&chunks[i].instrs);
+    }
+    free(chunks);
+}
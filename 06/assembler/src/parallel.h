@@ -0,0 +1,34 @@
+/*
+ * Header file for the multithreaded driver for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stdio.h>
+
+#include "lexer.h"
+#include "../../../lib/hash_table.h"
+
+// A contiguous run of whole lines from the input, and everything lexed out of it
+typedef struct chunk {
+    const char *start;   // The first char of the chunk
+    const char *end;     // One past the last char of the chunk
+    instr_list instrs;   // The instructions in the chunk, including L_COMMANDs
+    int num_lines;       // The number of lines in the chunk
+    int rom_count;       // The number of instructions in the chunk that take up ROM (i.e., non-labels)
+    int first_line;      // The source line the chunk begins on
+    int base_addr;       // The ROM address of the chunk's first instruction
+    ht_hash_table *ht;   // The symbol table, shared read-only between threads while resolving
+    char *text;          // The chunk's assembled .hack output
+    size_t text_len;     // The length of text
+} chunk;
+
+extern const int MAX_THREADS;  // The most threads assemble_parallel() will use
+
+char *read_all(FILE*, size_t*);
+void assemble_parallel(const char*, size_t, FILE*, ht_hash_table*, int);
+
+#endif
@@ -10,8 +10,10 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#include "constant.h"
 #include "encoder.h"
 #include "parser.h"
+#include "profile.h"
 #include "../../../lib/hash_table.h"
 
 #ifndef _PARSER_VARS
@@ -36,18 +38,13 @@ const int WORD = 16;
 
 
 /**
- * Opens the .asm file for parsing.
- * @param  filename The path to the .asm file to parse.
- * @return          The file handler pointer for the .asm file.
+ * Works out the name of a file to write alongside a .asm file.
+ * @param  file_in  The path to the .asm file.
+ * @param  ext      The extension of the file to write, including the '.'.
+ * @return          <file_in> with its extension replaced by @ext, or out<ext> if @file_in has no
+ *                  extension. The caller must free it.
  */
-io init(const char *file_in) {
-    FILE *in = fopen(file_in, "r");
-
-    if (!in) {
-        perror("Failed to open input file");
-        exit(EXIT_FAILURE);
-    }
-
+char *replace_ext(const char *file_in, const char *ext) {
     int period_idx = -1;
     for (int i = strlen(file_in) - 1; i >= 0; i--) {
         if (file_in[i] == '.') {
@@ -57,18 +54,44 @@ io init(const char *file_in) {
     }
 
     // Find filename of input up until the period, if one exists, and create an output file named
-    // <file_in>.hack. If there's no '.' in file_in, create an output file named out.hack.
+    // <file_in><ext>. If there's no '.' in file_in, create an output file named out<ext>.
     char *file_out;
     if (period_idx > -1) {
-        file_out = calloc(period_idx + strlen(FOUT_EXT) + 1, sizeof(char));
+        file_out = calloc(period_idx + strlen(ext) + 1, sizeof(char));
         file_out = strncpy(file_out, file_in, period_idx);
     } else {
         char *name = "out";
-        file_out = calloc(strlen(name) + strlen(FOUT_EXT) + 1, sizeof(char));
+        file_out = calloc(strlen(name) + strlen(ext) + 1, sizeof(char));
         file_out = strcpy(file_out, name);
     }
-    strcat(file_out, FOUT_EXT);
+    strcat(file_out, ext);
+    return file_out;
+}
 
+/**
+ * Works out the name of the .hack file to write a .asm file's binary to.
+ * @param  file_in  The path to the .asm file.
+ * @return          <file_in> with its extension replaced by FOUT_EXT, or out.hack if @file_in has no
+ *                  extension. The caller must free it.
+ */
+char *hack_path(const char *file_in) {
+    return replace_ext(file_in, FOUT_EXT);
+}
+
+/**
+ * Opens the .asm file for parsing.
+ * @param  filename The path to the .asm file to parse.
+ * @return          The file handler pointer for the .asm file.
+ */
+io init(const char *file_in) {
+    FILE *in = fopen(file_in, "r");
+
+    if (!in) {
+        perror("Failed to open input file");
+        exit(EXIT_FAILURE);
+    }
+
+    char *file_out = hack_path(file_in);
     FILE *out = fopen(file_out, "w");
     free(file_out);
 
@@ -94,6 +117,7 @@ char *advance(FILE *file) {
     int precomment = 0;
     int skip = 0;
     int inline_comment = 0;
+    int comment = 0;
     char *command = calloc(1, sizeof(char));
     command[0] = '\0';
 
@@ -105,6 +129,7 @@ char *advance(FILE *file) {
                         inline_comment = 1;  // so this must be an inline comment
                     } else {
                         skip = 1;
+                        comment = 1;
                     }
                 } else {
                     precomment = 1;
@@ -122,6 +147,7 @@ char *advance(FILE *file) {
         }
 
         if (c == EOL) {
+            PROF_COUNT(lines);
             int end_offset = inline_comment ? 2 : 1;
             command[line_size - end_offset] = '\0';
             break;
@@ -139,6 +165,11 @@ char *advance(FILE *file) {
     }
 
     if (skip || strlen(command) <= 1) {
+        if (comment) {
+            PROF_COUNT(comment_lines);
+        } else {
+            PROF_COUNT(blank_lines);
+        }
         free(command);
         return advance(file);
     }
@@ -301,7 +332,7 @@ char *parse_to_binary(int num) {
     }
 
     if (num > 0) {
-        printf("parse_to_binary only parses integers <= 2^%d - 1.\n", WORD);
+        fprintf(stderr, "parse_to_binary only parses integers <= 2^%d - 1.\n", WORD);
         free(binary);
         exit(EXIT_FAILURE);
     }
@@ -310,6 +341,35 @@ char *parse_to_binary(int num) {
     return binary;
 }
 
+/**
+ * Writes @word as WORD '0'/'1' characters into @out. Unlike parse_to_binary(), this doesn't allocate
+ * or NUL-terminate anything.
+ *
+ * @param word  The machine instruction to convert.
+ * @param out   The buffer to write the WORD characters to.
+ */
+void word_to_binary(uint16_t word, char *out) {
+    for (int i = WORD - 1; i >= 0; i--) {
+        out[i] = '0' + (word & 1);
+        word >>= 1;
+    }
+}
+
+/**
+ * Converts a WORD-character binary string, like those returned by parse_to_binary(), back into a
+ * machine word.
+ *
+ * @param  binary  The binary string to convert.
+ * @return         The machine word.
+ */
+uint16_t binary_to_word(const char *binary) {
+    uint16_t word = 0;
+    for (int i = 0; i < WORD && binary[i] != '\0'; i++) {
+        word = (word << 1) | (binary[i] == '1');
+    }
+    return word;
+}
+
 /**
  * Performs the first assembler pass on the program, generating the symbol table to be used in the
  * second pass. After this pass, the symbol table only contains symbols corresponding to L_COMMANDs,
@@ -348,8 +408,13 @@ void first_pass(FILE *in, ht_hash_table *ht) {
             char *symbol = parse_symbol(L_COMMAND, command);
             char *binary_addr = parse_to_binary(addr_ROM);
             ht_insert(ht, symbol, binary_addr);
+            PROF_COUNT(l_instrs);
+            PROF_COUNT(sym_inserts);
             free(symbol);
             free(binary_addr);
+        } else if (is_constant_load(command)) {
+            uint16_t words[MAX_CONST_WORDS];
+            addr_ROM += expand_constant_load(command, words, NULL);
         } else {
             addr_ROM++;
         }
@@ -375,31 +440,38 @@ void second_pass(FILE *in, FILE *out, ht_hash_table *ht) {
     char *computation = NULL;
     char *destination = NULL;
     char *jump_to = NULL;
-    char *comp_encoded = NULL;
-    const char *dest_encoded = NULL;
-    const char *jump_encoded = NULL;
 
     while ((command = advance(in)) != NULL) {
         char *cmd_out = calloc(WORD + 1, sizeof(char));
         cmd_out[WORD] = '\0';
         cmd_type = command_type(command);
 
-        if (cmd_type == C_COMMAND) {
+        if (cmd_type == C_COMMAND && is_constant_load(command)) {
+            // Write out every instruction but the last here, and the last one like any other
+            uint16_t words[MAX_CONST_WORDS];
+            int n = expand_constant_load(command, words, NULL);
+            for (int i = 0; i < n; i++) {
+                if ((words[i] & C_CMD_PREFIX) == C_CMD_PREFIX) {
+                    PROF_COUNT(c_instrs);
+                } else {
+                    PROF_COUNT(a_instrs);
+                }
+            }
+            for (int i = 0; i < n - 1; i++) {
+                word_to_binary(words[i], cmd_out);
+                cmd_out[WORD] = '\n';
+                fwrite(cmd_out, sizeof(char), WORD + 1, out);
+            }
+            word_to_binary(words[n - 1], cmd_out);
+        } else if (cmd_type == C_COMMAND) {
             // Parse command
             computation = parse_comp(command);
             destination = parse_dest(command);
             jump_to = parse_jump(command);
 
-            // Encode command
-            comp_encoded = encode_comp(computation);
-            dest_encoded = encode_dest(destination);
-            jump_encoded = encode_jump(jump_to);
-
-            // Generate machine code
-            strcpy(cmd_out, "111\0");
-            strcat(cmd_out, comp_encoded);
-            strcat(cmd_out, dest_encoded);
-            strcat(cmd_out, jump_encoded);
+            // Encode command and generate machine code
+            word_to_binary(encode_c_command(destination, computation, jump_to), cmd_out);
+            PROF_COUNT(c_instrs);
         } else if (cmd_type == A_COMMAND) {  // Convert the input to an address
             char *parsed = parse_symbol(cmd_type, command);
             char *binary_addr = NULL;
@@ -415,12 +487,17 @@ void second_pass(FILE *in, FILE *out, ht_hash_table *ht) {
                     binary_addr = parse_to_binary(addr_RAM);
                     ht_insert(ht, parsed, binary_addr);
                     addr_RAM++;
+                    PROF_COUNT(sym_misses);
+                    PROF_COUNT(sym_inserts);
+                } else {
+                    PROF_COUNT(sym_hits);
                 }
             } else {
                 binary_addr = parse_to_binary(atoi(command + 1));
             }
 
             strcpy(cmd_out, binary_addr);
+            PROF_COUNT(a_instrs);
             free(binary_addr);
             free(parsed);
             binary_addr = NULL;
@@ -440,13 +517,11 @@ void second_pass(FILE *in, FILE *out, ht_hash_table *ht) {
             free(computation);
             free(destination);
             free(jump_to);
-            free(comp_encoded);
             free(command);
             free(cmd_out);
             computation = NULL;
             destination = NULL;
             jump_to = NULL;
-            comp_encoded = NULL;
             command = NULL;
             cmd_out = NULL;
     }
@@ -7,6 +7,7 @@
 #ifndef _PARSER_H
 #define _PARSER_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include "../../../lib/hash_table.h"
 
@@ -39,6 +40,8 @@ extern const int WORD;  // The length of a binary word in the output file
 
 
 io init(const char*);
+char *replace_ext(const char*, const char*);
+char *hack_path(const char*);
 char *advance(FILE*);
 command_t command_type(const char*);
 char *symbol(command_t, const char*);
@@ -47,6 +50,8 @@ char *parse_comp(const char*);
 char *parse_jump(const char*);
 char *parse_symbol(command_t, char*);
 char *parse_to_binary(int);
+void word_to_binary(uint16_t, char*);
+uint16_t binary_to_word(const char*);
 void first_pass(FILE*, ht_hash_table*);
 void second_pass(FILE*, FILE*, ht_hash_table*);
 
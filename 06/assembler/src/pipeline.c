@@ -0,0 +1,356 @@
+/*
+ * Pipelined second pass for the nand2tetris assembler.
+ *
+ * second_pass() reads a line, encodes it and writes it out before moving on to the next one. Here
+ * those three jobs each get their own thread:
+ *
+ *   reader  --line batches-->  encoder  --text buffers-->  writer
+ *
+ * Batches move between neighbouring stages through lock-free single-producer/single-consumer rings.
+ * Each hand-off has a second ring going the other way, which returns emptied batches to the
+ * producer, so the stages share a fixed pool of buffers and memory stays bounded no matter how large
+ * the input is. There are only two text buffers, so the encoder fills one while the writer is
+ * flushing the other to disk.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "encoder.h"
+#include "lexer.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "../../../lib/hash_table.h"
+
+#define NUM_LINE_BATCHES RING_CAPACITY
+#define NUM_TEXT_BUFFERS 2
+#define LINE_BATCH_SIZE (1 << 16)
+#define TEXT_BUFFER_SIZE (1 << 16)
+
+// A run of whole lines read from the input
+typedef struct line_batch {
+    char *data;
+    size_t len;
+    size_t capacity;
+    int last;  // Set on the final batch of the input
+} line_batch;
+
+// A run of assembled .hack text waiting to be written
+typedef struct text_buffer {
+    char data[TEXT_BUFFER_SIZE];
+    size_t len;
+    int last;  // Set on the final buffer of the output
+} text_buffer;
+
+typedef struct pipeline {
+    FILE *in;
+    FILE *out;
+    ht_hash_table *ht;
+    spsc_ring free_lines;  // Empty line batches, going back to the reader
+    spsc_ring full_lines;  // Filled line batches, going to the encoder
+    spsc_ring free_text;   // Empty text buffers, going back to the encoder
+    spsc_ring full_text;   // Filled text buffers, going to the writer
+    stage_stats *stats;
+} pipeline;
+
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ * Initializes an empty ring.
+ * @param ring  The ring to initialize.
+ */
+void ring_init(spsc_ring *ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+/**
+ * Pushes an item onto a ring, unless the ring is full. Must only be called from the producer thread.
+ * @param  ring  The ring to push onto.
+ * @param  item  The item to push.
+ * @return       1 if @item was pushed, 0 if the ring was full.
+ */
+int ring_try_push(spsc_ring *ring, void *item) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head == RING_CAPACITY) {
+        return 0;
+    }
+
+    ring->slots[tail & (RING_CAPACITY - 1)] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * Pops an item off of a ring, unless the ring is empty. Must only be called from the consumer thread.
+ * @param  ring  The ring to pop from.
+ * @param  item  Set to the popped item.
+ * @return       1 if an item was popped, 0 if the ring was empty.
+ */
+int ring_try_pop(spsc_ring *ring, void **item) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+
+    *item = ring->slots[head & (RING_CAPACITY - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+// Blocking versions of the above, which charge any time spent waiting to the stage's idle time
+static void ring_push(spsc_ring *ring, void *item, stage_stats *stats) {
+    if (ring_try_push(ring, item)) return;
+    long long start = now_ns();
+    while (!ring_try_push(ring, item)) {
+        sched_yield();
+    }
+    stats->idle_ns += now_ns() - start;
+}
+
+static void *ring_pop(spsc_ring *ring, stage_stats *stats) {
+    void *item;
+    if (ring_try_pop(ring, &item)) return item;
+    long long start = now_ns();
+    while (!ring_try_pop(ring, &item)) {
+        sched_yield();
+    }
+    stats->idle_ns += now_ns() - start;
+    return item;
+}
+
+
+/**
+ * Reads the input into line batches. Each batch ends on a line boundary; a partial line at the end of
+ * a read is carried over to the start of the next batch.
+ */
+static void *reader_stage(void *arg) {
+    pipeline *p = arg;
+    stage_stats *stats = &p->stats[STAGE_READER];
+    long long start = now_ns();
+
+    char *carry = malloc(1);
+    size_t carry_len = 0;
+    int done = 0;
+
+    while (!done) {
+        line_batch *batch = ring_pop(&p->free_lines, stats);
+        batch->len = 0;
+        batch->last = 0;
+
+        if (carry_len + LINE_BATCH_SIZE > batch->capacity) {
+            batch->capacity = carry_len + LINE_BATCH_SIZE;
+            batch->data = realloc(batch->data, batch->capacity);
+        }
+        memcpy(batch->data, carry, carry_len);
+        batch->len = carry_len;
+
+        size_t n = fread(batch->data + batch->len, 1, LINE_BATCH_SIZE, p->in);
+        batch->len += n;
+        if (n == 0) {
+            if (ferror(p->in)) {
+                perror("Error advancing to next line of .asm file");
+                exit(EXIT_FAILURE);
+            }
+            // Like advance(), ignore a final line with no newline
+            batch->len = 0;
+            batch->last = 1;
+            done = 1;
+        }
+
+        // Hold back everything after the last newline for the next batch
+        size_t end = batch->len;
+        while (end > 0 && batch->data[end - 1] != EOL) {
+            end--;
+        }
+        carry_len = batch->len - end;
+        carry = realloc(carry, carry_len + 1);
+        memcpy(carry, batch->data + end, carry_len);
+        batch->len = end;
+
+        stats->batches++;
+        ring_push(&p->full_lines, batch, stats);
+    }
+
+    free(carry);
+    stats->busy_ns = now_ns() - start - stats->idle_ns;
+    return NULL;
+}
+
+/**
+ * Lexes, resolves and encodes each line batch, and formats the results into text buffers.
+ */
+static void *encoder_stage(void *arg) {
+    pipeline *p = arg;
+    stage_stats *stats = &p->stats[STAGE_ENCODER];
+    long long start = now_ns();
+
+    int addr_RAM = 16;
+    size_t scratch_len = 128;
+    char *scratch = malloc(scratch_len);
+    text_buffer *text = ring_pop(&p->free_text, stats);
+    text->len = 0;
+    text->last = 0;
+
+    int done = 0;
+    while (!done) {
+        line_batch *batch = ring_pop(&p->full_lines, stats);
+        done = batch->last;
+
+        const char *line = batch->data;
+        const char *batch_end = batch->data + batch->len;
+        while (line < batch_end) {
+            const char *eol = memchr(line, EOL, batch_end - line);
+            size_t len = eol - line;
+            if (len + 1 > scratch_len) {
+                scratch_len = 2 * (len + 1);
+                scratch = realloc(scratch, scratch_len);
+            }
+
+            instruction lexed[MAX_LINE_INSTRS];
+            int n = lex_line(line, len, scratch, lexed);
+            for (int i = 0; i < n; i++) {
+                instruction *instr = &lexed[i];
+                if (instr->type != L_COMMAND) {
+                    if (instr->symbol != NULL) {
+                        char *binary_addr = ht_search(p->ht, instr->symbol);
+                        if (binary_addr == NULL) {
+                            binary_addr = parse_to_binary(addr_RAM);
+                            ht_insert(p->ht, instr->symbol, binary_addr);
+                            addr_RAM++;
+                        }
+                        instr->word = binary_to_word(binary_addr);
+                        free(binary_addr);
+                    }
+
+                    if (text->len + WORD + 1 > TEXT_BUFFER_SIZE) {
+                        stats->batches++;
+                        ring_push(&p->full_text, text, stats);
+                        text = ring_pop(&p->free_text, stats);
+                        text->len = 0;
+                        text->last = 0;
+                    }
+                    word_to_binary(instr->word, text->data + text->len);
+                    text->data[text->len + WORD] = '\n';
+                    text->len += WORD + 1;
+                }
+                free(instr->symbol);
+            }
+            line = eol + 1;
+        }
+
+        ring_push(&p->free_lines, batch, stats);
+    }
+
+    text->last = 1;
+    stats->batches++;
+    ring_push(&p->full_text, text, stats);
+
+    free(scratch);
+    stats->busy_ns = now_ns() - start - stats->idle_ns;
+    return NULL;
+}
+
+/**
+ * Writes each text buffer to the output file.
+ */
+static void *writer_stage(void *arg) {
+    pipeline *p = arg;
+    stage_stats *stats = &p->stats[STAGE_WRITER];
+    long long start = now_ns();
+
+    int done = 0;
+    while (!done) {
+        text_buffer *text = ring_pop(&p->full_text, stats);
+        done = text->last;
+        fwrite(text->data, sizeof(char), text->len, p->out);
+        stats->batches++;
+        ring_push(&p->free_text, text, stats);
+    }
+
+    stats->busy_ns = now_ns() - start - stats->idle_ns;
+    return NULL;
+}
+
+
+/**
+ * Does the same job as second_pass(), but with reading, encoding and writing each on their own
+ * thread.
+ *
+ * @param in     the file containing the original assembly program
+ * @param out    the file to write the assembled binary to
+ * @param ht     the hash table containing the symbol table generated in `first_pass(...)`
+ * @param stats  an array of NUM_STAGES stage_stats, which is filled in with how busy each stage was
+ */
+void second_pass_pipelined(FILE *in, FILE *out, ht_hash_table *ht, stage_stats *stats) {
+    const char *stage_names[] = {"reader", "encoder", "writer"};
+    for (int i = 0; i < NUM_STAGES; i++) {
+        memset(&stats[i], 0, sizeof(stage_stats));
+        stats[i].name = stage_names[i];
+    }
+
+    encoder_init();
+
+    pipeline p = {.in = in, .out = out, .ht = ht, .stats = stats};
+    ring_init(&p.free_lines);
+    ring_init(&p.full_lines);
+    ring_init(&p.free_text);
+    ring_init(&p.full_text);
+
+    line_batch *batches = calloc(NUM_LINE_BATCHES, sizeof(line_batch));
+    text_buffer *texts = calloc(NUM_TEXT_BUFFERS, sizeof(text_buffer));
+    for (int i = 0; i < NUM_LINE_BATCHES; i++) {
+        ring_try_push(&p.free_lines, &batches[i]);
+    }
+    for (int i = 0; i < NUM_TEXT_BUFFERS; i++) {
+        ring_try_push(&p.free_text, &texts[i]);
+    }
+
+    void *(*stage_fns[])(void*) = {reader_stage, encoder_stage, writer_stage};
+    pthread_t threads[NUM_STAGES];
+    for (int i = 0; i < NUM_STAGES; i++) {
+        if (pthread_create(&threads[i], NULL, stage_fns[i], &p)) {
+            perror("Failed to start assembler pipeline thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < NUM_STAGES; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < NUM_LINE_BATCHES; i++) {
+        free(batches[i].data);
+    }
+    free(batches);
+    free(texts);
+}
+
+/**
+ * Prints how long each pipeline stage was busy and idle.
+ * @param out    The file to print to.
+ * @param stats  The NUM_STAGES stage_stats filled in by second_pass_pipelined().
+ */
+void print_stage_stats(FILE *out, const stage_stats *stats) {
+    fprintf(out, "%-8s %12s %12s %8s %8s\n", "stage", "busy (ms)", "idle (ms)", "busy %", "batches");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        long long total = stats[i].busy_ns + stats[i].idle_ns;
+        fprintf(out, "%-8s %12.3f %12.3f %7.1f%% %8ld\n", stats[i].name, stats[i].busy_ns / 1e6,
+            stats[i].idle_ns / 1e6, total > 0 ? 100.0 * stats[i].busy_ns / total : 0.0,
+            stats[i].batches);
+    }
+}
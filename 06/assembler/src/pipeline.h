@@ -0,0 +1,48 @@
+/*
+ * Header file for the pipelined second pass of the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../../../lib/hash_table.h"
+
+#define RING_CAPACITY 8  // Must be a power of 2
+
+// A bounded, lock-free ring buffer with a single producer thread and a single consumer thread
+typedef struct spsc_ring {
+    void *slots[RING_CAPACITY];
+    atomic_size_t head;  // The next slot to pop from. Only written by the consumer.
+    atomic_size_t tail;  // The next slot to push to. Only written by the producer.
+} spsc_ring;
+
+// How long a pipeline stage spent working, and how long it spent waiting on its neighbours
+typedef struct stage_stats {
+    const char *name;
+    long long busy_ns;
+    long long idle_ns;
+    long batches;
+} stage_stats;
+
+// The stages of the pipeline, in order
+typedef enum stage_t {
+    STAGE_READER = 0,
+    STAGE_ENCODER = 1,
+    STAGE_WRITER = 2,
+    NUM_STAGES = 3
+} stage_t;
+
+
+void ring_init(spsc_ring*);
+int ring_try_push(spsc_ring*, void*);
+int ring_try_pop(spsc_ring*, void**);
+void second_pass_pipelined(FILE*, FILE*, ht_hash_table*, stage_stats*);
+void print_stage_stats(FILE*, const stage_stats*);
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Header file for the built-in profiler for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdio.h>
+
+// The phases of a serial run that are timed separately
+typedef enum prof_phase {
+    PHASE_FIRST_PASS = 0,
+    PHASE_SECOND_PASS = 1,  // Encoding the program into memory
+    PHASE_OUTPUT = 2,       // Writing the encoded program to the output file
+    NUM_PROF_PHASES = 3
+} prof_phase;
+
+// What a profiled run spent its time and memory on
+typedef struct prof_stats {
+    double seconds[NUM_PROF_PHASES];  // The wall time each phase took
+    double last_mark;                 // When the last phase ended
+    long lines;                       // Lines read by advance(), in both passes
+    long comment_lines;               // Of those, lines skipped because they were only a comment
+    long blank_lines;                 // Of those, lines skipped because they were blank
+    long a_instrs;                    // A_COMMANDs encoded
+    long c_instrs;                    // C_COMMANDs encoded
+    long l_instrs;                    // Labels defined
+    long sym_hits;                    // Symbol lookups that found the symbol
+    long sym_misses;                  // Symbol lookups that didn't
+    long sym_inserts;                 // Symbols added to the symbol table
+    long allocs;                      // Calls to malloc(), calloc() and realloc()
+    long alloc_bytes;                 // The bytes those calls asked for
+    long peak_rss_kb;                 // The most memory the process used
+} prof_stats;
+
+extern prof_stats *profile;  // The stats being collected, or NULL if the run isn't being profiled
+
+// Bumps one of profile's counters, if the run is being profiled
+#define PROF_COUNT(field) do { if (profile != NULL) profile->field++; } while (0)
+
+extern const char *PROF_PHASE_NAMES[];  // The name of each prof_phase
+
+
+void profile_begin(prof_stats*);
+void profile_mark(prof_phase);
+void profile_end(void);
+void print_profile(FILE*, const prof_stats*);
+
+#endif
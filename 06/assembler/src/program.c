@@ -0,0 +1,172 @@
+/*
+ * Whole-program assembly from the in-memory instruction list.
+ *
+ * Passes that rewrite the program, like the optimizer, need all of it in memory at once, as a list of
+ * instructions rather than a FILE. These split first_pass() and second_pass() into the steps those
+ * passes fit between: lex the program, (rewrite it,) resolve its symbols, and write it out.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "program.h"
+#include "../../../lib/hash_table.h"
+
+
+/**
+ * Lexes a whole program that's already in memory.
+ * @param src     The .asm program to lex.
+ * @param len     The length of @src.
+ * @param instrs  The list to append every instruction to, including L_COMMANDs.
+ */
+void lex_program(const char *src, size_t len, instr_list *instrs) {
+    lex_program_diag(src, len, instrs, NULL);
+}
+
+/**
+ * Lexes a whole program that's already in memory, like lex_program(), but reports errors through
+ * @diag.
+ * @param  diag  The diagnostic to fill in if the program is invalid, or NULL to print the error and
+ *               exit.
+ * @return       0 on success, or -1 if a line is invalid.
+ */
+int lex_program_diag(const char *src, size_t len, instr_list *instrs, hackasm_diag *diag) {
+    size_t scratch_len = 128;
+    char *scratch = malloc(scratch_len);
+    int num_lines = 0;
+
+    const char *line = src;
+    const char *src_end = src + len;
+    while (line < src_end) {
+        const char *eol = memchr(line, EOL, src_end - line);
+        if (eol == NULL) {
+            break;  // Like advance(), ignore a final line with no newline
+        }
+
+        size_t line_len = eol - line;
+        if (line_len + 1 > scratch_len) {
+            scratch_len = 2 * (line_len + 1);
+            scratch = realloc(scratch, scratch_len);
+        }
+
+        num_lines++;
+        instruction lexed[MAX_LINE_INSTRS];
+        int found = lex_line_diag(line, line_len, scratch, lexed, diag);
+        if (found < 0) {
+            diag->line = num_lines;
+            free(scratch);
+            return -1;
+        }
+        for (int i = 0; i < found; i++) {
+            lexed[i].line = num_lines;
+            *instr_list_push(instrs) = lexed[i];
+        }
+        line = eol + 1;
+    }
+
+    free(scratch);
+    return 0;
+}
+
+/**
+ * Resolves every symbol in a program, the same way first_pass() and second_pass() do: labels get the
+ * ROM address of the instruction after them, and any other symbol that isn't already in the symbol
+ * table is a variable. Afterwards every instruction's word is final. Symbols are kept, so that the
+ * program's symbol map can still be written out.
+ *
+ * @param instrs  the program to resolve
+ * @param ht      the symbol table, which should contain only the predefined symbols
+ */
+void resolve_program(instr_list *instrs, ht_hash_table *ht) {
+    resolve_program_diag(instrs, ht, NULL);
+}
+
+/**
+ * Resolves every symbol in a program, like resolve_program(), but reports errors through @diag.
+ * @param  diag  The diagnostic to fill in if a symbol can't be resolved, or NULL to print the error
+ *               and exit.
+ * @return       0 on success, or -1 if a label or variable doesn't fit in the address space.
+ */
+int resolve_program_diag(instr_list *instrs, ht_hash_table *ht, hackasm_diag *diag) {
+    return resolve_labels(instrs, ht, diag) || resolve_symbols(instrs, ht, diag) ? -1 : 0;
+}
+
+/**
+ * Adds every label in a program to the symbol table, like first_pass() does, and sets each
+ * L_COMMAND's word to its label's ROM address.
+ * @param  instrs  The program.
+ * @param  ht      The symbol table to add the labels to.
+ * @param  diag    The diagnostic to fill in on an error, or NULL to print the error and exit.
+ * @return         0 on success, or -1 if a label is past the end of the address space.
+ */
+int resolve_labels(instr_list *instrs, ht_hash_table *ht, hackasm_diag *diag) {
+    int addr_ROM = 0;
+    for (int i = 0; i < instrs->count; i++) {
+        instruction *instr = &instrs->items[i];
+        if (instr->type == L_COMMAND) {
+            if (addr_ROM > UINT16_MAX) {
+                return report_error(diag, instr->line,
+                    "Label `%s` is past the end of the %d-bit address space", instr->symbol, WORD);
+            }
+            char *binary_addr = parse_to_binary(addr_ROM);
+            ht_insert(ht, instr->symbol, binary_addr);
+            free(binary_addr);
+            instr->word = addr_ROM;
+        } else {
+            addr_ROM++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Encodes every symbolic A_COMMAND in a program, like second_pass() does: symbols that aren't in the
+ * symbol table yet become variables. This must come after resolve_labels().
+ * @param  instrs  The program.
+ * @param  ht      The symbol table, with the predefined symbols and the program's labels in it.
+ * @param  diag    The diagnostic to fill in on an error, or NULL to print the error and exit.
+ * @return         0 on success, or -1 if there are more variables than fit in RAM.
+ */
+int resolve_symbols(instr_list *instrs, ht_hash_table *ht, hackasm_diag *diag) {
+    int addr_RAM = 16;
+    for (int i = 0; i < instrs->count; i++) {
+        instruction *instr = &instrs->items[i];
+        if (instr->type == A_COMMAND && instr->symbol != NULL) {
+            char *binary_addr = ht_search(ht, instr->symbol);
+            if (binary_addr == NULL) {
+                if (addr_RAM > UINT16_MAX) {
+                    return report_error(diag, instr->line,
+                        "Variable `%s` is past the end of the %d-bit address space", instr->symbol, WORD);
+                }
+                binary_addr = parse_to_binary(addr_RAM);
+                ht_insert(ht, instr->symbol, binary_addr);
+                addr_RAM++;
+            }
+            instr->word = binary_to_word(binary_addr);
+            free(binary_addr);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes out the machine code for every ROM instruction in a resolved program.
+ * @param instrs  The program, after resolve_program().
+ * @param out     The file to write the assembled binary to.
+ */
+void write_program(const instr_list *instrs, FILE *out) {
+    char text[WORD + 1];
+    text[WORD] = '\n';
+    for (int i = 0; i < instrs->count; i++) {
+        if (instrs->items[i].type != L_COMMAND) {
+            word_to_binary(instrs->items[i].word, text);
+            fwrite(text, sizeof(char), WORD + 1, out);
+        }
+    }
+}
@@ -0,0 +1,25 @@
+/*
+ * Header file for whole-program assembly from the in-memory instruction list.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _PROGRAM_H
+#define _PROGRAM_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "hackasm.h"
+#include "lexer.h"
+#include "../../../lib/hash_table.h"
+
+void lex_program(const char*, size_t, instr_list*);
+int lex_program_diag(const char*, size_t, instr_list*, hackasm_diag*);
+void resolve_program(instr_list*, ht_hash_table*);
+int resolve_program_diag(instr_list*, ht_hash_table*, hackasm_diag*);
+int resolve_labels(instr_list*, ht_hash_table*, hackasm_diag*);
+int resolve_symbols(instr_list*, ht_hash_table*, hackasm_diag*);
+void write_program(const instr_list*, FILE*);
+
+#endif
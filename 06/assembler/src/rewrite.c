@@ -0,0 +1,166 @@
+/*
+ * Superoptimizer rewrite rules for the nand2tetris assembler.
+ *
+ * A rewrite rule says that one short, straight-line sequence of instructions always leaves A, D and
+ * RAM exactly the way another, shorter one does. Rules are written over window tokens rather than
+ * instructions, so that one rule covers every symbol and constant:
+ *
+ *   - A jump-free C_COMMAND is its own machine word.
+ *   - `@0` and `@1` are the words for A=0 and A=1, which do the same thing.
+ *   - Any other A_COMMAND is a slot, numbered from 0 in the order the window first uses each
+ *     distinct symbol or constant. In text, slot k is written @$k.
+ *
+ * A slot never stands for SCREEN, KBD or a constant at or past SCREEN, since several rules assume that
+ * a value stored to @$k reads back, and memory-mapped I/O doesn't.
+ *
+ * Slots are tokens 0 to MAX_REWRITE_SLOTS - 1, which can't be confused with C_COMMAND words since
+ * those all start with C_CMD_PREFIX. The superoptimizer finds the rules, and the optimizer applies
+ * them; see superopt.c and rewrites.def.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alu.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "lexer.h"
+#include "parser.h"
+#include "rewrite.h"
+
+const char REWRITE_SLOT = '$';
+
+// Whether two A_COMMANDs load the same value
+static int same_value(const instruction *a, const instruction *b) {
+    if (a->symbol != NULL || b->symbol != NULL) {
+        return a->symbol != NULL && b->symbol != NULL && !strcmp(a->symbol, b->symbol);
+    }
+    return a->word == b->word;
+}
+
+// Whether an A_COMMAND addresses memory-mapped I/O, which optimizer.c's io_address() also checks
+static int io_operand(const instruction *instr) {
+    if (instr->symbol != NULL) {
+        return !strcmp(instr->symbol, "SCREEN") || !strcmp(instr->symbol, "KBD");
+    }
+    return instr->word >= IO_BASE;
+}
+
+/**
+ * Turns a run of instructions into window tokens, stopping at the first one that can't be part of
+ * a rewrite: a label, a jump, a constant too big to be an A_COMMAND, an A_COMMAND that addresses
+ * memory-mapped I/O, or one that would need one slot too many.
+ *
+ * @param  instrs  The instructions.
+ * @param  n       The number of instructions, at most MAX_REWRITE_LEN.
+ * @param  tokens  Filled in with a token for each instruction that can be part of a rewrite.
+ * @param  slots   Filled in with the first A_COMMAND that uses each slot.
+ * @return         The number of tokens filled in.
+ */
+int window_tokens(const instruction **instrs, int n, uint16_t *tokens, const instruction **slots) {
+    int num_slots = 0;
+    for (int i = 0; i < n; i++) {
+        const instruction *instr = instrs[i];
+        if (instr->type == L_COMMAND || (instr->type == C_COMMAND && (instr->word & 0x7))) {
+            return i;
+        }
+        if (instr->type == C_COMMAND) {
+            tokens[i] = instr->word;
+            continue;
+        }
+        if (instr->symbol == NULL && (instr->word & ~ADDRESS_MASK)) {
+            return i;
+        }
+        if (instr->symbol == NULL && instr->word <= 1) {
+            tokens[i] = encode_c_command("A", instr->word ? "1" : "0", NULL);
+            continue;
+        }
+        if (io_operand(instr)) {
+            return i;
+        }
+
+        int slot = 0;
+        while (slot < num_slots && !same_value(slots[slot], instr)) {
+            slot++;
+        }
+        if (slot == num_slots) {
+            if (num_slots == MAX_REWRITE_SLOTS) {
+                return i;
+            }
+            slots[num_slots++] = instr;
+        }
+        tokens[i] = slot;
+    }
+    return n;
+}
+
+/**
+ * Parses a window written as text, like "@$0 AM=M+1 A=A-1".
+ * @param  text    The window, with its instructions separated by spaces.
+ * @param  tokens  Filled in with the window's tokens. Must have room for MAX_REWRITE_LEN.
+ * @return         The number of tokens, or -1 if the text isn't a valid window.
+ */
+int parse_window(const char *text, uint16_t *tokens) {
+    int n = 0;
+    const char *p = text;
+    while (*p != '\0') {
+        const char *end = strchr(p, ' ');
+        size_t len = end != NULL ? (size_t)(end - p) : strlen(p);
+        if (len > 0) {
+            if (n == MAX_REWRITE_LEN) {
+                return -1;
+            }
+            if (len == 3 && p[0] == A_CMD_BEGIN && p[1] == REWRITE_SLOT && p[2] >= '0'
+                    && p[2] < '0' + MAX_REWRITE_SLOTS) {
+                tokens[n++] = p[2] - '0';
+            } else {
+                char *scratch = malloc(len + 1);
+                instruction instr[MAX_LINE_INSTRS];
+                hackasm_diag diag;
+                int found = lex_line_diag(p, len, scratch, instr, &diag);
+                free(scratch);
+                if (found != 1) {
+                    return -1;
+                }
+                const instruction *instr_ptr = instr;
+                const instruction *slots[MAX_REWRITE_SLOTS];
+                int ok = window_tokens(&instr_ptr, 1, &tokens[n], slots) == 1
+                    && tokens[n] >= MAX_REWRITE_SLOTS;
+                free(instr[0].symbol);
+                if (!ok) {
+                    return -1;
+                }
+                n++;
+            }
+        }
+        p += len;
+        while (*p == ' ') p++;
+    }
+    return n;
+}
+
+/**
+ * Writes a window out as text, in the form parse_window() reads.
+ * @param tokens  The window's tokens.
+ * @param n       The number of tokens.
+ * @param out     The buffer to write the text to.
+ * @param size    The size of @out.
+ */
+void format_window(const uint16_t *tokens, int n, char *out, size_t size) {
+    decoder_init();
+    size_t len = 0;
+    out[0] = '\0';
+    for (int i = 0; i < n && len < size; i++) {
+        const char *sep = i > 0 ? " " : "";
+        if (tokens[i] < MAX_REWRITE_SLOTS) {
+            len += snprintf(out + len, size - len, "%s%c%c%d", sep, A_CMD_BEGIN, REWRITE_SLOT,
+                tokens[i]);
+        } else {
+            len += snprintf(out + len, size - len, "%s%s", sep, decode_word(tokens[i]));
+        }
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * Header file for superoptimizer rewrite rules for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _REWRITE_H
+#define _REWRITE_H
+
+#include <stdint.h>
+
+#include "lexer.h"
+
+#define MAX_REWRITE_LEN 6    // The most instructions in a rewrite rule's target
+#define MAX_REWRITE_SLOTS 2  // The most distinct @values a rewrite rule can use
+
+extern const char REWRITE_SLOT;  // The char after '@' that marks a slot, as in @$0
+
+// A rule that replaces a sequence of instructions with a shorter one that does the same thing
+typedef struct rewrite_rule {
+    uint16_t target[MAX_REWRITE_LEN];       // The sequence to replace, as window tokens
+    int target_len;
+    uint16_t replacement[MAX_REWRITE_LEN];  // What to replace it with, as window tokens
+    int replacement_len;
+} rewrite_rule;
+
+int window_tokens(const instruction**, int, uint16_t*, const instruction**);
+int parse_window(const char*, uint16_t*);
+void format_window(const uint16_t*, int, char*, size_t);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * ROM image format for the nand2tetris assembler.
+ *
+ * A .hack file spends 17 bytes of text on every word, which every emulator and test runner then has
+ * to parse. A ROM image is the same program laid out the way it's used: a rom_header, followed
+ * directly by the program as an array of uint16s. The header is 32 bytes, so once the file is mapped
+ * the words are already aligned, and map_rom() can hand them out without reading or copying them.
+ *
+ * The header holds the number of words, the address to start at (always 0 for a Hack program, but
+ * kept so that images of other layouts can say otherwise), and the CRC-32 of the words, so that a
+ * truncated or corrupted image is caught before it's run. If the image has a symbol section, it's a
+ * binary .sym file (see symfile.c) that starts sym_offset bytes into the image, after the words.
+ * Numbers are in the machine's byte order.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "rom.h"
+#include "symfile.h"
+
+const char *ROM_EXT = ".rom";
+const char ROM_MAGIC[8] = {'H', 'A', 'C', 'K', 'R', 'O', 'M', 1};
+
+/**
+ * Computes the CRC-32 (the same one zlib and PNG use) of a program's words, as they're laid out in
+ * memory.
+ *
+ * @param  words  the program
+ * @param  n      the number of words in @words
+ * @return        the checksum
+ */
+uint32_t rom_checksum(const uint16_t *words, size_t n) {
+    static uint32_t table[256];
+    static int table_built = 0;
+    if (!table_built) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_built = 1;
+    }
+
+    const unsigned char *bytes = (const unsigned char*)words;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < n * sizeof(uint16_t); i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * Writes a resolved program out as a ROM image.
+ * @param instrs    the program, after its symbols have been resolved
+ * @param out       the file to write the image to
+ * @param with_syms whether to add the program's symbol map as a symbol section
+ */
+void write_rom(const instr_list *instrs, FILE *out, int with_syms) {
+    uint16_t *words = malloc((instrs->count + 1) * sizeof(uint16_t));
+    uint32_t n = 0;
+    for (int i = 0; i < instrs->count; i++) {
+        if (instrs->items[i].type != L_COMMAND) {
+            words[n++] = instrs->items[i].word;
+        }
+    }
+
+    rom_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ROM_MAGIC, sizeof(ROM_MAGIC));
+    header.version = ROM_VERSION;
+    header.num_words = n;
+    header.sym_offset = with_syms ? sizeof(header) + n * sizeof(uint16_t) : 0;
+    header.checksum = rom_checksum(words, n);
+
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(words, sizeof(uint16_t), n, out);
+    if (with_syms) {
+        write_sym_file(instrs, out, 1);
+    }
+    free(words);
+}
+
+/**
+ * Maps a ROM image into memory, and checks that it's intact.
+ * @param  path  the ROM image to map
+ * @param  img   filled in with the image's header and words. Free it with unmap_rom().
+ * @return       0 on success, or -1 if the file couldn't be mapped, or isn't a valid ROM image
+ */
+int map_rom(const char *path, rom_image *img) {
+    memset(img, 0, sizeof(rom_image));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open ROM image");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(rom_header)) {
+        fprintf(stderr, "%s is not a valid ROM image\n", path);
+        close(fd);
+        return -1;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Failed to map ROM image");
+        return -1;
+    }
+
+    const rom_header *header = base;
+    const uint16_t *words = (const uint16_t*)(header + 1);
+    size_t words_end = sizeof(rom_header) + (size_t)header->num_words * sizeof(uint16_t);
+    int ok = !memcmp(header->magic, ROM_MAGIC, sizeof(ROM_MAGIC)) && header->version == ROM_VERSION
+        && words_end <= (size_t)st.st_size
+        && (header->sym_offset == 0 || (header->sym_offset >= words_end
+            && header->sym_offset < (size_t)st.st_size))
+        && rom_checksum(words, header->num_words) == header->checksum;
+    if (!ok) {
+        fprintf(stderr, "%s is not a valid ROM image\n", path);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    img->header = header;
+    img->words = words;
+    img->base = base;
+    img->size = st.st_size;
+    return 0;
+}
+
+/**
+ * Unmaps a ROM image mapped by map_rom().
+ * @param img  the image to unmap
+ */
+void unmap_rom(rom_image *img) {
+    if (img->base != NULL) {
+        munmap(img->base, img->size);
+    }
+    memset(img, 0, sizeof(rom_image));
+}
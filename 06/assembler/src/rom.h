@@ -0,0 +1,45 @@
+/*
+ * Header file for the ROM image format for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _ROM_H
+#define _ROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lexer.h"
+
+#define ROM_VERSION 1
+
+// The header at the start of every ROM image
+typedef struct rom_header {
+    char magic[8];        // ROM_MAGIC
+    uint32_t version;     // ROM_VERSION
+    uint32_t num_words;   // The number of words in the program
+    uint32_t entry;       // The ROM address to start running the program at
+    uint32_t sym_offset;  // The byte offset of the symbol section, or 0 if there isn't one
+    uint32_t checksum;    // The CRC-32 of the program's words
+    uint32_t reserved;    // Always 0. Pads the header so that the words are 8-byte aligned.
+} rom_header;
+
+// A ROM image mapped into memory by map_rom()
+typedef struct rom_image {
+    const rom_header *header;
+    const uint16_t *words;  // The program, header->num_words long
+    void *base;             // The start of the mapping
+    size_t size;            // The size of the mapping
+} rom_image;
+
+extern const char *ROM_EXT;        // The file extension to use for ROM images
+extern const char ROM_MAGIC[8];    // The first bytes of a ROM image
+
+uint32_t rom_checksum(const uint16_t*, size_t);
+void write_rom(const instr_list*, FILE*, int);
+int map_rom(const char*, rom_image*);
+void unmap_rom(rom_image*);
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ * Single-pass streaming mode for the nand2tetris assembler.
+ *
+ * first_pass() and second_pass() each read the whole input, which means the input has to be a file
+ * that can be rewound. This assembles a program in one pass instead, so it can read from a pipe. A
+ * reference to a symbol that isn't known yet is assembled with a placeholder address, and the
+ * address of the reference is recorded as a fixup on the symbol. When a label with that name is
+ * defined, all of its fixups are patched. Whatever is still pending at the end of the input is a
+ * variable, and variables are allocated in the order they were first referenced, just like
+ * second_pass() allocates them.
+ *
+ * If the output can be seeked (e.g., stdout redirected to a file), every word is written as soon as
+ * it's assembled, and fixups are patched in place. Otherwise, words are held in a queue from the
+ * oldest unresolved reference onwards, and flushed as soon as everything in front of them is
+ * resolved. Variables aren't resolved until the end of the input, so a program that uses one early
+ * on would keep nearly all of itself queued; once the queue holds STREAM_QUEUE_MAX words, it's moved
+ * to a temporary file, which takes the place of the output for the rest of the program and is copied
+ * to it at the end. Either way, the only things kept in memory are the symbol tables, the fixups,
+ * and at most STREAM_QUEUE_MAX queued words.
+ *
+ * Since labels are resolved as soon as they're defined, a label that's defined more than once, or
+ * that shadows a predefined symbol, takes effect from its definition onwards, rather than for the
+ * whole program as it does with first_pass().
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "encoder.h"
+#include "lexer.h"
+#include "parser.h"
+#include "stream.h"
+#include "../../../lib/hash_table.h"
+
+const char *STREAM_PATH = "-";
+const int STREAM_QUEUE_MAX = 1024;
+
+typedef struct stream_state {
+    FILE *out;
+    int seekable;
+    long out_start;            // The position in @out that the first word was written to
+    long addr_ROM;             // The ROM address of the next instruction
+
+    queued_word *queue;        // Words that can't be written yet, when @out isn't seekable
+    long queue_base;           // The ROM address of queue[queue_head]
+    int queue_head;
+    int queue_len;             // The number of words in the queue, including those before queue_head
+    int queue_cap;
+    FILE *spill;               // Where words go once the queue is full, when @out isn't seekable
+    long spill_base;           // The ROM address of the first word in spill
+
+    ht_hash_table *pending_ids;  // Maps the name of each pending symbol to its index in pending
+    pending_symbol *pending;
+    int num_pending;
+    int pending_cap;
+} stream_state;
+
+
+static void write_word(FILE *out, uint16_t word) {
+    char text[WORD + 1];
+    word_to_binary(word, text);
+    text[WORD] = '\n';
+    fwrite(text, sizeof(char), WORD + 1, out);
+}
+
+// Overwrites the word @index words into @f, which starts at position @start, and goes back to the end
+static void patch_word(FILE *f, long start, long index, uint16_t word) {
+    char text[WORD];
+    word_to_binary(word, text);
+    fseek(f, start + index * (WORD + 1), SEEK_SET);
+    fwrite(text, sizeof(char), WORD, f);
+    fseek(f, 0, SEEK_END);
+}
+
+/**
+ * Moves the queue to a temporary file, which every word is written to from then on. If the file
+ * can't be created, words keep being queued in memory.
+ */
+static void spill_queue(stream_state *s) {
+    s->spill = tmpfile();
+    if (s->spill == NULL) {
+        perror("Failed to create a temporary file for queued output");
+        return;
+    }
+    s->spill_base = s->queue_base;
+    for (int i = s->queue_head; i < s->queue_len; i++) {
+        write_word(s->spill, s->queue[i].word);
+    }
+    s->queue_head = 0;
+    s->queue_len = 0;
+}
+
+/**
+ * Writes out every word at the front of the queue that isn't waiting on a pending symbol.
+ */
+static void flush_queue(stream_state *s) {
+    while (s->queue_head < s->queue_len && !s->queue[s->queue_head].pending) {
+        write_word(s->out, s->queue[s->queue_head].word);
+        s->queue_head++;
+        s->queue_base++;
+    }
+
+    // Reclaim the flushed space once it's at least half the queue
+    if (s->queue_head > 0 && s->queue_head >= s->queue_len / 2) {
+        s->queue_len -= s->queue_head;
+        memmove(s->queue, s->queue + s->queue_head, s->queue_len * sizeof(queued_word));
+        s->queue_head = 0;
+    }
+}
+
+/**
+ * Outputs the next word of the program, or queues it if it can't be written yet.
+ */
+static void emit_word(stream_state *s, uint16_t word, int pending) {
+    s->addr_ROM++;
+
+    if (s->spill != NULL) {
+        write_word(s->spill, word);
+        return;
+    }
+    if (s->seekable || (!pending && s->queue_head == s->queue_len)) {
+        write_word(s->out, word);
+        if (s->queue_head == s->queue_len) {
+            s->queue_base = s->addr_ROM;
+        }
+        return;
+    }
+
+    if (s->queue_len == s->queue_cap) {
+        s->queue_cap = s->queue_cap ? 2 * s->queue_cap : 256;
+        s->queue = realloc(s->queue, s->queue_cap * sizeof(queued_word));
+    }
+    s->queue[s->queue_len].word = word;
+    s->queue[s->queue_len].pending = pending;
+    s->queue_len++;
+
+    if (s->queue_len - s->queue_head >= STREAM_QUEUE_MAX) {
+        spill_queue(s);
+    }
+}
+
+/**
+ * Finds the pending symbol with the given name, creating it if it doesn't exist.
+ * @return The index of the symbol in s->pending.
+ */
+static int get_pending(stream_state *s, const char *name) {
+    char *id_str = ht_search(s->pending_ids, name);
+    if (id_str != NULL) {
+        int id = atoi(id_str);
+        free(id_str);
+        return id;
+    }
+
+    if (s->num_pending == s->pending_cap) {
+        s->pending_cap = s->pending_cap ? 2 * s->pending_cap : 64;
+        s->pending = realloc(s->pending, s->pending_cap * sizeof(pending_symbol));
+    }
+
+    int id = s->num_pending++;
+    pending_symbol *p = &s->pending[id];
+    memset(p, 0, sizeof(pending_symbol));
+    p->name = strdup(name);
+
+    char id_buf[16];
+    snprintf(id_buf, sizeof(id_buf), "%d", id);
+    ht_insert(s->pending_ids, name, id_buf);
+    return id;
+}
+
+/**
+ * Patches every reference to a pending symbol with its final address.
+ */
+static void resolve_pending(stream_state *s, int id, uint16_t addr) {
+    pending_symbol *p = &s->pending[id];
+    p->resolved = 1;
+
+    for (int i = 0; i < p->num_fixups; i++) {
+        if (s->seekable) {
+            patch_word(s->out, s->out_start, p->fixups[i], addr);
+        } else if (s->spill != NULL) {
+            patch_word(s->spill, 0, p->fixups[i] - s->spill_base, addr);
+        } else {
+            queued_word *q = &s->queue[s->queue_head + (p->fixups[i] - s->queue_base)];
+            q->word = addr;
+            q->pending = 0;
+        }
+    }
+
+    if (!s->seekable && s->spill == NULL) {
+        flush_queue(s);
+    }
+
+    free(p->fixups);
+    p->fixups = NULL;
+    p->num_fixups = 0;
+}
+
+/**
+ * Assembles a symbolic A_COMMAND, recording a fixup if its symbol isn't known yet.
+ */
+static void emit_symbol_ref(stream_state *s, ht_hash_table *ht, const char *symbol) {
+    char *binary_addr = ht_search(ht, symbol);
+    if (binary_addr != NULL) {
+        emit_word(s, binary_to_word(binary_addr), 0);
+        free(binary_addr);
+        return;
+    }
+
+    int id = get_pending(s, symbol);
+    pending_symbol *p = &s->pending[id];
+    if (p->num_fixups == p->capacity) {
+        p->capacity = p->capacity ? 2 * p->capacity : 4;
+        p->fixups = realloc(p->fixups, p->capacity * sizeof(long));
+    }
+    p->fixups[p->num_fixups++] = s->addr_ROM;
+    emit_word(s, 0, 1);
+}
+
+/**
+ * Defines a label at the current ROM address, and resolves any references to it.
+ */
+static void define_label(stream_state *s, ht_hash_table *ht, const char *label) {
+    char *binary_addr = parse_to_binary(s->addr_ROM);
+    ht_insert(ht, label, binary_addr);
+    free(binary_addr);
+
+    char *id_str = ht_search(s->pending_ids, label);
+    if (id_str != NULL) {
+        resolve_pending(s, atoi(id_str), s->addr_ROM);
+        ht_remove(s->pending_ids, label);
+        free(id_str);
+    }
+}
+
+
+/**
+ * Assembles a program in a single pass, reading it from @in and writing it to @out. Neither file has
+ * to be seekable, although output is buffered, in memory and then in a temporary file, if @out
+ * isn't.
+ *
+ * @param in   the file containing the assembly program
+ * @param out  the file to write the assembled binary to
+ * @param ht   the symbol table, which should contain only the predefined symbols
+ */
+void assemble_stream(FILE *in, FILE *out, ht_hash_table *ht) {
+    stream_state s;
+    memset(&s, 0, sizeof(stream_state));
+    s.out = out;
+    s.out_start = isatty(fileno(out)) ? -1 : ftell(out);
+    s.seekable = s.out_start >= 0 && fseek(out, 0, SEEK_CUR) == 0;
+    s.pending_ids = ht_new(1024);
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    char *scratch = NULL;
+    size_t scratch_len = 0;
+    ssize_t n;
+
+    while ((n = getline(&line, &line_cap, in)) > 0) {
+        if (line[n - 1] != EOL) {
+            break;  // Like advance(), ignore a final line with no newline
+        }
+        if ((size_t)n > scratch_len) {
+            scratch_len = n;
+            scratch = realloc(scratch, scratch_len);
+        }
+
+        instruction lexed[MAX_LINE_INSTRS];
+        int num_instrs = lex_line(line, n - 1, scratch, lexed);
+        for (int i = 0; i < num_instrs; i++) {
+            instruction *instr = &lexed[i];
+            if (instr->type == L_COMMAND) {
+                define_label(&s, ht, instr->symbol);
+            } else if (instr->symbol != NULL) {
+                emit_symbol_ref(&s, ht, instr->symbol);
+            } else {
+                emit_word(&s, instr->word, 0);
+            }
+            free(instr->symbol);
+        }
+    }
+
+    if (ferror(in)) {
+        perror("Error advancing to next line of .asm file");
+        exit(EXIT_FAILURE);
+    }
+
+    // Everything that's still pending is a variable
+    int addr_RAM = 16;
+    for (int i = 0; i < s.num_pending; i++) {
+        if (!s.pending[i].resolved) {
+            char *binary_addr = parse_to_binary(addr_RAM);
+            ht_insert(ht, s.pending[i].name, binary_addr);
+            free(binary_addr);
+            resolve_pending(&s, i, addr_RAM);
+            addr_RAM++;
+        }
+        free(s.pending[i].name);
+    }
+
+    if (s.spill != NULL) {
+        char buf[4096];
+        size_t len;
+        rewind(s.spill);
+        while ((len = fread(buf, sizeof(char), sizeof(buf), s.spill)) > 0) {
+            fwrite(buf, sizeof(char), len, out);
+        }
+        fclose(s.spill);
+    }
+
+    free(s.pending);
+    free(s.queue);
+    free(scratch);
+    free(line);
+    ht_delete(s.pending_ids);
+}
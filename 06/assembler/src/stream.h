@@ -0,0 +1,36 @@
+/*
+ * Header file for the single-pass streaming mode of the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../../../lib/hash_table.h"
+
+// A symbol that has been referenced, but not yet defined as a label
+typedef struct pending_symbol {
+    char *name;
+    long *fixups;     // The ROM addresses of every A_COMMAND that references the symbol
+    int num_fixups;
+    int capacity;
+    int resolved;     // Set once the symbol has been defined as a label
+} pending_symbol;
+
+// An instruction that has been assembled, but can't be written yet
+typedef struct queued_word {
+    uint16_t word;
+    int pending;      // Set if the word is waiting on a pending_symbol to be resolved
+} queued_word;
+
+extern const char *STREAM_PATH;     // The path argument that selects streaming mode
+extern const int STREAM_QUEUE_MAX;  // The most words queued in memory when the output isn't seekable
+
+
+void assemble_stream(FILE*, FILE*, ht_hash_table*);
+
+#endif
@@ -0,0 +1,648 @@
+/*
+ * Superoptimizer for short Hack instruction sequences.
+ *
+ * This reads some .asm programs, counts every short straight-line window of instructions in them
+ * (see rewrite.c for how windows are written), and then searches every sequence of Hack
+ * instructions up to a few instructions long, shortest first, for one that does exactly what a
+ * longer window does. Each one it finds becomes a rewrite rule, and the rules are written out as
+ * rewrites.def, which the optimizer compiles in.
+ *
+ * Two sequences are equivalent only if they leave A, D and every word of RAM the same, whatever A,
+ * D, RAM and the values of the window's @symbols were beforehand. The search runs every candidate
+ * on a few test states and looks its fingerprint up among the windows' fingerprints. A match is
+ * then checked on thousands of random states, and on every state of a small model where A, D, the
+ * @values and a few RAM words each take one of a handful of edge values, so that every way two
+ * addresses can alias is covered. What an instruction does comes from the bit-level ALU in alu.c,
+ * not from the mnemonics.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alu.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "lexer.h"
+#include "parallel.h"
+#include "program.h"
+#include "rewrite.h"
+
+#define MAX_SEARCH_LEN 4        // The longest replacement the search can be asked to find
+#define NUM_PROBES 4            // The test states every candidate is fingerprinted on
+#define NUM_RANDOM_CHECKS 4096  // The random states a match is checked on
+#define NUM_SMALL_VALUES 4      // The values each register and RAM word takes in the small model
+#define MAX_TEXT 128            // The longest a window can be as text
+
+// The values registers and RAM take in the small model, and the RAM words that are modeled
+static const uint16_t SMALL_VALUES[NUM_SMALL_VALUES] = {0, 1, 2, 0xFFFF};
+static const uint16_t SMALL_ADDRS[NUM_SMALL_VALUES] = {0, 1, 2, ADDRESS_MASK};
+
+// The state of the Hack CPU and its RAM
+typedef struct machine {
+    uint16_t a;
+    uint16_t d;
+    uint16_t slots[MAX_REWRITE_SLOTS];  // The value each of the window's @values loads
+    uint32_t seed;                      // Picks the value of each RAM word that hasn't been written
+    const uint16_t *small_ram;          // If set, the values of the RAM words at SMALL_ADDRS
+    int num_writes;
+    uint16_t addrs[MAX_REWRITE_LEN];    // The RAM words that have been written
+    uint16_t values[MAX_REWRITE_LEN];   // What each of them holds now
+} machine;
+
+// A window of instructions found in the programs, and the shortest replacement found for it
+typedef struct window {
+    uint16_t tokens[MAX_REWRITE_LEN];
+    int len;
+    int num_slots;
+    long count;                      // How many times the window appears in the programs
+    uint64_t fingerprint;
+    int next_same_print;             // The next window with the same fingerprint, or -1
+    int best_len;                    // The length of the replacement, or -1 if there isn't one
+    uint16_t best[MAX_SEARCH_LEN];
+    int dropped;                     // Set if a shorter window's rule already does as well
+} window;
+
+// A set of 64-bit keys, each with an int value, that grows as it fills up
+typedef struct key_table {
+    uint64_t *keys;
+    int *values;
+    long size;
+    long count;
+} key_table;
+
+// A growable list of candidate sequences that all have the same length
+typedef struct seq_list {
+    uint16_t (*items)[MAX_SEARCH_LEN];
+    long count;
+    long capacity;
+} seq_list;
+
+static window *windows;
+static int num_windows;
+static key_table window_index;  // Each window's token hash, to its index in windows
+static key_table print_index;   // Each fingerprint, to the first window with it
+static key_table seen;          // The fingerprint of every candidate kept so far
+static key_table first_probes;  // What each window leaves the first probe as
+
+static uint16_t alphabet[MAX_REWRITE_SLOTS + 128 * 7];
+static int alphabet_size;
+
+static uint32_t rng_state = 0x2545F491;
+
+
+static uint32_t mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352D;
+    x ^= x >> 15;
+    x *= 0x846CA68B;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// A random 16-bit value, which is one of SMALL_VALUES a quarter of the time
+static uint16_t random_value(void) {
+    uint32_t r = next_random();
+    return r & 3 ? r >> 16 : SMALL_VALUES[(r >> 2) & 3];
+}
+
+static void table_init(key_table *table, long size) {
+    table->keys = calloc(size, sizeof(uint64_t));
+    table->values = malloc(size * sizeof(int));
+    table->size = size;
+    table->count = 0;
+}
+
+static void table_free(key_table *table) {
+    free(table->keys);
+    free(table->values);
+}
+
+// Finds the slot for a key. Key 0 marks an empty slot, so keys are never 0.
+static long table_slot(const key_table *table, uint64_t key) {
+    long i = key & (table->size - 1);
+    while (table->keys[i] != 0 && table->keys[i] != key) {
+        i = (i + 1) & (table->size - 1);
+    }
+    return i;
+}
+
+// Looks a key up, and returns its value or -1 if it isn't there
+static int table_get(const key_table *table, uint64_t key) {
+    long i = table_slot(table, key | 1);
+    return table->keys[i] != 0 ? table->values[i] : -1;
+}
+
+// Adds a key, unless it's already there. Returns 1 if it was added.
+static int table_put(key_table *table, uint64_t key, int value) {
+    if (2 * (table->count + 1) > table->size) {
+        key_table bigger;
+        table_init(&bigger, 2 * table->size);
+        for (long i = 0; i < table->size; i++) {
+            if (table->keys[i] != 0) {
+                long j = table_slot(&bigger, table->keys[i]);
+                bigger.keys[j] = table->keys[i];
+                bigger.values[j] = table->values[i];
+            }
+        }
+        bigger.count = table->count;
+        table_free(table);
+        *table = bigger;
+    }
+
+    long i = table_slot(table, key | 1);
+    if (table->keys[i] != 0) {
+        return 0;
+    }
+    table->keys[i] = key | 1;
+    table->values[i] = value;
+    table->count++;
+    return 1;
+}
+
+static void seq_push(seq_list *list, const uint16_t *seq) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 1024;
+        list->items = realloc(list->items, list->capacity * sizeof(list->items[0]));
+    }
+    memcpy(list->items[list->count++], seq, MAX_SEARCH_LEN * sizeof(uint16_t));
+}
+
+// The value a RAM word held before the sequence ran
+static uint16_t initial_ram(const machine *m, uint16_t addr) {
+    if (m->small_ram != NULL) {
+        for (int i = 0; i < NUM_SMALL_VALUES; i++) {
+            if (addr == SMALL_ADDRS[i]) return m->small_ram[i];
+        }
+    }
+    return mix32(m->seed ^ (addr * 0x9E3779B9u));
+}
+
+static uint16_t read_ram(const machine *m, uint16_t addr) {
+    for (int i = 0; i < m->num_writes; i++) {
+        if (m->addrs[i] == addr) return m->values[i];
+    }
+    return initial_ram(m, addr);
+}
+
+static void write_ram(machine *m, uint16_t addr, uint16_t value) {
+    for (int i = 0; i < m->num_writes; i++) {
+        if (m->addrs[i] == addr) {
+            m->values[i] = value;
+            return;
+        }
+    }
+    m->addrs[m->num_writes] = addr;
+    m->values[m->num_writes++] = value;
+}
+
+/**
+ * Runs one window token. A C_COMMAND writes M at the address A held before it ran, as the CPU does.
+ * @param m      The machine to run it on.
+ * @param token  The token.
+ */
+static void step(machine *m, uint16_t token) {
+    if (token < MAX_REWRITE_SLOTS) {
+        m->a = m->slots[token];
+        return;
+    }
+    uint16_t addr = m->a & ADDRESS_MASK;
+    uint16_t result = c_command_result(token, m->a, m->d, read_ram(m, addr));
+    int dest = (token >> DEST_SHIFT) & 0x7;
+    if (dest & 1) write_ram(m, addr, result);
+    if (dest & 2) m->d = result;
+    if (dest & 4) m->a = result;
+}
+
+static void run(machine *m, const uint16_t *tokens, int n) {
+    for (int i = 0; i < n; i++) {
+        step(m, tokens[i]);
+    }
+}
+
+static int same_state(const machine *m1, const machine *m2) {
+    if (m1->a != m2->a || m1->d != m2->d) {
+        return 0;
+    }
+    for (int i = 0; i < m1->num_writes; i++) {
+        if (m1->values[i] != read_ram(m2, m1->addrs[i])) return 0;
+    }
+    for (int i = 0; i < m2->num_writes; i++) {
+        if (m2->values[i] != read_ram(m1, m2->addrs[i])) return 0;
+    }
+    return 1;
+}
+
+// Hashes a machine's registers and every RAM word that now holds something different
+static uint64_t state_hash(const machine *m) {
+    uint64_t hash = mix32((uint32_t)m->a << 16 | m->d);
+    for (int i = 0; i < m->num_writes; i++) {
+        if (m->values[i] != initial_ram(m, m->addrs[i])) {
+            hash += mix32(0x80000000u | (uint32_t)m->addrs[i] << 16 | m->values[i]);
+        }
+    }
+    return hash;
+}
+
+static uint64_t fingerprint(const machine *probes) {
+    uint64_t print = 0xCBF29CE484222325ull;
+    for (int i = 0; i < NUM_PROBES; i++) {
+        print = (print ^ state_hash(&probes[i])) * 0x100000001B3ull;
+    }
+    return print;
+}
+
+// Sets up the test states every candidate is fingerprinted on, some of which alias
+static void init_probes(machine *probes) {
+    for (int i = 0; i < NUM_PROBES; i++) {
+        machine *m = &probes[i];
+        uint32_t r = mix32(0x5EED + i);
+        m->a = r;
+        m->d = r >> 16;
+        r = mix32(r);
+        m->slots[0] = r & ADDRESS_MASK;
+        m->slots[1] = (r >> 16) & ADDRESS_MASK;
+        m->seed = mix32(r);
+        m->small_ram = NULL;
+        m->num_writes = 0;
+    }
+    probes[2].slots[1] = probes[2].slots[0];
+    probes[3].a = probes[3].slots[0];
+}
+
+/**
+ * Checks whether two sequences do the same thing on every state, as far as the random states and
+ * the small model can tell.
+ * @return  1 if they're equivalent, or 0 if not.
+ */
+static int equivalent(const uint16_t *target, int target_len, const uint16_t *seq, int len) {
+    machine m1;
+    machine m2;
+    for (int i = 0; i < NUM_RANDOM_CHECKS; i++) {
+        m1.a = random_value();
+        m1.d = random_value();
+        m1.slots[0] = random_value() & ADDRESS_MASK;
+        m1.slots[1] = next_random() & 1 ? m1.slots[0] : random_value() & ADDRESS_MASK;
+        if (next_random() & 1) m1.a = m1.slots[next_random() & 1] | (next_random() & ~ADDRESS_MASK);
+        m1.seed = next_random();
+        m1.small_ram = NULL;
+        m1.num_writes = 0;
+        m2 = m1;
+        run(&m1, target, target_len);
+        run(&m2, seq, len);
+        if (!same_state(&m1, &m2)) return 0;
+    }
+
+    // Every combination of SMALL_VALUES for A, D and the small model's RAM words, and of
+    // SMALL_ADDRS for the @values
+    int num_vars = 4 + NUM_SMALL_VALUES;
+    uint16_t ram[NUM_SMALL_VALUES];
+    for (long combo = 0; combo < 1L << (2 * num_vars); combo++) {
+        m1.a = SMALL_VALUES[combo & 3];
+        m1.d = SMALL_VALUES[(combo >> 2) & 3];
+        m1.slots[0] = SMALL_ADDRS[(combo >> 4) & 3];
+        m1.slots[1] = SMALL_ADDRS[(combo >> 6) & 3];
+        for (int i = 0; i < NUM_SMALL_VALUES; i++) {
+            ram[i] = SMALL_VALUES[(combo >> (8 + 2 * i)) & 3];
+        }
+        m1.seed = 0;
+        m1.small_ram = ram;
+        m1.num_writes = 0;
+        m2 = m1;
+        run(&m1, target, target_len);
+        run(&m2, seq, len);
+        if (!same_state(&m1, &m2)) return 0;
+    }
+    return 1;
+}
+
+// Renumbers a window's slots in the order it first uses them, and returns how many it uses
+static int canonicalize(uint16_t *tokens, int n) {
+    int map[MAX_REWRITE_SLOTS];
+    int num_slots = 0;
+    for (int i = 0; i < MAX_REWRITE_SLOTS; i++) map[i] = -1;
+    for (int i = 0; i < n; i++) {
+        if (tokens[i] < MAX_REWRITE_SLOTS) {
+            if (map[tokens[i]] < 0) map[tokens[i]] = num_slots++;
+            tokens[i] = map[tokens[i]];
+        }
+    }
+    return num_slots;
+}
+
+static uint64_t tokens_hash(const uint16_t *tokens, int n) {
+    uint64_t hash = 0xCBF29CE484222325ull ^ n;
+    for (int i = 0; i < n; i++) {
+        hash = (hash ^ tokens[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static int find_window(const uint16_t *tokens, int n) {
+    int i = table_get(&window_index, tokens_hash(tokens, n));
+    return i >= 0 && windows[i].len == n && !memcmp(windows[i].tokens, tokens, n * sizeof(uint16_t))
+        ? i : -1;
+}
+
+// Counts one appearance of a window, adding it if it's new
+static void count_window(const uint16_t *tokens, int n) {
+    int i = find_window(tokens, n);
+    if (i < 0) {
+        i = num_windows++;
+        windows = realloc(windows, num_windows * sizeof(window));
+        memset(&windows[i], 0, sizeof(window));
+        memcpy(windows[i].tokens, tokens, n * sizeof(uint16_t));
+        windows[i].len = n;
+        windows[i].num_slots = canonicalize(windows[i].tokens, n);
+        windows[i].best_len = -1;
+        table_put(&window_index, tokens_hash(tokens, n), i);
+    }
+    windows[i].count++;
+}
+
+/**
+ * Counts every window of 2 to MAX_REWRITE_LEN instructions in a program.
+ * @param  path  The .asm file.
+ * @return       0 on success, or -1 if the file couldn't be read or lexed.
+ */
+static int collect_windows(const char *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+    size_t size;
+    char *src = read_all(in, &size);
+    fclose(in);
+
+    instr_list instrs;
+    instr_list_init(&instrs);
+    hackasm_diag diag;
+    if (lex_program_diag(src, size, &instrs, &diag) < 0) {
+        fprintf(stderr, "%s:%d: %s\n", path, diag.line, diag.message);
+        free(src);
+        instr_list_free(&instrs);
+        return -1;
+    }
+
+    const instruction *ptrs[MAX_REWRITE_LEN];
+    const instruction *slots[MAX_REWRITE_SLOTS];
+    uint16_t tokens[MAX_REWRITE_LEN];
+    for (int i = 0; i < instrs.count; i++) {
+        int n = 0;
+        while (n < MAX_REWRITE_LEN && i + n < instrs.count) {
+            ptrs[n] = &instrs.items[i + n];
+            n++;
+        }
+        n = window_tokens(ptrs, n, tokens, slots);
+        // A computation that's neither stored nor jumped on is the optimizer's job, not ours
+        for (int j = 0; j < n; j++) {
+            if (tokens[j] >= MAX_REWRITE_SLOTS && !((tokens[j] >> DEST_SHIFT) & 0x7)) n = j;
+        }
+        for (int len = 2; len <= n; len++) {
+            count_window(tokens, len);
+        }
+    }
+
+    instr_list_free(&instrs);
+    free(src);
+    return 0;
+}
+
+// Checks a new candidate against every window with the same fingerprint that's still unsolved
+static void check_windows(uint64_t print, const uint16_t *seq, int len) {
+    for (int i = table_get(&print_index, print); i >= 0; i = windows[i].next_same_print) {
+        window *w = &windows[i];
+        if (w->best_len >= 0 || w->len <= len) {
+            continue;
+        }
+        int uses_slots = 1;
+        for (int j = 0; j < len; j++) {
+            if (seq[j] < MAX_REWRITE_SLOTS && seq[j] >= w->num_slots) uses_slots = 0;
+        }
+        if (uses_slots && equivalent(w->tokens, w->len, seq, len)) {
+            w->best_len = len;
+            memcpy(w->best, seq, len * sizeof(uint16_t));
+        }
+    }
+}
+
+/**
+ * Searches every sequence up to @max_len instructions long, shortest first, for replacements for
+ * the windows. A candidate that does the same thing as a shorter one is never extended, since
+ * anything built on it could be built on the shorter one instead.
+ */
+static void search(int max_len, int verbose) {
+    machine probes[NUM_PROBES];
+    machine base[NUM_PROBES];
+    init_probes(probes);
+
+    for (int i = 0; i < num_windows; i++) {
+        memcpy(base, probes, sizeof(base));
+        for (int j = 0; j < NUM_PROBES; j++) run(&base[j], windows[i].tokens, windows[i].len);
+        windows[i].fingerprint = fingerprint(base);
+        table_put(&first_probes, state_hash(&base[0]), i);
+        windows[i].next_same_print = table_get(&print_index, windows[i].fingerprint);
+        if (windows[i].next_same_print >= 0) {
+            // Keep the first window with each fingerprint at the head of the list
+            int head = windows[i].next_same_print;
+            windows[i].next_same_print = windows[head].next_same_print;
+            windows[head].next_same_print = i;
+        } else {
+            table_put(&print_index, windows[i].fingerprint, i);
+        }
+    }
+
+    seq_list levels[MAX_SEARCH_LEN + 1];
+    memset(levels, 0, sizeof(levels));
+    uint16_t seq[MAX_SEARCH_LEN] = {0};
+    seq_push(&levels[0], seq);
+    uint64_t print = fingerprint(probes);
+    table_put(&seen, print, 0);
+    check_windows(print, seq, 0);
+
+    machine m[NUM_PROBES];
+    for (int len = 1; len <= max_len; len++) {
+        for (long s = 0; s < levels[len - 1].count; s++) {
+            memcpy(seq, levels[len - 1].items[s], sizeof(seq));
+            memcpy(base, probes, sizeof(base));
+            for (int j = 0; j < NUM_PROBES; j++) run(&base[j], seq, len - 1);
+
+            for (int t = 0; t < alphabet_size; t++) {
+                seq[len - 1] = alphabet[t];
+                memcpy(m, base, sizeof(m));
+                step(&m[0], alphabet[t]);
+                // The last level only matters if it can match a window, and most can't
+                if (len == max_len && table_get(&first_probes, state_hash(&m[0])) < 0) {
+                    continue;
+                }
+                for (int j = 1; j < NUM_PROBES; j++) step(&m[j], alphabet[t]);
+                print = fingerprint(m);
+                if (table_get(&seen, print) >= 0) {
+                    continue;
+                }
+                if (len < max_len) {
+                    table_put(&seen, print, len);
+                    seq_push(&levels[len], seq);
+                }
+                check_windows(print, seq, len);
+            }
+        }
+        if (verbose) {
+            fprintf(stderr, "length %d: %ld distinct sequences kept\n", len, levels[len].count);
+        }
+    }
+
+    for (int i = 0; i <= MAX_SEARCH_LEN; i++) {
+        free(levels[i].items);
+    }
+}
+
+// Drops each rule that one of its shorter windows' rules already does at least as well as
+static void drop_subsumed(void) {
+    uint16_t sub[MAX_REWRITE_LEN];
+    for (int i = 0; i < num_windows; i++) {
+        window *w = &windows[i];
+        if (w->best_len < 0) continue;
+        for (int start = 0; start < w->len && !w->dropped; start++) {
+            for (int len = 2; start + len <= w->len && !w->dropped; len++) {
+                if (len == w->len) continue;
+                memcpy(sub, &w->tokens[start], len * sizeof(uint16_t));
+                canonicalize(sub, len);
+                int j = find_window(sub, len);
+                if (j >= 0 && windows[j].best_len >= 0
+                        && len - windows[j].best_len >= w->len - w->best_len) {
+                    w->dropped = 1;
+                }
+            }
+        }
+    }
+}
+
+// Orders rules by how many instructions they save, then by how often their window appears
+static int compare_rules(const void *a, const void *b) {
+    const window *w1 = *(const window* const*)a;
+    const window *w2 = *(const window* const*)b;
+    int saved1 = w1->len - w1->best_len;
+    int saved2 = w2->len - w2->best_len;
+    if (saved1 != saved2) return saved2 - saved1;
+    if (w1->count != w2->count) return w2->count > w1->count ? 1 : -1;
+    return w1 - w2 < 0 ? -1 : 1;
+}
+
+static int write_rules(FILE *out, int max_len, long min_count) {
+    window **rules = malloc(num_windows * sizeof(window*));
+    int num_rules = 0;
+    for (int i = 0; i < num_windows; i++) {
+        if (windows[i].best_len >= 0 && !windows[i].dropped) rules[num_rules++] = &windows[i];
+    }
+    qsort(rules, num_rules, sizeof(window*), compare_rules);
+
+    fprintf(out, "// Generated by superopt -n %d -m %ld; see superopt.c. Each rule is\n", max_len, min_count);
+    fprintf(out, "// REWRITE(target, replacement), and @$k stands for any @value, the same one each time.\n");
+    char target[MAX_TEXT];
+    char replacement[MAX_TEXT];
+    for (int i = 0; i < num_rules; i++) {
+        format_window(rules[i]->tokens, rules[i]->len, target, sizeof(target));
+        format_window(rules[i]->best, rules[i]->best_len, replacement, sizeof(replacement));
+        fprintf(out, "REWRITE(\"%s\", \"%s\")  // %ld uses\n", target, replacement, rules[i]->count);
+    }
+    free(rules);
+    return num_rules;
+}
+
+int main(int argc, char *argv[]) {
+    const char *usage =
+        "Usage: ./superopt [-n length] [-m count] [-o rewrites.def] [-v] prog.asm...\n\n"
+        "  -n length        the longest replacement to search for, up to 4 (default 4)\n"
+        "  -m count         only look at windows that appear at least this often (default 2)\n"
+        "  -o rewrites.def  where to write the rules (default stdout)\n"
+        "  -v               print how big each level of the search got\n";
+    int max_len = MAX_SEARCH_LEN;
+    long min_count = 2;
+    const char *out_path = NULL;
+    int verbose = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:o:v")) != -1) {
+        if (opt == 'n') {
+            max_len = atoi(optarg);
+        } else if (opt == 'm') {
+            min_count = atol(optarg);
+        } else if (opt == 'o') {
+            out_path = optarg;
+        } else if (opt == 'v') {
+            verbose = 1;
+        } else {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc || max_len < 1 || max_len > MAX_SEARCH_LEN) {
+        printf("%s", usage);
+        return EXIT_FAILURE;
+    }
+
+    decoder_init();
+    table_init(&window_index, 1 << 16);
+    table_init(&print_index, 1 << 16);
+    table_init(&seen, 1 << 20);
+    table_init(&first_probes, 1 << 16);
+    for (int i = optind; i < argc; i++) {
+        if (collect_windows(argv[i]) < 0) return EXIT_FAILURE;
+    }
+
+    // Forget the windows that don't appear often enough to be worth a rule
+    int kept = 0;
+    for (int i = 0; i < num_windows; i++) {
+        if (windows[i].count >= min_count) windows[kept++] = windows[i];
+    }
+    num_windows = kept;
+    table_free(&window_index);
+    table_init(&window_index, 1 << 16);
+    for (int i = 0; i < num_windows; i++) {
+        table_put(&window_index, tokens_hash(windows[i].tokens, windows[i].len), i);
+    }
+
+    // Every @value, then every computation stored to every combination of registers
+    for (int slot = 0; slot < MAX_REWRITE_SLOTS; slot++) {
+        alphabet[alphabet_size++] = slot;
+    }
+    for (int comp = 0; comp < 128; comp++) {
+        for (int dest = 1; dest <= 7; dest++) {
+            uint16_t word = C_CMD_PREFIX | comp << COMP_SHIFT | dest << DEST_SHIFT;
+            if (decode_word(word) != NULL) alphabet[alphabet_size++] = word;
+        }
+    }
+
+    search(max_len, verbose);
+    drop_subsumed();
+
+    FILE *out = out_path != NULL ? fopen(out_path, "w") : stdout;
+    if (out == NULL) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+    int num_rules = write_rules(out, max_len, min_count);
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "%d windows, %d rules\n", num_windows, num_rules);
+
+    table_free(&window_index);
+    table_free(&print_index);
+    table_free(&seen);
+    table_free(&first_probes);
+    free(windows);
+    return EXIT_SUCCESS;
+}
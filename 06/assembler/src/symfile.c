@@ -0,0 +1,169 @@
+/*
+ * Symbol map (.sym) writer for the nand2tetris assembler.
+ *
+ * Once a program is assembled, its symbols are gone from the binary. The symbol map keeps them: the
+ * ROM address of every label, the RAM address of every variable (and of every predefined symbol the
+ * program uses), and the source line every instruction came from. The disassembler reads it to
+ * restore names, and emulators and profilers can use it to map addresses back to the source.
+ *
+ * The text form has one record per line:
+ *
+ *     ROM <address> <label>
+ *     RAM <address> <variable>
+ *     SRC <address> <line>
+ *
+ * Instructions mostly come from consecutive lines, so source lines are stored as runs: a SRC record
+ * says the instruction at <address> came from <line>, and each instruction after it came from the
+ * line after the previous one's, up to the next SRC record. The binary form holds the same records:
+ * SYM_MAGIC, the int32 number of ROM, RAM, and SRC records, each ROM and RAM record as a uint16
+ * address followed by a uint16 length and the name, and each SRC record as a uint16 address followed
+ * by an int32 line. Numbers are in the machine's byte order.
+ *
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "lexer.h"
+#include "symfile.h"
+#include "../../../lib/hash_table.h"
+
+const char *SYM_EXT = ".sym";
+
+// A symbol and the address it resolved to
+typedef struct sym_entry {
+    int addr;
+    const char *name;
+} sym_entry;
+
+// Everything that goes into a symbol map
+typedef struct sym_map {
+    sym_entry *rom;     // Every label, in address order
+    int num_rom;
+    sym_entry *ram;     // Every variable and predefined symbol the program uses, in address order
+    int num_ram;
+    int *run_addrs;     // The ROM address each run of source lines starts at
+    int *run_lines;     // The source line each run starts at
+    int num_runs;
+} sym_map;
+
+
+static int compare_entries(const void *a, const void *b) {
+    const sym_entry *ea = a;
+    const sym_entry *eb = b;
+    return ea->addr != eb->addr ? ea->addr - eb->addr : strcmp(ea->name, eb->name);
+}
+
+/**
+ * Collects the symbol map of a program.
+ * @param instrs  The program, after resolve_program().
+ * @param map     The map to fill in. Its names point into @instrs.
+ */
+static void build_sym_map(const instr_list *instrs, sym_map *map) {
+    map->rom = malloc((instrs->count + 1) * sizeof(sym_entry));
+    map->ram = malloc((instrs->count + 1) * sizeof(sym_entry));
+    map->run_addrs = malloc((instrs->count + 1) * sizeof(int));
+    map->run_lines = malloc((instrs->count + 1) * sizeof(int));
+    map->num_rom = map->num_ram = map->num_runs = 0;
+
+    ht_hash_table *labels = ht_new(instrs->count + 1);
+    for (int i = 0; i < instrs->count; i++) {
+        const instruction *instr = &instrs->items[i];
+        if (instr->type == L_COMMAND) {
+            ht_insert(labels, instr->symbol, "");
+            map->rom[map->num_rom++] = (sym_entry){instr->word, instr->symbol};
+        }
+    }
+
+    ht_hash_table *seen = ht_new(instrs->count + 1);
+    int addr = 0;
+    int prev_line = -1;
+    for (int i = 0; i < instrs->count; i++) {
+        const instruction *instr = &instrs->items[i];
+        if (instr->type == L_COMMAND) {
+            continue;
+        }
+
+        if (instr->symbol != NULL) {
+            char *label = ht_search(labels, instr->symbol);
+            char *dup = ht_search(seen, instr->symbol);
+            if (label == NULL && dup == NULL) {
+                ht_insert(seen, instr->symbol, "");
+                map->ram[map->num_ram++] = (sym_entry){instr->word, instr->symbol};
+            }
+            free(label);
+            free(dup);
+        }
+
+        if (instr->line != prev_line + 1) {
+            map->run_addrs[map->num_runs] = addr;
+            map->run_lines[map->num_runs++] = instr->line;
+        }
+        prev_line = instr->line;
+        addr++;
+    }
+
+    if (map->num_ram > 0) {
+        qsort(map->ram, map->num_ram, sizeof(sym_entry), compare_entries);
+    }
+    ht_delete(seen);
+    ht_delete(labels);
+}
+
+static void write_entries(FILE *out, const sym_entry *entries, int n) {
+    for (int i = 0; i < n; i++) {
+        uint16_t addr = entries[i].addr;
+        uint16_t len = strlen(entries[i].name);
+        fwrite(&addr, sizeof(addr), 1, out);
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite(entries[i].name, sizeof(char), len, out);
+    }
+}
+
+/**
+ * Writes out the symbol map of a program.
+ * @param instrs  the program, after resolve_program()
+ * @param out     the file to write the map to
+ * @param binary  whether to write the binary form rather than the text form
+ */
+void write_sym_file(const instr_list *instrs, FILE *out, int binary) {
+    sym_map map;
+    build_sym_map(instrs, &map);
+
+    if (binary) {
+        int32_t counts[3] = {map.num_rom, map.num_ram, map.num_runs};
+        fwrite(SYM_MAGIC, sizeof(char), sizeof(SYM_MAGIC), out);
+        fwrite(counts, sizeof(int32_t), 3, out);
+        write_entries(out, map.rom, map.num_rom);
+        write_entries(out, map.ram, map.num_ram);
+        for (int i = 0; i < map.num_runs; i++) {
+            uint16_t addr = map.run_addrs[i];
+            int32_t line = map.run_lines[i];
+            fwrite(&addr, sizeof(addr), 1, out);
+            fwrite(&line, sizeof(line), 1, out);
+        }
+    } else {
+        fprintf(out, "// %s <address> <label>, %s <address> <variable>, and %s <address> <line>, where\n"
+            "// each instruction after <address> comes from the next line, up to the next %s\n",
+            SYM_ROM, SYM_RAM, SYM_SRC, SYM_SRC);
+        for (int i = 0; i < map.num_rom; i++) {
+            fprintf(out, "%s %d %s\n", SYM_ROM, map.rom[i].addr, map.rom[i].name);
+        }
+        for (int i = 0; i < map.num_ram; i++) {
+            fprintf(out, "%s %d %s\n", SYM_RAM, map.ram[i].addr, map.ram[i].name);
+        }
+        for (int i = 0; i < map.num_runs; i++) {
+            fprintf(out, "%s %d %d\n", SYM_SRC, map.run_addrs[i], map.run_lines[i]);
+        }
+    }
+
+    free(map.rom);
+    free(map.ram);
+    free(map.run_addrs);
+    free(map.run_lines);
+}
@@ -0,0 +1,18 @@
+/*
+ * Header file for the symbol map (.sym) writer for the nand2tetris assembler.
+ * @author Jesse Evers
+ * @email jesse27999@gmail.com
+ */
+
+#ifndef _SYMFILE_H
+#define _SYMFILE_H
+
+#include <stdio.h>
+
+#include "lexer.h"
+
+extern const char *SYM_EXT;  // The file extension to use for symbol maps
+
+void write_sym_file(const instr_list*, FILE*, int);
+
+#endif
@@ -3,12 +3,31 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include "alu.h"
+#include "batch.h"
+#include "constant.h"
+#include "corpus.h"
+#include "decoder.h"
 #include "encoder.h"
+#include "hackasm.h"
+#include "incremental.h"
 #include "../../../lib/hash_table.h"
 #include "minunit.h"
+#include "lexer.h"
+#include "object.h"
+#include "parallel.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "program.h"
+#include "rewrite.h"
+#include "rom.h"
+#include "stream.h"
 #include "symboltable.h"
+#include "symfile.h"
 
 int tests_run = 0;
 
@@ -17,184 +36,170 @@ void reinit_char(char **to_process) {
     *to_process = NULL;
 }
 
+// Checks whether @bits is exactly the binary number written out in @expected
+static int bits_eq(int bits, const char *expected) {
+    int len = strlen(expected);
+    for (int i = 0; i < len; i++) {
+        if (((bits >> (len - 1 - i)) & 1) != (expected[i] == '1')) {
+            return 0;
+        }
+    }
+    return bits >= 0 && bits < (1 << len);
+}
+
 // Test encoder.c
 static char *test_encoder() {
     // Test encode_dest()
-    const char *dest_m = encode_dest("M");
-    const char *dest_d = encode_dest("D");
-    const char *dest_md = encode_dest("MD");
-    const char *dest_dm = encode_dest("DM");
-    const char *dest_a = encode_dest("A");
-    const char *dest_am = encode_dest("AM");
-    const char *dest_ma = encode_dest("MA");
-    const char *dest_ad = encode_dest("AD");
-    const char *dest_da = encode_dest("DA");
-    const char *dest_amd = encode_dest("AMD");
-    const char *dest_adm = encode_dest("ADM");
-    const char *dest_mad = encode_dest("MAD");
-    const char *dest_mda = encode_dest("MDA");
-    const char *dest_dma = encode_dest("DMA");
-    const char *dest_dam = encode_dest("DAM");
-    mu_assert("NULL destination does not encode to 000", !strcmp(encode_dest(NULL), "000"));
-    mu_assert("destination M does not encode to 001", !strcmp(dest_m, "001"));
-    mu_assert("destination D does not encode to 010", !strcmp(dest_d, "010"));
-    mu_assert("destination MD does not encode to 011", !strcmp(dest_md, "011"));
+    int dest_m = encode_dest("M");
+    int dest_d = encode_dest("D");
+    int dest_md = encode_dest("MD");
+    int dest_dm = encode_dest("DM");
+    int dest_a = encode_dest("A");
+    int dest_am = encode_dest("AM");
+    int dest_ma = encode_dest("MA");
+    int dest_ad = encode_dest("AD");
+    int dest_da = encode_dest("DA");
+    int dest_amd = encode_dest("AMD");
+    int dest_adm = encode_dest("ADM");
+    int dest_mad = encode_dest("MAD");
+    int dest_mda = encode_dest("MDA");
+    int dest_dma = encode_dest("DMA");
+    int dest_dam = encode_dest("DAM");
+    mu_assert("NULL destination does not encode to 000", encode_dest(NULL) == 0);
+    mu_assert("destination M does not encode to 001", bits_eq(dest_m, "001"));
+    mu_assert("destination D does not encode to 010", bits_eq(dest_d, "010"));
+    mu_assert("destination MD does not encode to 011", bits_eq(dest_md, "011"));
     mu_assert("destinations MD and DM do not encode to the same value",
-        !strcmp(dest_md, dest_dm));
-    mu_assert("destination A does not encode to 100", !strcmp(dest_a, "100"));
-    mu_assert("destination AM does not encode to 101", !strcmp(dest_am, "101"));
+        dest_md == dest_dm);
+    mu_assert("destination A does not encode to 100", bits_eq(dest_a, "100"));
+    mu_assert("destination AM does not encode to 101", bits_eq(dest_am, "101"));
     mu_assert("destinations AM and MA do not encode to the same value",
-        !strcmp(dest_am, dest_ma));
-    mu_assert("destination AD does not encode to 110", !strcmp(dest_ad, "110"));
+        dest_am == dest_ma);
+    mu_assert("destination AD does not encode to 110", bits_eq(dest_ad, "110"));
     mu_assert("destinations AD and DA do not encode to the same value",
-        !strcmp(dest_ad, dest_da));
-    mu_assert("destination AMD does not encode to 111", !strcmp(dest_amd, "111"));
+        dest_ad == dest_da);
+    mu_assert("destination AMD does not encode to 111", bits_eq(dest_amd, "111"));
     mu_assert("destinations AMD, ADM, MAD, MDA, DMA, and DAM do not encode to the same value",
-        !strcmp(dest_amd, dest_adm) &&
-        !strcmp(dest_amd, dest_mad) &&
-        !strcmp(dest_amd, dest_mda) &&
-        !strcmp(dest_amd, dest_dma) &&
-        !strcmp(dest_amd, dest_dam));
+        dest_amd == dest_adm &&
+        dest_amd == dest_mad &&
+        dest_amd == dest_mda &&
+        dest_amd == dest_dma &&
+        dest_amd == dest_dam);
 
     // Test encode_comp()
-    char *comp_0 = encode_comp("0");
-    char *comp_1 = encode_comp("1");
-    char *comp_neg_1 = encode_comp("-1");
-    char *comp_d = encode_comp("D");
-    char *comp_a = encode_comp("A");
-    char *comp_m = encode_comp("M");
-    char *comp_not_d = encode_comp("!D");
-    char *comp_not_a = encode_comp("!A");
-    char *comp_not_m = encode_comp("!M");
-    char *comp_neg_d = encode_comp("-D");
-    char *comp_neg_a = encode_comp("-A");
-    char *comp_neg_m = encode_comp("-M");
-    char *comp_d_plus_1 = encode_comp("D+1");
-    char *comp_1_plus_d = encode_comp("1+D");
-    char *comp_a_plus_1 = encode_comp("A+1");
-    char *comp_1_plus_a = encode_comp("1+A");
-    char *comp_m_plus_1 = encode_comp("M+1");
-    char *comp_1_plus_m = encode_comp("1+M");
-    char *comp_d_min_1 = encode_comp("D-1");
-    char *comp_a_min_1 = encode_comp("A-1");
-    char *comp_m_min_1 = encode_comp("M-1");
-    char *comp_d_plus_a = encode_comp("D+A");
-    char *comp_a_plus_d = encode_comp("A+D");
-    char *comp_d_plus_m = encode_comp("D+M");
-    char *comp_m_plus_d = encode_comp("M+D");
-    char *comp_d_min_a = encode_comp("D-A");
-    char *comp_d_min_m = encode_comp("D-M");
-    char *comp_a_min_d = encode_comp("A-D");
-    char *comp_m_min_d = encode_comp("M-D");
-    char *comp_d_and_a = encode_comp("D&A");
-    char *comp_a_and_d = encode_comp("A&D");
-    char *comp_d_and_m = encode_comp("D&M");
-    char *comp_m_and_d = encode_comp("M&D");
-    char *comp_d_or_a = encode_comp("D|A");
-    char *comp_a_or_d = encode_comp("A|D");
-    char *comp_d_or_m = encode_comp("D|M");
-    char *comp_m_or_d = encode_comp("M|D");
-    mu_assert("computation 0 does not encode to 0101010", !strcmp(comp_0, "0101010"));
-    mu_assert("computation 1 does not encode to 0111111", !strcmp(comp_1, "0111111"));
-    mu_assert("computation -1 does not encode to 0111010", !strcmp(comp_neg_1, "0111010"));
-    mu_assert("computation D does not encode to 0001100", !strcmp(comp_d, "0001100"));
-    mu_assert("computation A does not encode to 0110000", !strcmp(comp_a, "0110000"));
-    mu_assert("computation M does not encode to 1110000", !strcmp(comp_m, "1110000"));
-    mu_assert("computation !D does not encode to 0001101", !strcmp(comp_not_d, "0001101"));
-    mu_assert("computation !A does not encode to 0110001", !strcmp(comp_not_a, "0110001"));
-    mu_assert("computation !M does not encode to 1110001", !strcmp(comp_not_m, "1110001"));
-    mu_assert("computation -D does not encode to 0001111", !strcmp(comp_neg_d, "0001111"));
-    mu_assert("computation -A does not encode to 0110011", !strcmp(comp_neg_a, "0110011"));
-    mu_assert("computation -M does not encode to 1110011", !strcmp(comp_neg_m, "1110011"));
-    mu_assert("computation D+1 does not encode to 0011111", !strcmp(comp_d_plus_1, "0011111"));
+    int comp_0 = encode_comp("0");
+    int comp_1 = encode_comp("1");
+    int comp_neg_1 = encode_comp("-1");
+    int comp_d = encode_comp("D");
+    int comp_a = encode_comp("A");
+    int comp_m = encode_comp("M");
+    int comp_not_d = encode_comp("!D");
+    int comp_not_a = encode_comp("!A");
+    int comp_not_m = encode_comp("!M");
+    int comp_neg_d = encode_comp("-D");
+    int comp_neg_a = encode_comp("-A");
+    int comp_neg_m = encode_comp("-M");
+    int comp_d_plus_1 = encode_comp("D+1");
+    int comp_1_plus_d = encode_comp("1+D");
+    int comp_a_plus_1 = encode_comp("A+1");
+    int comp_1_plus_a = encode_comp("1+A");
+    int comp_m_plus_1 = encode_comp("M+1");
+    int comp_1_plus_m = encode_comp("1+M");
+    int comp_d_min_1 = encode_comp("D-1");
+    int comp_a_min_1 = encode_comp("A-1");
+    int comp_m_min_1 = encode_comp("M-1");
+    int comp_d_plus_a = encode_comp("D+A");
+    int comp_a_plus_d = encode_comp("A+D");
+    int comp_d_plus_m = encode_comp("D+M");
+    int comp_m_plus_d = encode_comp("M+D");
+    int comp_d_min_a = encode_comp("D-A");
+    int comp_d_min_m = encode_comp("D-M");
+    int comp_a_min_d = encode_comp("A-D");
+    int comp_m_min_d = encode_comp("M-D");
+    int comp_d_and_a = encode_comp("D&A");
+    int comp_a_and_d = encode_comp("A&D");
+    int comp_d_and_m = encode_comp("D&M");
+    int comp_m_and_d = encode_comp("M&D");
+    int comp_d_or_a = encode_comp("D|A");
+    int comp_a_or_d = encode_comp("A|D");
+    int comp_d_or_m = encode_comp("D|M");
+    int comp_m_or_d = encode_comp("M|D");
+    mu_assert("computation 0 does not encode to 0101010", bits_eq(comp_0, "0101010"));
+    mu_assert("computation 1 does not encode to 0111111", bits_eq(comp_1, "0111111"));
+    mu_assert("computation -1 does not encode to 0111010", bits_eq(comp_neg_1, "0111010"));
+    mu_assert("computation D does not encode to 0001100", bits_eq(comp_d, "0001100"));
+    mu_assert("computation A does not encode to 0110000", bits_eq(comp_a, "0110000"));
+    mu_assert("computation M does not encode to 1110000", bits_eq(comp_m, "1110000"));
+    mu_assert("computation !D does not encode to 0001101", bits_eq(comp_not_d, "0001101"));
+    mu_assert("computation !A does not encode to 0110001", bits_eq(comp_not_a, "0110001"));
+    mu_assert("computation !M does not encode to 1110001", bits_eq(comp_not_m, "1110001"));
+    mu_assert("computation -D does not encode to 0001111", bits_eq(comp_neg_d, "0001111"));
+    mu_assert("computation -A does not encode to 0110011", bits_eq(comp_neg_a, "0110011"));
+    mu_assert("computation -M does not encode to 1110011", bits_eq(comp_neg_m, "1110011"));
+    mu_assert("computation D+1 does not encode to 0011111", bits_eq(comp_d_plus_1, "0011111"));
     mu_assert("computations D+1 and 1+D do not encode to the same thing",
-        !strcmp(comp_d_plus_1, comp_1_plus_d));
-    mu_assert("computation A+1 does not encode to 0110111", !strcmp(comp_a_plus_1, "0110111"));
+        comp_d_plus_1 == comp_1_plus_d);
+    mu_assert("computation A+1 does not encode to 0110111", bits_eq(comp_a_plus_1, "0110111"));
     mu_assert("computations A+1 and 1+A do not encode to the same thing",
-        !strcmp(comp_a_plus_1, comp_1_plus_a));
-    mu_assert("computation M+1 does not encode to 1110111", !strcmp(comp_m_plus_1, "1110111"));
+        comp_a_plus_1 == comp_1_plus_a);
+    mu_assert("computation M+1 does not encode to 1110111", bits_eq(comp_m_plus_1, "1110111"));
     mu_assert("computations M+1 and 1+M do not encode to the same thing",
-        !strcmp(comp_m_plus_1, comp_1_plus_m));
-    mu_assert("computation D-1 does not encode to 0001110", !strcmp(comp_d_min_1, "0001110"));
-    mu_assert("computation A-1 does not encode to 0110010", !strcmp(comp_a_min_1, "0110010"));
-    mu_assert("computation M-1 does not encode to 1110010", !strcmp(comp_m_min_1, "1110010"));
-    mu_assert("computation D+A does not encode to 0000010", !strcmp(comp_d_plus_a, "0000010"));
+        comp_m_plus_1 == comp_1_plus_m);
+    mu_assert("computation D-1 does not encode to 0001110", bits_eq(comp_d_min_1, "0001110"));
+    mu_assert("computation A-1 does not encode to 0110010", bits_eq(comp_a_min_1, "0110010"));
+    mu_assert("computation M-1 does not encode to 1110010", bits_eq(comp_m_min_1, "1110010"));
+    mu_assert("computation D+A does not encode to 0000010", bits_eq(comp_d_plus_a, "0000010"));
     mu_assert("computations D+A and A+D do not encode to the same thing",
-        !strcmp(comp_d_plus_a, comp_a_plus_d));
-    mu_assert("computation D+M does not encode to 1000010", !strcmp(comp_d_plus_m, "1000010"));
+        comp_d_plus_a == comp_a_plus_d);
+    mu_assert("computation D+M does not encode to 1000010", bits_eq(comp_d_plus_m, "1000010"));
     mu_assert("computations D+M and M+D do not encode to the same thing",
-        !strcmp(comp_d_plus_m, comp_m_plus_d));
-    mu_assert("computation D-A does not encode to 0010011", !strcmp(comp_d_min_a, "0010011"));
-    mu_assert("computation D-M does not encode to 1010011", !strcmp(comp_d_min_m, "1010011"));
-    mu_assert("computation A-D does not encode to 0000111", !strcmp(comp_a_min_d, "0000111"));
-    mu_assert("computation M-D does not encode to 1000111", !strcmp(comp_m_min_d, "1000111"));
-    mu_assert("computation D&A does not encode to 0000000", !strcmp(comp_d_and_a, "0000000"));
+        comp_d_plus_m == comp_m_plus_d);
+    mu_assert("computation D-A does not encode to 0010011", bits_eq(comp_d_min_a, "0010011"));
+    mu_assert("computation D-M does not encode to 1010011", bits_eq(comp_d_min_m, "1010011"));
+    mu_assert("computation A-D does not encode to 0000111", bits_eq(comp_a_min_d, "0000111"));
+    mu_assert("computation M-D does not encode to 1000111", bits_eq(comp_m_min_d, "1000111"));
+    mu_assert("computation D&A does not encode to 0000000", bits_eq(comp_d_and_a, "0000000"));
     mu_assert("computations D&A and A&D do not encode to the same thing",
-        !strcmp(comp_d_and_a, comp_a_and_d));
-    mu_assert("computation D&M does not encode to 1000000", !strcmp(comp_d_and_m, "1000000"));
+        comp_d_and_a == comp_a_and_d);
+    mu_assert("computation D&M does not encode to 1000000", bits_eq(comp_d_and_m, "1000000"));
     mu_assert("computations D&M and M&D do not encode to the same thing",
-        !strcmp(comp_d_and_m, comp_m_and_d));
-    mu_assert("computation D|A does not encode to 0010101", !strcmp(comp_d_or_a, "0010101"));
+        comp_d_and_m == comp_m_and_d);
+    mu_assert("computation D|A does not encode to 0010101", bits_eq(comp_d_or_a, "0010101"));
     mu_assert("computations D|A and A|D do not encode to the same thing",
-        !strcmp(comp_d_or_a, comp_a_or_d));
-    mu_assert("computation D|M does not encode to 1010101", !strcmp(comp_d_or_m, "1010101"));
+        comp_d_or_a == comp_a_or_d);
+    mu_assert("computation D|M does not encode to 1010101", bits_eq(comp_d_or_m, "1010101"));
     mu_assert("computations D|M and M|D do not encode to the same thing",
-        !strcmp(comp_d_or_m, comp_m_or_d));
-    reinit_char(&comp_0);
-    reinit_char(&comp_1);
-    reinit_char(&comp_neg_1);
-    reinit_char(&comp_d);
-    reinit_char(&comp_a);
-    reinit_char(&comp_m);
-    reinit_char(&comp_not_d);
-    reinit_char(&comp_not_a);
-    reinit_char(&comp_not_m);
-    reinit_char(&comp_neg_d);
-    reinit_char(&comp_neg_a);
-    reinit_char(&comp_neg_m);
-    reinit_char(&comp_d_plus_1);
-    reinit_char(&comp_1_plus_d);
-    reinit_char(&comp_a_plus_1);
-    reinit_char(&comp_1_plus_a);
-    reinit_char(&comp_m_plus_1);
-    reinit_char(&comp_1_plus_m);
-    reinit_char(&comp_d_min_1);
-    reinit_char(&comp_a_min_1);
-    reinit_char(&comp_m_min_1);
-    reinit_char(&comp_d_plus_a);
-    reinit_char(&comp_a_plus_d);
-    reinit_char(&comp_d_plus_m);
-    reinit_char(&comp_m_plus_d);
-    reinit_char(&comp_d_min_a);
-    reinit_char(&comp_d_min_m);
-    reinit_char(&comp_a_min_d);
-    reinit_char(&comp_m_min_d);
-    reinit_char(&comp_d_and_a);
-    reinit_char(&comp_a_and_d);
-    reinit_char(&comp_d_and_m);
-    reinit_char(&comp_m_and_d);
-    reinit_char(&comp_d_or_a);
-    reinit_char(&comp_a_or_d);
-    reinit_char(&comp_d_or_m);
-    reinit_char(&comp_m_or_d);
-
+        comp_d_or_m == comp_m_or_d);
 
     // Test encode_jump()
-    const char *jmp_gt = encode_jump("JGT");
-    const char *jmp_eq = encode_jump("JEQ");
-    const char *jmp_ge = encode_jump("JGE");
-    const char *jmp_lt = encode_jump("JLT");
-    const char *jmp_ne = encode_jump("JNE");
-    const char *jmp_le = encode_jump("JLE");
-    const char *jmp_always = encode_jump("JMP");
-    mu_assert("NULL jump code does not encode to 000", !strcmp(encode_jump(NULL), "000"));
-    mu_assert("jump code JGT does not encode to 001", !strcmp(jmp_gt, "001"));
-    mu_assert("jump code JEQ does not encode to 010", !strcmp(jmp_eq, "010"));
-    mu_assert("jump code JGE does not encode to 011", !strcmp(jmp_ge, "011"));
-    mu_assert("jump code JLT does not encode to 100", !strcmp(jmp_lt, "100"));
-    mu_assert("jump code JNE does not encode to 101", !strcmp(jmp_ne, "101"));
-    mu_assert("jump code JLE does not encode to 110", !strcmp(jmp_le, "110"));
-    mu_assert("jump code JMP does not encode to 111", !strcmp(jmp_always, "111"));
+    int jmp_gt = encode_jump("JGT");
+    int jmp_eq = encode_jump("JEQ");
+    int jmp_ge = encode_jump("JGE");
+    int jmp_lt = encode_jump("JLT");
+    int jmp_ne = encode_jump("JNE");
+    int jmp_le = encode_jump("JLE");
+    int jmp_always = encode_jump("JMP");
+    mu_assert("NULL jump code does not encode to 000", encode_jump(NULL) == 0);
+    mu_assert("jump code JGT does not encode to 001", bits_eq(jmp_gt, "001"));
+    mu_assert("jump code JEQ does not encode to 010", bits_eq(jmp_eq, "010"));
+    mu_assert("jump code JGE does not encode to 011", bits_eq(jmp_ge, "011"));
+    mu_assert("jump code JLT does not encode to 100", bits_eq(jmp_lt, "100"));
+    mu_assert("jump code JNE does not encode to 101", bits_eq(jmp_ne, "101"));
+    mu_assert("jump code JLE does not encode to 110", bits_eq(jmp_le, "110"));
+    mu_assert("jump code JMP does not encode to 111", bits_eq(jmp_always, "111"));
+
+    // Test encode_c_command() and the packed-mnemonic lookups
+    mu_assert("encode_c_command did not correctly encode AM=M+1;JMP",
+        bits_eq(encode_c_command("AM", "M+1", "JMP"), "1111110111101111"));
+    mu_assert("encode_c_command did not correctly encode D&A with no destination or jump",
+        bits_eq(encode_c_command(NULL, "D&A", NULL), "1110000000000000"));
+    mu_assert("pack_mnemonic did not reject a mnemonic longer than 3 characters",
+        pack_mnemonic("AMDM") == 0);
+    mu_assert("lookup_comp did not reject an invalid computation", lookup_comp(pack_mnemonic("D*A")) == -1);
+    mu_assert("lookup_comp did not reject an empty computation", lookup_comp(pack_mnemonic("")) == -1);
+    mu_assert("lookup_dest did not reject a destination with a repeated register",
+        lookup_dest(pack_mnemonic("MM")) == -1);
+    mu_assert("lookup_jump did not reject an invalid jump", lookup_jump(pack_mnemonic("JXX")) == -1);
 
 
     return 0;
@@ -509,10 +514,1118 @@ static char *test_parser() {
     return 0;
 }
 
+// Assembles @path serially into a temporary file, and returns that file rewound to the beginning
+static FILE *assemble_serial(const char *path) {
+    FILE *in = fopen(path, "r");
+    FILE *out = tmpfile();
+    ht_hash_table *ht = constructor(10000);
+    first_pass(in, ht);
+    fseek(in, 0, SEEK_SET);
+    second_pass(in, out, ht);
+    ht_delete(ht);
+    fclose(in);
+    rewind(out);
+    return out;
+}
+
+// Checks that two files have exactly the same contents
+static int same_contents(FILE *a, FILE *b) {
+    int ca, cb;
+    do {
+        ca = fgetc(a);
+        cb = fgetc(b);
+    } while (ca == cb && ca != EOF);
+    return ca == cb;
+}
+
+static char *test_parallel() {
+    // Test lex_line()
+    char scratch[64];
+    instruction instr;
+    mu_assert("lex_line did not skip a full-line comment",
+        !lex_line("  // comment", strlen("  // comment"), scratch, &instr));
+    mu_assert("lex_line did not skip a blank line", !lex_line(" \t", 2, scratch, &instr));
+    mu_assert("lex_line did not lex a C_COMMAND with an inline comment",
+        lex_line("  AM=M+1;JMP // inc", strlen("  AM=M+1;JMP // inc"), scratch, &instr)
+        && instr.type == C_COMMAND && bits_eq(instr.word, "1111110111101111"));
+    mu_assert("lex_line did not lex a numeric A_COMMAND",
+        lex_line("@2297", 5, scratch, &instr) && instr.type == A_COMMAND && instr.symbol == NULL
+        && instr.word == 2297);
+    mu_assert("lex_line did not lex a symbolic A_COMMAND",
+        lex_line("@LOOP", 5, scratch, &instr) && instr.type == A_COMMAND && !strcmp(instr.symbol, "LOOP"));
+    reinit_char(&instr.symbol);
+    mu_assert("lex_line did not lex an L_COMMAND",
+        lex_line("(END)", 5, scratch, &instr) && instr.type == L_COMMAND && !strcmp(instr.symbol, "END"));
+    reinit_char(&instr.symbol);
+
+    // Test assemble_parallel() against the serial assembler, with more threads than some inputs have
+    // lines
+    const char *paths[] = {"../rect/Rect.asm", "../max/Max.asm", "../pong/Pong.asm"};
+    const int thread_counts[] = {1, 2, 7, 64};
+    for (unsigned int i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        for (unsigned int j = 0; j < sizeof(thread_counts) / sizeof(thread_counts[0]); j++) {
+            FILE *in = fopen(paths[i], "r");
+            size_t len = 0;
+            char *src = read_all(in, &len);
+            fclose(in);
+
+            FILE *out = tmpfile();
+            ht_hash_table *ht = constructor(10000);
+            assemble_parallel(src, len, out, ht, thread_counts[j]);
+            ht_delete(ht);
+            free(src);
+            rewind(out);
+
+            FILE *expected = assemble_serial(paths[i]);
+            int same = same_contents(out, expected);
+            fclose(out);
+            fclose(expected);
+            mu_assert("assemble_parallel output differs from the serial assembler's", same);
+        }
+    }
+
+    return 0;
+}
+
+static char *test_pipeline() {
+    // Test ring_try_push() and ring_try_pop()
+    spsc_ring ring;
+    int items[RING_CAPACITY + 1];
+    void *popped = NULL;
+    ring_init(&ring);
+    mu_assert("ring_try_pop popped from an empty ring", !ring_try_pop(&ring, &popped));
+    for (int i = 0; i < RING_CAPACITY; i++) {
+        mu_assert("ring_try_push failed on a ring that wasn't full", ring_try_push(&ring, &items[i]));
+    }
+    mu_assert("ring_try_push pushed onto a full ring", !ring_try_push(&ring, &items[RING_CAPACITY]));
+    mu_assert("ring_try_pop did not pop items in the order they were pushed",
+        ring_try_pop(&ring, &popped) && popped == &items[0]);
+    mu_assert("ring_try_push failed after space was freed up", ring_try_push(&ring, &items[RING_CAPACITY]));
+
+    // Test second_pass_pipelined() against second_pass()
+    const char *path = "../pong/Pong.asm";
+    FILE *in = fopen(path, "r");
+    FILE *out = tmpfile();
+    ht_hash_table *ht = constructor(10000);
+    stage_stats stats[NUM_STAGES];
+    first_pass(in, ht);
+    fseek(in, 0, SEEK_SET);
+    second_pass_pipelined(in, out, ht, stats);
+    ht_delete(ht);
+    fclose(in);
+    rewind(out);
+
+    FILE *expected = assemble_serial(path);
+    int same = same_contents(out, expected);
+    fclose(out);
+    fclose(expected);
+    mu_assert("second_pass_pipelined output differs from second_pass's", same);
+    mu_assert("second_pass_pipelined did not count the batches each stage handled",
+        stats[STAGE_READER].batches > 0 && stats[STAGE_ENCODER].batches > 0 && stats[STAGE_WRITER].batches > 0);
+
+    return 0;
+}
+
+static char *test_stream() {
+    // Seekable output, so fixups are patched in place
+    const char *path = "../pong/Pong.asm";
+    FILE *in = fopen(path, "r");
+    FILE *out = tmpfile();
+    ht_hash_table *ht = constructor(4096);
+    assemble_stream(in, out, ht);
+    ht_delete(ht);
+    fclose(in);
+    rewind(out);
+
+    FILE *expected = assemble_serial(path);
+    int same = same_contents(out, expected);
+    fclose(out);
+    fclose(expected);
+    mu_assert("assemble_stream output to a file differs from second_pass's", same);
+
+    // Unseekable output, so words behind a forward reference are queued
+    path = "../rect/Rect.asm";
+    int fds[2];
+    mu_assert("pipe() failed", pipe(fds) == 0);
+    in = fopen(path, "r");
+    out = fdopen(fds[1], "w");
+    ht = constructor(4096);
+    assemble_stream(in, out, ht);
+    ht_delete(ht);
+    fclose(in);
+    fclose(out);
+
+    FILE *piped = fdopen(fds[0], "r");
+    expected = assemble_serial(path);
+    same = same_contents(piped, expected);
+    fclose(piped);
+    fclose(expected);
+    mu_assert("assemble_stream output to a pipe differs from second_pass's", same);
+
+    // A variable used at the start keeps the whole program queued, until it's moved to a file
+    char long_path[] = "/tmp/assembler_stream_XXXXXX";
+    int long_fd = mkstemp(long_path);
+    mu_assert("mkstemp() failed", long_fd >= 0);
+    FILE *long_src = fdopen(long_fd, "w");
+    fputs("@x\nD=M\n", long_src);
+    for (int i = 0; i < STREAM_QUEUE_MAX + 100; i++) {
+        fputs(i % 500 ? "D=D+1\n" : "@x\nM=D\n", long_src);
+    }
+    fputs("(END)\n@y\nM=D\n@END\n0;JMP\n", long_src);
+    fclose(long_src);
+
+    mu_assert("pipe() failed", pipe(fds) == 0);
+    in = fopen(long_path, "r");
+    out = fdopen(fds[1], "w");
+    ht = constructor(4096);
+    assemble_stream(in, out, ht);
+    ht_delete(ht);
+    fclose(in);
+    fclose(out);
+
+    piped = fdopen(fds[0], "r");
+    expected = assemble_serial(long_path);
+    same = same_contents(piped, expected);
+    fclose(piped);
+    fclose(expected);
+    remove(long_path);
+    mu_assert("assemble_stream output to a pipe differs from second_pass's once its queue is full",
+        same);
+
+    return 0;
+}
+
+// Copies @src to @dst
+static void copy_file(const char *src, const char *dst) {
+    FILE *in = fopen(src, "r");
+    FILE *out = fopen(dst, "w");
+    size_t len = 0;
+    char *buf = read_all(in, &len);
+    fwrite(buf, sizeof(char), len, out);
+    free(buf);
+    fclose(in);
+    fclose(out);
+}
+
+static char *test_batch() {
+    // Build a directory tree with a program at each level
+    char dir[] = "/tmp/assembler_test_XXXXXX";
+    mu_assert("mkdtemp() failed", mkdtemp(dir) != NULL);
+    char sub[64], max_asm[64], pong_asm[128], max_hack[64], pong_hack[128];
+    char bad_asm[64], bad_hack[64];
+    snprintf(sub, sizeof(sub), "%s/pong", dir);
+    snprintf(max_asm, sizeof(max_asm), "%s/Max.asm", dir);
+    snprintf(pong_asm, sizeof(pong_asm), "%s/Pong.asm", sub);
+    snprintf(max_hack, sizeof(max_hack), "%s/Max.hack", dir);
+    snprintf(pong_hack, sizeof(pong_hack), "%s/Pong.hack", sub);
+    snprintf(bad_asm, sizeof(bad_asm), "%s/Bad.asm", dir);
+    snprintf(bad_hack, sizeof(bad_hack), "%s/Bad.hack", dir);
+    mkdir(sub, 0700);
+    copy_file("../max/Max.asm", max_asm);
+    copy_file("../pong/Pong.asm", pong_asm);
+    FILE *bad = fopen(bad_asm, "w");
+    fputs("@2\nD=Q\n", bad);
+    fclose(bad);
+
+    // Test collect_asm_files()
+    file_list files;
+    file_list_init(&files);
+    mu_assert("collect_asm_files failed on a readable directory", !collect_asm_files(dir, &files));
+    mu_assert("collect_asm_files did not find every .asm file in a directory tree", files.count == 3);
+    mu_assert("collect_asm_files did not add a missing file as-is",
+        !collect_asm_files("../missing.asm", &files) && files.count == 4);
+
+    // Test assemble_batch() against second_pass()
+    batch_stats stats;
+    assemble_batch(&files, 2, &stats);
+    mu_assert("assemble_batch did not count every file", stats.num_files == 4);
+    mu_assert("assemble_batch did not count the missing and invalid files as failures",
+        stats.num_failed == 2);
+    mu_assert("assemble_batch wrote a .hack file for an invalid program", access(bad_hack, F_OK));
+
+    const char *sources[] = {"../max/Max.asm", "../pong/Pong.asm"};
+    const char *outputs[] = {max_hack, pong_hack};
+    long num_instrs = 0;
+    for (int i = 0; i < 2; i++) {
+        FILE *out = fopen(outputs[i], "r");
+        FILE *expected = assemble_serial(sources[i]);
+        int same = out != NULL && same_contents(out, expected);
+        if (out) {
+            fseek(out, 0, SEEK_END);
+            num_instrs += ftell(out) / (WORD + 1);
+            fclose(out);
+        }
+        fclose(expected);
+        mu_assert("assemble_batch output differs from second_pass's", same);
+    }
+    mu_assert("assemble_batch miscounted the instructions it wrote", stats.num_instrs == num_instrs);
+
+    file_list_free(&files);
+    remove(max_asm);
+    remove(max_hack);
+    remove(pong_asm);
+    remove(pong_hack);
+    remove(bad_asm);
+    rmdir(sub);
+    rmdir(dir);
+
+    return 0;
+}
+
+// Incrementally assembles @src and checks the result against serially assembling @path
+static int incremental_matches(const char *src, size_t len, const char *path, const char *cache_path,
+                               incr_stats *stats) {
+    FILE *out = tmpfile();
+    ht_hash_table *ht = constructor(10000);
+    assemble_incremental(src, len, out, ht, cache_path, stats);
+    ht_delete(ht);
+    rewind(out);
+
+    FILE *expected = assemble_serial(path);
+    int same = same_contents(out, expected);
+    fclose(out);
+    fclose(expected);
+    return same;
+}
+
+static char *test_incremental() {
+    // Test hash_block()
+    mu_assert("hash_block gave different hashes for the same text",
+        hash_block("D=M\n", 4) == hash_block("D=M\n", 4));
+    mu_assert("hash_block gave the same hash for different text",
+        hash_block("D=M\n", 4) != hash_block("D=A\n", 4));
+
+    char dir[] = "/tmp/assembler_test_XXXXXX";
+    mu_assert("mkdtemp() failed", mkdtemp(dir) != NULL);
+    char path[64], cache_path[64];
+    snprintf(path, sizeof(path), "%s/Pong.asm", dir);
+    snprintf(cache_path, sizeof(cache_path), "%s/Pong.hack.cache", dir);
+
+    FILE *in = fopen("../pong/Pong.asm", "r");
+    size_t len = 0;
+    char *src = read_all(in, &len);
+    fclose(in);
+
+    // Without a cache, every block has to be lexed
+    incr_stats stats;
+    mu_assert("assemble_incremental output differs from second_pass's without a cache",
+        incremental_matches(src, len, "../pong/Pong.asm", cache_path, &stats));
+    mu_assert("assemble_incremental reused blocks without a cache",
+        stats.num_blocks > 1 && stats.relexed == stats.num_blocks);
+
+    // With nothing changed, every block is reused as-is
+    mu_assert("assemble_incremental output differs from second_pass's with an up-to-date cache",
+        incremental_matches(src, len, "../pong/Pong.asm", cache_path, &stats));
+    mu_assert("assemble_incremental did not reuse every block of an unchanged program",
+        stats.reused == stats.num_blocks && stats.relexed == 0);
+
+    // Insert a variable reference halfway through, which moves every label after it
+    const char *insert = "@incremental_test_var\nM=D\n";
+    const char *mid = memchr(src + len / 2, '\n', len - len / 2) + 1;
+    FILE *edited = fopen(path, "w");
+    fwrite(src, sizeof(char), mid - src, edited);
+    fputs(insert, edited);
+    fwrite(mid, sizeof(char), src + len - mid, edited);
+    fclose(edited);
+    free(src);
+
+    in = fopen(path, "r");
+    src = read_all(in, &len);
+    fclose(in);
+    mu_assert("assemble_incremental output differs from second_pass's after an edit",
+        incremental_matches(src, len, path, cache_path, &stats));
+    mu_assert("assemble_incremental re-lexed more than the edited block",
+        stats.relexed == 1 && stats.reresolved > 0 && stats.reused > 0);
+    free(src);
+
+    // A corrupt cache is ignored
+    FILE *cache = fopen(cache_path, "r+");
+    fseek(cache, 12, SEEK_SET);
+    fputs("corrupt", cache);
+    fclose(cache);
+    in = fopen(path, "r");
+    src = read_all(in, &len);
+    fclose(in);
+    mu_assert("assemble_incremental output differs from second_pass's with a corrupt cache",
+        incremental_matches(src, len, path, cache_path, &stats));
+    free(src);
+
+    remove(path);
+    remove(cache_path);
+    rmdir(dir);
+
+    return 0;
+}
+
+static char *test_decoder() {
+    decoder_init();
+
+    // Test decode_word()
+    mu_assert("decode_word did not decode an A_COMMAND", !strcmp(decode_word(2297), "@2297"));
+    mu_assert("decode_word did not use the first listed destination and computation",
+        !strcmp(decode_word(encode_c_command("DM", "M+D", NULL)), "MD=D+M"));
+    mu_assert("decode_word did not decode a jump", !strcmp(decode_word(encode_c_command(NULL, "0", "JMP")),
+        "0;JMP"));
+    mu_assert("decode_word decoded a word without the C_COMMAND prefix", decode_word(0x8000) == NULL);
+    mu_assert("decode_word decoded an unknown computation", decode_word(0xE000 | 0x20 << 6) == NULL);
+
+    // Every word that decodes should assemble back to itself
+    char scratch[DECODED_LEN + 1];
+    int round_trips = 1;
+    for (int word = 0; word < NUM_WORDS && round_trips; word++) {
+        const char *text = decode_word(word);
+        instruction instr;
+        if (text != NULL) {
+            round_trips = lex_line(text, strlen(text), scratch, &instr) && instr.word == word
+                && instr.symbol == NULL;
+        }
+    }
+    mu_assert("decode_word output did not assemble back to the same word", round_trips);
+
+    // Test disassemble() with symbols restored
+    FILE *sym_file = tmpfile();
+    fputs("// Symbols\nROM 2 LOOP\nRAM 16 i\n", sym_file);
+    rewind(sym_file);
+    char sym_path[64];
+    snprintf(sym_path, sizeof(sym_path), "/proc/self/fd/%d", fileno(sym_file));
+    sym_table syms;
+    sym_table_init(&syms);
+    mu_assert("load_sym_file failed on a valid .sym file", !load_sym_file(sym_path, &syms));
+    fclose(sym_file);
+
+    FILE *in = tmpfile();
+    fputs("0000000000010000\n1111110000010000\n0000000000000010\n1110101010000111\n", in);
+    rewind(in);
+    FILE *out = tmpfile();
+    mu_assert("disassemble failed on a valid .hack file", !disassemble(in, out, &syms));
+    rewind(out);
+    char text[256] = {0};
+    fread(text, sizeof(char), sizeof(text) - 1, out);
+    mu_assert("disassemble did not restore symbols",
+        !strcmp(text, "    @i\n    D=M\n(LOOP)\n    @LOOP\n    0;JMP\n"));
+    fclose(in);
+    fclose(out);
+    sym_table_free(&syms);
+
+    // Test disassemble() on a file that isn't .hack
+    in = tmpfile();
+    fputs("0000000000010000\n@16\n", in);
+    rewind(in);
+    out = tmpfile();
+    mu_assert("disassemble accepted a line that isn't a binary word", disassemble(in, out, NULL) == -1);
+    fclose(in);
+    fclose(out);
+
+    return 0;
+}
+
+// Runs an optimizer pass over a program, and returns how many ROM instructions are left
+static int run_pass(void (*pass)(instr_list*, opt_stats*), const char *src, opt_stats *stats) {
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, strlen(src), &instrs);
+    pass(&instrs, stats);
+    int size = count_rom(&instrs);
+    instr_list_free(&instrs);
+    return size;
+}
+
+static int optimized_size(const char *src, opt_stats *stats) {
+    return run_pass(peephole, src, stats);
+}
+
+static int pruned_size(const char *src, opt_stats *stats) {
+    return run_pass(eliminate_unreachable, src, stats);
+}
+
+static int laid_out_size(const char *src, opt_stats *stats) {
+    return run_pass(layout_blocks, src, stats);
+}
+
+// Lays out a program's blocks, and returns its first C_COMMAND after layout
+static uint16_t first_c_after_layout(const char *src) {
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, strlen(src), &instrs);
+    opt_stats stats;
+    layout_blocks(&instrs, &stats);
+    uint16_t word = 0;
+    for (int i = 0; i < instrs.count && !word; i++) {
+        if (instrs.items[i].type == C_COMMAND) {
+            word = instrs.items[i].word;
+        }
+    }
+    instr_list_free(&instrs);
+    return word;
+}
+
+static char *test_optimizer() {
+    // Test lex_program(), resolve_program() and write_program() against second_pass()
+    FILE *in = fopen("../pong/Pong.asm", "r");
+    size_t len = 0;
+    char *src = read_all(in, &len);
+    fclose(in);
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, len, &instrs);
+    ht_hash_table *ht = constructor(10000);
+    resolve_program(&instrs, ht);
+    FILE *out = tmpfile();
+    write_program(&instrs, out);
+    rewind(out);
+    ht_delete(ht);
+    instr_list_free(&instrs);
+    free(src);
+
+    FILE *expected = assemble_serial("../pong/Pong.asm");
+    int same = same_contents(out, expected);
+    fclose(out);
+    fclose(expected);
+    mu_assert("write_program output differs from second_pass's", same);
+
+    opt_stats stats;
+
+    mu_assert("peephole did not remove a plain A reload",
+        optimized_size("@x\nD=M\n@x\nM=D+1\n", &stats) == 3 && stats.removed[RULE_A_RELOAD] == 1);
+    mu_assert("peephole did not remove a derived A reload",
+        optimized_size("@SP\nA=M-1\nD=M\n@SP\nA=M-1\nM=D+M\n", &stats) == 4
+        && stats.removed[RULE_A_RELOAD] == 2);
+    mu_assert("peephole removed a derived A reload after a write to memory",
+        optimized_size("@SP\nA=M-1\nM=D\n@SP\nA=M-1\nD=M\n", &stats) == 6);
+    mu_assert("peephole removed an A reload across a label that's jumped to",
+        optimized_size("@x\nD=M\n(L)\n@x\nM=D+1\n@L\n0;JMP\n", &stats) == 6);
+    mu_assert("peephole did not remove an A reload across a label that's never jumped to",
+        optimized_size("@x\nD=M\n(L)\n@x\nM=D+1\n", &stats) == 3 && stats.removed[RULE_KNOWN_VALUE] == 1);
+    mu_assert("peephole did not remove a dead A load",
+        optimized_size("@1\n(L)\n@2\nD=A\n", &stats) == 2 && stats.removed[RULE_DEAD_A_LOAD] == 1);
+    mu_assert("peephole did not remove a cancelling update",
+        optimized_size("@SP\nM=M+1\nM=M-1\nD=M\n", &stats) == 2 && stats.removed[RULE_CANCELLING] == 2);
+    mu_assert("peephole did not remove a duplicate assignment",
+        optimized_size("@x\nD=M\nD=M\nM=D+1\n", &stats) == 3 && stats.removed[RULE_DUPLICATE] == 1);
+    mu_assert("peephole removed a repeated assignment that reads its own destination",
+        optimized_size("@x\nD=D+M\nD=D+M\n", &stats) == 3);
+    mu_assert("peephole did not remove a no-op computation",
+        optimized_size("@x\nD;\nM=D\n", &stats) == 2 && stats.removed[RULE_NOOP] == 1);
+    mu_assert("peephole did not remove a jump to the next instruction",
+        optimized_size("D=M\n@L\n0;JMP\n(L)\n@x\nM=D\n", &stats) == 3
+        && stats.removed[RULE_JUMP_NEXT] == 2);
+    mu_assert("peephole removed the A load before a jump to code that reads A",
+        optimized_size("@L\nD;JGT\n(L)\nD=A\n", &stats) == 2 && stats.removed[RULE_JUMP_NEXT] == 1);
+    // Once D=A goes, so does @5, and then the jump goes to the next instruction
+    mu_assert("peephole did not remove a load that every path into a label agrees on",
+        optimized_size("@5\nD=A\n@L\nD;JGT\n@5\nD=A\n(L)\n@x\nM=D\n", &stats) == 4
+        && stats.removed[RULE_KNOWN_VALUE] == 1);
+    mu_assert("peephole removed a load that the paths into a label disagree on",
+        optimized_size("@5\nD=A\n@L\nD;JGT\n@6\nD=A\n(L)\n@5\nD=A\n@x\nM=D\n", &stats) == 10
+        && stats.removed[RULE_KNOWN_VALUE] == 0);
+    mu_assert("peephole did not follow a RAM word through an increment",
+        optimized_size("@SP\nAM=M+1\nD=A\n@SP\nD=M\n@x\nM=D\n", &stats) == 5
+        && stats.removed[RULE_KNOWN_VALUE] == 1);
+    mu_assert("peephole kept a RAM word known across a store that might alias it",
+        optimized_size("@SP\nD=M\n@R0\nM=0\n@SP\nD=M\n@x\nM=D\n", &stats) == 8
+        && stats.removed[RULE_KNOWN_VALUE] == 0);
+    mu_assert("peephole treated the keyboard as a RAM word that only changes when written",
+        optimized_size("@KBD\nD=M\n@PRESSED\nD;JNE\n@END\n0;JMP\n(PRESSED)\n@KBD\nD=M\n"
+            "(WAIT)\n@KBD\nD=M\n@WAIT\nD;JNE\n(END)\n@END\n0;JMP\n", &stats) == 14
+        && stats.removed[RULE_KNOWN_VALUE] == 0);
+    mu_assert("peephole kept a word past SCREEN known across a label",
+        optimized_size("@24577\nD=M\n(L)\n@24577\nD=M\n@L\nD;JNE\n", &stats) == 6);
+    mu_assert("peephole optimized a program that jumps to a hard-coded address",
+        optimized_size("@x\n@3\n0;JMP\n", &stats) == 3 && stats.skipped);
+
+    mu_assert("eliminate_unreachable did not remove an uncalled function",
+        pruned_size("(LOOP)\n@LOOP\n0;JMP\n(F)\nD=M\n@F\nD;JGT\n", &stats) == 2
+        && stats.removed[RULE_UNREACHABLE] == 3);
+    mu_assert("eliminate_unreachable did not follow a conditional jump",
+        pruned_size("@A\nD;JEQ\n@END\n0;JMP\n(A)\nM=1\n(END)\n@END\n0;JMP\n", &stats) == 7);
+    mu_assert("eliminate_unreachable did not follow a jump that's always taken",
+        pruned_size("@A\n1;JGT\nM=1\n(A)\nM=0\n", &stats) == 3 && stats.removed[RULE_UNREACHABLE] == 1);
+    mu_assert("eliminate_unreachable followed a jump that's never taken",
+        pruned_size("@A\n0;JLT\nM=1\n@B\n0;JMP\n(A)\nM=0\n(B)\n", &stats) == 5
+        && stats.removed[RULE_UNREACHABLE] == 1);
+    // F is called by loading its address into D and jumping through memory, and returns the same way
+    const char *indirect = "@RET\nD=A\n@R13\nM=D\n@F\nD=A\n@R14\nM=D\nA=M\n0;JMP\n(RET)\n@RET\n"
+        "0;JMP\n(F)\n@R13\nA=M\n0;JMP\n(G)\nD=M\n";
+    mu_assert("eliminate_unreachable removed code reached by an indirect jump",
+        pruned_size(indirect, &stats) == 15 && stats.removed[RULE_UNREACHABLE] == 1);
+    mu_assert("eliminate_unreachable removed code after a jump that returns",
+        pruned_size("@L\nD;JGT\n@R13\nA=M\n0;JMP\n(L)\nD=0\n", &stats) == 6);
+
+    // The blocks are in the reverse of the order they run in, so every jump but the last can go
+    const char *backwards = "@B\n0;JMP\n(A)\nD=0\n@END\n0;JMP\n(B)\nD=1\n@A\n0;JMP\n(END)\n@END\n0;JMP\n";
+    mu_assert("layout_blocks did not turn jumps into fall-through",
+        laid_out_size(backwards, &stats) == 6 && stats.removed[RULE_BLOCK_LAYOUT] == 4
+        && stats.jumps_before == 4 && stats.jumps_after == 1);
+    mu_assert("layout_blocks moved the entry point",
+        first_c_after_layout("(LOOP)\nM=1\n@LOOP\n0;JMP\n(F)\nM=0\n@LOOP\n0;JMP\n") == 0xefc8);
+    // Moving A up to follow the entry would leave B to fall through into END
+    mu_assert("layout_blocks moved a block that falls off the end of the program",
+        laid_out_size("@A\n0;JMP\n(B)\nM=1\n@END\n0;JMP\n(A)\nM=0\n@B\nD;JGT\n(END)\n", &stats) == 8
+        && stats.removed[RULE_BLOCK_LAYOUT] == 0);
+    mu_assert("layout_blocks did not leave a program without unconditional jumps alone",
+        laid_out_size("@x\nD=M\n@L\nD;JGT\nM=0\n(L)\nM=1\n", &stats) == 6 && stats.jumps_after == 1);
+
+    return 0;
+}
+
+static char *test_corpus() {
+    mu_assert("parse_size did not parse a plain size", parse_size("512") == 512);
+    mu_assert("parse_size did not parse a size in MB", parse_size("16M") == 16L << 20);
+    mu_assert("parse_size did not parse a lowercase suffix", parse_size("1g") == 1L << 30);
+    mu_assert("parse_size accepted a size with an unknown suffix", parse_size("4X") == -1);
+    mu_assert("parse_size accepted a path", parse_size("prog.asm") == -1);
+
+    // The corpus should be about as big as asked for, and the same every time for a given seed
+    corpus_stats stats;
+    FILE *a = tmpfile();
+    generate_corpus(a, 256 << 10, 7, &stats);
+    long size = ftell(a);
+    mu_assert("generate_corpus miscounted the corpus size", size == stats.bytes);
+    mu_assert("generate_corpus did not write as much as asked for",
+        size >= 256 << 10 && size < (256 << 10) + 512);
+    FILE *b = tmpfile();
+    corpus_stats b_stats;
+    generate_corpus(b, 256 << 10, 7, &b_stats);
+    rewind(a);
+    rewind(b);
+    mu_assert("generate_corpus gave different corpora for the same seed", same_contents(a, b));
+    fclose(b);
+
+    // The corpus should assemble, and have as many instructions and labels as it says
+    rewind(a);
+    size_t len = 0;
+    char *src = read_all(a, &len);
+    fclose(a);
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, len, &instrs);
+    int num_labels = 0;
+    for (int i = 0; i < instrs.count; i++) {
+        num_labels += instrs.items[i].type == L_COMMAND;
+    }
+    mu_assert("generate_corpus miscounted the instructions", count_rom(&instrs) == stats.num_instrs);
+    mu_assert("generate_corpus did not define any labels",
+        num_labels > 0 && num_labels == stats.num_labels);
+    ht_hash_table *ht = constructor(10000);
+    resolve_program(&instrs, ht);
+    ht_delete(ht);
+    instr_list_free(&instrs);
+    free(src);
+
+    // Past MAX_CORPUS_LABEL instructions, every label that's referenced should still be defined
+    a = tmpfile();
+    generate_corpus(a, 2 << 20, 7, &stats);
+    rewind(a);
+    src = read_all(a, &len);
+    fclose(a);
+    instr_list_init(&instrs);
+    lex_program(src, len, &instrs);
+    ht = ht_new(stats.num_labels + 1);
+    for (int i = 0; i < instrs.count; i++) {
+        if (instrs.items[i].type == L_COMMAND) {
+            ht_insert(ht, instrs.items[i].symbol, "");
+        }
+    }
+    int undefined = 0;
+    for (int i = 0; i < instrs.count; i++) {
+        const char *symbol = instrs.items[i].symbol;
+        if (instrs.items[i].type == A_COMMAND && symbol != NULL && !strncmp(symbol, "LOOP_", 5)) {
+            char *found = ht_search(ht, symbol);
+            undefined += found == NULL;
+            free(found);
+        }
+    }
+    ht_delete(ht);
+    instr_list_free(&instrs);
+    free(src);
+    mu_assert("generate_corpus did not write a corpus past MAX_CORPUS_LABEL",
+        stats.num_instrs > MAX_CORPUS_LABEL);
+    mu_assert("generate_corpus referenced a label it never defined", undefined == 0);
+
+    return 0;
+}
+
+static char *test_symfile() {
+    FILE *in = fopen("../max/Max.asm", "r");
+    size_t len = 0;
+    char *src = read_all(in, &len);
+    fclose(in);
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, len, &instrs);
+    ht_hash_table *ht = constructor(100);
+    resolve_program(&instrs, ht);
+    ht_delete(ht);
+    free(src);
+
+    // Both forms should load back to the same symbols and source lines
+    for (int binary = 0; binary <= 1; binary++) {
+        FILE *sym_file = tmpfile();
+        write_sym_file(&instrs, sym_file, binary);
+        rewind(sym_file);
+        char sym_path[64];
+        snprintf(sym_path, sizeof(sym_path), "/proc/self/fd/%d", fileno(sym_file));
+        sym_table syms;
+        sym_table_init(&syms);
+        int loaded = !load_sym_file(sym_path, &syms);
+        fclose(sym_file);
+
+        mu_assert("load_sym_file failed on a symbol map from write_sym_file", loaded);
+        mu_assert("write_sym_file did not write the labels",
+            syms.num_labels == 3 && !strcmp(syms.rom[10], "OUTPUT_FIRST")
+            && !strcmp(syms.rom[14], "INFINITE_LOOP"));
+        mu_assert("write_sym_file did not write the predefined symbols the program uses",
+            !strcmp(syms.ram[0], "R0") && !strcmp(syms.ram[2], "R2") && syms.ram[3] == NULL);
+        mu_assert("write_sym_file wrote a label as a variable", syms.ram[10] == NULL);
+        mu_assert("write_sym_file did not write the source lines",
+            syms.lines[0] == 8 && syms.lines[9] == 17 && syms.lines[10] == 19 && syms.lines[15] == 26);
+        sym_table_free(&syms);
+    }
+    instr_list_free(&instrs);
+
+    return 0;
+}
+
+// Assembles a program with hackasm_assemble(), and returns its status
+static int hackasm_status(const char *src, hackasm_diag *diag) {
+    uint16_t *words;
+    size_t n;
+    int ret = hackasm_assemble(src, strlen(src), &words, &n, diag);
+    free(words);
+    return ret;
+}
+
+static char *test_hackasm() {
+    // Test hackasm_assemble() against second_pass()
+    FILE *in = fopen("../pong/Pong.asm", "r");
+    size_t len = 0;
+    char *src = read_all(in, &len);
+    fclose(in);
+    uint16_t *words;
+    size_t n;
+    hackasm_diag diag;
+    int ret = hackasm_assemble(src, len, &words, &n, &diag);
+    free(src);
+    mu_assert("hackasm_assemble failed on a valid program", ret == 0 && diag.message[0] == '\0');
+
+    FILE *out = tmpfile();
+    char text[WORD + 1];
+    text[WORD] = '\n';
+    for (size_t i = 0; i < n; i++) {
+        word_to_binary(words[i], text);
+        fwrite(text, sizeof(char), WORD + 1, out);
+    }
+    free(words);
+    rewind(out);
+    FILE *expected = assemble_serial("../pong/Pong.asm");
+    int same = same_contents(out, expected);
+    fclose(out);
+    fclose(expected);
+    mu_assert("hackasm_assemble output differs from second_pass's", same);
+
+    // Errors should come back as diagnostics, with the line they're on
+    mu_assert("hackasm_assemble accepted an invalid destination",
+        hackasm_status("@x\n// comment\nX=D\n", &diag) == -1 && diag.line == 3
+        && !strcmp(diag.message, "Invalid destination `X`"));
+    mu_assert("hackasm_assemble accepted an invalid computation",
+        hackasm_status("D=D*M\n", &diag) == -1 && diag.line == 1
+        && !strcmp(diag.message, "Invalid computation `D*M`"));
+    mu_assert("hackasm_assemble accepted an invalid jump",
+        hackasm_status("\n0;JXX\n", &diag) == -1 && diag.line == 2
+        && !strcmp(diag.message, "Invalid jump command `JXX`"));
+    mu_assert("hackasm_assemble accepted a constant that's too big",
+        hackasm_status("@70000\n", &diag) == -1 && diag.line == 1);
+    mu_assert("hackasm_assemble failed without a diagnostic", hackasm_status("D=D*M\n", NULL) == -1);
+
+    ret = hackasm_assemble("D=X\n", 4, &words, &n, NULL);
+    mu_assert("hackasm_assemble returned words for an invalid program", words == NULL && n == 0);
+
+    return 0;
+}
+
+// Lexes @len chars of a program, and writes them out as an object file
+static FILE *object_of(const char *src, size_t len) {
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, len, &instrs);
+    FILE *obj = tmpfile();
+    write_object(&instrs, obj);
+    fflush(obj);
+    instr_list_free(&instrs);
+    return obj;
+}
+
+static char *test_object() {
+    // Split Pong in two at a label, and check that linking the halves gives the same program
+    FILE *in = fopen("../pong/Pong.asm", "r");
+    size_t len = 0;
+    char *src = read_all(in, &len);
+    fclose(in);
+    const char *split = strstr(src + len / 2, "\n(") + 1;
+    FILE *objs[2] = {object_of(src, split - src), object_of(split, src + len - split)};
+    free(src);
+
+    instr_list instrs;
+    instr_list_init(&instrs);
+    int ok = 1;
+    for (int i = 0; i < 2; i++) {
+        char obj_path[64];
+        snprintf(obj_path, sizeof(obj_path), "/proc/self/fd/%d", fileno(objs[i]));
+        ok = ok && !read_object(obj_path, &instrs);
+        fclose(objs[i]);
+    }
+    mu_assert("read_object failed on a valid object file", ok);
+
+    ht_hash_table *ht = constructor(10000);
+    resolve_program(&instrs, ht);
+    FILE *out = tmpfile();
+    write_program(&instrs, out);
+    rewind(out);
+    ht_delete(ht);
+    instr_list_free(&instrs);
+
+    FILE *expected = assemble_serial("../pong/Pong.asm");
+    int same = same_contents(out, expected);
+    fclose(out);
+    fclose(expected);
+    mu_assert("linking objects gave a different program than assembling the whole source", same);
+
+    // Test read_object() on a file that isn't an object file
+    FILE *bad = tmpfile();
+    fputs("@0\nD=A\n", bad);
+    fflush(bad);
+    char bad_path[64];
+    snprintf(bad_path, sizeof(bad_path), "/proc/self/fd/%d", fileno(bad));
+    instr_list_init(&instrs);
+    mu_assert("read_object accepted a file that isn't an object file", read_object(bad_path, &instrs) == -1);
+    instr_list_free(&instrs);
+    fclose(bad);
+
+    // Test read_object() on object files whose counts are bigger than the file could hold
+    const int32_t bad_counts[3][3] = {{INT32_MAX, 0, 0}, {0, INT32_MAX, INT32_MAX}, {1000, 0, 0}};
+    for (int i = 0; i < 3; i++) {
+        bad = tmpfile();
+        fwrite(OBJ_MAGIC, sizeof(char), sizeof(OBJ_MAGIC), bad);
+        fwrite(bad_counts[i], sizeof(int32_t), 3, bad);
+        fwrite(bad_counts[i], sizeof(int32_t), 3, bad);
+        fflush(bad);
+        snprintf(bad_path, sizeof(bad_path), "/proc/self/fd/%d", fileno(bad));
+        instr_list_init(&instrs);
+        ok = read_object(bad_path, &instrs) == -1 && instrs.count == 0;
+        instr_list_free(&instrs);
+        fclose(bad);
+        mu_assert("read_object accepted an object file with counts bigger than the file", ok);
+    }
+
+    // Test read_objects() on two objects that both define a label, and on two that don't
+    const char *link_srcs[3] = {"(LOOP)\n@LOOP\n0;JMP\n", "(LOOP)\n@1\nD=A\n@LOOP\n0;JMP\n",
+        "(OTHER)\n@LOOP\n0;JMP\n"};
+    FILE *link_objs[3];
+    char link_paths[3][64];
+    for (int i = 0; i < 3; i++) {
+        link_objs[i] = object_of(link_srcs[i], strlen(link_srcs[i]));
+        snprintf(link_paths[i], sizeof(link_paths[i]), "/proc/self/fd/%d", fileno(link_objs[i]));
+    }
+    char *dup_pair[2] = {link_paths[0], link_paths[1]};
+    char *ok_pair[2] = {link_paths[0], link_paths[2]};
+
+    instr_list_init(&instrs);
+    int rejected = read_objects(dup_pair, 2, &instrs) == -1;
+    instr_list_free(&instrs);
+    instr_list_init(&instrs);
+    int linked = read_objects(ok_pair, 2, &instrs) == 0 && instrs.count == 6;
+    instr_list_free(&instrs);
+    for (int i = 0; i < 3; i++) {
+        fclose(link_objs[i]);
+    }
+    mu_assert("read_objects linked two objects that both define the same label", rejected);
+    mu_assert("read_objects failed on objects that only share a label through a relocation", linked);
+
+    return 0;
+}
+
+// Runs the instructions a constant load into D expanded to, and returns what ends up in D
+static int run_constant_load(const uint16_t *words, int n, uint16_t *d) {
+    uint16_t a = 0;
+    for (int i = 0; i < n; i++) {
+        if ((words[i] & C_CMD_PREFIX) != C_CMD_PREFIX) {
+            a = words[i];
+        } else if (words[i] == encode_c_command("D", "0", NULL)) {
+            *d = 0;
+        } else if (words[i] == encode_c_command("D", "1", NULL)) {
+            *d = 1;
+        } else if (words[i] == encode_c_command("D", "-1", NULL)) {
+            *d = -1;
+        } else if (words[i] == encode_c_command("D", "A", NULL)) {
+            *d = a;
+        } else if (words[i] == encode_c_command("D", "-A", NULL)) {
+            *d = -a;
+        } else if (words[i] == encode_c_command("D", "!A", NULL)) {
+            *d = ~a;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static char *test_constant() {
+    // Every 16-bit value should load into D correctly, in one instruction if the ALU can make it
+    // directly and two otherwise
+    int correct = 1;
+    int shortest = 1;
+    for (int value = 0; value <= UINT16_MAX; value++) {
+        uint16_t words[MAX_CONST_WORDS];
+        uint16_t d = 0;
+        int n = materialize_constant(value, 2, words);
+        correct &= run_constant_load(words, n, &d) == 0 && d == value;
+        shortest &= n == (value == 0 || value == 1 || value == UINT16_MAX ? 1 : 2);
+    }
+    mu_assert("materialize_constant did not load every value into D", correct);
+    mu_assert("materialize_constant did not give the shortest load for every value", shortest);
+
+    uint16_t words[MAX_CONST_WORDS];
+    mu_assert("materialize_constant used two instructions to load a small value into A",
+        materialize_constant(5, 4, words) == 1 && words[0] == 5);
+    mu_assert("materialize_constant did not load -32768 with !A",
+        materialize_constant(0x8000, 2, words) == 2 && words[0] == 0x7FFF
+        && words[1] == encode_c_command("D", "!A", NULL));
+    mu_assert("materialize_constant did not load -1 into M",
+        materialize_constant(UINT16_MAX, 1, words) == 1
+        && words[0] == encode_c_command("M", "-1", NULL));
+    mu_assert("materialize_constant loaded a value into M by changing A",
+        materialize_constant(5, 1, words) == -1);
+
+    // Constant loads written out in source should expand the same way, in every assembler
+    mu_assert("expand_constant_load did not expand D=#-5",
+        expand_constant_load("D=#-5", words, NULL) == 2 && words[0] == 5
+        && words[1] == encode_c_command("D", "-A", NULL));
+    mu_assert("expand_constant_load did not treat 65535 as -1",
+        expand_constant_load("AD=#65535", words, NULL) == 1
+        && words[0] == encode_c_command("AD", "-1", NULL));
+
+    const char *src = "D=#-1\n@x\nM=D\nAD=#32768\nM=#0\n(END)\n@END\n0;JMP\n";
+    uint16_t *lib_words;
+    size_t n;
+    hackasm_diag diag;
+    mu_assert("hackasm_assemble failed on constant loads",
+        hackasm_assemble(src, strlen(src), &lib_words, &n, &diag) == 0 && n == 8
+        && lib_words[3] == 0x7FFF && lib_words[6] == 6);
+    free(lib_words);
+
+    mu_assert("hackasm_assemble accepted a constant load into M that changes A",
+        hackasm_status("@x\nM=#5\n", &diag) == -1 && diag.line == 2
+        && !strcmp(diag.message, "Constant load `M=#5` can't write to M, since it changes A"));
+    mu_assert("hackasm_assemble accepted a constant that doesn't fit in 16 bits",
+        hackasm_status("D=#-32769\n", &diag) == -1 && diag.line == 1);
+    mu_assert("hackasm_assemble accepted a constant load that jumps",
+        hackasm_status("D=#1;JGT\n", &diag) == -1);
+
+    return 0;
+}
+
+static char *test_rom() {
+    // Write Pong out as a ROM image with its symbols, and check that it maps back to the same words
+    FILE *in = fopen("../pong/Pong.asm", "r");
+    size_t len = 0;
+    char *src = read_all(in, &len);
+    fclose(in);
+    uint16_t *words;
+    size_t n;
+    hackasm_assemble(src, len, &words, &n, NULL);
+
+    instr_list instrs;
+    instr_list_init(&instrs);
+    lex_program(src, len, &instrs);
+    free(src);
+    ht_hash_table *ht = constructor(10000);
+    resolve_program(&instrs, ht);
+    FILE *out = tmpfile();
+    write_rom(&instrs, out, 1);
+    fflush(out);
+    ht_delete(ht);
+    instr_list_free(&instrs);
+
+    char rom_path[64];
+    snprintf(rom_path, sizeof(rom_path), "/proc/self/fd/%d", fileno(out));
+    rom_image img;
+    mu_assert("map_rom failed on a valid ROM image", map_rom(rom_path, &img) == 0);
+    mu_assert("map_rom gave the wrong number of words", img.header->num_words == n);
+    mu_assert("map_rom gave different words than hackasm_assemble",
+        !memcmp(img.words, words, n * sizeof(uint16_t)));
+    mu_assert("ROM image words are not aligned", (uintptr_t)img.words % sizeof(uint64_t) == 0);
+    mu_assert("ROM image has the wrong entry point", img.header->entry == 0);
+    mu_assert("ROM image's symbol section is not a binary symbol map",
+        img.header->sym_offset == sizeof(rom_header) + n * sizeof(uint16_t)
+        && !memcmp((char*)img.base + img.header->sym_offset, SYM_MAGIC, sizeof(SYM_MAGIC)));
+    unmap_rom(&img);
+    free(words);
+
+    // Flip a bit in the last word, and the checksum should catch it
+    fseek(out, sizeof(rom_header) + (n - 1) * sizeof(uint16_t), SEEK_SET);
+    int c = fgetc(out);
+    fseek(out, -1, SEEK_CUR);
+    fputc(c ^ 1, out);
+    fflush(out);
+    mu_assert("map_rom accepted a corrupted ROM image", map_rom(rom_path, &img) == -1);
+    fclose(out);
+
+    uint16_t check[4];
+    memcpy(check, "12345678", sizeof(check));
+    mu_assert("rom_checksum did not compute the standard CRC-32", rom_checksum(check, 4) == 0x9AE0DAAF);
+
+    return 0;
+}
+
+static char *test_profile() {
+    // Profile both passes over a small program, and check what was counted
+    FILE *in = tmpfile();
+    fputs("// Adds 1 to x\n\n(LOOP)\n@x\nM=M+1\n@LOOP\n0;JMP\n@x\nD=#-2\n", in);
+    rewind(in);
+    FILE *out = tmpfile();
+    ht_hash_table *ht = constructor(10);
+
+    prof_stats stats;
+    profile_begin(&stats);
+    first_pass(in, ht);
+    profile_mark(PHASE_FIRST_PASS);
+    fseek(in, 0, SEEK_SET);
+    second_pass(in, out, ht);
+    profile_mark(PHASE_SECOND_PASS);
+    profile_end();
+    ht_delete(ht);
+    fclose(in);
+    fclose(out);
+
+    mu_assert("profile_end did not stop profiling", profile == NULL);
+    mu_assert("the profile miscounted the lines read",
+        stats.lines == 18 && stats.comment_lines == 2 && stats.blank_lines == 2);
+    mu_assert("the profile miscounted the instructions",
+        stats.a_instrs == 4 && stats.c_instrs == 3 && stats.l_instrs == 1);
+    mu_assert("the profile miscounted the symbol table lookups",
+        stats.sym_hits == 2 && stats.sym_misses == 1 && stats.sym_inserts == 2);
+    mu_assert("the profile did not time the passes",
+        stats.seconds[PHASE_FIRST_PASS] > 0 && stats.seconds[PHASE_SECOND_PASS] > 0);
+    mu_assert("the profile recorded a phase that didn't run", stats.seconds[PHASE_OUTPUT] == 0);
+    mu_assert("the profile did not record the peak RSS", stats.peak_rss_kb > 0);
+
+    return 0;
+}
+
+// Reads one operand of a computation's mnemonic
+static uint16_t operand(char c, uint16_t a, uint16_t d, uint16_t m) {
+    return c == 'A' ? a : c == 'D' ? d : c == 'M' ? m : c == '1' ? 1 : 0;
+}
+
+// Computes what a computation's mnemonic says it does, to check the bit-level ALU against. Some
+// computations decode with a trailing ';', which is ignored.
+static uint16_t mnemonic_result(const char *comp, uint16_t a, uint16_t d, uint16_t m) {
+    size_t len = strcspn(comp, ";");
+    if (len == 1) {
+        return operand(comp[0], a, d, m);
+    } else if (len == 2) {
+        uint16_t x = operand(comp[1], a, d, m);
+        return comp[0] == '!' ? ~x : -x;
+    }
+    uint16_t x = operand(comp[0], a, d, m);
+    uint16_t y = operand(comp[2], a, d, m);
+    switch (comp[1]) {
+        case '+': return x + y;
+        case '-': return x - y;
+        case '&': return x & y;
+        default: return x | y;
+    }
+}
+
+static char *test_superopt() {
+    decoder_init();
+    const uint16_t values[] = {0, 1, 2, 0x7FFF, 0x8000, 0xFFFF, 0x1234, 0xBEEF};
+    int num_values = sizeof(values) / sizeof(values[0]);
+    int num_comps = 0;
+    int alu_ok = 1;
+    for (int comp = 0; comp < 128; comp++) {
+        uint16_t word = C_CMD_PREFIX | comp << COMP_SHIFT;
+        const char *text = decode_word(word);
+        if (text == NULL) continue;
+        num_comps++;
+        for (int i = 0; i < num_values * num_values * num_values; i++) {
+            uint16_t a = values[i % num_values];
+            uint16_t d = values[i / num_values % num_values];
+            uint16_t m = values[i / num_values / num_values];
+            alu_ok &= c_command_result(word, a, d, m) == mnemonic_result(text, a, d, m);
+        }
+    }
+    mu_assert("the bit-level ALU did not cover every computation", num_comps == 28);
+    mu_assert("the bit-level ALU disagreed with a computation's mnemonic", alu_ok);
+
+    uint16_t tokens[MAX_REWRITE_LEN];
+    char text[64];
+    mu_assert("parse_window did not parse a window with a slot",
+        parse_window("@$0 AM=M+1 A=A-1", tokens) == 3 && tokens[0] == 0
+        && tokens[1] == encode_c_command("AM", "M+1", NULL));
+    format_window(tokens, 3, text, sizeof(text));
+    mu_assert("format_window did not write out what parse_window read",
+        !strcmp(text, "@$0 AM=M+1 A=A-1"));
+    mu_assert("parse_window accepted a jump", parse_window("@$0 D;JGT", tokens) == -1);
+    mu_assert("parse_window accepted one slot too many", parse_window("@$2 D=A", tokens) == -1);
+    mu_assert("parse_window did not treat @0 as A=0",
+        parse_window("@0", tokens) == 1 && tokens[0] == encode_c_command("A", "0", NULL));
+
+    // @0 D=A @x M=D is @x MD=0
+    opt_stats stats;
+    instr_list instrs;
+    instr_list_init(&instrs);
+    const char *store_zero = "@0\nD=A\n@x\nM=D\n";
+    lex_program(store_zero, strlen(store_zero), &instrs);
+    peephole(&instrs, &stats);
+    mu_assert("the optimizer did not apply a superoptimizer rewrite",
+        instrs.count == 2 && stats.removed[RULE_SUPEROPT] == 2 && !strcmp(instrs.items[0].symbol, "x")
+        && instrs.items[1].word == encode_c_command("MD", "0", NULL));
+    instr_list_free(&instrs);
+    mu_assert("the optimizer applied a superoptimizer rewrite across a label",
+        optimized_size("@0\nD=A\n(L)\n@x\nM=D\n", &stats) == 3 && stats.removed[RULE_SUPEROPT] == 1);
+    mu_assert("the optimizer did not apply a superoptimizer rewrite with two slots",
+        optimized_size("@x\nM=M+1\n@y\nD=A\n@x\n", &stats) == 4 && stats.removed[RULE_SUPEROPT] == 1);
+    mu_assert("the optimizer assumed a store to KBD reads back",
+        optimized_size("@KBD\nM=D\n@KBD\nD=M\n", &stats) == 3 && stats.removed[RULE_SUPEROPT] == 0);
+
+    // Several rules assume that what @$0 M=D stores reads back, so I/O can't fill a slot
+    const char *io_store = "@KBD\nM=D\n@16385\nM=D\n@x\nM=D\n";
+    const instruction *window[MAX_REWRITE_LEN];
+    const instruction *slots[MAX_REWRITE_SLOTS];
+    instr_list_init(&instrs);
+    lex_program(io_store, strlen(io_store), &instrs);
+    for (int i = 0; i < instrs.count; i++) {
+        window[i] = &instrs.items[i];
+    }
+    mu_assert("window_tokens gave KBD a slot", window_tokens(window, 2, tokens, slots) == 0);
+    mu_assert("window_tokens gave an address past SCREEN a slot",
+        window_tokens(&window[1], 2, tokens, slots) == 1);
+    mu_assert("window_tokens did not give RAM a slot", window_tokens(&window[4], 2, tokens, slots) == 2);
+    instr_list_free(&instrs);
+
+    return 0;
+}
+
 static char *all_tests() {
     mu_run_test(test_encoder);
     mu_run_test(test_symbol_table);
     mu_run_test(test_parser);
+    mu_run_test(test_parallel);
+    mu_run_test(test_pipeline);
+    mu_run_test(test_stream);
+    mu_run_test(test_batch);
+    mu_run_test(test_incremental);
+    mu_run_test(test_decoder);
+    mu_run_test(test_optimizer);
+    mu_run_test(test_corpus);
+    mu_run_test(test_symfile);
+    mu_run_test(test_hackasm);
+    mu_run_test(test_object);
+    mu_run_test(test_constant);
+    mu_run_test(test_rom);
+    mu_run_test(test_profile);
+    mu_run_test(test_superopt);
     return 0;
 }
 
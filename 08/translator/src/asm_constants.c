@@ -155,6 +155,47 @@ const fmt_str ARITH_UNARY_BASE_CMD = {
     .fmt_len = 2
 };
 
+/*
+ * The INLINE_<OPTYPE>_CMD constants are what the ARITH_<OPTYPE>_BASE_CMD routines do, written out at the
+ * place the operation is used so that it doesn't have to jump to a shared routine and back. Each takes the
+ * same operator as the base command it replaces. Comparisons also take a number that makes their label
+ * unique.
+ */
+const fmt_str INLINE_BINARY_CMD = {
+    .str =
+        "@SP\n"
+        "AM=M-1\n"
+        "D=M\n"
+        "A=A-1\n"
+        "M=M%sD\n",
+    .fmt_len = 2
+};
+
+const fmt_str INLINE_CMP_CMD = {
+    .str =
+        "@SP\n"
+        "AM=M-1\n"
+        "D=M\n"
+        "A=A-1\n"
+        "D=M-D\n"
+        "M=-1\n"
+        "@__CMP_END_%d\n"
+        "D;J%s\n"
+        "@SP\n"
+        "A=M-1\n"
+        "M=0\n"
+        "(__CMP_END_%d)\n",
+    .fmt_len = 6
+};
+
+const fmt_str INLINE_UNARY_CMD = {
+    .str =
+        "@SP\n"
+        "A=M-1\n"
+        "M=%sM\n",
+    .fmt_len = 2
+};
+
 const int NUM_ARITH_OPS = 9;
 const char *HACK_ARITH_OPS[] = {"+", "-", "-", "EQ", "GT", "LT", "&", "|", "!", NULL};
 
@@ -279,6 +320,127 @@ const fmt_str POP_STATIC_SEG = {
 
 
 
+// All PEEP_XXX constants are pieces of the fused sequences the VM peephole optimizer writes (see peephole.c)
+const fmt_str PEEP_LOAD_CONSTANT = {
+    .str =
+        "@%d\n"
+        "D=A\n",
+    .fmt_len = 2
+};
+
+const fmt_str PEEP_LOAD_DIRECT = {
+    .str =
+        "@%s\n"
+        "D=M\n",
+    .fmt_len = 2
+};
+
+const fmt_str PEEP_STORE_DIRECT = {
+    .str =
+        "@%s\n"
+        "M=D\n",
+    .fmt_len = 2
+};
+
+const fmt_str PEEP_LOAD_INDIRECT = {
+    .str =
+        "@%s\n"
+        "D=M\n"
+        "@%d\n"
+        "A=D+A\n"
+        "D=M\n",
+    .fmt_len = 4
+};
+
+// Puts the address of a segment's first or second word in A, to be followed by "A=A+1" for each word past that
+const fmt_str PEEP_SEG_BASE = {
+    .str =
+        "@%s\n"
+        "A=M%s\n",
+    .fmt_len = 4
+};
+
+const fmt_str PEEP_SAVE_ADDR = {
+    .str =
+        "@%s\n"
+        "D=M\n"
+        "@%d\n"
+        "D=D+A\n"
+        "@R15\n"
+        "M=D\n",
+    .fmt_len = 4
+};
+
+const char *PEEP_STORE_SAVED_ADDR =
+    "@R15\n"
+    "A=M\n"
+    "M=D\n";
+
+const fmt_str PEEP_ADD_CONSTANT = {
+    .str =
+        "@%d\n"
+        "D=A\n"
+        "@SP\n"
+        "A=M-1\n"
+        "M=M%sD\n",
+    .fmt_len = 4
+};
+
+const fmt_str PEEP_STEP = {
+    .str =
+        "@SP\n"
+        "A=M-1\n"
+        "M=M%s1\n",
+    .fmt_len = 2
+};
+
+const fmt_str PEEP_ZERO_TEST = {
+    .str =
+        "@SP\n"
+        "A=M-1\n"
+        "D=M\n"
+        "M=-1\n"
+        "@__ZERO_TEST_%d\n"
+        "D;JEQ\n"
+        "@SP\n"
+        "A=M-1\n"
+        "M=0\n"
+        "(__ZERO_TEST_%d)\n",
+    .fmt_len = 4
+};
+
+
+/**
+ * Used when the top of the stack is cached in D. TOS_SPILL writes D back to the top of the stack in
+ * RAM, and TOS_FILL reads the top of the stack in RAM into D. TOS_CMP turns D, the first operand of a
+ * comparison minus the second, into -1 if the comparison is true or 0 if it's false; it takes a
+ * number that makes its labels unique, then the jump for the comparison.
+ */
+const char *TOS_SPILL =
+    "@SP\n"
+    "AM=M+1\n"
+    "A=A-1\n"
+    "M=D\n";
+
+const char *TOS_FILL =
+    "@SP\n"
+    "AM=M-1\n"
+    "D=M\n";
+
+const fmt_str TOS_CMP = {
+    .str =
+        "@__TOS_TRUE_%d\n"
+        "D;J%s\n"
+        "D=0\n"
+        "@__TOS_END_%d\n"
+        "0;JMP\n"
+        "(__TOS_TRUE_%d)\n"
+        "D=-1\n"
+        "(__TOS_END_%d)\n",
+    .fmt_len = 10
+};
+
+
 const fmt_str DEF_LABEL = {
     .str = "(%s%c%s)\n",
     .fmt_len = 6
@@ -301,6 +463,36 @@ const fmt_str IF_GOTO_LABEL = {
     .fmt_len = 6
 };
 
+const fmt_str CMP_GOTO_LABEL = {
+    .str =
+        "@SP\n"
+        "AM=M-1\n"
+        "D=M\n"
+        "@SP\n"
+        "AM=M-1\n"
+        "D=M-D\n"
+        "@%s%c%s\n"
+        "D;J%s\n",
+    .fmt_len = 8
+};
+
+const fmt_str ZERO_GOTO_LABEL = {
+    .str =
+        "@SP\n"
+        "AM=M-1\n"
+        "D=M\n"
+        "@%s%c%s\n"
+        "D;J%s\n",
+    .fmt_len = 8
+};
+
+const fmt_str D_GOTO_LABEL = {
+    .str =
+        "@%s%c%s\n"
+        "D;J%s\n",
+    .fmt_len = 8
+};
+
 const fmt_str DEF_FUNC_INIT = {
     .str =
         "(%s)\n"  // The filled-in version of DEF_FUNC_LABEL
@@ -21,6 +21,9 @@ extern const fmt_str ARITH_ADDSUB_BASE_CMD;
 extern const fmt_str ARITH_CMP_BASE_CMD;
 extern const fmt_str ARITH_BOOL_BASE_CMD;
 extern const fmt_str ARITH_UNARY_BASE_CMD;
+extern const fmt_str INLINE_BINARY_CMD;
+extern const fmt_str INLINE_CMP_CMD;
+extern const fmt_str INLINE_UNARY_CMD;
 extern const int NUM_ARITH_OPS;
 extern const char *HACK_ARITH_OPS[];
 
@@ -36,10 +39,30 @@ extern const fmt_str POP_POINTER_SEG;
 extern const fmt_str PUSH_STATIC_SEG;
 extern const fmt_str POP_STATIC_SEG;
 
+// Related to the VM peephole optimizer
+extern const fmt_str PEEP_LOAD_CONSTANT;
+extern const fmt_str PEEP_LOAD_DIRECT;
+extern const fmt_str PEEP_STORE_DIRECT;
+extern const fmt_str PEEP_LOAD_INDIRECT;
+extern const fmt_str PEEP_SEG_BASE;
+extern const fmt_str PEEP_SAVE_ADDR;
+extern const char *PEEP_STORE_SAVED_ADDR;
+extern const fmt_str PEEP_ADD_CONSTANT;
+extern const fmt_str PEEP_STEP;
+extern const fmt_str PEEP_ZERO_TEST;
+
+// Related to caching the top of the stack in D
+extern const char *TOS_SPILL;
+extern const char *TOS_FILL;
+extern const fmt_str TOS_CMP;
+
 // Related to control flow operations
 extern const fmt_str DEF_LABEL;
 extern const fmt_str GOTO_LABEL;
 extern const fmt_str IF_GOTO_LABEL;
+extern const fmt_str CMP_GOTO_LABEL;
+extern const fmt_str ZERO_GOTO_LABEL;
+extern const fmt_str D_GOTO_LABEL;
 
 // Related to functions
 extern const fmt_str DEF_FUNC_INIT;
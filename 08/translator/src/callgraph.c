@@ -0,0 +1,182 @@
+/*
+ * Dead-function elimination.
+ *
+ * The bootstrap code only ever calls Sys.init, and the VM language has no way to call a function
+ * except by naming it in a call command, so a function that no chain of calls from Sys.init names
+ * can never run. This matters most when translating a whole directory that includes the OS, since
+ * most programs only use a few of the OS's functions.
+ *
+ * The call graph is built over function symbols: every command from a function command up to the
+ * next one belongs to that function, and each call in it is an edge to the function it names.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callgraph.h"
+#include "code_writer.h"
+#include "parser.h"
+#include "peephole.h"
+#include "tos.h"
+
+const char *ENTRY_FUNCTION = "Sys.init";
+
+
+/**
+ * Marks every function that can be called, directly or indirectly, from the entry function.
+ *
+ * @param prog  the program to search
+ * @param entry the symbol id of the entry function
+ * @return      an array with an entry for each symbol id in @prog, 1 if the symbol is a function
+ *              that can be called and 0 otherwise, which the caller must free
+ */
+static char *reachable_functions(const vm_program *prog, int entry) {
+    // Where each function's commands start, by symbol id. If a function is defined more than once,
+    // the calls in every definition are followed.
+    int *start = malloc(prog->num_symbols * sizeof(int));
+    int *next_def = malloc(prog->num_instrs * sizeof(int));
+    for (int id = 0; id < prog->num_symbols; id++) {
+        start[id] = -1;
+    }
+    for (int i = prog->num_instrs - 1; i >= 0; i--) {
+        if (prog->instrs[i].op == OP_FUNCTION) {
+            next_def[i] = start[prog->instrs[i].sym];
+            start[prog->instrs[i].sym] = i;
+        }
+    }
+
+    char *reached = calloc(prog->num_symbols, sizeof(char));
+    int *pending = malloc(prog->num_symbols * sizeof(int));
+    int num_pending = 0;
+    reached[entry] = 1;
+    pending[num_pending++] = entry;
+
+    while (num_pending > 0) {
+        int func = pending[--num_pending];
+        for (int def = start[func]; def != -1; def = next_def[def]) {
+            for (int i = def + 1; i < prog->num_instrs && prog->instrs[i].op != OP_FUNCTION; i++) {
+                int callee = prog->instrs[i].sym;
+                if (prog->instrs[i].op == OP_CALL && !reached[callee]) {
+                    reached[callee] = 1;
+                    pending[num_pending++] = callee;
+                }
+            }
+        }
+    }
+
+    free(pending);
+    free(next_def);
+    free(start);
+    return reached;
+}
+
+
+/**
+ * Removes every function that can't be called from the entry function from a program. Commands
+ * before the first function don't belong to any function, and are kept.
+ *
+ * @param prog the program to remove dead functions from
+ * @return     a program with the removed functions' commands and the same symbol ids as @prog,
+ *             which the caller must delete, or NULL if @prog doesn't define the entry function
+ */
+vm_program *vm_remove_dead_functions(vm_program *prog) {
+    int entry = -1;
+    for (int i = 0; i < prog->num_instrs && entry == -1; i++) {
+        const vm_instr *instr = &prog->instrs[i];
+        if (instr->op == OP_FUNCTION && !strcmp(prog->symbols[instr->sym], ENTRY_FUNCTION)) {
+            entry = instr->sym;
+        }
+    }
+    if (entry == -1) {
+        return NULL;
+    }
+
+    char *reached = reachable_functions(prog, entry);
+
+    // Intern the symbols in the same order, so that the removed commands' symbol ids still work
+    vm_program *dead = vm_program_new();
+    for (int id = 0; id < prog->num_symbols; id++) {
+        vm_intern(dead, prog->symbols[id], strlen(prog->symbols[id]));
+    }
+
+    int live = 1;
+    int kept = 0;
+    for (int i = 0; i < prog->num_instrs; i++) {
+        if (prog->instrs[i].op == OP_FUNCTION) {
+            live = reached[prog->instrs[i].sym];
+        }
+        if (live) {
+            prog->instrs[kept++] = prog->instrs[i];
+        } else {
+            vm_program_append(dead, prog->instrs[i]);
+        }
+    }
+    prog->num_instrs = kept;
+
+    free(reached);
+    return dead;
+}
+
+
+/**
+ * Counts the Hack instructions a program translates to, not including the bootstrap code or the
+ * shared routines every program has.
+ *
+ * @param prog the program to count the instructions of
+ * @param opt  what the code writer optimizes the generated code for
+ * @return     the number of words of ROM the program's commands take up
+ */
+int vm_count_words(const vm_program *prog, vm_opt_mode opt) {
+    FILE *scratch = tmpfile();
+    if (scratch == NULL) {
+        perror("[ERR] Failed to open a temporary file to count Hack instructions in");
+        return 0;
+    }
+
+    code_writer *cw = cw_new(scratch, NULL, NULL);
+    cw->opt = opt;
+    if (opt == OPT_TOS) {
+        tos_stats stats = {0};
+        vm_write_program_tos(prog, cw, &stats);
+    } else {
+        peep_stats stats = {0};
+        vm_write_program(prog, cw, opt != OPT_NONE ? &stats : NULL);
+    }
+
+    // Every line that isn't blank, a comment or a label is one instruction
+    int words = 0;
+    char line[256];
+    rewind(scratch);
+    while (fgets(line, sizeof(line), scratch) != NULL) {
+        if (line[0] != '\n' && line[0] != '(' && strncmp(line, "//", 2)) {
+            words++;
+        }
+    }
+
+    cw_delete(&cw);
+    return words;
+}
+
+
+/**
+ * Prints the functions that dead-function elimination removed, and how much ROM that saved.
+ *
+ * @param out   the file to print to
+ * @param dead  the removed functions, as returned by vm_remove_dead_functions()
+ * @param words the number of Hack instructions the removed functions would have taken up
+ */
+void print_dead_functions(FILE *out, const vm_program *dead, int words) {
+    int num_removed = 0;
+    for (int i = 0; i < dead->num_instrs; i++) {
+        num_removed += dead->instrs[i].op == OP_FUNCTION;
+    }
+
+    fprintf(out, "Removed %d functions that can't be called from %s, saving %d words of ROM\n",
+            num_removed, ENTRY_FUNCTION, words);
+    for (int i = 0; i < dead->num_instrs; i++) {
+        if (dead->instrs[i].op == OP_FUNCTION) {
+            fprintf(out, "  %s\n", dead->symbols[dead->instrs[i].sym]);
+        }
+    }
+}
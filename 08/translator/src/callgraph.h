@@ -0,0 +1,15 @@
+#ifndef _VM_CALLGRAPH_H
+#define _VM_CALLGRAPH_H
+
+#include <stdio.h>
+
+#include "code_writer.h"
+#include "parser.h"
+
+extern const char *ENTRY_FUNCTION;  // The function the bootstrap code calls
+
+vm_program *vm_remove_dead_functions(vm_program*);
+int vm_count_words(const vm_program*, vm_opt_mode);
+void print_dead_functions(FILE*, const vm_program*, int);
+
+#endif /* _VM_CALLGRAPH_H */
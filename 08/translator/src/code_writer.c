@@ -6,6 +6,7 @@
 #include "asm_constants.h"
 #include "code_writer.h"
 #include "parser.h"
+#include "peephole.h"
 #include "util.h"
 #include "vm_constants.h"
 #include "../../../lib/hash_table.h"
@@ -35,6 +36,7 @@ const vm_mem_seg SEG_INVALID = {NULL, NULL, -1, -1};
 /* STATIC VARIABLES */
 
 static int num_arith_calls = 0;
+static int num_inline_cmps = 0;
 static int num_func_definitions = 0;
 static int num_func_calls = 0;
 
@@ -43,54 +45,10 @@ static int num_func_calls = 0;
 
 /* STATIC FUNCTIONS */
 
-/**
- * Returns the vm_mem_seg corresponding to the text name of a memory segment.
- * 
- * @param  char*  segment  The segment for which to retrieve the corresponding vm_mem_seg
- * @return vm_mem_seg      The corresponding vm_mem_seg
- */
-static vm_mem_seg seg_to_vm_memseg(char *segment) {
-    if (!strcmp(segment, "local")) {
-        return LCL;
-    } else if (!strcmp(segment, "argument")) {
-        return ARG;
-    } else if (!strcmp(segment, "this")) {
-        return THIS;
-    } else if (!strcmp(segment, "that")) {
-        return THAT;
-    } else if (!strcmp(segment, "pointer")) {
-        return POINTER;
-    } else if (!strcmp(segment, "temp")) {
-        return TEMP;
-    } else if (!strcmp(segment, "general")) {
-        return GENERAL;
-    } else if (!strcmp(segment, "constant")) {
-        return CONSTANT;
-    } else if (!strcmp(segment, "static")) {
-        return STATIC;
-    } else if (!strcmp(segment, "stack")) {
-        return STACK;
-    } else if (!strcmp(segment, "heap")) {
-        return HEAP;
-    } else if (!strcmp(segment, "io")) {
-        return MEMMAP_IO;
-    } else {
-        return SEG_INVALID;
-    }
-}
-
-
-/**
- * Compares two vm_mem_seg structs.
- * 
- * @param a the first vm_mem_seg to compare
- * @param b the second vm_mem_seg to compare
- * @return  1 if the a and b are equivalent, 0 otherwise
- */
-static int segcmp(vm_mem_seg a, vm_mem_seg b) {
-    return !vm_strcmp(a.vm_name, b.vm_name) && !vm_strcmp(a.hack_name, b.hack_name)
-        && a.begin_addr == b.begin_addr && a.end_addr == b.end_addr;
-}
+// The vm_mem_seg of each vm_segment_t
+static const vm_mem_seg *SEGMENTS[NUM_SEGMENTS] = {
+    &LCL, &ARG, &THIS, &THAT, &POINTER, &TEMP, &GENERAL, &CONSTANT, &STATIC, &STACK, &HEAP, &MEMMAP_IO
+};
 
 
 /**
@@ -213,9 +171,11 @@ static char *fmt_str_printf(const fmt_str *fs, int sub_len, ...) {
  * @param fs    the format string to be used to generate the Hack commands
  * @param func  the function containing the label
  * @param label the label name itself
+ * @param jump  the jump condition to substitute in after the label (e.g. "LT"), or NULL if @fs
+ *              doesn't take one
  * @return      the Hack code to define or go to a VM label
  */
-static char *gen_label_cmd(fmt_str fs, char *func, char *label) {
+static char *gen_label_cmd(fmt_str fs, char *func, char *label, const char *jump) {
     char *cmd = NULL;
 
     char *internal_func = func != NULL ? strdup(func) : strdup(DEFAULT_FUNC_NAME);
@@ -223,7 +183,8 @@ static char *gen_label_cmd(fmt_str fs, char *func, char *label) {
     int valid = valid_identifier(internal_func, 0) && valid_identifier(label, 1);
 
     if (valid) {
-        cmd = fmt_str_printf(&fs, strlen(internal_func) + strlen(label) + 1, internal_func, LABEL_SEPARATOR, label);
+        int sub_len = strlen(internal_func) + strlen(label) + 1 + (jump != NULL ? strlen(jump) : 0);
+        cmd = fmt_str_printf(&fs, sub_len, internal_func, LABEL_SEPARATOR, label, jump);
     } else {
         printf("[ERR] Invalid label %s defined or referenced in %s\n", label, internal_func);
     }
@@ -314,65 +275,99 @@ char *vm_write_initial(char *output_path) {
 
 
 /**
- * Writes a VM command in Hack assembly format.
+ * Writes a parsed VM command in Hack assembly format.
  *
- * @param command      the VM command to translate
- * @param command_type the command type of the VM command
- * @param cw           the code_writer to use to write the translated command
- * @return             the status of the function
+ * @param prog  the program that @instr is from, which holds its symbols
+ * @param instr the VM command to translate
+ * @param cw    the code_writer to use to write the translated command
+ * @return      the status of the function
  */
-vm_wc_status vm_write_command(char *command, vm_command_t command_type, code_writer *cw) {
+vm_wc_status vm_write_command(const vm_program *prog, const vm_instr *instr, code_writer *cw) {
     vm_wc_status status = WC_SUCCESS;
-    char *arg1 = vm_arg1(command);
-    int arg2 = vm_arg2(command);
+    char *sym = instr->sym > -1 ? prog->symbols[instr->sym] : NULL;
     char *translated = NULL;
 
-    if (command_type == C_PUSH || command_type == C_POP) {
-        if (arg1 != NULL && strlen(arg1) && arg2 > -1) {
-            vm_mem_seg seg = seg_to_vm_memseg(arg1);
-            translated = vm_write_push_pop(seg, arg2, command_type, cw->in_name);
-        } else {
-            const char *err = "[ERR] Result of calling vm_arg1() on command \"%s\" was NULL. "
-                              "Cannot translate command\n";
-            printf(err, command);
+    switch (instr->op) {
+        case OP_PUSH:
+        case OP_POP:
+            translated = vm_write_push_pop(instr->seg, instr->arg, instr->op, sym);
+            break;
+        case OP_LABEL:
+            translated = vm_write_label(cw->func, sym);
+            break;
+        case OP_GOTO:
+            translated = vm_write_goto(cw->func, sym);
+            break;
+        case OP_IF:
+            translated = vm_write_if(cw->func, sym);
+            break;
+        case OP_CALL:
+            translated = vm_write_call(sym, instr->arg);
+            break;
+        case OP_FUNCTION:
+            cw_set_func(cw, sym);
+            translated = vm_write_function(cw, instr->arg);
+            break;
+        case OP_RETURN:
+            translated = vm_write_return();
+            break;
+        case OP_INVALID:
+            printf("[ERR] Invalid command\n");
             status = WC_INVALID_CMD;
-        }
-    } else if (command_type == C_ARITHMETIC) {
-        translated = vm_write_arithmetic(arg1);
-    } else if (command_type == C_LABEL) {
-        translated = vm_write_label(cw->func, arg1);
-    } else if (command_type == C_GOTO) {
-        translated = vm_write_goto(cw->func, arg1);
-    } else if (command_type == C_IF) {
-        translated = vm_write_if(cw->func, arg1);
-    } else if (command_type == C_CALL) {
-        translated = vm_write_call(arg1, arg2);
-    } else if (command_type == C_FUNCTION) {
-        cw_set_func(cw, arg1);
-        translated = vm_write_function(cw, arg2);
-    } else if (command_type == C_RETURN) {
-        translated = vm_write_return();
-    } else if (command_type == C_INVALID) {
-        printf("[ERR] Invalid command %s\n", command);
-        status = WC_INVALID_CMD;
-    } else {
-        printf("[ERR] Command type %d is not currently supported.\n", command_type);
-        status = WC_UNSUPPORTED_CMD;
+            break;
+        default:
+            if (instr->op >= OP_ADD && instr->op <= OP_NOT) {
+                translated = cw->opt >= OPT_SPEED ? vm_write_inline_arithmetic(instr->op)
+                                                  : vm_write_arithmetic((char*)ARITHMETIC_OPS[instr->op]);
+            } else {
+                printf("[ERR] Command type %d is not currently supported.\n", instr->op);
+                status = WC_UNSUPPORTED_CMD;
+            }
+            break;
     }
 
     if (status == WC_SUCCESS && translated != NULL) {
         fprintf(cw->out, "%s", translated);
     } else {
-        printf("[ERR] Not writing translation of command \"%s\" to file due to vm_wc_status code"
-               " %d\n", command, status);
+        printf("[ERR] Not writing translation of command %d to file due to vm_wc_status code %d\n",
+               instr->op, status);
     }
 
     reinit_str(&translated);
-    reinit_str(&arg1);
     return status;
 }
 
 
+/**
+ * Writes every command of a program in Hack assembly format. If @stats isn't NULL, patterns of
+ * commands the peephole optimizer knows are written as one fused sequence, and counted in @stats.
+ *
+ * @param prog  the program to translate
+ * @param cw    the code_writer to use to write the translated commands
+ * @param stats the peephole optimizer's counters, or NULL to translate each command on its own
+ */
+void vm_write_program(const vm_program *prog, code_writer *cw, peep_stats *stats) {
+    int i = 0;
+    while (i < prog->num_instrs) {
+        char *fused = NULL;
+        int used = stats != NULL ? vm_peephole(prog, i, cw->func, stats, &fused) : 0;
+
+        if (used > 0) {
+            fprintf(cw->out, "%s", fused);
+            reinit_str(&fused);
+            i += used;
+        } else {
+            vm_write_command(prog, &prog->instrs[i], cw);
+            i++;
+        }
+    }
+
+    if (stats != NULL) {
+        stats->commands += prog->num_instrs;
+    }
+}
+
+
 /**
  * Encodes arithmetic VM operations as Hack assembly code.
  *
@@ -392,27 +387,72 @@ char *vm_write_arithmetic(char *command) {
 }
 
 
+/**
+ * Encodes an arithmetic VM operation as Hack assembly code that does the whole operation in place,
+ * rather than jumping to the shared routine for it like vm_write_arithmetic() does.
+ *
+ * @param op the arithmetic operation to encode
+ * @return   the encoded operation, or NULL if @op isn't an arithmetic operation
+ */
+char *vm_write_inline_arithmetic(vm_opcode_t op) {
+    char *encoded = NULL;
+
+    switch (op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_AND:
+        case OP_OR:
+            encoded = fmt_str_printf(&INLINE_BINARY_CMD, strlen(HACK_ARITH_OPS[op]), HACK_ARITH_OPS[op]);
+            break;
+        case OP_NEG:
+        case OP_NOT:
+            encoded = fmt_str_printf(&INLINE_UNARY_CMD, strlen(HACK_ARITH_OPS[op]), HACK_ARITH_OPS[op]);
+            break;
+        case OP_EQ:
+        case OP_GT:
+        case OP_LT:
+            encoded = fmt_str_printf(
+                &INLINE_CMP_CMD,
+                2 * num_digits(num_inline_cmps) + strlen(HACK_ARITH_OPS[op]),
+                num_inline_cmps, HACK_ARITH_OPS[op], num_inline_cmps
+            );
+            num_inline_cmps++;
+            break;
+        default:
+            printf("[ERR] Operation %d is not an arithmetic operation\n", op);
+            break;
+    }
+
+    return encoded;
+}
+
+
 /**
  * Translates a VM push or pop command into Hack assembly code.
  *
- * @param segment  the segment that data is being pushed from/popped to
+ * @param seg      the segment that data is being pushed from/popped to
  * @param index    the index in the segment to select data from
- * @param cmd_type the type of command to translate (push or pop)
+ * @param op       the operation to translate (OP_PUSH or OP_POP)
  * @param in_fname the name (without a file extension) of the .vm file being translated
  * @return         the translated assembly code
  */
-char *vm_write_push_pop(vm_mem_seg segment, int index, vm_command_t cmd_type, char *in_fname) {
+char *vm_write_push_pop(vm_segment_t seg, int index, vm_opcode_t op, char *in_fname) {
     char *push_encoded = NULL;
+
+    if (seg <= SEG_NONE || seg >= NUM_SEGMENTS) {
+        printf("[ERR] Invalid memory segment %d\n", seg);
+        return NULL;
+    }
+
+    const vm_mem_seg *segment = SEGMENTS[seg];
     // The value to push onto the stack is the value starting at the index-th value in 
     // the given segment
-    int mem_addr = index + segment.begin_addr;
+    int mem_addr = index + segment->begin_addr;
 
-    if (segcmp(segment, SEG_INVALID)) {
-        printf("[ERR] Invalid memory segment %s\n", segment.vm_name == NULL ? "(unnamed segment)" : segment.vm_name);
     // Validate the memory address
-    } else if (mem_addr < 0 || (segment.end_addr > -1 && mem_addr > segment.end_addr)) {
-        printf("[ERR] Invalid memory address %d in segment %s\n", mem_addr, segment.vm_name);
-    } else if (segcmp(segment, CONSTANT)) {
+    if (!vm_valid_index(seg, index)) {
+        printf("[ERR] Invalid memory address %d in segment %s\n", mem_addr, segment->vm_name);
+    } else if (seg == SEG_CONSTANT) {
         /*
          * To push a constant value onto the stack, we have to increment the stack pointer,
          * store that value in D, and then put that value in the memory address pointed to by
@@ -422,20 +462,21 @@ char *vm_write_push_pop(vm_mem_seg segment, int index, vm_command_t cmd_type, ch
          * the "pop" command cannot be used with it.
          */
         push_encoded = fmt_str_printf(&PUSH_CONSTANT_SEG, num_digits(mem_addr), mem_addr);
-    } else if (segcmp(segment, LCL) || segcmp(segment, ARG) || segcmp(segment, THIS) || segcmp(segment, THAT) || segcmp(segment, TEMP)) {
-        char *seg_hack_name = vms_name(segment);
-        const fmt_str *fs = cmd_type == C_PUSH ? &PUSH_VIRTUAL_SEG : &POP_VIRTUAL_SEG;
-        if (segcmp(segment, TEMP)) {
-            fs = cmd_type == C_PUSH ? &PUSH_LITERAL_SEG : &POP_LITERAL_SEG;
+    } else if (seg == SEG_LOCAL || seg == SEG_ARGUMENT || seg == SEG_THIS || seg == SEG_THAT
+               || seg == SEG_TEMP) {
+        char *seg_hack_name = vms_name(*segment);
+        const fmt_str *fs = op == OP_PUSH ? &PUSH_VIRTUAL_SEG : &POP_VIRTUAL_SEG;
+        if (seg == SEG_TEMP) {
+            fs = op == OP_PUSH ? &PUSH_LITERAL_SEG : &POP_LITERAL_SEG;
         }
         push_encoded = fmt_str_printf(fs, strlen(seg_hack_name) + num_digits(index), seg_hack_name, index);
         reinit_str(&seg_hack_name);
-    } else if (segcmp(segment, POINTER) || segcmp(segment, TEMP)) {
-        push_encoded = fmt_str_printf(cmd_type == C_PUSH ? &PUSH_POINTER_SEG : &POP_POINTER_SEG, num_digits(mem_addr), mem_addr);
-    } else if (segcmp(segment, STATIC)) {
-        push_encoded = fmt_str_printf(cmd_type == C_PUSH ? &PUSH_STATIC_SEG : &POP_STATIC_SEG, strlen(in_fname) + num_digits(index), in_fname, index);
+    } else if (seg == SEG_POINTER) {
+        push_encoded = fmt_str_printf(op == OP_PUSH ? &PUSH_POINTER_SEG : &POP_POINTER_SEG, num_digits(mem_addr), mem_addr);
+    } else if (seg == SEG_STATIC) {
+        push_encoded = fmt_str_printf(op == OP_PUSH ? &PUSH_STATIC_SEG : &POP_STATIC_SEG, strlen(in_fname) + num_digits(index), in_fname, index);
     } else {
-        printf("[ERR] Pushing from the segment %s is not supported\n", segment.vm_name);
+        printf("[ERR] Pushing from the segment %s is not supported\n", segment->vm_name);
     }
 
     return push_encoded;
@@ -450,7 +491,7 @@ char *vm_write_push_pop(vm_mem_seg segment, int index, vm_command_t cmd_type, ch
  * @return      the translated Hack code
  */
 char *vm_write_label(char *func, char *label) {
-    return gen_label_cmd(DEF_LABEL, func, label);
+    return gen_label_cmd(DEF_LABEL, func, label, NULL);
 }
 
 
@@ -462,7 +503,7 @@ char *vm_write_label(char *func, char *label) {
  * @return      the Hack code needed to go to the label
  */
 char *vm_write_goto(char *func, char *label) {
-    return gen_label_cmd(GOTO_LABEL, func, label);
+    return gen_label_cmd(GOTO_LABEL, func, label, NULL);
 }
 
 
@@ -474,7 +515,25 @@ char *vm_write_goto(char *func, char *label) {
  * @return      the Hack code needed to conditiionally jump to the label
  */
 char *vm_write_if(char *func, char *label) {
-    return gen_label_cmd(IF_GOTO_LABEL, func, label);
+    return gen_label_cmd(IF_GOTO_LABEL, func, label, NULL);
+}
+
+
+/**
+ * Translates a comparison followed by an if-goto into Hack assembly code that jumps on the
+ * comparison directly, rather than pushing its -1/0 result and then popping it to test it.
+ *
+ * @param func  the VM function that the label is in
+ * @param label the label to conditionally jump to
+ * @param jump  the condition to jump on, e.g. "LT" to jump if the second value on the stack is less
+ *              than the top one
+ * @param pops  2 to compare the second value on the stack with the top one, 1 to compare the top
+ *              value with 0, or 0 to compare D with 0 when the top of the stack is cached in D
+ * @return      the Hack code needed to conditionally jump to the label
+ */
+char *vm_write_compare_goto(char *func, char *label, const char *jump, int pops) {
+    const fmt_str *fs = pops == 2 ? &CMP_GOTO_LABEL : pops == 1 ? &ZERO_GOTO_LABEL : &D_GOTO_LABEL;
+    return gen_label_cmd(*fs, func, label, jump);
 }
 
 
@@ -565,47 +624,52 @@ void vm_code_writer_close(code_writer *cw) {
     // Hack routine to return from a function (including resetting the global stack to the previous state of the caller function)
     fprintf(out, "%s\n", FUNC_RETURN);
 
-    // A map of VM arithmetic operations (add, sub, etc) and the assembly commands associated with them
-    ht_hash_table *vm_op_to_asm = ht_new(NUM_ARITH_OPS);
-    ht_insert_all(vm_op_to_asm, NUM_ARITH_OPS, ARITHMETIC_OPS, HACK_ARITH_OPS);
-    
-    // Arithmetic operations (this could be made DRYer, but I think it's more clear when written out)
-    char *add_op = gen_arith_cmd(ARITH_ADDSUB_BASE_CMD.str, "add", vm_op_to_asm);
-    char *sub_op = gen_arith_cmd(ARITH_ADDSUB_BASE_CMD.str, "sub", vm_op_to_asm);
-    char *eq_op = gen_arith_cmd(ARITH_CMP_BASE_CMD.str, "eq", vm_op_to_asm);
-    char *gt_op = gen_arith_cmd(ARITH_CMP_BASE_CMD.str, "gt", vm_op_to_asm);
-    char *lt_op = gen_arith_cmd(ARITH_CMP_BASE_CMD.str, "lt", vm_op_to_asm);
-    char *and_op = gen_arith_cmd(ARITH_BOOL_BASE_CMD.str, "and", vm_op_to_asm);
-    char *or_op = gen_arith_cmd(ARITH_BOOL_BASE_CMD.str, "or", vm_op_to_asm);
-    char *neg_op = gen_arith_cmd(ARITH_UNARY_BASE_CMD.str, "neg", vm_op_to_asm);
-    char *not_op = gen_arith_cmd(ARITH_UNARY_BASE_CMD.str, "not", vm_op_to_asm);
-    fprintf(out, "%s\n", add_op);
-    fprintf(out, "%s\n", sub_op);
-    fprintf(out, "%s\n", eq_op);
-    fprintf(out, "%s\n", gt_op);
-    fprintf(out, "%s\n", lt_op);
-    fprintf(out, "%s\n", and_op);
-    fprintf(out, "%s\n", or_op);
-    fprintf(out, "%s\n", neg_op);
-    fprintf(out, "%s\n", not_op);
-    reinit_str(&add_op);
-    reinit_str(&sub_op);
-    reinit_str(&eq_op);
-    reinit_str(&gt_op);
-    reinit_str(&lt_op);
-    reinit_str(&and_op);
-    reinit_str(&or_op);
-    reinit_str(&neg_op);
-    reinit_str(&not_op);
-    
-
-    ht_delete(vm_op_to_asm);
+    // Arithmetic is written out in full at each use when optimizing for speed or caching the top of
+    // the stack, so nothing jumps to the shared arithmetic routines
+    if (cw->opt < OPT_SPEED) {
+        // A map of VM arithmetic operations (add, sub, etc) and the assembly commands associated with them
+        ht_hash_table *vm_op_to_asm = ht_new(NUM_ARITH_OPS);
+        ht_insert_all(vm_op_to_asm, NUM_ARITH_OPS, ARITHMETIC_OPS, HACK_ARITH_OPS);
+
+        // Arithmetic operations (this could be made DRYer, but I think it's more clear when written out)
+        char *add_op = gen_arith_cmd(ARITH_ADDSUB_BASE_CMD.str, "add", vm_op_to_asm);
+        char *sub_op = gen_arith_cmd(ARITH_ADDSUB_BASE_CMD.str, "sub", vm_op_to_asm);
+        char *eq_op = gen_arith_cmd(ARITH_CMP_BASE_CMD.str, "eq", vm_op_to_asm);
+        char *gt_op = gen_arith_cmd(ARITH_CMP_BASE_CMD.str, "gt", vm_op_to_asm);
+        char *lt_op = gen_arith_cmd(ARITH_CMP_BASE_CMD.str, "lt", vm_op_to_asm);
+        char *and_op = gen_arith_cmd(ARITH_BOOL_BASE_CMD.str, "and", vm_op_to_asm);
+        char *or_op = gen_arith_cmd(ARITH_BOOL_BASE_CMD.str, "or", vm_op_to_asm);
+        char *neg_op = gen_arith_cmd(ARITH_UNARY_BASE_CMD.str, "neg", vm_op_to_asm);
+        char *not_op = gen_arith_cmd(ARITH_UNARY_BASE_CMD.str, "not", vm_op_to_asm);
+        fprintf(out, "%s\n", add_op);
+        fprintf(out, "%s\n", sub_op);
+        fprintf(out, "%s\n", eq_op);
+        fprintf(out, "%s\n", gt_op);
+        fprintf(out, "%s\n", lt_op);
+        fprintf(out, "%s\n", and_op);
+        fprintf(out, "%s\n", or_op);
+        fprintf(out, "%s\n", neg_op);
+        fprintf(out, "%s\n", not_op);
+        reinit_str(&add_op);
+        reinit_str(&sub_op);
+        reinit_str(&eq_op);
+        reinit_str(&gt_op);
+        reinit_str(&lt_op);
+        reinit_str(&and_op);
+        reinit_str(&or_op);
+        reinit_str(&neg_op);
+        reinit_str(&not_op);
+
+        ht_delete(vm_op_to_asm);
+    }
 
     // Assists jump back to primary program flow after built-in operations
     fprintf(out, "%s\n", JUMP_OP_END);
 
-    // Enables true/false operations
-    fprintf(out, "%s\n", TF_FUNC);
+    // Enables true/false operations, which only the shared comparison routines use
+    if (cw->opt < OPT_SPEED) {
+        fprintf(out, "%s\n", TF_FUNC);
+    }
 
     cw_delete(&cw);
 }
@@ -713,3 +777,32 @@ char *vms_name(vm_mem_seg vms) {
 
     return name;
 }
+
+
+/**
+ * Gets the vm_mem_seg that describes a segment.
+ *
+ * @param seg the segment to describe
+ * @return    the segment's vm_mem_seg, or NULL if @seg isn't a segment
+ */
+const vm_mem_seg *vm_segment_info(vm_segment_t seg) {
+    return seg > SEG_NONE && seg < NUM_SEGMENTS ? SEGMENTS[seg] : NULL;
+}
+
+
+/**
+ * Checks whether an index is within a segment.
+ *
+ * @param seg   the segment
+ * @param index the index into @seg
+ * @return      1 if @index is a valid index into @seg, 0 otherwise
+ */
+int vm_valid_index(vm_segment_t seg, int index) {
+    const vm_mem_seg *segment = vm_segment_info(seg);
+    if (segment == NULL) {
+        return 0;
+    }
+
+    int mem_addr = index + segment->begin_addr;
+    return mem_addr >= 0 && (segment->end_addr == -1 || mem_addr <= segment->end_addr);
+}
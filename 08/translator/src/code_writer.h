@@ -5,14 +5,26 @@
 #include <stdlib.h>
 
 #include "parser.h"
+#include "peephole.h"
 
 
+// What the code writer optimizes the generated code for
+typedef enum vm_opt_mode {
+    OPT_NONE,  // Translate each command on its own, sharing one copy of each arithmetic routine
+    OPT_SIZE,  // Like OPT_NONE, but fuse patterns of commands with the peephole optimizer
+    OPT_SPEED, // Fuse patterns of commands, and write arithmetic out in full at each use, with no
+               // jumps to shared routines
+    OPT_TOS    // Write arithmetic out in full at each use, keeping the top of the stack in D instead
+               // of RAM wherever possible
+} vm_opt_mode;
+
 // Stores the file that the code writer writes to, and the name of the .vm file currently being translated
 typedef struct code_writer {
     // The file to write to
     FILE *out;
     char *in_name;
     char *func;
+    vm_opt_mode opt;
 } code_writer;
 
 // Stores info about a VM memory segment
@@ -60,13 +72,16 @@ extern const vm_mem_seg SEG_INVALID;
 
 code_writer *VM_Code_Writer(char*);
 void vm_set_filename(char*);
-vm_wc_status vm_write_command(char*, vm_command_t, code_writer*);
+vm_wc_status vm_write_command(const vm_program*, const vm_instr*, code_writer*);
+void vm_write_program(const vm_program*, code_writer*, peep_stats*);
 char *vm_write_initial(char*);
 char *vm_write_arithmetic(char*);
-char *vm_write_push_pop(vm_mem_seg, int, vm_command_t, char*);
+char *vm_write_inline_arithmetic(vm_opcode_t);
+char *vm_write_push_pop(vm_segment_t, int, vm_opcode_t, char*);
 char *vm_write_label(char*, char*);
 char *vm_write_goto(char*, char*);
 char *vm_write_if(char*, char*);
+char *vm_write_compare_goto(char*, char*, const char*, int);
 char *vm_write_call(char*, int);
 char *vm_write_function(code_writer*, int);
 char *vm_write_return();
@@ -78,5 +93,7 @@ void cw_set_in_name(code_writer*, char*);
 void cw_delete(code_writer**);
 
 char *vms_name(vm_mem_seg);
+const vm_mem_seg *vm_segment_info(vm_segment_t);
+int vm_valid_index(vm_segment_t, int);
 
 #endif /* _VM_CODE_WRITER_H */
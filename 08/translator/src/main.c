@@ -1,71 +1,120 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include "callgraph.h"
 #include "code_writer.h"
 #include "parser.h"
+#include "peephole.h"
 #include "tinydir.h"
+#include "tos.h"
 #include "util.h"
 #include "vm_constants.h"
 
 
-void process_file(char *in_path, code_writer *cw) {
+/**
+ * Parses a .vm file, appending its commands to the program being translated.
+ *
+ * @param in_path the path to the .vm file
+ * @param prog    the program to append the file's commands to
+ */
+void process_file(char *in_path, vm_program *prog) {
     path_parts *in_path_parts = calloc(1, sizeof(path_parts));
     in_path_parts->dirname = calloc(strlen(in_path) + 1, sizeof(char));
     in_path_parts->basename = calloc(strlen(in_path) + 1, sizeof(char));
     path_parts_split(in_path_parts, in_path);
     char *infile_name_noext = remove_fext(in_path_parts->basename);
-    char *line = NULL;
-    FILE *infile = fopen(in_path, "r");
+    FILE *infile = VM_Parser(in_path);
 
-    cw_set_in_name(cw, infile_name_noext);
-
-    while ((line = vm_advance(infile)) != NULL) {
-        vm_write_command(line, vm_command_type(line), cw);
-        reinit_str(&line);
+    if (infile != NULL) {
+        vm_parse_file(prog, infile, infile_name_noext);
+        fclose(infile);
     }
 
-    fclose(infile);
     reinit_str(&infile_name_noext);
-    reinit_str(&(cw->in_name));
     path_parts_delete(&in_path_parts);
 }
 
 
 int main(int argc, char **argv) {
     const char *VM_FILE_EXT = "vm";
+    const char *usage =
+        "Usage: ./translator [-O size|speed|tos] path/to/prog.vm\n"
+        "                                 or path/to/project/dir/\n\n"
+        "If passing a path to a directory, the directory should contain at least 1\n"
+        ".vm file. Functions that can't be called from Sys.init are left out, and listed.\n\n"
+        "  -O size   write one fused sequence for each pattern of commands the peephole\n"
+        "            optimizer knows, and print how many times each pattern matched\n"
+        "  -O speed  like -O size, but also write each arithmetic operation out in full where\n"
+        "            it's used, so that it doesn't jump to a shared routine and back\n"
+        "  -O tos    write arithmetic out in full like -O speed, and keep the value on top of\n"
+        "            the stack in the D register instead of RAM wherever possible, printing\n"
+        "            how often it had to be moved between the two\n";
+    vm_opt_mode opt_mode = OPT_NONE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "O:")) != -1) {
+        if (opt == 'O' && !strcmp(optarg, "size")) {
+            opt_mode = OPT_SIZE;
+        } else if (opt == 'O' && !strcmp(optarg, "speed")) {
+            opt_mode = OPT_SPEED;
+        } else if (opt == 'O' && !strcmp(optarg, "tos")) {
+            opt_mode = OPT_TOS;
+        } else {
+            printf("%s", usage);
+            return EXIT_FAILURE;
+        }
+    }
 
-    if (argc != 2) {
-        printf("Usage: ./translator path/to/prog.vm\n"
-               "                 or path/to/project/dir/\n\n"
-               "If passing a path to a directory, the directory should contain at least 1\n"
-               ".vm file.");
+    if (argc - optind != 1) {
+        printf("%s", usage);
         return EXIT_FAILURE;
     }
+    char *input_path = argv[optind];
 
-    code_writer *cw = VM_Code_Writer(argv[1]);
-    FILE *infile = NULL;
+    code_writer *cw = VM_Code_Writer(input_path);
+    cw->opt = opt_mode;
+    vm_program *prog = vm_program_new();
+    vm_program *dead = NULL;
 
-    if (is_directory(argv[1])) {
+    if (is_directory(input_path)) {
         tinydir_dir dir;
-        tinydir_open(&dir, argv[1]);
+        tinydir_open(&dir, input_path);
 
         while (dir.has_next) {
             tinydir_file file;
             tinydir_readfile(&dir, &file);
             if (file.is_reg && !strcmp(file.extension, VM_FILE_EXT)) {
-                infile = fopen(file.path, "r");
-                process_file(file.path, cw);
-                fclose(infile);
-                infile = NULL;
+                process_file(file.path, prog);
             }
 
             tinydir_next(&dir);
         }
         tinydir_close(&dir);
+
+        dead = vm_remove_dead_functions(prog);
     } else {
-        process_file(argv[1], cw);
+        process_file(input_path, prog);
+    }
+
+    if (opt_mode == OPT_TOS) {
+        tos_stats stats = {0};
+        vm_write_program_tos(prog, cw, &stats);
+        print_tos_stats(stderr, &stats);
+    } else {
+        peep_stats stats = {0};
+        vm_write_program(prog, cw, opt_mode != OPT_NONE ? &stats : NULL);
+        if (opt_mode != OPT_NONE) {
+            print_peep_stats(stderr, &stats);
+        }
+    }
+
+    if (dead != NULL && dead->num_instrs > 0) {
+        print_dead_functions(stderr, dead, vm_count_words(dead, opt_mode));
     }
+    vm_program_delete(&dead);
 
+    vm_program_delete(&prog);
     vm_code_writer_close(cw);
 
     return 0;
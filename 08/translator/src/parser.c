@@ -5,10 +5,13 @@
 
 #include "parser.h"
 #include "vm_constants.h"
+#include "../../../lib/hash_table.h"
 
 const char BEGIN_COMMENT = '/';
 const char EOL = '\n';
 
+#define MAX_WORDS 3  // The most words in a VM command, e.g. "push constant 7"
+
 
 /**
  * Opens the .vm file for processing.
@@ -105,123 +108,284 @@ char *vm_advance(FILE *file) {
 
 
 /**
- * Determines the command type of @command.
+ * Creates an empty vm_program.
+ *
+ * @return a new vm_program
+ */
+vm_program *vm_program_new() {
+    vm_program *prog = calloc(1, sizeof(vm_program));
+    prog->num_buckets = 64;
+    prog->sym_buckets = calloc(prog->num_buckets, sizeof(int));
+    return prog;
+}
+
+
+/**
+ * Hashes the first @len characters of @str with FNV-1a.
  *
- * @param command the command to determine the type of
- * @return        the command type
+ * @param str the string to hash
+ * @param len the number of characters of @str to hash
+ * @return    the hash
  */
-vm_command_t vm_command_type(char *line) {
-    unsigned int i = 0;
-    for (; i < strlen(line); i++) {
-        if (line[i] == ' ') {
+static unsigned long long hash_symbol(const char *str, int len) {
+    unsigned long long hash = HT_FNV_OFFSET_BASIS;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= HT_FNV_PRIME;
+    }
+    return hash;
+}
+
+
+/**
+ * Finds the bucket that holds @name in @prog's symbol hash, or the empty bucket where it would go.
+ *
+ * @param prog the program whose symbols to search
+ * @param name the symbol to search for (doesn't have to be null-terminated)
+ * @param len  the length of @name
+ * @return     the index of the bucket
+ */
+static int find_bucket(const vm_program *prog, const char *name, int len) {
+    int mask = prog->num_buckets - 1;
+    int i = hash_symbol(name, len) & mask;
+    while (prog->sym_buckets[i]) {
+        const char *sym = prog->symbols[prog->sym_buckets[i] - 1];
+        if (!strncmp(sym, name, len) && sym[len] == '\0') {
             break;
         }
+        i = (i + 1) & mask;
     }
+    return i;
+}
 
-    if ((int)i < SHORTEST_OP_LEN) {
-        return C_INVALID;
-    }
-
-    // Copy the command from the VM program line given
-    char *cmd = calloc(i + 1, sizeof(char));
-    snprintf(cmd, i + 1, "%s", line);
-    
-    vm_command_t cmd_type = C_INVALID;
-
-    if (!strcmp(cmd, PUSH_OP)) {
-        cmd_type = C_PUSH;
-    } else if (!strcmp(cmd, POP_OP)) {
-        cmd_type = C_POP;
-    } else if (!strcmp(cmd, LABEL_OP)) {
-        cmd_type = C_LABEL;
-    } else if (!strcmp(cmd, GOTO_OP)) {
-        cmd_type = C_GOTO;
-    } else if (!strcmp(cmd, IF_OP)) {
-        cmd_type = C_IF;
-    } else if (!strcmp(cmd, FUNCTION_OP)) {
-        cmd_type = C_FUNCTION;
-    } else if (!strcmp(cmd, CALL_OP)) {
-        cmd_type = C_CALL;
-    } else if (!strcmp(cmd, RETURN_OP)) {
-        cmd_type = C_RETURN;
-    } else {
-        for (i = 0; i < sizeof(ARITHMETIC_OPS) / sizeof(ARITHMETIC_OPS[0]) - 1; i++) {
-            if (!strcmp(cmd, ARITHMETIC_OPS[i])) {
-                cmd_type = C_ARITHMETIC;
-            }
-        }
+
+/**
+ * Gets the id of a symbol in a program, adding the symbol if the program doesn't have it yet. Every
+ * use of the same name gets the same id, so later passes can compare symbols as ints.
+ *
+ * @param prog the program to intern the symbol in
+ * @param name the symbol (doesn't have to be null-terminated)
+ * @param len  the length of @name
+ * @return     the symbol's id, an index into @prog's symbols
+ */
+int vm_intern(vm_program *prog, const char *name, int len) {
+    int bucket = find_bucket(prog, name, len);
+    if (prog->sym_buckets[bucket]) {
+        return prog->sym_buckets[bucket] - 1;
     }
 
-    free(cmd);
+    // Keep the hash at most half full so that probe sequences stay short
+    if (2 * (prog->num_symbols + 1) > prog->num_buckets) {
+        free(prog->sym_buckets);
+        prog->num_buckets *= 2;
+        prog->sym_buckets = calloc(prog->num_buckets, sizeof(int));
+        for (int id = 0; id < prog->num_symbols; id++) {
+            const char *sym = prog->symbols[id];
+            prog->sym_buckets[find_bucket(prog, sym, strlen(sym))] = id + 1;
+        }
+        bucket = find_bucket(prog, name, len);
+
+        prog->symbols = realloc(prog->symbols, prog->num_buckets / 2 * sizeof(char*));
+    } else if (prog->symbols == NULL) {
+        prog->symbols = calloc(prog->num_buckets / 2, sizeof(char*));
+    }
 
-    return cmd_type;
+    int id = prog->num_symbols++;
+    prog->symbols[id] = strndup(name, len);
+    prog->sym_buckets[bucket] = id + 1;
+    return id;
 }
 
 
 /**
- * Returns the first argument of the given command. In the case of C_ARITHMETIC, the command itself
- * ("add", "sub", etc.) is returned. Should not be called for C_RETURN. If given an invalid command
- * type, returns NULL.
+ * Parses a non-negative decimal integer.
  *
- * @param line the line from the VM program
- * @return     the first argument, or NULL if an invalid command type is given
-*/
-char *vm_arg1(char *line) {
-    vm_command_t cmd_type = vm_command_type(line);
+ * @param str the digits (doesn't have to be null-terminated)
+ * @param len the number of digits
+ * @return    the integer, or -1 if @str isn't a non-negative integer that fits in an int
+ */
+static int parse_index(const char *str, int len) {
+    if (len == 0 || len > 9) {
+        return -1;
+    }
 
-    if (cmd_type == C_RETURN || cmd_type == C_INVALID) {
-        return NULL;
-    } else if (cmd_type == C_ARITHMETIC) {
-        // Copy the original line to a new variable so that we don't return a direct pointer to the
-        // `line` parameter
-        char *copy = calloc(strlen(line) + 1, sizeof(char));
-        snprintf(copy, strlen(line) + 1, "%s", line);
-        return copy;
+    int value = 0;
+    for (int i = 0; i < len; i++) {
+        if (str[i] < '0' || str[i] > '9') {
+            return -1;
+        }
+        value = 10 * value + (str[i] - '0');
+    }
+    return value;
+}
+
+
+/**
+ * Looks up the name of a VM operation.
+ *
+ * @param word the operation, e.g. "push" (doesn't have to be null-terminated)
+ * @param len  the length of @word
+ * @return     the operation, or OP_INVALID if @word isn't one
+ */
+static vm_opcode_t opcode_of(const char *word, int len) {
+    const char *ops[] = {PUSH_OP, POP_OP, LABEL_OP, GOTO_OP, IF_OP, FUNCTION_OP, CALL_OP, RETURN_OP};
+    for (int i = 0; ARITHMETIC_OPS[i] != NULL; i++) {
+        if (!strncmp(word, ARITHMETIC_OPS[i], len) && ARITHMETIC_OPS[i][len] == '\0') {
+            return OP_ADD + i;
+        }
     }
+    for (int i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+        if (!strncmp(word, ops[i], len) && ops[i][len] == '\0') {
+            return OP_PUSH + i;
+        }
+    }
+    return OP_INVALID;
+}
 
-    int i = 0;
-    while (line[i] != ' ') {
-        i++;
+
+/**
+ * Parses one line of a VM program into a vm_instr, checking that it has the arguments its
+ * operation needs. Invalid lines are reported and parsed as an instruction with the op OP_INVALID.
+ *
+ * @param prog the program to intern the line's symbols in
+ * @param line the line, without comments, as returned by vm_advance()
+ * @param file the symbol id of the .vm file the line is from (without its extension), which push
+ *             and pop instructions carry so that static variables can be named
+ * @return     the parsed instruction
+ */
+vm_instr vm_parse_line(vm_program *prog, const char *line, int file) {
+    vm_instr instr = {OP_INVALID, SEG_NONE, -1, -1};
+    const char *words[MAX_WORDS];
+    int lens[MAX_WORDS];
+    int num_words = 0;
+
+    // Split the line into words in place, without copying any of them
+    const char *p = line;
+    while (*p != '\0') {
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        if (num_words == MAX_WORDS) {
+            num_words++;
+            break;
+        }
+        words[num_words] = p;
+        while (*p != '\0' && *p != ' ') {
+            p++;
+        }
+        lens[num_words] = p - words[num_words];
+        num_words++;
     }
-    i++;
 
-    int j = i;
-    while (j < (int)strlen(line) && line[j] != ' ') {
-        j++;
+    vm_opcode_t op = num_words > 0 ? opcode_of(words[0], lens[0]) : OP_INVALID;
+    int valid = 0;
+    switch (op) {
+        case OP_PUSH:
+        case OP_POP:
+            if (num_words == 3) {
+                for (int i = 0; SEGMENT_NAMES[i] != NULL; i++) {
+                    if (!strncmp(words[1], SEGMENT_NAMES[i], lens[1])
+                            && SEGMENT_NAMES[i][lens[1]] == '\0') {
+                        instr.seg = i;
+                    }
+                }
+                instr.arg = parse_index(words[2], lens[2]);
+                instr.sym = file;
+                valid = instr.seg != SEG_NONE && instr.arg > -1;
+            }
+            break;
+        case OP_LABEL:
+        case OP_GOTO:
+        case OP_IF:
+            if (num_words == 2) {
+                instr.sym = vm_intern(prog, words[1], lens[1]);
+                valid = 1;
+            }
+            break;
+        case OP_FUNCTION:
+        case OP_CALL:
+            if (num_words == 3) {
+                instr.sym = vm_intern(prog, words[1], lens[1]);
+                instr.arg = parse_index(words[2], lens[2]);
+                valid = instr.arg > -1;
+            }
+            break;
+        case OP_INVALID:
+            break;
+        default:  // Arithmetic and return take no arguments
+            valid = num_words == 1;
+            break;
     }
 
-    char *arg = calloc(j - i + 1, sizeof(char));
-    snprintf(arg, j - i + 1, "%s", line + i);
+    if (valid) {
+        instr.op = op;
+    } else {
+        printf("[ERR] Invalid command %s\n", line);
+        instr = (vm_instr){OP_INVALID, SEG_NONE, -1, -1};
+    }
 
-    return arg;
+    return instr;
 }
 
 
 /**
- * Returns the second argument of the current command. Should be called only if the current command
- * is C_PUSH, C_POP, C_FUNCTION, or C_CALL. If called on an invalid command type, returns -1.
+ * Appends an instruction to a program.
  *
- * @param line the VM program line to parse the second argument out of
- * @return     the second argument, or -1 if the second argument doesn't exist
+ * @param prog  the program to append to
+ * @param instr the instruction to append
  */
-int vm_arg2(char *line) {
-    vm_command_t cmd_type = vm_command_type(line);
-
-    if (cmd_type != C_PUSH && cmd_type != C_POP && cmd_type != C_FUNCTION && cmd_type != C_CALL) {
-        return -1;
+void vm_program_append(vm_program *prog, vm_instr instr) {
+    if (prog->num_instrs == prog->instrs_size) {
+        prog->instrs_size = prog->instrs_size ? 2 * prog->instrs_size : 256;
+        prog->instrs = realloc(prog->instrs, prog->instrs_size * sizeof(vm_instr));
     }
+    prog->instrs[prog->num_instrs++] = instr;
+}
 
-    int num_spaces = 0;
-    int i = 0;
 
-    // We want to go past the first two spaces in this line of the VM program. For instance:
-    //      push constant 2
-    //          ^        ^
-    while (i < (int)strlen(line)) {
-        if (line[i] == ' ') num_spaces++;
-        i++;
-        if (num_spaces == 2) break;
+/**
+ * Parses every line of a .vm file, appending the valid ones to a program. Invalid lines are
+ * reported and left out.
+ *
+ * @param prog      the program to append the file's instructions to
+ * @param file      the open .vm file
+ * @param file_name the name of the .vm file, without its extension
+ * @return          the number of invalid lines in the file
+ */
+int vm_parse_file(vm_program *prog, FILE *file, const char *file_name) {
+    int file_sym = vm_intern(prog, file_name, strlen(file_name));
+    int num_invalid = 0;
+    char *line = NULL;
+
+    while ((line = vm_advance(file)) != NULL) {
+        vm_instr instr = vm_parse_line(prog, line, file_sym);
+        if (instr.op == OP_INVALID) {
+            num_invalid++;
+        } else {
+            vm_program_append(prog, instr);
+        }
+        free(line);
     }
 
-    return atoi(line + i);
+    return num_invalid;
+}
+
+
+/**
+ * Deletes a vm_program, along with all of its instructions and symbols.
+ *
+ * @param prog a double pointer to the program to delete
+ */
+void vm_program_delete(vm_program **prog) {
+    if (*prog != NULL) {
+        for (int i = 0; i < (*prog)->num_symbols; i++) {
+            free((*prog)->symbols[i]);
+        }
+        free((*prog)->symbols);
+        free((*prog)->sym_buckets);
+        free((*prog)->instrs);
+        free(*prog);
+        *prog = NULL;
+    }
 }
@@ -3,18 +3,67 @@
 
 #include <stdio.h>
 
-typedef enum vm_command_t {
-    C_INVALID = -1,
-    C_ARITHMETIC = 0,
-    C_PUSH = 1,
-    C_POP = 2,
-    C_LABEL = 3,
-    C_GOTO = 4,
-    C_IF = 5,
-    C_FUNCTION = 6,
-    C_RETURN = 7,
-    C_CALL = 8
-} vm_command_t;
+// The operation of a parsed VM instruction. The arithmetic operations come first, in the same
+// order as ARITHMETIC_OPS, so that ARITHMETIC_OPS[op] is the name of an arithmetic op.
+typedef enum vm_opcode_t {
+    OP_INVALID = -1,
+    OP_ADD,
+    OP_SUB,
+    OP_NEG,
+    OP_EQ,
+    OP_GT,
+    OP_LT,
+    OP_AND,
+    OP_OR,
+    OP_NOT,
+    OP_PUSH,
+    OP_POP,
+    OP_LABEL,
+    OP_GOTO,
+    OP_IF,
+    OP_FUNCTION,
+    OP_CALL,
+    OP_RETURN
+} vm_opcode_t;
+
+// The memory segment of a parsed push or pop, in the same order as SEGMENT_NAMES
+typedef enum vm_segment_t {
+    SEG_NONE = -1,
+    SEG_LOCAL,
+    SEG_ARGUMENT,
+    SEG_THIS,
+    SEG_THAT,
+    SEG_POINTER,
+    SEG_TEMP,
+    SEG_GENERAL,
+    SEG_CONSTANT,
+    SEG_STATIC,
+    SEG_STACK,
+    SEG_HEAP,
+    SEG_IO,
+    NUM_SEGMENTS
+} vm_segment_t;
+
+// A VM command, parsed once so that nothing after the parser has to look at its text again
+typedef struct vm_instr {
+    vm_opcode_t op;
+    vm_segment_t seg;  // The segment of a push or pop, SEG_NONE otherwise
+    // The label of a label, goto or if-goto, the function of a function or call, or the .vm file
+    // (without its extension) of a push or pop, as an interned symbol id. -1 if there isn't one.
+    int sym;
+    int arg;           // The index of a push or pop, or the number of locals/args of a function/call
+} vm_instr;
+
+// The parsed VM commands of every .vm file being translated, along with the symbols they use
+typedef struct vm_program {
+    vm_instr *instrs;
+    int num_instrs;
+    int instrs_size;
+    char **symbols;     // The interned symbols, indexed by symbol id
+    int num_symbols;
+    int *sym_buckets;   // Open-addressed hash of symbol id + 1 by symbol name (0 = empty)
+    int num_buckets;    // Always a power of 2
+} vm_program;
 
 extern const char BEGIN_COMMENT;
 extern const char EOL;
@@ -22,8 +71,12 @@ extern const char EOL;
 
 FILE *VM_Parser(char*);
 char *vm_advance(FILE*);
-vm_command_t vm_command_type(char*);
-char *vm_arg1(char*);
-int vm_arg2(char*);
+
+vm_program *vm_program_new();
+int vm_intern(vm_program*, const char*, int);
+vm_instr vm_parse_line(vm_program*, const char*, int);
+int vm_parse_file(vm_program*, FILE*, const char*);
+void vm_program_append(vm_program*, vm_instr);
+void vm_program_delete(vm_program**);
 
 #endif /* _VM_PARSER_H */
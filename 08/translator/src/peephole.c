@@ -0,0 +1,317 @@
+/*
+ * The VM peephole optimizer.
+ *
+ * Translating each VM command on its own means every command goes through the stack, even when the
+ * next command immediately undoes what it did. Before the code writer translates a command, the
+ * optimizer checks whether it starts one of a few short patterns of commands, and if so writes
+ * one fused Hack sequence for the whole pattern instead. Patterns never span a label or a
+ * function, since they're made up only of pushes, pops and arithmetic.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm_constants.h"
+#include "code_writer.h"
+#include "parser.h"
+#include "peephole.h"
+#include "util.h"
+
+const char *PEEP_RULE_NAMES[] = {
+    "memory-to-memory move",
+    "add constant in place",
+    "zero test",
+    "temp at fixed address",
+    "compare and branch"
+};
+
+// The jump condition for each comparison (in the order eq, gt, lt), and for its negation
+const char *COMPARE_JUMPS[3][2] = {{"EQ", "NE"}, {"GT", "LE"}, {"LT", "GE"}};
+
+// The highest index into a pointer segment that's stored to by stepping A, rather than by
+// computing the address and saving it in R15
+#define MAX_STEPPED_INDEX 6
+
+static int num_zero_tests = 0;
+
+
+/**
+ * Appends Hack code to a string of Hack code.
+ *
+ * @param code   a pointer to the code to append to, which is reallocated to fit
+ * @param format the code to append, as a format string
+ * @param ...    the values to substitute into @format
+ */
+void peep_append(char **code, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    int old_len = *code != NULL ? strlen(*code) : 0;
+    *code = realloc(*code, old_len + len + 1);
+    va_start(args, format);
+    vsnprintf(*code + old_len, len + 1, format, args);
+    va_end(args);
+}
+
+
+/**
+ * Checks whether a segment can be read from or written to directly, by address or symbol, and
+ * gets that address or symbol.
+ *
+ * @param prog  the program the push or pop is from
+ * @param instr the push or pop
+ * @param addr  filled in with the address (e.g. "6") or symbol (e.g. "Foo.2") of the word
+ * @param size  the size of @addr
+ * @return      1 if the word has a fixed address, 0 otherwise
+ */
+int peep_fixed_address(const vm_program *prog, const vm_instr *instr, char *addr, int size) {
+    if (instr->seg == SEG_STATIC) {
+        snprintf(addr, size, "%s.%d", prog->symbols[instr->sym], instr->arg);
+        return 1;
+    } else if (instr->seg == SEG_TEMP || instr->seg == SEG_POINTER) {
+        snprintf(addr, size, "%d", vm_segment_info(instr->seg)->begin_addr + instr->arg);
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * Checks whether a segment is reached through a pointer, like local or that.
+ *
+ * @param seg the segment to check
+ * @return    1 if @seg is reached through a pointer, 0 otherwise
+ */
+static int pointer_segment(vm_segment_t seg) {
+    return seg == SEG_LOCAL || seg == SEG_ARGUMENT || seg == SEG_THIS || seg == SEG_THAT;
+}
+
+
+/**
+ * Checks whether a push or pop is one the fused sequences can read or write, which are the same
+ * ones the code writer can.
+ *
+ * @param instr the push or pop
+ * @return      1 if the fused sequences can handle @instr, 0 otherwise
+ */
+int peep_fusable(const vm_instr *instr) {
+    if (!vm_valid_index(instr->seg, instr->arg)) {
+        return 0;  // Leave it to the code writer to report
+    }
+    if (instr->op == OP_PUSH && instr->seg == SEG_CONSTANT) {
+        return 1;
+    }
+    return pointer_segment(instr->seg) || instr->seg == SEG_TEMP || instr->seg == SEG_POINTER
+        || instr->seg == SEG_STATIC;
+}
+
+
+/**
+ * Appends the Hack code that loads the word a push would push into D, without touching the stack.
+ *
+ * @param code  a pointer to the code to append to
+ * @param prog  the program the push is from
+ * @param instr the push
+ */
+void peep_load_d(char **code, const vm_program *prog, const vm_instr *instr) {
+    char addr[64];
+    char *seg_name = vms_name(*vm_segment_info(instr->seg));
+
+    if (instr->seg == SEG_CONSTANT) {
+        peep_append(code, PEEP_LOAD_CONSTANT.str, instr->arg);
+    } else if (peep_fixed_address(prog, instr, addr, sizeof(addr))) {
+        peep_append(code, PEEP_LOAD_DIRECT.str, addr);
+    } else if (instr->arg <= 1) {
+        peep_append(code, PEEP_SEG_BASE.str, seg_name, instr->arg ? "+1" : "");
+        peep_append(code, "D=M\n");
+    } else {
+        peep_append(code, PEEP_LOAD_INDIRECT.str, seg_name, instr->arg);
+    }
+
+    reinit_str(&seg_name);
+}
+
+
+/**
+ * Checks whether a pop can store D without first saving it somewhere else, which it can if its
+ * word has a fixed address or is close enough to the start of its segment to step A to.
+ *
+ * @param prog the program the pop is from
+ * @param pop  the pop
+ * @return     1 if @pop can store D directly, 0 otherwise
+ */
+static int direct_store(const vm_program *prog, const vm_instr *pop) {
+    char addr[64];
+    return peep_fixed_address(prog, pop, addr, sizeof(addr)) || pop->arg <= MAX_STEPPED_INDEX;
+}
+
+
+/**
+ * Appends the Hack code that stores D where a pop would store the top of the stack, without
+ * touching the stack.
+ *
+ * @param code a pointer to the code to append to
+ * @param prog the program the pop is from
+ * @param pop  the pop
+ */
+void peep_store_d(char **code, const vm_program *prog, const vm_instr *pop) {
+    char addr[64];
+    char *seg_name = vms_name(*vm_segment_info(pop->seg));
+
+    if (peep_fixed_address(prog, pop, addr, sizeof(addr))) {
+        peep_append(code, PEEP_STORE_DIRECT.str, addr);
+    } else if (pop->arg <= MAX_STEPPED_INDEX) {
+        peep_append(code, PEEP_SEG_BASE.str, seg_name, pop->arg ? "+1" : "");
+        for (int i = 1; i < pop->arg; i++) {
+            peep_append(code, "A=A+1\n");
+        }
+        peep_append(code, "M=D\n");
+    } else {
+        // D is needed to work out the address, so it has to be saved while that happens
+        peep_append(code, "@R13\nM=D\n");
+        peep_append(code, PEEP_SAVE_ADDR.str, seg_name, pop->arg);
+        peep_append(code, "@R13\nD=M\n");
+        peep_append(code, PEEP_STORE_SAVED_ADDR);
+    }
+
+    reinit_str(&seg_name);
+}
+
+
+/**
+ * Appends the Hack code for a memory-to-memory move: a push followed by a pop.
+ *
+ * @param code a pointer to the code to append to
+ * @param prog the program the move is from
+ * @param push the push
+ * @param pop  the pop
+ */
+static void write_move(char **code, const vm_program *prog, const vm_instr *push,
+                       const vm_instr *pop) {
+    if (direct_store(prog, pop)) {
+        peep_load_d(code, prog, push);
+        peep_store_d(code, prog, pop);
+    } else {
+        // Work out the address first, so that the word being moved can stay in D
+        char *seg_name = vms_name(*vm_segment_info(pop->seg));
+        peep_append(code, PEEP_SAVE_ADDR.str, seg_name, pop->arg);
+        peep_load_d(code, prog, push);
+        peep_append(code, PEEP_STORE_SAVED_ADDR);
+        reinit_str(&seg_name);
+    }
+}
+
+
+/**
+ * Checks for a comparison that an if-goto tests, optionally with a not in between, and translates
+ * it into a jump on the comparison itself. A comparison with 0 that eq makes, which is how Jack
+ * tests for 0, just tests the top of the stack.
+ *
+ * @param prog the program being translated
+ * @param i    the index of the comparison, or of the push constant 0 before an eq
+ * @param func the function the instructions are in, or NULL if they aren't in one
+ * @param out  set to the translated Hack code if the pattern matched
+ * @return     the number of VM commands the fused code translates, or 0 if the pattern didn't match
+ */
+static int compare_branch(const vm_program *prog, int i, char *func, char **out) {
+    int zero = 0;
+    if (prog->instrs[i].op == OP_PUSH && prog->instrs[i].seg == SEG_CONSTANT
+            && prog->instrs[i].arg == 0 && i + 1 < prog->num_instrs
+            && prog->instrs[i + 1].op == OP_EQ) {
+        zero = 1;
+    }
+
+    int cmp = i + zero;
+    vm_opcode_t op = prog->instrs[cmp].op;
+    if (op != OP_EQ && op != OP_GT && op != OP_LT) {
+        return 0;
+    }
+
+    int branch = cmp + 1;
+    int negate = branch < prog->num_instrs && prog->instrs[branch].op == OP_NOT;
+    branch += negate;
+    if (branch >= prog->num_instrs || prog->instrs[branch].op != OP_IF) {
+        return 0;
+    }
+
+    char *label = prog->symbols[prog->instrs[branch].sym];
+    *out = vm_write_compare_goto(func, label, COMPARE_JUMPS[op - OP_EQ][negate], zero ? 1 : 2);
+    return *out != NULL ? branch - i + 1 : 0;
+}
+
+
+/**
+ * Checks whether a pattern of VM commands starts at an instruction, and if so translates the whole
+ * pattern into one fused Hack sequence.
+ *
+ * @param prog  the program being translated
+ * @param i     the index of the instruction to check
+ * @param func  the function the instruction is in, or NULL if it isn't in one
+ * @param stats the counters to add the match to
+ * @param out   set to the translated Hack code if a pattern matched, which the caller must free
+ * @return      the number of VM commands the fused code translates, or 0 if no pattern matched
+ */
+int vm_peephole(const vm_program *prog, int i, char *func, peep_stats *stats, char **out) {
+    const vm_instr *cur = &prog->instrs[i];
+    const vm_instr *next = i + 1 < prog->num_instrs ? &prog->instrs[i + 1] : NULL;
+    int used = 0;
+    peep_rule rule = RULE_MOVE;
+    *out = NULL;
+
+    if ((used = compare_branch(prog, i, func, out)) > 0) {
+        rule = RULE_COMPARE_BRANCH;
+    } else if (cur->op == OP_PUSH && peep_fusable(cur) && next != NULL && next->op == OP_POP
+               && peep_fusable(next)) {
+        write_move(out, prog, cur, next);
+        rule = RULE_MOVE;
+        used = 2;
+    } else if (cur->op == OP_PUSH && cur->seg == SEG_CONSTANT && peep_fusable(cur) && next != NULL
+               && (next->op == OP_ADD || next->op == OP_SUB)) {
+        const char *sign = next->op == OP_ADD ? "+" : "-";
+        if (cur->arg == 1) {
+            peep_append(out, PEEP_STEP.str, sign);
+        } else {
+            peep_append(out, PEEP_ADD_CONSTANT.str, cur->arg, sign);
+        }
+        rule = RULE_ADD_CONSTANT;
+        used = 2;
+    } else if (cur->op == OP_PUSH && cur->seg == SEG_CONSTANT && cur->arg == 0 && next != NULL
+               && next->op == OP_EQ) {
+        peep_append(out, PEEP_ZERO_TEST.str, num_zero_tests, num_zero_tests);
+        num_zero_tests++;
+        rule = RULE_ZERO_TEST;
+        used = 2;
+    } else if ((cur->op == OP_PUSH || cur->op == OP_POP) && cur->seg == SEG_TEMP
+            && peep_fusable(cur)) {
+        // Temp has a fixed address, just like pointer does
+        peep_append(out, cur->op == OP_PUSH ? PUSH_POINTER_SEG.str : POP_POINTER_SEG.str,
+               TEMP.begin_addr + cur->arg);
+        rule = RULE_FIXED_TEMP;
+        used = 1;
+    }
+
+    if (used > 0) {
+        stats->hits[rule]++;
+        stats->fused += used;
+    }
+    return used;
+}
+
+
+/**
+ * Prints how many times each peephole rule matched.
+ *
+ * @param out   the file to print to
+ * @param stats the counters to print
+ */
+void print_peep_stats(FILE *out, const peep_stats *stats) {
+    fprintf(out, "%-26s %8s\n", "rule", "matches");
+    for (int i = 0; i < NUM_PEEP_RULES; i++) {
+        fprintf(out, "%-26s %8d\n", PEEP_RULE_NAMES[i], stats->hits[i]);
+    }
+    fprintf(out, "%d of %d VM commands fused\n", stats->fused, stats->commands);
+}
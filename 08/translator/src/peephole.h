@@ -0,0 +1,37 @@
+#ifndef _VM_PEEPHOLE_H
+#define _VM_PEEPHOLE_H
+
+#include <stdio.h>
+
+#include "parser.h"
+
+// The patterns of VM commands the peephole optimizer writes fused Hack code for
+typedef enum peep_rule {
+    RULE_MOVE = 0,          // A push straight into a pop, which moves a word without using the stack
+    RULE_ADD_CONSTANT = 1,  // Pushing a constant and adding or subtracting it, e.g. incrementing
+    RULE_ZERO_TEST = 2,     // Pushing 0 and comparing it with eq
+    RULE_FIXED_TEMP = 3,    // A push or pop of temp, e.g. the pop temp 0 that throws away a void call's
+                            // return value, which can use temp's fixed address directly
+    RULE_COMPARE_BRANCH = 4,  // A comparison, optionally negated with not, that an if-goto tests
+    NUM_PEEP_RULES = 5
+} peep_rule;
+
+// How many times each rule matched
+typedef struct peep_stats {
+    int hits[NUM_PEEP_RULES];  // The number of times each rule matched
+    int commands;              // The number of VM commands translated, fused or not
+    int fused;                 // The number of VM commands translated by a rule
+} peep_stats;
+
+extern const char *PEEP_RULE_NAMES[];
+extern const char *COMPARE_JUMPS[3][2];
+
+int vm_peephole(const vm_program*, int, char*, peep_stats*, char**);
+void peep_append(char**, const char*, ...);
+int peep_fusable(const vm_instr*);
+int peep_fixed_address(const vm_program*, const vm_instr*, char*, int);
+void peep_load_d(char**, const vm_program*, const vm_instr*);
+void peep_store_d(char**, const vm_program*, const vm_instr*);
+void print_peep_stats(FILE*, const peep_stats*);
+
+#endif /* _VM_PEEPHOLE_H */
@@ -6,9 +6,12 @@
 #include <sys/types.h>
 
 #include "asm_constants.h"
+#include "callgraph.h"
 #include "code_writer.h"
 #include "minunit.h"
 #include "parser.h"
+#include "peephole.h"
+#include "tos.h"
 #include "util.h"
 
 int tests_run = 0;
@@ -46,101 +49,67 @@ static char *test_parser() {
 
     fclose(parser_in);
 
-    // Test vm_command_type()
-    mu_assert("vm_command_type did not return C_INVALID when given an invalid command",
-        vm_command_type("asdf") == C_INVALID);
-    mu_assert("vm_command_type did not return C_PUSH when given command `push constant 7`",
-        vm_command_type("push constant 7") == C_PUSH);
-    mu_assert("vm_command_type did not return C_POP when given command `pop local 0`",
-        vm_command_type("pop local 0") == C_POP);
-    mu_assert("vm_command_type did not return C_LABEL when given command `label test`",
-        vm_command_type("label test") == C_LABEL);
-    mu_assert("vm_command_type did not return C_GOTO when given command `goto asdf`",
-        vm_command_type("goto asdf") == C_GOTO);
-    mu_assert("vm_command_type did not return C_IF when given command `if-goto end`",
-        vm_command_type("if-goto end") == C_IF);
-    mu_assert("vm_command_type did not return C_FUNCTION when given command `function mult 2`",
-        vm_command_type("function mult 2") == C_FUNCTION);
-    mu_assert("vm_command_type did not return C_RETURN when given command `return`",
-        vm_command_type("return") == C_RETURN);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `add`",
-        vm_command_type("add") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `sub`",
-        vm_command_type("sub") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `neg`",
-        vm_command_type("neg") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `eq`",
-        vm_command_type("eq") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `gt`",
-        vm_command_type("gt") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `lt`",
-        vm_command_type("lt") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `and`",
-        vm_command_type("and") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `or`",
-        vm_command_type("or") == C_ARITHMETIC);
-    mu_assert("vm_command_type did not return C_ARITHMETIC when given command `not`",
-        vm_command_type("not") == C_ARITHMETIC);
-
-
-    // Test vm_arg1()
-    char *arg1_invalid = vm_arg1("asdf");
-    char *arg1_ret = vm_arg1("return");
-    char *arg1_arith1 = vm_arg1("add");
-    char *arg1_arith2 = vm_arg1("lt");
-    char *arg1_goto = vm_arg1("goto start");
-    char *arg1_ifgoto = vm_arg1("if-goto end");
-    char *arg1_push = vm_arg1("push local 0");
-    char *arg1_label = vm_arg1("label test");
-    char *arg1_func = vm_arg1("function mult 2");
-    mu_assert("vm_arg1 did not return NULL when given an invalid command", arg1_invalid == NULL);
-    mu_assert("vm_arg1 did not return NULL when given a command of type C_RETURN", arg1_ret == NULL);
-    mu_assert("vm_arg1 did not return `add` when given the C_ARITHMETIC command `add`",
-        !strcmp(arg1_arith1, "add"));
-    mu_assert("vm_arg1 did not return `lt` when given the C_ARITHMETIC command `lt`",
-        !strcmp(arg1_arith2, "lt"));
-    mu_assert("vm_arg1 did not return `start` when given the command `goto start`",
-        !strcmp(arg1_goto, "start"));
-    mu_assert("vm_arg1 did not return `end` when given the command `if-goto end`",
-        !strcmp(arg1_ifgoto, "end"));
-    mu_assert("vm_arg1 did not return `local` when given the command `push local 0`",
-        !strcmp(arg1_push, "local"));
-    mu_assert("vm_arg1 did not return `test` when given the command `label test`",
-        !strcmp(arg1_label, "test"));
-    mu_assert("vm_arg1 did not return `mult` when given the command `function mult 2`",
-        !strcmp(arg1_func, "mult"));
-    reinit_str(&arg1_invalid);
-    reinit_str(&arg1_ret);
-    reinit_str(&arg1_arith1);
-    reinit_str(&arg1_arith2);
-    reinit_str(&arg1_goto);
-    reinit_str(&arg1_ifgoto);
-    reinit_str(&arg1_push);
-    reinit_str(&arg1_label);
-    reinit_str(&arg1_func);
-
-
-    // Test vm_arg2()
-    int arg2_invalid = vm_arg2("asdf");
-    int arg2_arith = vm_arg2("add");
-    int arg2_goto = vm_arg2("goto start");
-    int arg2_ifgoto = vm_arg2("if-goto end");
-    int arg2_label = vm_arg2("label test");
-    int arg2_push = vm_arg2("push constant 0");
-    int arg2_pop = vm_arg2("pop that 2");
-    int arg2_func = vm_arg2("function mult 33");
-    int arg2_call = vm_arg2("call mult 771");
-    mu_assert("vm_arg2 did not return -1 when given an invalid command", arg2_invalid == -1);
-    mu_assert("vm_arg2 did not return -1 when given an arithmetic command", arg2_arith == -1);
-    mu_assert("vm_arg2 did not return -1 when given a goto command", arg2_goto == -1);
-    mu_assert("vm_arg2 did not return -1 when given a if-goto command", arg2_ifgoto == -1);
-    mu_assert("vm_arg2 did not return -1 when given a label command", arg2_label == -1);
-    mu_assert("vm_arg2 did not return 0 when given the command `push constant 0`", arg2_push == 0);
-    mu_assert("vm_arg2 did not return 2 when given the command `pop that 2`", arg2_pop == 2);
-    mu_assert("vm_arg2 did not return 33 when given the command `function mult 33`",
-        arg2_func == 33);
-    mu_assert("vm_arg2 did not return 771 when given the command `call mult 771`",
-        arg2_call == 771);
+
+    // Test vm_intern()
+    vm_program *prog = vm_program_new();
+    int main_id = vm_intern(prog, "Main.main", 9);
+    int loop_id = vm_intern(prog, "LOOP rest of line", 4);
+    mu_assert("vm_intern did not give the first two symbols ids 0 and 1", main_id == 0 && loop_id == 1);
+    mu_assert("vm_intern did not give a symbol the same id twice", vm_intern(prog, "LOOP", 4) == loop_id);
+    mu_assert("vm_intern did not copy only the first len chars of a symbol",
+        !strcmp(prog->symbols[loop_id], "LOOP"));
+    char sym_name[16];
+    for (int i = 0; i < 200; i++) {
+        snprintf(sym_name, sizeof(sym_name), "sym%d", i);
+        vm_intern(prog, sym_name, strlen(sym_name));
+    }
+    mu_assert("vm_intern lost a symbol when its hash grew",
+        vm_intern(prog, "Main.main", 9) == main_id && vm_intern(prog, "sym17", 5) == 19
+        && prog->num_symbols == 202);
+
+
+    // Test vm_parse_line()
+    int file = vm_intern(prog, "Foo", 3);
+    vm_instr push = vm_parse_line(prog, "push static 12", file);
+    vm_instr pop = vm_parse_line(prog, "pop  that 3", file);
+    vm_instr lt = vm_parse_line(prog, "lt", file);
+    vm_instr if_goto = vm_parse_line(prog, "if-goto LOOP", file);
+    vm_instr call = vm_parse_line(prog, "call Main.main 2", file);
+    vm_instr ret = vm_parse_line(prog, "return", file);
+    mu_assert("vm_parse_line did not parse `push static 12`",
+        push.op == OP_PUSH && push.seg == SEG_STATIC && push.arg == 12 && push.sym == file);
+    mu_assert("vm_parse_line did not parse `pop  that 3`",
+        pop.op == OP_POP && pop.seg == SEG_THAT && pop.arg == 3);
+    mu_assert("vm_parse_line did not parse `lt`", lt.op == OP_LT && lt.seg == SEG_NONE);
+    mu_assert("vm_parse_line did not parse `if-goto LOOP`",
+        if_goto.op == OP_IF && if_goto.sym == loop_id);
+    mu_assert("vm_parse_line did not parse `call Main.main 2`",
+        call.op == OP_CALL && call.sym == main_id && call.arg == 2);
+    mu_assert("vm_parse_line did not parse `return`", ret.op == OP_RETURN);
+    mu_assert("vm_parse_line did not reject an unknown segment",
+        vm_parse_line(prog, "push heapish 1", file).op == OP_INVALID);
+    mu_assert("vm_parse_line did not reject a non-numeric index",
+        vm_parse_line(prog, "push local x", file).op == OP_INVALID);
+    mu_assert("vm_parse_line did not reject a label with no name",
+        vm_parse_line(prog, "goto", file).op == OP_INVALID);
+    mu_assert("vm_parse_line did not reject an arithmetic op with an argument",
+        vm_parse_line(prog, "add 1", file).op == OP_INVALID);
+    mu_assert("vm_parse_line did not reject a command with too many words",
+        vm_parse_line(prog, "call f 1 2", file).op == OP_INVALID);
+    vm_program_delete(&prog);
+    mu_assert("vm_program_delete did not set the program to NULL", prog == NULL);
+
+
+    // Test vm_parse_file()
+    prog = vm_program_new();
+    parser_in = VM_Parser(fin_name);
+    mu_assert("vm_parse_file reported invalid lines in a valid file",
+        vm_parse_file(prog, parser_in, "Test") == 0);
+    fclose(parser_in);
+    mu_assert("vm_parse_file did not parse all three commands of Test.vm", prog->num_instrs == 3
+        && prog->instrs[0].op == OP_PUSH && prog->instrs[0].seg == SEG_CONSTANT
+        && prog->instrs[1].arg == 8 && prog->instrs[2].op == OP_ADD);
+    vm_program_delete(&prog);
 
 
     return 0;
@@ -209,30 +178,45 @@ static char *test_code_writer() {
     vm_code_writer_close(folder_code_writer);
 
     // Test vm_write_command()
+    vm_program *wc_prog = vm_program_new();
+    int wc_file = vm_intern(wc_prog, "Test", 4);
+    vm_instr wc_invalid = vm_parse_line(wc_prog, "asdf", wc_file);
+    vm_instr wc_push_no_args = vm_parse_line(wc_prog, "push", wc_file);
+    vm_instr wc_pop_negative = vm_parse_line(wc_prog, "pop local -1", wc_file);
+    vm_instr wc_push = vm_parse_line(wc_prog, "push constant 2", wc_file);
+    vm_instr wc_pop = vm_parse_line(wc_prog, "pop local 1", wc_file);
+    vm_instr wc_add = vm_parse_line(wc_prog, "add", wc_file);
+    vm_instr wc_label = vm_parse_line(wc_prog, "label test", wc_file);
+    vm_instr wc_goto = vm_parse_line(wc_prog, "goto func", wc_file);
+    vm_instr wc_if = vm_parse_line(wc_prog, "if-goto end", wc_file);
+    vm_instr wc_func = vm_parse_line(wc_prog, "function mult 2", wc_file);
+    vm_instr wc_ret = vm_parse_line(wc_prog, "return", wc_file);
+    vm_instr wc_call = vm_parse_line(wc_prog, "call mult 2", wc_file);
     mu_assert("vm_write_command did not return WC_INVALID_CMD when given a command of type C_INVALID",
-        vm_write_command("asdf", C_INVALID, file_code_writer) == WC_INVALID_CMD);
+        vm_write_command(wc_prog, &wc_invalid, file_code_writer) == WC_INVALID_CMD);
     mu_assert("vm_write_command did not return WC_INVALID_CMD when given a command of type C_PUSH with no arguments",
-        vm_write_command("push", C_PUSH, file_code_writer) == WC_INVALID_CMD);
+        vm_write_command(wc_prog, &wc_push_no_args, file_code_writer) == WC_INVALID_CMD);
     mu_assert("vm_write_command did not return WC_INVALID_CMD when given a command of type C_POP with a negative index",
-        vm_write_command("pop local -1", C_POP, file_code_writer) == WC_INVALID_CMD);
+        vm_write_command(wc_prog, &wc_pop_negative, file_code_writer) == WC_INVALID_CMD);
     mu_assert("vm_write_command did not return WC_SUCCESS when given a valid C_PUSH command",
-        vm_write_command("push constant 2", C_PUSH, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_push, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_SUCCESS when given a valid C_POP command",
-        vm_write_command("pop local 1", C_POP, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_pop, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_SUCCESS when given a valid C_ARITHMETIC command",
-        vm_write_command("add", C_ARITHMETIC, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_add, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_UNSUPPORTED_CMD when given a command of type C_LABEL",
-        vm_write_command("label test", C_LABEL, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_label, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_UNSUPPORTED_CMD when given a command of type C_GOTO",
-        vm_write_command("goto func", C_GOTO, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_goto, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_UNSUPPORTED_CMD when given a command of type C_IF",
-        vm_write_command("if-goto end", C_IF, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_if, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_UNSUPPORTED_CMD when given a command of type C_FUNCTION",
-        vm_write_command("function mult 2", C_FUNCTION, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_func, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_UNSUPPORTED_CMD when given a command of type C_RETURN",
-        vm_write_command("return", C_RETURN, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_ret, file_code_writer) == WC_SUCCESS);
     mu_assert("vm_write_command did not return WC_UNSUPPORTED_CMD when given a command of type C_CALL",
-        vm_write_command("call mult 2", C_CALL, file_code_writer) == WC_SUCCESS);
+        vm_write_command(wc_prog, &wc_call, file_code_writer) == WC_SUCCESS);
+    vm_program_delete(&wc_prog);
 
     vm_code_writer_close(file_code_writer);
 
@@ -290,15 +274,57 @@ static char *test_code_writer() {
     reinit_str(&translate_eq);
 
 
+    // Test vm_write_inline_arithmetic()
+    char *inline_sub = vm_write_inline_arithmetic(OP_SUB);
+    char *inline_not = vm_write_inline_arithmetic(OP_NOT);
+    char *inline_lt = vm_write_inline_arithmetic(OP_LT);
+    char *inline_gt = vm_write_inline_arithmetic(OP_GT);
+    mu_assert("vm_write_inline_arithmetic doesn't translate `sub` in place",
+        !strcmp(inline_sub,
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "A=A-1\n"
+            "M=M-D\n"));
+    mu_assert("vm_write_inline_arithmetic doesn't translate `not` in place",
+        !strcmp(inline_not,
+            "@SP\n"
+            "A=M-1\n"
+            "M=!M\n"));
+    mu_assert("vm_write_inline_arithmetic doesn't translate `lt` in place",
+        !strcmp(inline_lt,
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "A=A-1\n"
+            "D=M-D\n"
+            "M=-1\n"
+            "@__CMP_END_0\n"
+            "D;JLT\n"
+            "@SP\n"
+            "A=M-1\n"
+            "M=0\n"
+            "(__CMP_END_0)\n"));
+    mu_assert("vm_write_inline_arithmetic doesn't give each comparison its own label",
+        strstr(inline_gt, "@__CMP_END_1\nD;JGT\n") != NULL && strstr(inline_gt, "(__CMP_END_1)\n") != NULL);
+    mu_assert("vm_write_inline_arithmetic doesn't return NULL given an operation that isn't arithmetic",
+        vm_write_inline_arithmetic(OP_PUSH) == NULL);
+
+    reinit_str(&inline_sub);
+    reinit_str(&inline_not);
+    reinit_str(&inline_lt);
+    reinit_str(&inline_gt);
+
+
     // Test vm_write_push_pop()
-    char *translate_push_const = vm_write_push_pop(CONSTANT, 23, C_PUSH, "Test");
-    char *translate_push_arg = vm_write_push_pop(ARG, 8, C_PUSH, "Test");
-    char *translate_pop_local = vm_write_push_pop(LCL, 2, C_POP, "Test");
-    char *translate_push_temp = vm_write_push_pop(TEMP, 6, C_PUSH, "Test");
-    char *translate_pop_temp = vm_write_push_pop(TEMP, 2, C_POP, "Test");
-    char *translate_pop_pointer = vm_write_push_pop(POINTER, 1, C_POP, "Test");
-    char *translate_push_static = vm_write_push_pop(STATIC, 2, C_PUSH, "Test");
-    char *translate_pop_static = vm_write_push_pop(STATIC, 4, C_POP, "Test");
+    char *translate_push_const = vm_write_push_pop(SEG_CONSTANT, 23, OP_PUSH, "Test");
+    char *translate_push_arg = vm_write_push_pop(SEG_ARGUMENT, 8, OP_PUSH, "Test");
+    char *translate_pop_local = vm_write_push_pop(SEG_LOCAL, 2, OP_POP, "Test");
+    char *translate_push_temp = vm_write_push_pop(SEG_TEMP, 6, OP_PUSH, "Test");
+    char *translate_pop_temp = vm_write_push_pop(SEG_TEMP, 2, OP_POP, "Test");
+    char *translate_pop_pointer = vm_write_push_pop(SEG_POINTER, 1, OP_POP, "Test");
+    char *translate_push_static = vm_write_push_pop(SEG_STATIC, 2, OP_PUSH, "Test");
+    char *translate_pop_static = vm_write_push_pop(SEG_STATIC, 4, OP_POP, "Test");
 
     mu_assert("vm_write_push_pop doesn't translate `push constant 23` correctly",
         !strcmp(translate_push_const,
@@ -434,6 +460,26 @@ static char *test_code_writer() {
     reinit_str(&invalid_if);
 
 
+    // Test vm_write_compare_goto()
+    char *valid_compare_goto = vm_write_compare_goto("Foo.bar", "LOOP", "LE", 2);
+    char *invalid_compare_goto = vm_write_compare_goto("Foo.bar", "not-valid", "LE", 1);
+
+    mu_assert("vm_write_compare_goto does not jump on a comparison",
+        !strcmp(valid_compare_goto,
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M-D\n"
+            "@Foo.bar:LOOP\n"
+            "D;JLE\n"));
+    mu_assert("vm_write_compare_goto does not return NULL when given an invalid label",
+        invalid_compare_goto == NULL);
+
+    reinit_str(&valid_compare_goto);
+
+
     // Test vm_write_function()
     code_writer *test_write_func = cw_new(fopen("./src/test/Test.asm", "a"), "Test", "asdf");
     char *valid_func = vm_write_function(test_write_func, 2);
@@ -524,6 +570,233 @@ static char *test_code_writer() {
     return 0;
 }
 
+// Parses n VM commands into a new program, as if they were all in Foo.vm
+static vm_program *program_of(const char **lines, int n) {
+    vm_program *prog = vm_program_new();
+    int file = vm_intern(prog, "Foo", 3);
+    for (int i = 0; i < n; i++) {
+        vm_program_append(prog, vm_parse_line(prog, lines[i], file));
+    }
+    return prog;
+}
+
+static char *test_peephole() {
+    const char *lines[] = {
+        "push local 0", "pop that 1",   // 0: move between pointer segments
+        "push static 3", "pop that 9",  // 2: move to an index too far to step A to
+        "push constant 1", "add",       // 4: increment
+        "push constant 7", "sub",       // 6: subtract a constant
+        "push constant 0", "eq",        // 8: zero test
+        "call Foo.bar 0", "pop temp 0", // 10: throw away a void call's return value
+        "push local 0", "label END",    // 12: nothing to fuse
+        "pop constant 2",               // 14: not something a pop can write to
+        "lt", "not", "if-goto LOOP",    // 15: negated compare and branch
+        "push constant 0", "eq", "if-goto END",  // 18: branch if zero
+        "gt", "if-goto END",            // 21: compare and branch
+        "eq", "add"                     // 23: a comparison nothing branches on
+    };
+    vm_program *prog = program_of(lines, (int)(sizeof(lines) / sizeof(lines[0])));
+
+    peep_stats stats = {0};
+    char *fused = NULL;
+
+    mu_assert("vm_peephole did not fuse `push local 0; pop that 1` into one move",
+        vm_peephole(prog, 0, NULL, &stats, &fused) == 2);
+    mu_assert("vm_peephole's move from local 0 to that 1 touches the stack",
+        !strcmp(fused,
+            "@LCL\n"
+            "A=M\n"
+            "D=M\n"
+            "@THAT\n"
+            "A=M+1\n"
+            "M=D\n"));
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole did not fuse `push static 3; pop that 9` into one move",
+        vm_peephole(prog, 2, NULL, &stats, &fused) == 2);
+    mu_assert("vm_peephole's move from static 3 to that 9 isn't right",
+        !strcmp(fused,
+            "@THAT\n"
+            "D=M\n"
+            "@9\n"
+            "D=D+A\n"
+            "@R15\n"
+            "M=D\n"
+            "@Foo.3\n"
+            "D=M\n"
+            "@R15\n"
+            "A=M\n"
+            "M=D\n"));
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole did not fuse `push constant 1; add` into an increment",
+        vm_peephole(prog, 4, NULL, &stats, &fused) == 2
+        && !strcmp(fused, "@SP\nA=M-1\nM=M+1\n"));
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole did not fuse `push constant 7; sub` into a subtraction in place",
+        vm_peephole(prog, 6, NULL, &stats, &fused) == 2
+        && !strcmp(fused, "@7\nD=A\n@SP\nA=M-1\nM=M-D\n"));
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole did not fuse `push constant 0; eq` into a zero test",
+        vm_peephole(prog, 8, NULL, &stats, &fused) == 2 && strstr(fused, "D;JEQ\n") != NULL);
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole fused a call", vm_peephole(prog, 10, NULL, &stats, &fused) == 0 && fused == NULL);
+    mu_assert("vm_peephole did not pop temp 0 straight to its address",
+        vm_peephole(prog, 11, NULL, &stats, &fused) == 1
+        && !strcmp(fused, "@SP\nAM=M-1\nD=M\n@5\nM=D\n"));
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole fused a push followed by a label",
+        vm_peephole(prog, 12, NULL, &stats, &fused) == 0);
+    mu_assert("vm_peephole fused a pop to the constant segment",
+        vm_peephole(prog, 14, NULL, &stats, &fused) == 0);
+
+    mu_assert("vm_peephole did not count each rule's matches",
+        stats.hits[RULE_MOVE] == 2 && stats.hits[RULE_ADD_CONSTANT] == 2
+        && stats.hits[RULE_ZERO_TEST] == 1 && stats.hits[RULE_FIXED_TEMP] == 1 && stats.fused == 11);
+
+    mu_assert("vm_peephole did not fuse `lt; not; if-goto LOOP` into one jump",
+        vm_peephole(prog, 15, "Main.run", &stats, &fused) == 3);
+    mu_assert("vm_peephole's jump for `lt; not; if-goto LOOP` isn't right",
+        !strcmp(fused,
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M\n"
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M-D\n"
+            "@Main.run:LOOP\n"
+            "D;JGE\n"));
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole did not fuse `push constant 0; eq; if-goto END` into a test of the top value",
+        vm_peephole(prog, 18, "Main.run", &stats, &fused) == 3
+        && !strcmp(fused, "@SP\nAM=M-1\nD=M\n@Main.run:END\nD;JEQ\n"));
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole did not fuse `gt; if-goto END` into one jump",
+        vm_peephole(prog, 21, "Main.run", &stats, &fused) == 2 && strstr(fused, "D;JGT\n") != NULL);
+    reinit_str(&fused);
+
+    mu_assert("vm_peephole fused a comparison that isn't branched on",
+        vm_peephole(prog, 23, "Main.run", &stats, &fused) == 0);
+    mu_assert("vm_peephole did not count the compare and branch matches",
+        stats.hits[RULE_COMPARE_BRANCH] == 3 && stats.hits[RULE_ZERO_TEST] == 1);
+
+    vm_program_delete(&prog);
+
+    return 0;
+}
+
+static char *test_tos() {
+    const char *lines[] = {
+        "push local 0", "push constant 1", "add",    // folded into an increment of D
+        "push static 2", "sub",                      // folded, reading the operand from RAM
+        "push constant 0", "and",                    // folded into clearing D
+        "pop temp 1",                                // written straight from D
+        "push argument 0", "push local 3", "lt",     // not folded, so D is spilled
+        "not", "if-goto END",                        // tested in D
+        "push constant 5", "label END", "neg"        // spilled before the label
+    };
+    vm_program *prog = program_of(lines, (int)(sizeof(lines) / sizeof(lines[0])));
+
+    FILE *out = tmpfile();
+    code_writer *cw = cw_new(out, "Foo", "Main.run");
+    tos_stats stats = {0};
+    vm_write_program_tos(prog, cw, &stats);
+
+    char code[1024] = {0};
+    rewind(out);
+    size_t len = fread(code, 1, sizeof(code) - 1, out);
+    code[len] = '\0';
+    cw_delete(&cw);
+    vm_program_delete(&prog);
+
+    const char *expected =
+        "@LCL\n"
+        "A=M\n"
+        "D=M\n"
+        "D=D+1\n"
+        "@Foo.2\n"
+        "D=D-M\n"
+        "D=0\n"
+        "@6\n"
+        "M=D\n"
+        "@ARG\n"
+        "A=M\n"
+        "D=M\n"
+        "@SP\n"
+        "AM=M+1\n"
+        "A=A-1\n"
+        "M=D\n"
+        "@LCL\n"
+        "D=M\n"
+        "@3\n"
+        "A=D+A\n"
+        "D=M\n"
+        "@SP\n"
+        "AM=M-1\n"
+        "D=M-D\n"
+        "@Main.run:END\n"
+        "D;JGE\n"
+        "@5\n"
+        "D=A\n"
+        "@SP\n"
+        "AM=M+1\n"
+        "A=A-1\n"
+        "M=D\n";
+    mu_assert("vm_write_program_tos did not keep the top of the stack in D",
+        !strncmp(code, expected, strlen(expected)));
+    mu_assert("vm_write_program_tos did not negate the top of the stack in RAM after a label",
+        strstr(code, "@SP\nAM=M-1\nD=-M\n@SP\nAM=M+1\nA=A-1\nM=D\n") != NULL);
+    mu_assert("vm_write_program_tos did not count its spills, fills and folds",
+        stats.commands == 16 && stats.spills == 3 && stats.fills == 0 && stats.folded == 3);
+
+    return 0;
+}
+
+static char *test_callgraph() {
+    const char *lines[] = {
+        "function Foo.unused 0", "call Foo.cycle 0", "return",     // 0: only called by dead code
+        "function Sys.init 0", "call Foo.used 0", "return",        // 3: the entry function
+        "function Foo.cycle 0", "call Foo.unused 0", "return",     // 6: dead, even though it's called
+        "function Foo.used 0", "call Foo.leaf 1", "return",        // 9: called from Sys.init
+        "function Foo.leaf 1", "push constant 7", "pop static 0", "return"  // 12: called indirectly
+    };
+    vm_program *prog = program_of(lines, (int)(sizeof(lines) / sizeof(lines[0])));
+    int leaf = vm_intern(prog, "Foo.leaf", 8);
+
+    vm_program *dead = vm_remove_dead_functions(prog);
+    mu_assert("vm_remove_dead_functions did not keep the functions Sys.init calls",
+        dead != NULL && prog->num_instrs == 10 && prog->instrs[0].op == OP_FUNCTION
+        && prog->instrs[6].op == OP_FUNCTION && prog->instrs[6].sym == leaf);
+    mu_assert("vm_remove_dead_functions did not remove the functions Sys.init can't reach",
+        dead->num_instrs == 6 && !strcmp(dead->symbols[dead->instrs[0].sym], "Foo.unused")
+        && !strcmp(dead->symbols[dead->instrs[3].sym], "Foo.cycle"));
+    mu_assert("vm_remove_dead_functions changed the ids of the removed commands' symbols",
+        dead->num_symbols == prog->num_symbols && dead->instrs[4].sym == dead->instrs[0].sym);
+    vm_program_delete(&dead);
+
+    mu_assert("vm_remove_dead_functions removed something from a program with no dead functions",
+        (dead = vm_remove_dead_functions(prog)) != NULL && dead->num_instrs == 0
+        && prog->num_instrs == 10);
+    vm_program_delete(&dead);
+    vm_program_delete(&prog);
+
+    const char *no_entry[] = {"push constant 7", "pop static 0"};
+    prog = program_of(no_entry, 2);
+    mu_assert("vm_remove_dead_functions removed commands from a program without Sys.init",
+        vm_remove_dead_functions(prog) == NULL && prog->num_instrs == 2);
+    mu_assert("vm_count_words did not count the Hack instructions a program translates to",
+        vm_count_words(prog, OPT_TOS) == 4);
+    vm_program_delete(&prog);
+
+    return 0;
+}
+
 static char *test_util() {
     // Test is_directory()
     mu_assert("is_directory says that ./src/test/ is not a directory", is_directory("./src/test/"));
@@ -687,6 +960,9 @@ static char *test_util() {
 static char *all_tests() {
     mu_run_test(test_parser);
     mu_run_test(test_code_writer);
+    mu_run_test(test_peephole);
+    mu_run_test(test_tos);
+    mu_run_test(test_callgraph);
     mu_run_test(test_util);
     return 0;
 }
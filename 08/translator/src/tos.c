@@ -0,0 +1,299 @@
+/*
+ * Top-of-stack caching.
+ *
+ * In this mode the top value of the VM stack is kept in D instead of in RAM wherever it can be, so
+ * a push followed by an operation on it doesn't have to write the value to RAM and read it straight
+ * back. The stack is either cached (D holds the top value, and RAM holds the rest of the stack,
+ * with SP pointing just past it) or not (the whole stack is in RAM, as usual).
+ *
+ * Cache state is tracked through each basic block. Every block starts and ends with the stack not
+ * cached, so that code jumping to a label never has to know what the code falling into it did:
+ * D is spilled to RAM before labels, gotos, calls and returns. An if-goto on a cached value
+ * tests D and leaves the stack not cached on both of its paths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm_constants.h"
+#include "code_writer.h"
+#include "parser.h"
+#include "peephole.h"
+#include "tos.h"
+#include "util.h"
+
+static int num_tos_cmps = 0;
+
+
+/**
+ * Checks whether an operation takes two operands, and leaves its result in D when the top of the
+ * stack is cached.
+ *
+ * @param op the operation to check
+ * @return   1 if @op is add, sub, and, or, or a comparison, 0 otherwise
+ */
+static int binary_op(vm_opcode_t op) {
+    return op == OP_ADD || op == OP_SUB || op == OP_AND || op == OP_OR || op == OP_EQ
+        || op == OP_GT || op == OP_LT;
+}
+
+
+/**
+ * Checks whether an operation is a comparison.
+ *
+ * @param op the operation to check
+ * @return   1 if @op is eq, gt or lt, 0 otherwise
+ */
+static int compare_op(vm_opcode_t op) {
+    return op == OP_EQ || op == OP_GT || op == OP_LT;
+}
+
+
+/**
+ * Appends the Hack code that makes the value a push would push available in A or M without
+ * changing D, so that an operation can use it straight from there.
+ *
+ * @param code a pointer to the code to append to
+ * @param prog the program the push is from
+ * @param push the push
+ * @return     "A" or "M", whichever the value ends up in, or NULL (with nothing appended) if the
+ *             value can't be reached without changing D
+ */
+static const char *append_operand(char **code, const vm_program *prog, const vm_instr *push) {
+    char addr[64];
+
+    if (!peep_fusable(push)) {
+        return NULL;
+    } else if (push->seg == SEG_CONSTANT) {
+        peep_append(code, "@%d\n", push->arg);
+        return "A";
+    } else if (peep_fixed_address(prog, push, addr, sizeof(addr))) {
+        peep_append(code, "@%s\n", addr);
+        return "M";
+    } else if (push->arg <= 1) {
+        char *seg_name = vms_name(*vm_segment_info(push->seg));
+        peep_append(code, PEEP_SEG_BASE.str, seg_name, push->arg ? "+1" : "");
+        reinit_str(&seg_name);
+        return "M";
+    }
+    return NULL;
+}
+
+
+/**
+ * Makes sure the top of the stack is cached in D, reading it from RAM if it isn't.
+ *
+ * @param code   a pointer to the code to append to
+ * @param cached whether the top of the stack is cached, which is set
+ * @param stats  the counters to add the fill to
+ */
+static void fill(char **code, int *cached, tos_stats *stats) {
+    if (!*cached) {
+        peep_append(code, "%s", TOS_FILL);
+        stats->fills++;
+        *cached = 1;
+    }
+}
+
+
+/**
+ * Makes sure the whole stack is in RAM, writing D back to it if the top of the stack is cached.
+ *
+ * @param code   a pointer to the code to append to
+ * @param cached whether the top of the stack is cached, which is cleared
+ * @param stats  the counters to add the spill to
+ */
+static void spill(char **code, int *cached, tos_stats *stats) {
+    if (*cached) {
+        peep_append(code, "%s", TOS_SPILL);
+        stats->spills++;
+        *cached = 0;
+    }
+}
+
+
+/**
+ * Finishes a comparison once D holds the first operand minus the second. If an if-goto tests the
+ * comparison, optionally after a not, jumps on D directly; otherwise turns D into -1 or 0.
+ *
+ * @param code   a pointer to the code to append to
+ * @param prog   the program being translated
+ * @param i      the index of the comparison
+ * @param func   the function the comparison is in, or NULL if it isn't in one
+ * @param cached whether the top of the stack is cached, which is updated
+ * @return       the number of commands after the comparison that were translated along with it
+ */
+static int finish_compare(char **code, const vm_program *prog, int i, char *func, int *cached) {
+    vm_opcode_t op = prog->instrs[i].op;
+    int branch = i + 1;
+    int negate = branch < prog->num_instrs && prog->instrs[branch].op == OP_NOT;
+    branch += negate;
+
+    if (branch < prog->num_instrs && prog->instrs[branch].op == OP_IF) {
+        char *label = prog->symbols[prog->instrs[branch].sym];
+        char *jump = vm_write_compare_goto(func, label, COMPARE_JUMPS[op - OP_EQ][negate], 0);
+        if (jump != NULL) {
+            peep_append(code, "%s", jump);
+            reinit_str(&jump);
+        }
+        *cached = 0;
+        return branch - i;
+    }
+
+    peep_append(code, TOS_CMP.str, num_tos_cmps, COMPARE_JUMPS[op - OP_EQ][0], num_tos_cmps,
+                num_tos_cmps, num_tos_cmps);
+    num_tos_cmps++;
+    return 0;
+}
+
+
+/**
+ * Applies an operation that takes two operands to D and a second operand in A or M, leaving the
+ * result in D. Comparisons leave the first operand minus the second, for finish_compare().
+ *
+ * @param code    a pointer to the code to append to
+ * @param op      the operation
+ * @param operand "A" or "M"
+ */
+static void apply_binary(char **code, vm_opcode_t op, const char *operand) {
+    const char *hack_op = compare_op(op) ? "-" : HACK_ARITH_OPS[op];
+    peep_append(code, "D=D%s%s\n", hack_op, operand);
+}
+
+
+/**
+ * Translates a push whose value an operation right after it uses, without putting the value on
+ * the stack at all: the operation reads it straight from where it's stored.
+ *
+ * @param code   a pointer to the code to append to
+ * @param prog   the program being translated
+ * @param i      the index of the push
+ * @param cached whether the top of the stack is cached, which is updated
+ * @param stats  the counters to add the fill and fold to
+ * @return       1 if the push could be folded into the operation, 0 (with nothing appended) if not
+ */
+static int fold_push(char **code, const vm_program *prog, int i, int *cached, tos_stats *stats) {
+    const vm_instr *push = &prog->instrs[i];
+    vm_opcode_t op = prog->instrs[i + 1].op;
+    char *operand_code = NULL;
+
+    if (push->seg == SEG_CONSTANT && push->arg <= 1) {
+        fill(code, cached, stats);
+        if (push->arg == 0 && op == OP_AND) {
+            peep_append(code, "D=0\n");
+        } else if (push->arg == 1 && (op == OP_ADD || op == OP_SUB || compare_op(op))) {
+            peep_append(code, "D=D%s1\n", op == OP_ADD ? "+" : "-");
+        } else if (push->arg == 1) {
+            peep_append(code, "@1\n");
+            apply_binary(code, op, "A");
+        }
+        // Adding, subtracting, or-ing or comparing with 0 leaves D as it is
+    } else {
+        const char *operand = append_operand(&operand_code, prog, push);
+        if (operand == NULL) {
+            return 0;
+        }
+        fill(code, cached, stats);
+        peep_append(code, "%s", operand_code);
+        apply_binary(code, op, operand);
+        reinit_str(&operand_code);
+    }
+
+    stats->folded++;
+    return 1;
+}
+
+
+/**
+ * Writes every command of a program in Hack assembly format, keeping the top of the stack cached
+ * in D wherever it can.
+ *
+ * @param prog  the program to translate
+ * @param cw    the code_writer to use to write the translated commands
+ * @param stats the counters to add the spills, fills and folds to
+ */
+void vm_write_program_tos(const vm_program *prog, code_writer *cw, tos_stats *stats) {
+    int cached = 0;
+    int i = 0;
+
+    while (i < prog->num_instrs) {
+        const vm_instr *cur = &prog->instrs[i];
+        const vm_instr *next = i + 1 < prog->num_instrs ? &prog->instrs[i + 1] : NULL;
+        char *code = NULL;
+        int used = 1;
+        int delegate = 0;  // Set if the code writer should translate the command as usual
+
+        if (cur->op == OP_PUSH && next != NULL && binary_op(next->op)
+                && fold_push(&code, prog, i, &cached, stats)) {
+            used = 2;
+            if (compare_op(next->op)) {
+                used += finish_compare(&code, prog, i + 1, cw->func, &cached);
+            }
+        } else if (cur->op == OP_PUSH && peep_fusable(cur)) {
+            spill(&code, &cached, stats);
+            peep_load_d(&code, prog, cur);
+            cached = 1;
+        } else if (cur->op == OP_POP && cur->seg != SEG_CONSTANT && peep_fusable(cur)) {
+            fill(&code, &cached, stats);
+            peep_store_d(&code, prog, cur);
+            cached = 0;
+        } else if (binary_op(cur->op)) {
+            fill(&code, &cached, stats);
+            const char *hack_op = compare_op(cur->op) ? "-" : HACK_ARITH_OPS[cur->op];
+            peep_append(&code, "@SP\nAM=M-1\nD=M%sD\n", hack_op);
+            if (compare_op(cur->op)) {
+                used += finish_compare(&code, prog, i, cw->func, &cached);
+            }
+        } else if (cur->op == OP_NEG || cur->op == OP_NOT) {
+            if (cached) {
+                peep_append(&code, "D=%sD\n", HACK_ARITH_OPS[cur->op]);
+            } else {
+                peep_append(&code, "@SP\nAM=M-1\nD=%sM\n", HACK_ARITH_OPS[cur->op]);
+                cached = 1;
+            }
+        } else if (cur->op == OP_IF && cached) {
+            char *jump = vm_write_compare_goto(cw->func, prog->symbols[cur->sym], "NE", 0);
+            if (jump != NULL) {
+                peep_append(&code, "%s", jump);
+                reinit_str(&jump);
+            }
+            cached = 0;
+        } else {
+            // Labels, gotos, functions, calls and returns need the whole stack in RAM, and so do
+            // pushes and pops the fused sequences can't handle
+            spill(&code, &cached, stats);
+            delegate = 1;
+        }
+
+        if (code != NULL) {
+            fprintf(cw->out, "%s", code);
+            reinit_str(&code);
+        }
+        if (delegate) {
+            vm_write_command(prog, cur, cw);
+        }
+        i += used;
+    }
+
+    char *code = NULL;
+    spill(&code, &cached, stats);
+    if (code != NULL) {
+        fprintf(cw->out, "%s", code);
+        reinit_str(&code);
+    }
+    stats->commands += prog->num_instrs;
+}
+
+
+/**
+ * Prints how often the top of the stack had to move between D and RAM.
+ *
+ * @param out   the file to print to
+ * @param stats the counters to print
+ */
+void print_tos_stats(FILE *out, const tos_stats *stats) {
+    fprintf(out, "%d VM commands: %d spills of D to RAM, %d fills of D from RAM, %d pushes folded "
+                 "into the next operation\n", stats->commands, stats->spills, stats->fills,
+            stats->folded);
+}
@@ -0,0 +1,20 @@
+#ifndef _VM_TOS_H
+#define _VM_TOS_H
+
+#include <stdio.h>
+
+#include "code_writer.h"
+#include "parser.h"
+
+// How often the top of the stack had to move between D and RAM
+typedef struct tos_stats {
+    int commands;  // The number of VM commands translated
+    int spills;    // The number of times D was written back to the stack in RAM
+    int fills;     // The number of times the top of the stack was read from RAM into D
+    int folded;    // The number of pushes folded into the operation after them
+} tos_stats;
+
+void vm_write_program_tos(const vm_program*, code_writer*, tos_stats*);
+void print_tos_stats(FILE*, const tos_stats*);
+
+#endif /* _VM_TOS_H */
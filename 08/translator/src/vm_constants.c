@@ -3,6 +3,10 @@
 #include "vm_constants.h"
 
 const char *ARITHMETIC_OPS[10] = {"add", "sub", "neg", "eq", "gt", "lt", "and", "or", "not", NULL};
+const char *SEGMENT_NAMES[13] = {
+    "local", "argument", "this", "that", "pointer", "temp", "general", "constant", "static", "stack",
+    "heap", "io", NULL
+};
 const char *PUSH_OP = "push";
 const char *POP_OP = "pop";
 const char *LABEL_OP = "label";
@@ -13,7 +17,6 @@ const char *CALL_OP = "call";
 const char *RETURN_OP = "return";
 
 const int ARITHMETIC_OPS_NUM_ARGS[9] = {2, 2, 1, 2, 2, 2, 2, 2, 1};
-const int SHORTEST_OP_LEN = 2;
 
 const char LABEL_SEPARATOR = ':';
 // There's also a FUNCTION_SEPARATOR, but it's defined as a macro in vm_constants.h for reasons
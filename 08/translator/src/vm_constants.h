@@ -11,9 +11,9 @@ extern const char *FUNCTION_OP;
 extern const char *CALL_OP;
 extern const char *RETURN_OP;
 extern const char *ARITHMETIC_OPS[10];
+extern const char *SEGMENT_NAMES[13];
 
 extern const int ARITHMETIC_OPS_NUM_ARGS[9];
-extern const int SHORTEST_OP_LEN;
 
 extern const char LABEL_SEPARATOR;
 // FUNCTION_SEPARATOR has to use #define so that it can be used in the definition of LABEL_CHAR_RANGES